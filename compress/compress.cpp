@@ -0,0 +1,27 @@
+#include "compress.h"
+#include "lz4.h"
+#include "gzip.h"
+
+CompressionFormat DetectCompression(const uint8_t *data, size_t size) {
+	if(size >= 4 &&
+	   data[0] == 0x04 && data[1] == 0x22 && data[2] == 0x4D && data[3] == 0x18) {
+		return COMPRESSION_LZ4;
+	}
+
+	if(size >= 3 && data[0] == 0x1F && data[1] == 0x8B && data[2] == 0x08) {
+		return COMPRESSION_GZIP;
+	}
+
+	return COMPRESSION_NONE;
+}
+
+intmax_t DecompressStream(const uint8_t *data, size_t size, DecompressSink sink, void *context) {
+	switch(DetectCompression(data, size)) {
+		case COMPRESSION_LZ4:
+			return LZ4DecompressFrames(data, size, sink, context);
+		case COMPRESSION_GZIP:
+			return GzipDecompress(data, size, sink, context);
+		default:
+			return -1;
+	}
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/* Decompressed data is handed out in pieces to a sink as soon as it is
+ * produced, so the whole output never has to be in memory at once.
+ * The sink returns false to stop decompression.
+ */
+typedef bool (*DecompressSink)(void *context, const uint8_t *data, size_t size);
+
+enum CompressionFormat {
+	COMPRESSION_NONE,
+	COMPRESSION_LZ4,
+	COMPRESSION_GZIP,
+};
+
+CompressionFormat DetectCompression(const uint8_t *data, size_t size);
+
+/* Returns the amount of bytes produced, or -1 on a malformed stream */
+intmax_t DecompressStream(const uint8_t *data, size_t size, DecompressSink sink, void *context);
@@ -0,0 +1,468 @@
+#include "gzip.h"
+
+#include <mkmi.h>
+
+#define GZIP_FLAG_HCRC    0x02
+#define GZIP_FLAG_EXTRA   0x04
+#define GZIP_FLAG_NAME    0x08
+#define GZIP_FLAG_COMMENT 0x10
+
+static const uint16_t LengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint16_t LengthExtra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t DistanceBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+
+static const uint16_t DistanceExtra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const uint8_t CodeLengthOrder[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+struct InflateState {
+	const uint8_t *Input;
+	size_t InputSize;
+	size_t Position;
+
+	uint64_t BitBuffer;
+	size_t BitCount;
+
+	/* Output goes here, and the last INFLATE_WINDOW_SIZE bytes
+	   are kept around when it is flushed */
+	uint8_t *Window;
+	size_t Fill;
+	size_t Flushed;
+
+	DecompressSink Sink;
+	void *Context;
+	intmax_t Total;
+
+	bool Failed;
+
+	InflateHuffman LengthCodes;
+	InflateHuffman DistanceCodes;
+};
+
+static uint32_t Bits(InflateState *state, size_t count) {
+	while(state->BitCount < count) {
+		if(state->Position >= state->InputSize) {
+			state->Failed = true;
+			return 0;
+		}
+
+		state->BitBuffer |= (uint64_t)state->Input[state->Position++] << state->BitCount;
+		state->BitCount += 8;
+	}
+
+	uint32_t value = state->BitBuffer & ((1ULL << count) - 1);
+	state->BitBuffer >>= count;
+	state->BitCount -= count;
+
+	return value;
+}
+
+/* Gives back the whole bytes that were read ahead, dropping the partial one */
+static void AlignToByte(InflateState *state) {
+	state->Position -= state->BitCount / 8;
+	state->BitBuffer = 0;
+	state->BitCount = 0;
+}
+
+static bool Flush(InflateState *state) {
+	if(state->Fill == state->Flushed) return true;
+
+	if(!state->Sink(state->Context, state->Window + state->Flushed, state->Fill - state->Flushed)) {
+		state->Failed = true;
+		return false;
+	}
+
+	state->Total += state->Fill - state->Flushed;
+	state->Flushed = state->Fill;
+
+	return true;
+}
+
+static bool Slide(InflateState *state) {
+	if(!Flush(state)) return false;
+
+	uint8_t *history = state->Window + state->Fill - INFLATE_WINDOW_SIZE;
+	Memcpy(state->Window, history, INFLATE_WINDOW_SIZE);
+
+	state->Fill = INFLATE_WINDOW_SIZE;
+	state->Flushed = INFLATE_WINDOW_SIZE;
+
+	return true;
+}
+
+static inline bool Put(InflateState *state, uint8_t byte) {
+	if(state->Fill == INFLATE_BUFFER_SIZE && !Slide(state)) return false;
+
+	state->Window[state->Fill++] = byte;
+	return true;
+}
+
+static bool Copy(InflateState *state, size_t distance, size_t length) {
+	/* The window always keeps at least INFLATE_WINDOW_SIZE bytes of history */
+	if(distance > state->Fill) return false;
+
+	while(length > 0) {
+		if(state->Fill == INFLATE_BUFFER_SIZE && !Slide(state)) return false;
+
+		size_t chunk = INFLATE_BUFFER_SIZE - state->Fill;
+		if(chunk > length) chunk = length;
+
+		uint8_t *destination = state->Window + state->Fill;
+		const uint8_t *from = destination - distance;
+
+		if(distance >= chunk) {
+			Memcpy(destination, from, chunk);
+		} else {
+			for (size_t i = 0; i < chunk; ++i) destination[i] = from[i];
+		}
+
+		state->Fill += chunk;
+		length -= chunk;
+	}
+
+	return true;
+}
+
+static uint32_t ReverseBits(uint32_t code, size_t length) {
+	uint32_t reversed = 0;
+	for (size_t i = 0; i < length; ++i) {
+		reversed = (reversed << 1) | (code & 1);
+		code >>= 1;
+	}
+
+	return reversed;
+}
+
+static bool BuildHuffman(InflateHuffman *huffman, const uint8_t *lengths, size_t count) {
+	Memset(huffman->Count, 0, sizeof(huffman->Count));
+	Memset(huffman->Fast, 0, sizeof(huffman->Fast));
+
+	for (size_t symbol = 0; symbol < count; ++symbol) ++huffman->Count[lengths[symbol]];
+
+	/* Over-subscribed codes are invalid, incomplete ones are allowed */
+	intmax_t left = 1;
+	for (size_t length = 1; length <= INFLATE_MAX_BITS; ++length) {
+		left <<= 1;
+		left -= huffman->Count[length];
+		if(left < 0) return false;
+	}
+
+	uint16_t offsets[INFLATE_MAX_BITS + 1];
+	offsets[1] = 0;
+	for (size_t length = 1; length < INFLATE_MAX_BITS; ++length) {
+		offsets[length + 1] = offsets[length] + huffman->Count[length];
+	}
+
+	for (size_t symbol = 0; symbol < count; ++symbol) {
+		if(lengths[symbol] != 0) huffman->Symbol[offsets[lengths[symbol]]++] = symbol;
+	}
+
+	/* Walk the canonical codes in order to fill the lookup table */
+	uint32_t code = 0;
+	size_t index = 0;
+	for (size_t length = 1; length <= INFLATE_MAX_BITS; ++length) {
+		for (size_t i = 0; i < huffman->Count[length]; ++i, ++code, ++index) {
+			if(length > INFLATE_FAST_BITS) continue;
+
+			uint16_t entry = (huffman->Symbol[index] << 4) | length;
+			for (uint32_t slot = ReverseBits(code, length); slot < (1 << INFLATE_FAST_BITS); slot += 1 << length) {
+				huffman->Fast[slot] = entry;
+			}
+		}
+
+		code <<= 1;
+	}
+
+	return true;
+}
+
+static intmax_t Decode(InflateState *state, InflateHuffman *huffman) {
+	while(state->BitCount < INFLATE_FAST_BITS && state->Position < state->InputSize) {
+		state->BitBuffer |= (uint64_t)state->Input[state->Position++] << state->BitCount;
+		state->BitCount += 8;
+	}
+
+	uint16_t entry = huffman->Fast[state->BitBuffer & ((1 << INFLATE_FAST_BITS) - 1)];
+	if(entry != 0 && (size_t)(entry & 15) <= state->BitCount) {
+		state->BitBuffer >>= entry & 15;
+		state->BitCount -= entry & 15;
+
+		return entry >> 4;
+	}
+
+	/* Long codes are decoded one bit at a time */
+	intmax_t code = 0, first = 0, index = 0;
+	for (size_t length = 1; length <= INFLATE_MAX_BITS; ++length) {
+		code |= Bits(state, 1);
+		if(state->Failed) return -1;
+
+		intmax_t count = huffman->Count[length];
+		if(code - count < first) return huffman->Symbol[index + (code - first)];
+
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+static bool InflateCodes(InflateState *state) {
+	while(true) {
+		intmax_t symbol = Decode(state, &state->LengthCodes);
+		if(symbol < 0) return false;
+
+		if(symbol < 256) {
+			if(!Put(state, symbol)) return false;
+			continue;
+		}
+
+		if(symbol == 256) return true;
+
+		symbol -= 257;
+		if(symbol >= 29) return false;
+
+		size_t length = LengthBase[symbol] + Bits(state, LengthExtra[symbol]);
+
+		symbol = Decode(state, &state->DistanceCodes);
+		if(symbol < 0 || symbol >= 30) return false;
+
+		size_t distance = DistanceBase[symbol] + Bits(state, DistanceExtra[symbol]);
+		if(state->Failed) return false;
+
+		if(!Copy(state, distance, length)) return false;
+	}
+}
+
+static bool InflateStored(InflateState *state) {
+	AlignToByte(state);
+
+	if(state->Position + 4 > state->InputSize) return false;
+
+	const uint8_t *header = state->Input + state->Position;
+	size_t length = header[0] | (header[1] << 8);
+	size_t inverse = header[2] | (header[3] << 8);
+	if(length != (~inverse & 0xFFFF)) return false;
+
+	state->Position += 4;
+	if(state->Position + length > state->InputSize) return false;
+
+	while(length > 0) {
+		if(state->Fill == INFLATE_BUFFER_SIZE && !Slide(state)) return false;
+
+		size_t chunk = INFLATE_BUFFER_SIZE - state->Fill;
+		if(chunk > length) chunk = length;
+
+		Memcpy(state->Window + state->Fill, state->Input + state->Position, chunk);
+		state->Fill += chunk;
+		state->Position += chunk;
+		length -= chunk;
+	}
+
+	return true;
+}
+
+static bool InflateFixed(InflateState *state) {
+	uint8_t lengths[INFLATE_FIXED_LCODES];
+
+	size_t symbol = 0;
+	for (; symbol < 144; ++symbol) lengths[symbol] = 8;
+	for (; symbol < 256; ++symbol) lengths[symbol] = 9;
+	for (; symbol < 280; ++symbol) lengths[symbol] = 7;
+	for (; symbol < INFLATE_FIXED_LCODES; ++symbol) lengths[symbol] = 8;
+	BuildHuffman(&state->LengthCodes, lengths, INFLATE_FIXED_LCODES);
+
+	for (symbol = 0; symbol < INFLATE_MAX_DCODES; ++symbol) lengths[symbol] = 5;
+	BuildHuffman(&state->DistanceCodes, lengths, INFLATE_MAX_DCODES);
+
+	return InflateCodes(state);
+}
+
+static bool InflateDynamic(InflateState *state) {
+	size_t lengthCount = Bits(state, 5) + 257;
+	size_t distanceCount = Bits(state, 5) + 1;
+	size_t codeCount = Bits(state, 4) + 4;
+	if(state->Failed) return false;
+
+	if(lengthCount > INFLATE_MAX_LCODES || distanceCount > INFLATE_MAX_DCODES) return false;
+
+	uint8_t lengths[INFLATE_MAX_LCODES + INFLATE_MAX_DCODES];
+	Memset(lengths, 0, sizeof(lengths));
+
+	for (size_t i = 0; i < codeCount; ++i) lengths[CodeLengthOrder[i]] = Bits(state, 3);
+	if(state->Failed) return false;
+
+	if(!BuildHuffman(&state->LengthCodes, lengths, 19)) return false;
+
+	size_t index = 0;
+	while(index < lengthCount + distanceCount) {
+		intmax_t symbol = Decode(state, &state->LengthCodes);
+		if(symbol < 0) return false;
+
+		if(symbol < 16) {
+			lengths[index++] = symbol;
+			continue;
+		}
+
+		uint8_t length = 0;
+		size_t repeat;
+		if(symbol == 16) {
+			if(index == 0) return false;
+			length = lengths[index - 1];
+			repeat = 3 + Bits(state, 2);
+		} else if(symbol == 17) {
+			repeat = 3 + Bits(state, 3);
+		} else {
+			repeat = 11 + Bits(state, 7);
+		}
+
+		if(state->Failed || index + repeat > lengthCount + distanceCount) return false;
+
+		while(repeat--) lengths[index++] = length;
+	}
+
+	/* Without an end of block code nothing could ever stop */
+	if(lengths[256] == 0) return false;
+
+	if(!BuildHuffman(&state->LengthCodes, lengths, lengthCount)) return false;
+	if(!BuildHuffman(&state->DistanceCodes, lengths + lengthCount, distanceCount)) return false;
+
+	return InflateCodes(state);
+}
+
+static bool Inflate(InflateState *state) {
+	bool last;
+
+	do {
+		last = Bits(state, 1);
+		uint32_t type = Bits(state, 2);
+		if(state->Failed) return false;
+
+		bool result;
+		switch(type) {
+			case 0:
+				result = InflateStored(state);
+				break;
+			case 1:
+				result = InflateFixed(state);
+				break;
+			case 2:
+				result = InflateDynamic(state);
+				break;
+			default:
+				result = false;
+				break;
+		}
+
+		if(!result || state->Failed) return false;
+	} while(!last);
+
+	AlignToByte(state);
+
+	return Flush(state);
+}
+
+static bool SkipGzipHeader(InflateState *state) {
+	const uint8_t *data = state->Input;
+	size_t position = state->Position;
+
+	if(position + 10 > state->InputSize) return false;
+	if(data[position] != 0x1F || data[position + 1] != 0x8B || data[position + 2] != 0x08) return false;
+
+	uint8_t flags = data[position + 3];
+	position += 10;
+
+	if(flags & GZIP_FLAG_EXTRA) {
+		if(position + 2 > state->InputSize) return false;
+		position += 2 + (data[position] | (data[position + 1] << 8));
+	}
+
+	if(flags & GZIP_FLAG_NAME) {
+		while(position < state->InputSize && data[position] != 0) ++position;
+		++position;
+	}
+
+	if(flags & GZIP_FLAG_COMMENT) {
+		while(position < state->InputSize && data[position] != 0) ++position;
+		++position;
+	}
+
+	if(flags & GZIP_FLAG_HCRC) position += 2;
+
+	if(position > state->InputSize) return false;
+
+	state->Position = position;
+	return true;
+}
+
+intmax_t GzipDecompress(const uint8_t *data, size_t size, DecompressSink sink, void *context) {
+	InflateState *state = new InflateState;
+
+	state->Input = data;
+	state->InputSize = size;
+	state->Position = 0;
+	state->Sink = sink;
+	state->Context = context;
+	state->Total = 0;
+	state->Failed = false;
+
+	state->Window = (uint8_t*)Malloc(INFLATE_BUFFER_SIZE);
+	if(state->Window == NULL) {
+		delete state;
+		return -1;
+	}
+
+	intmax_t result = 0;
+	size_t members = 0;
+
+	/* Members may be concatenated, each one restarting the history.
+	   Anything else after the last one, like zero padding, is left alone */
+	while(state->Position < size && (members == 0 || data[state->Position] == 0x1F)) {
+		state->BitBuffer = 0;
+		state->BitCount = 0;
+		state->Fill = 0;
+		state->Flushed = 0;
+
+		/* A member is at least a header, an empty block and its trailer */
+		if(size - state->Position < 18 || !SkipGzipHeader(state) || !Inflate(state)) {
+			result = -1;
+			break;
+		}
+
+		/* CRC32 and size */
+		if(size - state->Position < 8) {
+			result = -1;
+			break;
+		}
+
+		state->Position += 8;
+		++members;
+	}
+
+	if(members == 0) result = -1;
+
+	if(result == 0) result = state->Total;
+
+	Free(state->Window);
+	delete state;
+
+	return result;
+}
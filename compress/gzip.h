@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "compress.h"
+
+/* How far back a deflate match can reach */
+#define INFLATE_WINDOW_SIZE  0x8000
+/* Decompressed data is flushed to the sink every time this fills up */
+#define INFLATE_BUFFER_SIZE  (4 * INFLATE_WINDOW_SIZE)
+/* Huffman codes up to this length are decoded with a single lookup */
+#define INFLATE_FAST_BITS    10
+
+#define INFLATE_MAX_BITS     15
+#define INFLATE_MAX_LCODES   286
+#define INFLATE_MAX_DCODES   30
+#define INFLATE_FIXED_LCODES 288
+
+struct InflateHuffman {
+	uint16_t Count[INFLATE_MAX_BITS + 1];
+	uint16_t Symbol[INFLATE_FIXED_LCODES];
+
+	/* Symbol << 4 | length, zero when the code is longer than INFLATE_FAST_BITS */
+	uint16_t Fast[1 << INFLATE_FAST_BITS];
+};
+
+/* Decodes one or more concatenated gzip members. The CRC is not verified.
+   Fails when there is no member or the last one is cut short */
+intmax_t GzipDecompress(const uint8_t *data, size_t size, DecompressSink sink, void *context);
@@ -0,0 +1,272 @@
+#include "lz4.h"
+
+#include <mkmi.h>
+
+static uint32_t ReadLE32(const uint8_t *data) {
+	return (uint32_t)data[0] |
+	       ((uint32_t)data[1] << 8) |
+	       ((uint32_t)data[2] << 16) |
+	       ((uint32_t)data[3] << 24);
+}
+
+/* Decodes a compressed block into window, starting from start.
+ * The window before start holds the previous output, which matches may refer to.
+ */
+static intmax_t LZ4DecodeBlock(const uint8_t *source, size_t sourceSize, uint8_t *window, size_t start, size_t limit) {
+	size_t in = 0;
+	size_t out = start;
+
+	while(in < sourceSize) {
+		uint8_t token = source[in++];
+
+		size_t literals = token >> 4;
+		if(literals == 15) {
+			uint8_t extra;
+			do {
+				if(in >= sourceSize) return -1;
+				extra = source[in++];
+				literals += extra;
+			} while(extra == 255);
+		}
+
+		if(in + literals > sourceSize || out + literals > limit) return -1;
+
+		Memcpy(window + out, source + in, literals);
+		in += literals;
+		out += literals;
+
+		/* The last sequence only has literals */
+		if(in == sourceSize) break;
+
+		if(in + 2 > sourceSize) return -1;
+		size_t offset = source[in] | (source[in + 1] << 8);
+		in += 2;
+
+		if(offset == 0 || offset > out) return -1;
+
+		size_t match = (token & 15) + 4;
+		if((token & 15) == 15) {
+			uint8_t extra;
+			do {
+				if(in >= sourceSize) return -1;
+				extra = source[in++];
+				match += extra;
+			} while(extra == 255);
+		}
+
+		if(out + match > limit) return -1;
+
+		uint8_t *destination = window + out;
+		const uint8_t *from = destination - offset;
+
+		/* Matches may overlap with what they produce */
+		if(offset >= match) {
+			Memcpy(destination, from, match);
+		} else {
+			for (size_t i = 0; i < match; ++i) destination[i] = from[i];
+		}
+
+		out += match;
+	}
+
+	return out - start;
+}
+
+intmax_t LZ4DecompressBlock(const uint8_t *source, size_t size, uint8_t *destination, size_t capacity) {
+	return LZ4DecodeBlock(source, size, destination, 0, capacity);
+}
+
+/* Matches are at least this long */
+#define LZ4_MIN_MATCH        4
+/* The block always ends with this many literals, */
+#define LZ4_LAST_LITERALS    5
+/* and no match starts this close to its end */
+#define LZ4_MATCH_LIMIT      12
+
+static inline uint32_t HashSequence(uint32_t sequence) {
+	return (sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+/* Lengths past what fits in a token go in bytes of 255, then the rest */
+static size_t WriteLength(uint8_t *destination, size_t out, size_t length) {
+	while(length >= 255) {
+		destination[out++] = 255;
+		length -= 255;
+	}
+
+	destination[out++] = length;
+	return out;
+}
+
+/* Room a sequence takes at worst, so that it can be checked for once up front */
+static inline size_t SequenceBound(size_t literals, size_t match) {
+	return 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1;
+}
+
+size_t LZ4CompressBlock(const uint8_t *source, size_t size, uint8_t *destination, size_t capacity) {
+	uint32_t positions[1 << LZ4_HASH_LOG];
+	Memset(positions, 0, sizeof(positions));
+
+	size_t in = 0;
+	size_t anchor = 0;
+	size_t out = 0;
+
+	if(size > LZ4_MATCH_LIMIT) {
+		size_t limit = size - LZ4_MATCH_LIMIT + 1;
+		size_t matchEnd = size - LZ4_LAST_LITERALS;
+		size_t misses = 0;
+
+		while(in < limit) {
+			uint32_t sequence = ReadLE32(source + in);
+			uint32_t hash = HashSequence(sequence);
+			size_t candidate = positions[hash];
+			positions[hash] = in;
+
+			/* The longer nothing matches, the further ahead the next look is */
+			if(candidate >= in || in - candidate >= LZ4_WINDOW_SIZE || ReadLE32(source + candidate) != sequence) {
+				in += 1 + (misses++ >> 6);
+				continue;
+			}
+
+			misses = 0;
+
+			while(in > anchor && candidate > 0 && source[in - 1] == source[candidate - 1]) {
+				--in;
+				--candidate;
+			}
+
+			size_t length = LZ4_MIN_MATCH;
+			while(in + length < matchEnd && source[in + length] == source[candidate + length]) ++length;
+
+			size_t literals = in - anchor;
+			size_t match = length - LZ4_MIN_MATCH;
+			if(out + SequenceBound(literals, match) > capacity) return 0;
+
+			uint8_t *token = &destination[out++];
+			*token = (literals >= 15 ? 15 : literals) << 4 | (match >= 15 ? 15 : match);
+
+			if(literals >= 15) out = WriteLength(destination, out, literals - 15);
+			Memcpy(destination + out, source + anchor, literals);
+			out += literals;
+
+			size_t offset = in - candidate;
+			destination[out++] = offset & 0xFF;
+			destination[out++] = offset >> 8;
+
+			if(match >= 15) out = WriteLength(destination, out, match - 15);
+
+			in += length;
+			anchor = in;
+
+			/* What comes right before the next position often starts the next match */
+			positions[HashSequence(ReadLE32(source + in - 2))] = in - 2;
+		}
+	}
+
+	size_t literals = size - anchor;
+	if(out + SequenceBound(literals, 0) > capacity) return 0;
+
+	destination[out++] = (literals >= 15 ? 15 : literals) << 4;
+	if(literals >= 15) out = WriteLength(destination, out, literals - 15);
+
+	Memcpy(destination + out, source + anchor, literals);
+	out += literals;
+
+	return out;
+}
+
+intmax_t LZ4DecompressFrames(const uint8_t *data, size_t size, DecompressSink sink, void *context) {
+	size_t position = 0;
+	intmax_t total = 0;
+
+	uint8_t *window = NULL;
+	size_t windowCapacity = 0;
+
+	while(position + 4 <= size) {
+		uint32_t magic = ReadLE32(data + position);
+
+		if((magic & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC) {
+			if(position + 8 > size) break;
+			position += 8 + ReadLE32(data + position + 4);
+			continue;
+		}
+
+		/* Anything else after the last frame is padding */
+		if(magic != LZ4_FRAME_MAGIC) break;
+		position += 4;
+
+		if(position + 3 > size) goto fail;
+
+		uint8_t flags = data[position];
+		uint8_t blockDescriptor = data[position + 1];
+
+		if((flags >> 6) != 1) goto fail;
+
+		bool blockChecksum = flags & 0x10;
+		bool contentSize = flags & 0x08;
+		bool contentChecksum = flags & 0x04;
+		bool dictionaryID = flags & 0x01;
+
+		size_t sizeIndex = (blockDescriptor >> 4) & 7;
+		if(sizeIndex < 4) goto fail;
+		size_t blockMax = (size_t)1 << (8 + 2 * sizeIndex);
+
+		position += 2 + (contentSize ? 8 : 0) + (dictionaryID ? 4 : 0) + 1;
+
+		/* Room for the history matches can reach back to, plus a whole block */
+		if(windowCapacity < LZ4_WINDOW_SIZE + blockMax) {
+			if(window != NULL) Free(window);
+
+			windowCapacity = LZ4_WINDOW_SIZE + blockMax;
+			window = (uint8_t*)Malloc(windowCapacity);
+			if(window == NULL) return -1;
+		}
+
+		size_t fill = 0;
+
+		while(true) {
+			if(position + 4 > size) goto fail;
+
+			uint32_t blockSize = ReadLE32(data + position);
+			position += 4;
+
+			if(blockSize == 0) break;
+
+			bool uncompressed = blockSize & 0x80000000;
+			blockSize &= 0x7FFFFFFF;
+
+			if(blockSize > blockMax || position + blockSize > size) goto fail;
+
+			/* Keep only the history that can still be referenced */
+			if(fill > LZ4_WINDOW_SIZE) {
+				uint8_t *history = window + fill - LZ4_WINDOW_SIZE;
+				for (size_t i = 0; i < LZ4_WINDOW_SIZE; ++i) window[i] = history[i];
+				fill = LZ4_WINDOW_SIZE;
+			}
+
+			intmax_t produced;
+			if(uncompressed) {
+				Memcpy(window + fill, data + position, blockSize);
+				produced = blockSize;
+			} else {
+				produced = LZ4DecodeBlock(data + position, blockSize, window, fill, fill + blockMax);
+				if(produced < 0) goto fail;
+			}
+
+			if(!sink(context, window + fill, produced)) goto fail;
+
+			fill += produced;
+			total += produced;
+
+			position += blockSize + (blockChecksum ? 4 : 0);
+		}
+
+		position += contentChecksum ? 4 : 0;
+	}
+
+	if(window != NULL) Free(window);
+	return total;
+fail:
+	if(window != NULL) Free(window);
+	return -1;
+}
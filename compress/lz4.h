@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "compress.h"
+
+#define LZ4_FRAME_MAGIC      0x184D2204
+#define LZ4_SKIPPABLE_MAGIC  0x184D2A50
+#define LZ4_SKIPPABLE_MASK   0xFFFFFFF0
+
+/* How far back a match can reach */
+#define LZ4_WINDOW_SIZE      0x10000
+
+/* Decodes one or more concatenated LZ4 frames. Checksums are not verified */
+intmax_t LZ4DecompressFrames(const uint8_t *data, size_t size, DecompressSink sink, void *context);
+
+/* Compresses into a single raw block, with no frame around it.
+ * Returns the compressed size, or 0 if it would not fit in capacity.
+ * Matches are found through a table of 1 << LZ4_HASH_LOG positions on the stack
+ */
+#define LZ4_HASH_LOG         12
+size_t LZ4CompressBlock(const uint8_t *source, size_t size, uint8_t *destination, size_t capacity);
+
+/* Decodes a single raw block. Returns the decompressed size, or -1 if it is malformed or does not fit */
+intmax_t LZ4DecompressBlock(const uint8_t *source, size_t size, uint8_t *destination, size_t capacity);
@@ -0,0 +1,142 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../vfs/ustar.h"
+
+static void BenchArchive(size_t files, size_t fileSize) {
+	const size_t filesPerDirectory = 64;
+
+	char params[96];
+	snprintf(params, sizeof(params), "\"files\":%zu,\"file_size\":%zu,\"files_per_directory\":%zu",
+	         files, fileSize, filesPerDirectory);
+
+	size_t size;
+	uint8_t *archive = GenerateArchive(files, fileSize, filesPerDirectory, &size);
+	if(archive == NULL) return;
+
+	size_t directories = (files + filesPerDirectory - 1) / filesPerDirectory;
+
+	/* The last file is checked after every run, its bytes count up from its number */
+	char last[64];
+	snprintf(last, sizeof(last), "dir%zu/file%zu", (files - 1) / filesPerDirectory, files - 1);
+
+	uint8_t expected[64];
+	size_t checked = fileSize < sizeof(expected) ? fileSize : sizeof(expected);
+	for (size_t i = 0; i < checked; ++i) expected[i] = (uint8_t)(files - 1 + i);
+
+	Bench("archive.index", params, [&](BenchTimer *timer) {
+		timer->Start();
+		ArchiveIndex *index = IndexArchive(archive, size);
+		timer->Stop();
+
+		timer->Operations = index->EntryCount;
+		timer->Bytes = size;
+
+		if(index->EntryCount != files + directories) BenchFail("archive.index", "indexed %zu entries", index->EntryCount);
+
+		ArchiveEntry *entry = FindEntryInArchive(index, last, strlen(last));
+		if(entry == NULL || entry->Size != fileSize || memcmp(entry->Data, expected, checked) != 0) {
+			BenchFail("archive.index", "%s is missing or wrong", last);
+		}
+
+		FreeArchiveIndex(index);
+	});
+
+	/* What boot does with a plain initrd: index it, then unpack it */
+	Bench("archive.unpack", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(files + directories + 1);
+
+		timer->Start();
+		ArchiveIndex *index = IndexArchive(archive, size);
+		UnpackArchive(environment->VFS, index, "/", NULL);
+		timer->Stop();
+
+		timer->Operations = index->EntryCount;
+		timer->Bytes = size;
+
+		char path[MAX_PATH_SIZE];
+		snprintf(path, sizeof(path), "/%s", last);
+
+		VNode node;
+		uint8_t data[sizeof(expected)] = { 0 };
+		if(environment->VFS->ResolvePath(path, &node) != 0 || node.Size != fileSize) {
+			BenchFail("archive.unpack", "%s is missing or has the wrong size", last);
+		} else {
+			environment->FS->ReadNode(node.Inode, 0, checked, data);
+			if(memcmp(data, expected, checked) != 0) BenchFail("archive.unpack", "%s has the wrong data", last);
+		}
+
+		FreeArchiveIndex(index);
+		DestroyEnvironment(environment);
+	});
+
+	/* What boot does with a ramfs.img instead: the image is dumped from an unpacked tree,
+	   then restored into a fresh root before anything else is written to it */
+	if(!BenchSelected("archive.restore_image")) {
+		free(archive);
+		return;
+	}
+
+	BenchEnvironment *unpacked = CreateEnvironment(files + directories + 1);
+	ArchiveIndex *unpackedIndex = IndexArchive(archive, size);
+	UnpackArchive(unpacked->VFS, unpackedIndex, "/", NULL);
+	FreeArchiveIndex(unpackedIndex);
+
+	intmax_t imageSize = unpacked->FS->DumpImage(NULL, 0);
+	uint8_t *image = imageSize > 0 ? (uint8_t*)malloc(imageSize) : NULL;
+	bool dumped = image != NULL && unpacked->FS->DumpImage(image, imageSize) == imageSize;
+	DestroyEnvironment(unpacked);
+
+	if(!dumped) {
+		BenchFail("archive.restore_image", "the unpacked tree can't be dumped");
+		free(image);
+		free(archive);
+		return;
+	}
+
+	Bench("archive.restore_image", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(files + directories + 2);
+
+		timer->Start();
+		bool restored = environment->FS->RestoreImage(image, imageSize);
+		timer->Stop();
+
+		timer->Operations = files + directories;
+		timer->Bytes = imageSize;
+
+		char path[MAX_PATH_SIZE];
+		snprintf(path, sizeof(path), "/%s", last);
+
+		VNode node;
+		uint8_t data[sizeof(expected)] = { 0 };
+		if(!restored) {
+			BenchFail("archive.restore_image", "the image was turned down");
+		} else if(environment->VFS->ResolvePath(path, &node) != 0 || node.Size != fileSize) {
+			BenchFail("archive.restore_image", "%s is missing or has the wrong size", last);
+		} else {
+			environment->FS->ReadNode(node.Inode, 0, checked, data);
+			if(memcmp(data, expected, checked) != 0) BenchFail("archive.restore_image", "%s has the wrong data", last);
+		}
+
+		/* Boot goes on to write to the restored tree */
+		char name[MAX_NAME_SIZE] = "README";
+		if(restored && environment->FS->CreateNode(0, name, NODE_PROPERTY_FILE) == NULL) {
+			BenchFail("archive.restore_image", "the restored tree can't be written to");
+		}
+
+		DestroyEnvironment(environment);
+	});
+
+	free(image);
+	free(archive);
+}
+
+void RunArchiveBenchmarks() {
+	BenchArchive(1000, 512);
+	BenchArchive(1000, 16384);
+
+	if(!Options.Quick) BenchArchive(10000, 512);
+}
@@ -0,0 +1,222 @@
+#include "bench.h"
+
+#include <mkmi.h>
+
+#include "../../vfs/ustar.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+BenchOptions Options = { NULL, 5, false, NULL };
+
+static bool Failed = false;
+
+uint64_t BenchNow() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+bool BenchSelected(const char *name) {
+	return Options.Filter == NULL || strstr(name, Options.Filter) != NULL;
+}
+
+void BenchFail(const char *name, const char *format, ...) {
+	fprintf(stderr, "%s: ", name);
+
+	va_list arguments;
+	va_start(arguments, format);
+	vfprintf(stderr, format, arguments);
+	va_end(arguments);
+
+	fprintf(stderr, "\n");
+	Failed = true;
+}
+
+bool BenchFilled(const void *data, size_t size, uint8_t value) {
+	const uint8_t *bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; ++i) {
+		if(bytes[i] != value) return false;
+	}
+
+	return true;
+}
+
+static int CompareDoubles(const void *first, const void *second) {
+	double a = *(const double*)first;
+	double b = *(const double*)second;
+
+	return (a > b) - (a < b);
+}
+
+void BenchReport(const char *name, const char *params, BenchTimer *runs, size_t count) {
+	double perOperation[BENCH_MAX_REPEATS];
+	double total = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		uint64_t operations = runs[i].Operations == 0 ? 1 : runs[i].Operations;
+		perOperation[i] = (double)runs[i].Elapsed / operations;
+		total += perOperation[i];
+	}
+
+	qsort(perOperation, count, sizeof(double), CompareDoubles);
+
+	double median = count % 2 ? perOperation[count / 2] : (perOperation[count / 2 - 1] + perOperation[count / 2]) / 2;
+
+	printf("{\"benchmark\":\"%s\",\"params\":{%s},\"repeats\":%zu,\"ops\":%llu,"
+	       "\"ns_per_op_min\":%.2f,\"ns_per_op_median\":%.2f,\"ns_per_op_mean\":%.2f",
+	       name, params, count, (unsigned long long)runs[0].Operations,
+	       perOperation[0], median, total / count);
+
+	/* Throughput only means something for benchmarks that move data */
+	if(runs[0].Bytes != 0 && runs[0].Operations != 0) {
+		double bytesPerOperation = (double)runs[0].Bytes / runs[0].Operations;
+		printf(",\"mb_per_s_median\":%.2f", bytesPerOperation / median * 1000000000 / (1024 * 1024));
+	}
+
+	printf("}\n");
+	fflush(stdout);
+}
+
+BenchEnvironment *CreateEnvironment(inode_t maxInodes) {
+	BenchEnvironment *environment = new BenchEnvironment;
+
+	environment->VFS = new VirtualFilesystem();
+	environment->FS = new RamFS(maxInodes);
+
+	FSOperations *ops = new FSOperations();
+	ops->CreateNode = environment->FS->CreateNodeWrapper;
+	ops->DeleteNode = environment->FS->DeleteNodeWrapper;
+	ops->RenameNode = environment->FS->RenameNodeWrapper;
+	ops->GetByInode = environment->FS->GetByInodeWrapper;
+	ops->GetByName = environment->FS->GetByNameWrapper;
+	ops->GetByIndex = environment->FS->GetByIndexWrapper;
+	ops->GetRootNode = environment->FS->GetRootNodeWrapper;
+	ops->ReadNode = environment->FS->ReadNodeWrapper;
+	ops->WriteNode = environment->FS->WriteNodeWrapper;
+	ops->ReadNodeVector = environment->FS->ReadNodeVectorWrapper;
+	ops->WriteNodeVector = environment->FS->WriteNodeVectorWrapper;
+	ops->BindNode = environment->FS->BindNodeWrapper;
+	ops->MapNode = environment->FS->MapNodeWrapper;
+	ops->MapBlock = environment->FS->MapBlockWrapper;
+	ops->UnmapNode = environment->FS->UnmapNodeWrapper;
+	ops->CloneNode = environment->FS->CloneNodeWrapper;
+	ops->CopyRange = environment->FS->CopyRangeWrapper;
+	ops->Snapshot = environment->FS->SnapshotWrapper;
+	ops->ReadDirectory = environment->FS->ReadDirectoryWrapper;
+
+	environment->Descriptor = environment->VFS->RegisterFilesystem(0, 0, environment->FS, ops);
+	environment->FS->SetDescriptor(environment->Descriptor);
+	environment->VFS->SetRootFS(environment->Descriptor);
+
+	return environment;
+}
+
+void DestroyEnvironment(BenchEnvironment *environment) {
+	delete environment->VFS;
+	delete environment->FS;
+	delete environment;
+}
+
+static void WriteOctal(char *field, size_t length, size_t value) {
+	field[length - 1] = '\0';
+
+	for (size_t i = length - 1; i > 0; --i) {
+		field[i - 1] = '0' + (value & 7);
+		value >>= 3;
+	}
+}
+
+static void WriteHeader(uint8_t *block, const char *name, size_t size, char type) {
+	memset(block, 0, 512);
+
+	TarHeader *header = (TarHeader*)block;
+	/* A name that fills the field is left unterminated, as tar does */
+	size_t length = strlen(name);
+	memcpy(header->Filename, name, length < sizeof(header->Filename) ? length : sizeof(header->Filename));
+	WriteOctal(header->Mode, sizeof(header->Mode), type == TAR_TYPE_DIRECTORY ? 0755 : 0644);
+	WriteOctal(header->UID, sizeof(header->UID), 0);
+	WriteOctal(header->GID, sizeof(header->GID), 0);
+	WriteOctal(header->Size, sizeof(header->Size), size);
+	WriteOctal(header->MTime, sizeof(header->MTime), 0);
+	header->TypeFlag[0] = type;
+	memcpy(header->USTAR, "ustar", 6);
+	memcpy(header->USTARVer, "00", 2);
+
+	memset(header->Chksum, ' ', sizeof(header->Chksum));
+
+	size_t checksum = 0;
+	for (size_t i = 0; i < 512; ++i) checksum += block[i];
+	WriteOctal(header->Chksum, 7, checksum);
+}
+
+uint8_t *GenerateArchive(size_t files, size_t fileSize, size_t filesPerDirectory, size_t *size) {
+	size_t directories = (files + filesPerDirectory - 1) / filesPerDirectory;
+	size_t dataBlocks = (fileSize + 511) / 512;
+
+	*size = (directories + files * (1 + dataBlocks) + 2) * 512;
+
+	uint8_t *archive = (uint8_t*)malloc(*size);
+	if(archive == NULL) return NULL;
+
+	uint8_t *position = archive;
+	char name[100];
+
+	for (size_t file = 0; file < files; ++file) {
+		size_t directory = file / filesPerDirectory;
+
+		if(file % filesPerDirectory == 0) {
+			snprintf(name, sizeof(name), "dir%zu/", directory);
+			WriteHeader(position, name, 0, TAR_TYPE_DIRECTORY);
+			position += 512;
+		}
+
+		snprintf(name, sizeof(name), "dir%zu/file%zu", directory, file);
+		WriteHeader(position, name, fileSize, TAR_TYPE_FILE);
+		position += 512;
+
+		for (size_t i = 0; i < dataBlocks * 512; ++i) position[i] = i < fileSize ? (uint8_t)(file + i) : 0;
+		position += dataBlocks * 512;
+	}
+
+	memset(position, 0, 1024);
+
+	return archive;
+}
+
+static void Usage(const char *program) {
+	fprintf(stderr, "Usage: %s [--filter <substring>] [--repeat <count>] [--quick] [--replay <trace>]\n", program);
+	fprintf(stderr, "Prints one JSON object per benchmark on standard output.\n");
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+			Options.Filter = argv[++i];
+		} else if(strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+			Options.Repeats = strtoul(argv[++i], NULL, 10);
+		} else if(strcmp(argv[i], "--quick") == 0) {
+			Options.Quick = true;
+		} else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			Options.Replay = argv[++i];
+		} else {
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(Options.Repeats == 0) Options.Repeats = 1;
+	if(Options.Repeats > BENCH_MAX_REPEATS) Options.Repeats = BENCH_MAX_REPEATS;
+
+	if(Options.Replay != NULL) return RunReplayBenchmark(Options.Replay) && !Failed ? 0 : 1;
+
+	RunRamFSBenchmarks();
+	RunVFSBenchmarks();
+	RunArchiveBenchmarks();
+
+	return Failed ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../../vfs/vfs.h"
+#include "../../ramfs/ramfs.h"
+
+#define BENCH_MAX_REPEATS 64
+
+struct BenchOptions {
+	/* Only benchmarks whose name contains this are run */
+	const char *Filter;
+	size_t Repeats;
+	/* Smaller sizes, for a quick check that everything still runs */
+	bool Quick;
+	/* A trace to replay instead of the usual benchmarks */
+	const char *Replay;
+};
+
+extern BenchOptions Options;
+
+uint64_t BenchNow();
+
+/* Only the time between Start and Stop is counted, so setup can happen around it */
+struct BenchTimer {
+	uint64_t Elapsed = 0;
+	uint64_t Started = 0;
+
+	/* Filled in by the benchmark */
+	uint64_t Operations = 0;
+	uint64_t Bytes = 0;
+
+	void Start() { Started = BenchNow(); }
+	void Stop() { Elapsed += BenchNow() - Started; }
+};
+
+bool BenchSelected(const char *name);
+/* Reports a benchmark that got a wrong result. The others still run,
+   but fsbench exits with an error at the end, and so does make bench */
+void BenchFail(const char *name, const char *format, ...) __attribute__((format(printf, 2, 3)));
+/* Whether all size bytes at data are value */
+bool BenchFilled(const void *data, size_t size, uint8_t value);
+/* Prints one JSON object per line, params being the members of its params object */
+void BenchReport(const char *name, const char *params, BenchTimer *runs, size_t count);
+
+template<typename Body>
+void Bench(const char *name, const char *params, Body body) {
+	if(!BenchSelected(name)) return;
+
+	BenchTimer runs[BENCH_MAX_REPEATS];
+	for (size_t i = 0; i < Options.Repeats; ++i) body(&runs[i]);
+
+	BenchReport(name, params, runs, Options.Repeats);
+}
+
+struct BenchEnvironment {
+	VirtualFilesystem *VFS;
+	RamFS *FS;
+	filesystem_t Descriptor;
+};
+
+/* A fresh VFS with a RamFS as its root */
+BenchEnvironment *CreateEnvironment(inode_t maxInodes);
+void DestroyEnvironment(BenchEnvironment *environment);
+
+/* Builds a ustar archive of files spread over nested directories.
+   The result is terminated by two zeroed blocks and has to be freed */
+uint8_t *GenerateArchive(size_t files, size_t fileSize, size_t filesPerDirectory, size_t *size);
+
+void RunRamFSBenchmarks();
+void RunVFSBenchmarks();
+void RunArchiveBenchmarks();
+/* Replays a trace dumped by VFSTrace against a fresh RamFS */
+bool RunReplayBenchmark(const char *path);
@@ -0,0 +1,487 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* RamFS wants whole name buffers, not just the string */
+static char (*GenerateNames(size_t count, const char *prefix))[MAX_NAME_SIZE] {
+	char (*names)[MAX_NAME_SIZE] = new char[count][MAX_NAME_SIZE];
+
+	for (size_t i = 0; i < count; ++i) {
+		memset(names[i], 0, MAX_NAME_SIZE);
+		snprintf(names[i], MAX_NAME_SIZE, "%s%zu", prefix, i);
+	}
+
+	return names;
+}
+
+static void BenchGetByName(size_t entries) {
+	char params[64];
+	snprintf(params, sizeof(params), "\"entries\":%zu", entries);
+
+	size_t lookups = 2000000 / entries;
+	if(lookups < 1000) lookups = 1000;
+	if(Options.Quick) lookups /= 10;
+
+	Bench("ramfs.get_by_name", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(entries + 1);
+		char (*names)[MAX_NAME_SIZE] = GenerateNames(entries, "file");
+
+		for (size_t i = 0; i < entries; ++i) environment->FS->CreateNode(0, names[i], NODE_PROPERTY_FILE);
+
+		size_t found = 0;
+		timer->Start();
+		for (size_t i = 0; i < lookups; ++i) {
+			/* Spread the lookups over the whole directory */
+			if(environment->FS->GetByName(0, names[(i * 7919) % entries]) != NULL) ++found;
+		}
+		timer->Stop();
+
+		timer->Operations = lookups;
+		if(found != lookups) BenchFail("ramfs.get_by_name", "%zu lookups failed", lookups - found);
+
+		delete[] names;
+		DestroyEnvironment(environment);
+	});
+}
+
+static void BenchCreateNode(size_t entries) {
+	char params[64];
+	snprintf(params, sizeof(params), "\"entries\":%zu", entries);
+
+	Bench("ramfs.create_node", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(entries + 1);
+		char (*names)[MAX_NAME_SIZE] = GenerateNames(entries, "file");
+
+		size_t created = 0;
+		timer->Start();
+		for (size_t i = 0; i < entries; ++i) {
+			if(environment->FS->CreateNode(0, names[i], NODE_PROPERTY_FILE) != NULL) ++created;
+		}
+		timer->Stop();
+
+		timer->Operations = entries;
+
+		if(created != entries) BenchFail("ramfs.create_node", "%zu nodes were not created", entries - created);
+		if(environment->FS->GetByName(0, names[entries - 1]) == NULL) BenchFail("ramfs.create_node", "the last node can't be found");
+
+		delete[] names;
+		DestroyEnvironment(environment);
+	});
+}
+
+/* Offsets either follow each other or jump around, never lining up with blocks */
+static size_t NextOffset(size_t *state, size_t previous, size_t size, size_t fileSize, bool sequential) {
+	if(sequential) {
+		size_t next = previous + size;
+		return next + size > fileSize ? 0 : next;
+	}
+
+	*state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (*state >> 33) % (fileSize - size);
+}
+
+static void BenchReadWrite(bool write, size_t size, bool sequential) {
+	const size_t fileSize = Options.Quick ? 0x100000 : 0x400000;
+
+	char params[96];
+	snprintf(params, sizeof(params), "\"size\":%zu,\"pattern\":\"%s\",\"file_size\":%zu",
+	         size, sequential ? "sequential" : "random", fileSize);
+
+	size_t operations = (fileSize * 4) / size;
+	if(operations > 200000) operations = 200000;
+
+	Bench(write ? "ramfs.write_node" : "ramfs.read_node", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(2);
+		char (*names)[MAX_NAME_SIZE] = GenerateNames(1, "file");
+
+		inode_t file = environment->FS->CreateNode(0, names[0], NODE_PROPERTY_FILE)->Inode;
+
+		uint8_t *buffer = new uint8_t[fileSize];
+		memset(buffer, 0x5A, fileSize);
+
+		/* Writes measured here overwrite, allocation has its own benchmark */
+		environment->FS->WriteNode(file, 0, fileSize, buffer);
+
+		/* Writes put down another pattern, reads have to bring back the first one */
+		memset(buffer, write ? 0xA5 : 0, size);
+
+		size_t state = 1;
+		size_t offset = 0;
+		uint64_t moved = 0;
+
+		timer->Start();
+		for (size_t i = 0; i < operations; ++i) {
+			intmax_t result;
+			if(write) {
+				result = environment->FS->WriteNode(file, offset, size, buffer);
+			} else {
+				result = environment->FS->ReadNode(file, offset, size, buffer);
+			}
+
+			if(result > 0) moved += result;
+			offset = NextOffset(&state, offset, size, fileSize, sequential);
+		}
+		timer->Stop();
+
+		timer->Operations = operations;
+		timer->Bytes = operations * size;
+
+		const char *name = write ? "ramfs.write_node" : "ramfs.read_node";
+		if(moved != operations * size) BenchFail(name, "moved %llu bytes", (unsigned long long)moved);
+
+		/* The first request always goes to the start of the file */
+		if(write) environment->FS->ReadNode(file, 0, size, buffer);
+		if(!BenchFilled(buffer, size, write ? 0xA5 : 0x5A)) BenchFail(name, "wrong data at the start of the file");
+
+		delete[] buffer;
+		delete[] names;
+		DestroyEnvironment(environment);
+	});
+}
+
+static void BenchAppend(size_t size) {
+	const size_t fileSize = Options.Quick ? 0x100000 : 0x400000;
+
+	char params[64];
+	snprintf(params, sizeof(params), "\"size\":%zu,\"file_size\":%zu", size, fileSize);
+
+	Bench("ramfs.append_node", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(2);
+		char (*names)[MAX_NAME_SIZE] = GenerateNames(1, "file");
+
+		inode_t file = environment->FS->CreateNode(0, names[0], NODE_PROPERTY_FILE)->Inode;
+
+		uint8_t *buffer = new uint8_t[size];
+		memset(buffer, 0x5A, size);
+
+		size_t operations = fileSize / size;
+
+		timer->Start();
+		for (size_t i = 0; i < operations; ++i) environment->FS->WriteNode(file, i * size, size, buffer);
+		timer->Stop();
+
+		timer->Operations = operations;
+		timer->Bytes = operations * size;
+
+		VNode *node = environment->FS->GetByInode(file);
+		if(node == NULL || node->Size != operations * size) BenchFail("ramfs.append_node", "the file did not grow to %zu bytes", operations * size);
+
+		memset(buffer, 0, size);
+		environment->FS->ReadNode(file, (operations - 1) * size, size, buffer);
+		if(!BenchFilled(buffer, size, 0x5A)) BenchFail("ramfs.append_node", "wrong data at the end of the file");
+
+		delete[] buffer;
+		delete[] names;
+		DestroyEnvironment(environment);
+	});
+}
+
+static const char *CopyMethods[] = { "read_write", "clone", "copy_range" };
+
+/* Copies a whole file over and over, by moving bytes or by sharing its blocks */
+static void BenchCopy(size_t method) {
+	const size_t fileSize = Options.Quick ? 0x400000 : 0x1000000;
+	const size_t copies = 16;
+
+	char params[64];
+	snprintf(params, sizeof(params), "\"method\":\"%s\",\"file_size\":%zu", CopyMethods[method], fileSize);
+
+	Bench("ramfs.copy_file", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(copies + 2);
+		char (*names)[MAX_NAME_SIZE] = GenerateNames(copies + 1, "file");
+
+		inode_t source = environment->FS->CreateNode(0, names[copies], NODE_PROPERTY_FILE)->Inode;
+
+		const size_t chunk = 0x10000;
+		uint8_t *buffer = new uint8_t[chunk];
+		memset(buffer, 0x5A, chunk);
+		for (size_t offset = 0; offset < fileSize; offset += chunk) environment->FS->WriteNode(source, offset, chunk, buffer);
+
+		timer->Start();
+		for (size_t i = 0; i < copies; ++i) {
+			if(method == 1) {
+				environment->FS->CloneNode(source, 0, names[i]);
+				continue;
+			}
+
+			inode_t copy = environment->FS->CreateNode(0, names[i], NODE_PROPERTY_FILE)->Inode;
+
+			if(method == 2) {
+				environment->FS->CopyRange(source, 0, copy, 0, fileSize);
+				continue;
+			}
+
+			for (size_t offset = 0; offset < fileSize; offset += chunk) {
+				environment->FS->ReadNode(source, offset, chunk, buffer);
+				environment->FS->WriteNode(copy, offset, chunk, buffer);
+			}
+		}
+		timer->Stop();
+
+		timer->Operations = copies;
+		timer->Bytes = copies * fileSize;
+
+		/* Every copy has to read back whole, whether it got its own blocks or not */
+		for (size_t i = 0; i < copies; ++i) {
+			VNode *copy = environment->FS->GetByName(0, names[i]);
+			if(copy == NULL || copy->Size != fileSize) {
+				BenchFail("ramfs.copy_file", "copy %zu is missing or has the wrong size", i);
+				break;
+			}
+
+			memset(buffer, 0, chunk);
+			environment->FS->ReadNode(copy->Inode, fileSize - chunk, chunk, buffer);
+			if(!BenchFilled(buffer, chunk, 0x5A)) {
+				BenchFail("ramfs.copy_file", "copy %zu has the wrong data", i);
+				break;
+			}
+		}
+
+		delete[] buffer;
+		delete[] names;
+		DestroyEnvironment(environment);
+	});
+}
+
+/* Snapshots copy the tree and the block tables, so they should not care how much data there is */
+static void BenchSnapshot(size_t files, size_t fileSize) {
+	char params[64];
+	snprintf(params, sizeof(params), "\"files\":%zu,\"file_size\":%zu", files, fileSize);
+
+	Bench("ramfs.snapshot", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(files + 1);
+		char (*names)[MAX_NAME_SIZE] = GenerateNames(files, "file");
+
+		uint8_t *buffer = new uint8_t[fileSize];
+		memset(buffer, 0x5A, fileSize);
+
+		for (size_t i = 0; i < files; ++i) {
+			inode_t file = environment->FS->CreateNode(0, names[i], NODE_PROPERTY_FILE)->Inode;
+			environment->FS->WriteNode(file, 0, fileSize, buffer);
+		}
+
+		timer->Start();
+		RamFS *snapshot = environment->FS->Snapshot(environment->Descriptor + 1);
+		timer->Stop();
+
+		timer->Operations = 1;
+
+		VNode *file = snapshot == NULL ? NULL : snapshot->GetByName(0, names[files - 1]);
+		if(file == NULL || file->Size != fileSize) {
+			BenchFail("ramfs.snapshot", "the last file is missing from the snapshot");
+		} else {
+			memset(buffer, 0, fileSize);
+			snapshot->ReadNode(file->Inode, 0, fileSize, buffer);
+			if(!BenchFilled(buffer, fileSize, 0x5A)) BenchFail("ramfs.snapshot", "the snapshot has the wrong data");
+		}
+
+		delete snapshot;
+		delete[] buffer;
+		delete[] names;
+		DestroyEnvironment(environment);
+	});
+}
+
+/* Compacting a tree of files that compress about as well as text, then reading them all back cold */
+static void BenchCompact(bool read) {
+	const size_t files = 64;
+	const size_t fileSize = Options.Quick ? 0x10000 : 0x40000;
+
+	char params[64];
+	snprintf(params, sizeof(params), "\"files\":%zu,\"file_size\":%zu", files, fileSize);
+
+	Bench(read ? "ramfs.read_compressed" : "ramfs.compact", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(files + 1);
+		char (*names)[MAX_NAME_SIZE] = GenerateNames(files, "file");
+
+		static const char *words[] = { "block ", "table ", "inode ", "mount ", "the ", "of ", "a ", "read ", "write ", "file\n" };
+		uint8_t *buffer = new uint8_t[fileSize];
+		uint8_t *expected = new uint8_t[fileSize];
+		uint32_t seed = 1;
+		for (size_t i = 0; i < fileSize; ) {
+			seed = seed * 1103515245 + 12345;
+			for (const char *word = words[(seed >> 16) % 10]; *word != '\0' && i < fileSize; ++word) buffer[i++] = *word;
+		}
+		memcpy(expected, buffer, fileSize);
+
+		inode_t *inodes = new inode_t[files];
+		for (size_t i = 0; i < files; ++i) {
+			inodes[i] = environment->FS->CreateNode(0, names[i], NODE_PROPERTY_FILE)->Inode;
+			environment->FS->WriteNode(inodes[i], 0, fileSize, buffer);
+		}
+
+		environment->FS->SetCompactionThreshold(0);
+
+		/* The first pass only finds that everything was just written */
+		const size_t budget = 4 * files * (fileSize / BLOCK_SIZE) + 4 * (files + 1);
+
+		if(!read) timer->Start();
+		environment->FS->CompactBlocks(budget);
+		if(!read) timer->Stop();
+
+		const CompactionStats *stats = environment->FS->GetCompactionStats();
+		if(!read) {
+			timer->Operations = stats->Compressions;
+			timer->Bytes = stats->OriginalBytes;
+		} else {
+			timer->Start();
+			for (size_t i = 0; i < files; ++i) environment->FS->ReadNode(inodes[i], 0, fileSize, buffer);
+			timer->Stop();
+
+			timer->Operations = stats->Decompressions;
+			timer->Bytes = files * fileSize;
+		}
+
+		const char *name = read ? "ramfs.read_compressed" : "ramfs.compact";
+		if(stats->Compressions == 0) BenchFail(name, "nothing was compressed");
+
+		/* Reading it back is what would have been timed for read_compressed, any file will do */
+		if(!read) environment->FS->ReadNode(inodes[files - 1], 0, fileSize, buffer);
+		if(memcmp(buffer, expected, fileSize) != 0) BenchFail(name, "the data changed");
+
+		delete[] inodes;
+		delete[] expected;
+		delete[] buffer;
+		delete[] names;
+		DestroyEnvironment(environment);
+	});
+}
+
+/* Gathers small records spread over a whole file, one call per record or one for all of them */
+static void BenchReadVector(bool vector) {
+	const size_t fileSize = Options.Quick ? 0x400000 : 0x1000000;
+	const size_t records = 64;
+	const size_t recordSize = 64;
+	const size_t stride = fileSize / records;
+
+	size_t batches = Options.Quick ? 2000 : 20000;
+
+	char params[96];
+	snprintf(params, sizeof(params), "\"method\":\"%s\",\"records\":%zu,\"file_size\":%zu",
+	         vector ? "vector" : "per_record", records, fileSize);
+
+	Bench("ramfs.read_records", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(2);
+		char (*names)[MAX_NAME_SIZE] = GenerateNames(1, "file");
+
+		inode_t file = environment->FS->CreateNode(0, names[0], NODE_PROPERTY_FILE)->Inode;
+
+		/* Written in small pieces, so that the file spans as many tables as it can */
+		const size_t chunk = BLOCK_SIZE;
+		uint8_t *buffer = new uint8_t[chunk > records * recordSize ? chunk : records * recordSize];
+		memset(buffer, 0x5A, chunk);
+		for (size_t offset = 0; offset < fileSize; offset += chunk) environment->FS->WriteNode(file, offset, chunk, buffer);
+
+		/* The records land where the pattern was, so that reading them back shows */
+		memset(buffer, 0, records * recordSize);
+
+		IOSegment segments[records];
+		for (size_t i = 0; i < records; ++i) {
+			segments[i].Offset = i * stride + (i * 97) % (stride - recordSize);
+			segments[i].Size = recordSize;
+			segments[i].Address = (uintptr_t)(buffer + i * recordSize);
+		}
+
+		size_t read = 0;
+		timer->Start();
+		for (size_t i = 0; i < batches; ++i) {
+			if(vector) {
+				read += environment->FS->ReadNodeVector(file, segments, records);
+				continue;
+			}
+
+			for (size_t j = 0; j < records; ++j) {
+				read += environment->FS->ReadNode(file, segments[j].Offset, segments[j].Size, (void*)segments[j].Address);
+			}
+		}
+		timer->Stop();
+
+		timer->Operations = batches * records;
+		timer->Bytes = read;
+
+		if(read != batches * records * recordSize) BenchFail("ramfs.read_records", "short read");
+		if(!BenchFilled(buffer, records * recordSize, 0x5A)) BenchFail("ramfs.read_records", "wrong data");
+
+		delete[] buffer;
+		delete[] names;
+		DestroyEnvironment(environment);
+	});
+}
+
+/* Scanning files that are mostly the same blocks, like modules built against the same library */
+static void BenchDeduplicate() {
+	const size_t files = 64;
+	const size_t fileSize = Options.Quick ? 0x10000 : 0x40000;
+	const size_t blocks = fileSize / BLOCK_SIZE;
+
+	char params[64];
+	snprintf(params, sizeof(params), "\"files\":%zu,\"file_size\":%zu", files, fileSize);
+
+	Bench("ramfs.deduplicate", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(files + 1);
+		char (*names)[MAX_NAME_SIZE] = GenerateNames(files, "file");
+
+		/* A quarter of every file is its own, and an eighth is zeroes */
+		uint8_t *buffer = new uint8_t[fileSize];
+		for (size_t i = 0; i < files; ++i) {
+			for (size_t j = 0; j < blocks; ++j) {
+				uint8_t value = j % 8 == 0 ? 0 : j % 4 == 1 ? i * blocks + j : j;
+				memset(buffer + j * BLOCK_SIZE, value, BLOCK_SIZE);
+			}
+
+			inode_t file = environment->FS->CreateNode(0, names[i], NODE_PROPERTY_FILE)->Inode;
+			environment->FS->WriteNode(file, 0, fileSize, buffer);
+		}
+
+		timer->Start();
+		environment->FS->DeduplicateBlocks(files * blocks + files + 1);
+		timer->Stop();
+
+		const DedupStats *stats = environment->FS->GetDedupStats();
+		timer->Operations = stats->Scanned;
+		timer->Bytes = stats->Scanned * BLOCK_SIZE;
+
+		if(stats->SavedBytes == 0) BenchFail("ramfs.deduplicate", "nothing was saved");
+
+		/* The buffer still holds the last file, which has to read back the same with its blocks shared */
+		uint8_t *check = new uint8_t[fileSize];
+		environment->FS->ReadNode(environment->FS->GetByName(0, names[files - 1])->Inode, 0, fileSize, check);
+		if(memcmp(check, buffer, fileSize) != 0) BenchFail("ramfs.deduplicate", "the data changed");
+		delete[] check;
+
+		delete[] buffer;
+		delete[] names;
+		DestroyEnvironment(environment);
+	});
+}
+
+void RunRamFSBenchmarks() {
+	const size_t directorySizes[] = { 16, 256, 4096 };
+	for (size_t entries : directorySizes) BenchGetByName(entries);
+
+	BenchCreateNode(1000);
+	if(!Options.Quick) BenchCreateNode(10000);
+
+	const size_t sizes[] = { 64, 4096, 65536 };
+	for (size_t size : sizes) {
+		BenchReadWrite(false, size, true);
+		BenchReadWrite(false, size, false);
+		BenchReadWrite(true, size, true);
+		BenchReadWrite(true, size, false);
+		BenchAppend(size);
+	}
+
+	for (size_t method = 0; method < sizeof(CopyMethods) / sizeof(CopyMethods[0]); ++method) BenchCopy(method);
+
+	BenchReadVector(false);
+	BenchReadVector(true);
+
+	BenchSnapshot(256, 0x1000);
+	BenchSnapshot(256, Options.Quick ? 0x40000 : 0x100000);
+
+	BenchCompact(false);
+	BenchCompact(true);
+
+	BenchDeduplicate();
+}
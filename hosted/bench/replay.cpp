@@ -0,0 +1,604 @@
+#include "bench.h"
+
+#include "../../vfs/trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Traces keep inode numbers but not names, so the tree they ran against is rebuilt
+ * from what the records show: every node gets a made up name as long as the real one,
+ * nodes that were there before the trace started are created up front, and files that
+ * were read are filled up to the furthest byte that was read.
+ * Only node requests are replayed, as file requests are made of node requests
+ * which are in the trace on their own.
+ */
+
+#define REPLAY_MAX_FILESYSTEMS 16
+
+struct ReplayNode {
+	int32_t FS;
+	int64_t Inode;
+
+	/* Where the node was first seen, when it was known before the trace started */
+	int64_t Parent;
+	bool Existing;
+	bool Directory;
+	bool Root;
+	uint64_t Content;
+
+	size_t NameOffset;
+	uint8_t NameLength;
+
+	/* The node standing in for it in the replay */
+	inode_t Replayed;
+};
+
+struct ReplayTable {
+	ReplayNode *Nodes;
+	size_t Count;
+	size_t Capacity;
+
+	/* Open addressing over Nodes, zero being an empty bucket */
+	size_t *Buckets;
+	size_t BucketMask;
+
+	char *Names;
+	size_t NamesSize;
+
+	/* The root of every traced filesystem */
+	ReplayNode *Roots[REPLAY_MAX_FILESYSTEMS];
+	size_t RootCount;
+
+	size_t MaxTransfer;
+	size_t MaxBind;
+};
+
+static size_t HashNode(int32_t fs, int64_t inode) {
+	uint64_t key = ((uint64_t)(uint32_t)fs << 48) ^ (uint64_t)inode;
+	key *= 0x9E3779B97F4A7C15ull;
+
+	return key >> 17;
+}
+
+static ReplayNode *FindNode(ReplayTable *table, int32_t fs, int64_t inode) {
+	for (size_t bucket = HashNode(fs, inode) & table->BucketMask; ; bucket = (bucket + 1) & table->BucketMask) {
+		size_t index = table->Buckets[bucket];
+		if(index == 0) return NULL;
+
+		ReplayNode *node = &table->Nodes[index - 1];
+		if(node->FS == fs && node->Inode == inode) return node;
+	}
+}
+
+static ReplayNode *AddNode(ReplayTable *table, int32_t fs, int64_t inode) {
+	ReplayNode *node = FindNode(table, fs, inode);
+	if(node != NULL) return node;
+
+	size_t bucket = HashNode(fs, inode) & table->BucketMask;
+	while(table->Buckets[bucket] != 0) bucket = (bucket + 1) & table->BucketMask;
+
+	node = &table->Nodes[table->Count++];
+	memset(node, 0, sizeof(ReplayNode));
+	node->FS = fs;
+	node->Inode = inode;
+	node->Parent = TRACE_NO_NODE;
+	node->Existing = true;
+	node->Replayed = TRACE_NO_NODE;
+
+	table->Buckets[bucket] = table->Count;
+
+	return node;
+}
+
+/* Every record names at most two nodes, besides the root of its filesystem */
+static ReplayTable *BuildTable(const TraceRecord *records, size_t count) {
+	ReplayTable *table = new ReplayTable;
+	table->Capacity = count * 3 + 1;
+	table->Nodes = (ReplayNode*)malloc(table->Capacity * sizeof(ReplayNode));
+	table->Count = 0;
+
+	size_t buckets = 1;
+	while(buckets < table->Capacity * 2) buckets *= 2;
+	table->Buckets = (size_t*)calloc(buckets, sizeof(size_t));
+	table->BucketMask = buckets - 1;
+	table->MaxTransfer = 0;
+	table->MaxBind = 0;
+	table->RootCount = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		const TraceRecord *record = &records[i];
+		if(record->Kind != TRACE_NODE_OPERATION) continue;
+
+		bool succeeded = record->Result >= 0;
+
+		switch(record->Request) {
+			case NODE_GETROOT:
+				if(succeeded) {
+					ReplayNode *root = AddNode(table, record->FS, record->Target);
+					root->Directory = true;
+
+					if(!root->Root && table->RootCount < REPLAY_MAX_FILESYSTEMS) {
+						root->Root = true;
+						table->Roots[table->RootCount++] = root;
+					}
+				}
+				break;
+			case NODE_CREATE:
+				AddNode(table, record->FS, record->Inode)->Directory = true;
+
+				if(succeeded) {
+					ReplayNode *node = FindNode(table, record->FS, record->Target);
+					if(node == NULL) {
+						node = AddNode(table, record->FS, record->Target);
+						node->Existing = false;
+						node->Parent = record->Inode;
+					}
+
+					node->NameLength = record->NameLength;
+					if(record->Size & NODE_PROPERTY_DIRECTORY) node->Directory = true;
+				}
+				break;
+			case NODE_GETBYNAME:
+			case NODE_GETBYINDEX:
+				AddNode(table, record->FS, record->Inode)->Directory = true;
+
+				if(succeeded && FindNode(table, record->FS, record->Target) == NULL) {
+					ReplayNode *node = AddNode(table, record->FS, record->Target);
+					node->Parent = record->Inode;
+					node->NameLength = record->Request == NODE_GETBYNAME ? record->NameLength : 0;
+				}
+				break;
+			case NODE_READDIR:
+				AddNode(table, record->FS, record->Inode)->Directory = true;
+				if(record->Size > table->MaxTransfer) table->MaxTransfer = record->Size;
+				break;
+			case NODE_READ:
+			case NODE_READ_SCATTER:
+			case NODE_READ_VECTOR: {
+				ReplayNode *node = AddNode(table, record->FS, record->Inode);
+				if(succeeded && node->Existing && record->Offset + record->Result > node->Content) {
+					node->Content = record->Offset + record->Result;
+				}
+
+				if(record->Size > table->MaxTransfer) table->MaxTransfer = record->Size;
+				}
+				break;
+			case NODE_WRITE:
+			case NODE_WRITE_SCATTER:
+			case NODE_WRITE_VECTOR:
+				AddNode(table, record->FS, record->Inode);
+				if(record->Size > table->MaxTransfer) table->MaxTransfer = record->Size;
+				break;
+			case NODE_RENAME:
+				AddNode(table, record->FS, record->Inode);
+				AddNode(table, record->FS, record->Offset)->Directory = true;
+				if(succeeded) AddNode(table, record->FS, record->Target)->NameLength = record->NameLength;
+				break;
+			case NODE_BIND:
+				AddNode(table, record->FS, record->Inode);
+				if(record->Size > table->MaxBind) table->MaxBind = record->Size;
+				break;
+			case NODE_CLONE:
+				AddNode(table, record->FS, record->Inode);
+				AddNode(table, record->FS, record->Offset)->Directory = true;
+
+				if(succeeded && FindNode(table, record->FS, record->Target) == NULL) {
+					ReplayNode *node = AddNode(table, record->FS, record->Target);
+					node->Existing = false;
+					node->Parent = record->Offset;
+					node->NameLength = record->NameLength;
+				}
+				break;
+			case NODE_COPY_RANGE: {
+				/* Copies read their source like any read would */
+				ReplayNode *node = AddNode(table, record->FS, record->Inode);
+				if(succeeded && node->Existing && record->Offset + record->Result > node->Content) {
+					node->Content = record->Offset + record->Result;
+				}
+
+				AddNode(table, record->FS, record->Target);
+				}
+				break;
+			case NODE_DELETE:
+			case NODE_MAP:
+			case NODE_MAP_BLOCK:
+			case NODE_UNMAP:
+				AddNode(table, record->FS, record->Inode);
+				break;
+		}
+	}
+
+	/* Names are long enough to be unique, and otherwise as long as the real ones */
+	table->NamesSize = 0;
+	for (size_t i = 0; i < table->Count; ++i) table->NamesSize += 64 + table->Nodes[i].NameLength + 1;
+	table->Names = (char*)malloc(table->NamesSize);
+
+	size_t offset = 0;
+	for (size_t i = 0; i < table->Count; ++i) {
+		ReplayNode *node = &table->Nodes[i];
+		char *name = table->Names + offset;
+
+		int length = snprintf(name, 64, "%d.%lld", node->FS, (long long)node->Inode);
+		while(length < node->NameLength && length < MAX_NAME_SIZE - 1) name[length++] = '_';
+		name[length] = '\0';
+
+		node->NameOffset = offset;
+		offset += length + 1;
+	}
+
+	return table;
+}
+
+static void FreeTable(ReplayTable *table) {
+	free(table->Nodes);
+	free(table->Buckets);
+	free(table->Names);
+	delete table;
+}
+
+static const char *NodeName(ReplayTable *table, ReplayNode *node) {
+	return table->Names + node->NameOffset;
+}
+
+/* Makes a node that was already there when the trace started, after its parent */
+static bool CreateExisting(BenchEnvironment *environment, ReplayTable *table, ReplayNode *node, size_t depth) {
+	if(node->Replayed != TRACE_NO_NODE) return true;
+	if(depth > table->Count) return false;
+
+	inode_t directory = TRACE_NO_NODE;
+
+	if(node->Root) {
+		/* Every traced filesystem gets a directory of its own */
+		directory = environment->FS->GetRootNode()->Inode;
+	} else if(node->Parent != TRACE_NO_NODE) {
+		ReplayNode *parent = FindNode(table, node->FS, node->Parent);
+		if(parent != NULL && parent->Existing && CreateExisting(environment, table, parent, depth + 1)) {
+			directory = parent->Replayed;
+		}
+	}
+
+	if(directory == TRACE_NO_NODE) {
+		/* Nodes that never showed up in a lookup go in their filesystem's directory */
+		ReplayNode *root = NULL;
+		for (size_t i = 0; i < table->RootCount; ++i) {
+			if(table->Roots[i]->FS == node->FS) root = table->Roots[i];
+		}
+
+		if(root == NULL || root == node || !CreateExisting(environment, table, root, depth + 1)) {
+			directory = environment->FS->GetRootNode()->Inode;
+		} else {
+			directory = root->Replayed;
+		}
+	}
+
+	char name[MAX_NAME_SIZE] = { 0 };
+	strcpy(name, NodeName(table, node));
+
+	VNode *created = environment->FS->CreateNode(directory, name, node->Directory ? NODE_PROPERTY_DIRECTORY : NODE_PROPERTY_FILE);
+	if(created == NULL) return false;
+
+	node->Replayed = created->Inode;
+
+	if(!node->Directory && node->Content != 0) {
+		uint8_t *content = (uint8_t*)calloc(1, node->Content);
+		environment->FS->WriteNode(node->Replayed, 0, node->Content, content);
+		free(content);
+	}
+
+	return true;
+}
+
+struct ReplayResult {
+	size_t Replayed;
+	size_t Skipped;
+	/* Requests that failed where they succeeded in the trace, or the other way around */
+	size_t Diverged;
+	uint64_t Bytes;
+};
+
+static inode_t Translate(ReplayTable *table, int32_t fs, int64_t inode) {
+	ReplayNode *node = FindNode(table, fs, inode);
+	return node == NULL ? TRACE_NO_NODE : node->Replayed;
+}
+
+/* Bound memory is gone with the trace, so every bind gets the same zeroed range */
+static void Replay(BenchEnvironment *environment, ReplayTable *table, const TraceRecord *records, size_t count, uint8_t *buffer, const uint8_t *bound, ReplayResult *result) {
+	VirtualFilesystem *vfs = environment->VFS;
+	filesystem_t fs = environment->Descriptor;
+
+	/* Large enough for any of the requests, the transfers go right after it */
+	FSOperationRequest *request = (FSOperationRequest*)buffer;
+
+	for (size_t i = 0; i < count; ++i) {
+		const TraceRecord *record = &records[i];
+		if(record->Kind != TRACE_NODE_OPERATION) continue;
+
+		bool succeeded = record->Result >= 0;
+		inode_t inode = Translate(table, record->FS, record->Inode);
+
+		request->MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+		request->Request = record->Request;
+
+		switch(record->Request) {
+			case NODE_GETROOT:
+				break;
+			case NODE_CREATE: {
+				if(!succeeded || inode == TRACE_NO_NODE) goto skip;
+
+				FSCreateNodeRequest *createRequest = (FSCreateNodeRequest*)request;
+				createRequest->Directory = inode;
+				strcpy(createRequest->Name, NodeName(table, FindNode(table, record->FS, record->Target)));
+				createRequest->Flags = record->Size;
+				}
+				break;
+			case NODE_DELETE:
+				if(!succeeded || inode == TRACE_NO_NODE) goto skip;
+				((FSDeleteNodeRequest*)request)->Node = inode;
+				break;
+			case NODE_RENAME: {
+				inode_t directory = Translate(table, record->FS, record->Offset);
+				if(!succeeded || inode == TRACE_NO_NODE || directory == TRACE_NO_NODE) goto skip;
+
+				FSRenameNodeRequest *renameRequest = (FSRenameNodeRequest*)request;
+				renameRequest->Node = inode;
+				renameRequest->Directory = directory;
+				strcpy(renameRequest->Name, NodeName(table, FindNode(table, record->FS, record->Target)));
+				}
+				break;
+			case NODE_GETBYNAME: {
+				if(inode == TRACE_NO_NODE) goto skip;
+
+				FSGetByNameRequest *getByNameRequest = (FSGetByNameRequest*)request;
+				getByNameRequest->Directory = inode;
+
+				if(succeeded) {
+					strcpy(getByNameRequest->Name, NodeName(table, FindNode(table, record->FS, record->Target)));
+				} else {
+					/* Lookups that missed miss again, on a name of the same length */
+					memset(getByNameRequest->Name, '?', record->NameLength);
+					getByNameRequest->Name[record->NameLength] = '\0';
+				}
+				}
+				break;
+			case NODE_GETBYINDEX: {
+				if(inode == TRACE_NO_NODE) goto skip;
+
+				FSGetByIndexRequest *getByIndexRequest = (FSGetByIndexRequest*)request;
+				getByIndexRequest->Directory = inode;
+				getByIndexRequest->Index = record->Offset;
+				}
+				break;
+			case NODE_READ: {
+				if(inode == TRACE_NO_NODE) goto skip;
+
+				FSReadNodeRequest *readRequest = (FSReadNodeRequest*)request;
+				readRequest->Node = inode;
+				readRequest->Offset = record->Offset;
+				readRequest->Size = record->Size;
+				}
+				break;
+			case NODE_WRITE: {
+				if(!succeeded || inode == TRACE_NO_NODE) goto skip;
+
+				FSWriteNodeRequest *writeRequest = (FSWriteNodeRequest*)request;
+				writeRequest->Node = inode;
+				writeRequest->Offset = record->Offset;
+				writeRequest->Size = record->Size;
+				}
+				break;
+			case NODE_READ_SCATTER:
+			case NODE_WRITE_SCATTER: {
+				if(inode == TRACE_NO_NODE) goto skip;
+				if(record->Request == NODE_WRITE_SCATTER && !succeeded) goto skip;
+
+				/* The payload goes right after the request, where a plain read would have put it */
+				FSScatterNodeRequest *scatterRequest = (FSScatterNodeRequest*)request;
+				scatterRequest->Node = inode;
+				scatterRequest->Offset = record->Offset;
+				scatterRequest->Size = record->Size;
+				scatterRequest->Address = (uintptr_t)(scatterRequest + 1);
+				}
+				break;
+			case NODE_READ_VECTOR:
+			case NODE_WRITE_VECTOR: {
+				if(inode == TRACE_NO_NODE) goto skip;
+				if(record->Request == NODE_WRITE_VECTOR && !succeeded) goto skip;
+
+				/* Only the extent of the segments was kept, so they are replayed as one */
+				FSVectorNodeRequest *vectorRequest = (FSVectorNodeRequest*)request;
+				vectorRequest->Node = inode;
+				vectorRequest->Count = 1;
+				vectorRequest->Segments.Offset = record->Offset;
+				vectorRequest->Segments.Size = record->Size;
+				vectorRequest->Segments.Address = (uintptr_t)(vectorRequest + 1);
+				}
+				break;
+			case NODE_READDIR: {
+				if(inode == TRACE_NO_NODE) goto skip;
+
+				FSReadDirectoryRequest *readDirRequest = (FSReadDirectoryRequest*)request;
+				readDirRequest->Directory = inode;
+				readDirRequest->Cursor = record->Offset;
+				readDirRequest->Size = record->Size;
+				}
+				break;
+			case NODE_BIND: {
+				if(!succeeded || inode == TRACE_NO_NODE) goto skip;
+
+				FSBindNodeRequest *bindRequest = (FSBindNodeRequest*)request;
+				bindRequest->Node = inode;
+				bindRequest->Address = (uintptr_t)bound;
+				bindRequest->Size = record->Size;
+				}
+				break;
+			case NODE_MAP:
+				if(inode == TRACE_NO_NODE) goto skip;
+				((FSMapNodeRequest*)request)->Node = inode;
+				break;
+			case NODE_UNMAP:
+				if(inode == TRACE_NO_NODE) goto skip;
+				((FSUnmapNodeRequest*)request)->Node = inode;
+				break;
+			case NODE_CLONE: {
+				inode_t directory = Translate(table, record->FS, record->Offset);
+				if(!succeeded || inode == TRACE_NO_NODE || directory == TRACE_NO_NODE) goto skip;
+
+				FSCloneNodeRequest *cloneRequest = (FSCloneNodeRequest*)request;
+				cloneRequest->Node = inode;
+				cloneRequest->Directory = directory;
+				strcpy(cloneRequest->Name, NodeName(table, FindNode(table, record->FS, record->Target)));
+				}
+				break;
+			case NODE_COPY_RANGE: {
+				inode_t destination = Translate(table, record->FS, record->Target);
+				if(inode == TRACE_NO_NODE || destination == TRACE_NO_NODE) goto skip;
+
+				/* The destination offset is not in the trace, the copy lands where it came from */
+				FSCopyRangeRequest *copyRequest = (FSCopyRangeRequest*)request;
+				copyRequest->Source = inode;
+				copyRequest->SourceOffset = record->Offset;
+				copyRequest->Destination = destination;
+				copyRequest->DestinationOffset = record->Offset;
+				copyRequest->Size = record->Size;
+				}
+				break;
+			case NODE_MAP_BLOCK: {
+				if(inode == TRACE_NO_NODE) goto skip;
+
+				FSMapBlockRequest *mapBlockRequest = (FSMapBlockRequest*)request;
+				mapBlockRequest->Node = inode;
+				mapBlockRequest->Offset = record->Offset;
+				mapBlockRequest->Write = record->Size;
+				}
+				break;
+			default:
+				goto skip;
+		}
+
+		{
+			result_t replayed = vfs->DoFilesystemOperation(fs, request);
+			++result->Replayed;
+
+			if((replayed >= 0) != succeeded) ++result->Diverged;
+			bool transfer = record->Request == NODE_READ || record->Request == NODE_WRITE ||
+			                record->Request == NODE_READ_SCATTER || record->Request == NODE_WRITE_SCATTER ||
+			                record->Request == NODE_READ_VECTOR || record->Request == NODE_WRITE_VECTOR;
+			if(transfer && replayed > 0) result->Bytes += replayed;
+
+			/* Nodes made during the trace are known from here on */
+			if(replayed >= 0 && (record->Request == NODE_CREATE || record->Request == NODE_RENAME || record->Request == NODE_CLONE)) {
+				ReplayNode *target = FindNode(table, record->FS, record->Target);
+				target->Replayed = record->Request == NODE_CREATE ? ((FSCreateNodeRequest*)request)->ResultNode.Inode :
+				                   record->Request == NODE_RENAME ? ((FSRenameNodeRequest*)request)->ResultNode.Inode :
+				                   ((FSCloneNodeRequest*)request)->ResultNode.Inode;
+			}
+		}
+		continue;
+skip:
+		++result->Skipped;
+	}
+}
+
+static uint8_t *LoadTrace(const char *path, size_t *size) {
+	FILE *file = fopen(path, "rb");
+	if(file == NULL) return NULL;
+
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	uint8_t *data = length > 0 ? (uint8_t*)malloc(length) : NULL;
+	if(data != NULL && fread(data, 1, length, file) != (size_t)length) {
+		free(data);
+		data = NULL;
+	}
+
+	fclose(file);
+
+	*size = length;
+	return data;
+}
+
+bool RunReplayBenchmark(const char *path) {
+	size_t size = 0;
+	uint8_t *data = LoadTrace(path, &size);
+	if(data == NULL) {
+		fprintf(stderr, "replay: cannot read %s\n", path);
+		return false;
+	}
+
+	const TraceHeader *header = (const TraceHeader*)data;
+	if(size < sizeof(TraceHeader) ||
+	   memcmp(header->Magic, TRACE_MAGIC, sizeof(header->Magic)) != 0 ||
+	   header->Version != TRACE_VERSION ||
+	   header->RecordSize != sizeof(TraceRecord) ||
+	   header->RecordCount > (size - sizeof(TraceHeader)) / sizeof(TraceRecord)) {
+		fprintf(stderr, "replay: %s is not a trace this build understands\n", path);
+		free(data);
+		return false;
+	}
+
+	const TraceRecord *records = (const TraceRecord*)(header + 1);
+	size_t count = header->RecordCount;
+
+	if(header->Dropped != 0) {
+		fprintf(stderr, "replay: %llu requests were dropped from the trace, the start of it may not replay\n",
+		        (unsigned long long)header->Dropped);
+	}
+
+	ReplayTable *table = BuildTable(records, count);
+	uint8_t *buffer = (uint8_t*)malloc(sizeof(FSCreateNodeRequest) + sizeof(FSRenameNodeRequest) + table->MaxTransfer);
+	uint8_t *bound = (uint8_t*)calloc(1, table->MaxBind + 1);
+
+	const char *name = strrchr(path, '/');
+	name = name == NULL ? path : name + 1;
+
+	/* Only node requests are replayed, the file requests they came from are not */
+	size_t nodeRecords = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if(records[i].Kind == TRACE_NODE_OPERATION) ++nodeRecords;
+	}
+
+	ReplayResult result;
+	char params[512] = { 0 };
+
+	Bench("vfs.replay", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(table->Count + 1);
+
+		for (size_t i = 0; i < table->Count; ++i) {
+			table->Nodes[i].Replayed = TRACE_NO_NODE;
+		}
+
+		for (size_t i = 0; i < table->Count; ++i) {
+			if(table->Nodes[i].Existing) CreateExisting(environment, table, &table->Nodes[i], 0);
+		}
+
+		memset(&result, 0, sizeof(result));
+
+		timer->Start();
+		Replay(environment, table, records, count, buffer, bound, &result);
+		timer->Stop();
+
+		timer->Operations = result.Replayed;
+		timer->Bytes = result.Bytes;
+
+		/* The report is printed after the last run, so this is what it shows */
+		snprintf(params, sizeof(params), "\"trace\":\"%s\",\"records\":%zu,\"replayed\":%zu,\"skipped\":%zu,\"diverged\":%zu",
+		         name, count, result.Replayed, result.Skipped, result.Diverged);
+
+		/* Requests may fail differently than they did, but none may go missing */
+		if(result.Replayed + result.Skipped != nodeRecords) {
+			BenchFail("vfs.replay", "%zu of %zu node requests were replayed or skipped", result.Replayed + result.Skipped, nodeRecords);
+		}
+
+		DestroyEnvironment(environment);
+	});
+
+	free(buffer);
+	free(bound);
+	FreeTable(table);
+	free(data);
+
+	return true;
+}
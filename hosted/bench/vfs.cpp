@@ -0,0 +1,578 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* RamFS wants whole name buffers, not just the string */
+static VNode *CreateNamed(RamFS *fs, inode_t directory, const char *name, property_t properties) {
+	char buffer[MAX_NAME_SIZE] = { 0 };
+	snprintf(buffer, sizeof(buffer), "%s", name);
+
+	return fs->CreateNode(directory, buffer, properties);
+}
+
+static void BenchResolvePath(size_t depth) {
+	char params[64];
+	snprintf(params, sizeof(params), "\"depth\":%zu", depth);
+
+	size_t lookups = Options.Quick ? 10000 : 100000;
+
+	Bench("vfs.resolve_path", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(depth + 1);
+
+		char path[MAX_PATH_SIZE] = { 0 };
+		size_t length = 0;
+
+		inode_t directory = 0;
+		for (size_t i = 0; i < depth; ++i) {
+			char name[MAX_NAME_SIZE] = { 0 };
+			snprintf(name, sizeof(name), "d%zu", i);
+
+			directory = environment->FS->CreateNode(directory, name, NODE_PROPERTY_DIRECTORY)->Inode;
+			length += snprintf(path + length, sizeof(path) - length, "/%s", name);
+		}
+
+		/* ResolvePath cuts up the path it is given, so every lookup gets a fresh copy */
+		char copy[MAX_PATH_SIZE];
+		size_t resolved = 0;
+
+		timer->Start();
+		for (size_t i = 0; i < lookups; ++i) {
+			memcpy(copy, path, length + 1);
+
+			VNode node;
+			if(environment->VFS->ResolvePath(copy, &node) == 0 && node.Inode == directory) ++resolved;
+		}
+		timer->Stop();
+
+		timer->Operations = lookups;
+		if(resolved != lookups) BenchFail("vfs.resolve_path", "%zu lookups failed", lookups - resolved);
+
+		DestroyEnvironment(environment);
+	});
+}
+
+/* How a read request gets its memory: a fresh heap block each time,
+   a block from the VFS request pool, or none, reading into the caller's buffer */
+enum RequestSource {
+	REQUEST_HEAP,
+	REQUEST_POOL,
+	REQUEST_SCATTER,
+};
+
+static const char *RequestSourceNames[] = { "heap", "pool", "scatter" };
+
+static void BenchReadRequest(size_t size, RequestSource source) {
+	char params[64];
+	snprintf(params, sizeof(params), "\"size\":%zu,\"source\":\"%s\"", size, RequestSourceNames[source]);
+
+	const size_t fileSize = 1 << 20;
+	size_t operations = (Options.Quick ? 16 : 64) * fileSize / size;
+
+	Bench("vfs.read_request", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(16);
+		VirtualFilesystem *vfs = environment->VFS;
+		RequestPool *pool = vfs->GetRequestPool();
+
+		inode_t file = CreateNamed(environment->FS, 0, "file", NODE_PROPERTY_FILE)->Inode;
+		uint8_t *content = (uint8_t*)malloc(fileSize);
+		memset(content, 0xA5, fileSize);
+		environment->FS->WriteNode(file, 0, fileSize, content);
+
+		uint64_t bytes = 0;
+		bool matched = true;
+
+		/* Scattered reads land in content, so it has to start out different from the file */
+		memset(content, 0, fileSize);
+
+		timer->Start();
+		for (size_t i = 0; i < operations; ++i) {
+			size_t offset = (i * size) % fileSize;
+
+			if(source == REQUEST_SCATTER) {
+				FSScatterNodeRequest request;
+				request.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+				request.Request = NODE_READ_SCATTER;
+				request.Node = file;
+				request.Offset = offset;
+				request.Size = size;
+				request.Address = (uintptr_t)content;
+
+				vfs->DoFilesystemOperation(environment->Descriptor, &request);
+				if(request.Result > 0) bytes += request.Result;
+				continue;
+			}
+
+			size_t requestSize = sizeof(FSReadNodeRequest) + size;
+			FSReadNodeRequest *request = (FSReadNodeRequest*)(source == REQUEST_POOL ? pool->Allocate(requestSize) : malloc(requestSize));
+
+			request->MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+			request->Request = NODE_READ;
+			request->Node = file;
+			request->Offset = offset;
+			request->Size = size;
+
+			vfs->DoFilesystemOperation(environment->Descriptor, request);
+			if(request->Result > 0) bytes += request->Result;
+
+			/* Only the last request is looked at, the rest are timed as they are */
+			if(i == operations - 1) matched = BenchFilled(&request->Buffer, size, 0xA5);
+
+			if(source == REQUEST_POOL) pool->Release(request);
+			else free(request);
+		}
+		timer->Stop();
+
+		timer->Operations = operations;
+		timer->Bytes = bytes;
+
+		if(source == REQUEST_SCATTER) matched = BenchFilled(content, size, 0xA5);
+		if(bytes != operations * size) BenchFail("vfs.read_request", "moved %llu bytes", (unsigned long long)bytes);
+		if(!matched) BenchFail("vfs.read_request", "wrong data");
+
+		free(content);
+		DestroyEnvironment(environment);
+	});
+}
+
+/* Sums a file once through a mapping, faulting each page in the first time,
+   against reading it into a buffer */
+static void BenchMappedRead(bool mapped) {
+	char params[64];
+	snprintf(params, sizeof(params), "\"access\":\"%s\"", mapped ? "mmap" : "read");
+
+	const size_t fileSize = 1 << 20;
+	size_t passes = Options.Quick ? 16 : 64;
+
+	Bench("vfs.mapped_read", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(16);
+		VirtualFilesystem *vfs = environment->VFS;
+
+		inode_t file = CreateNamed(environment->FS, 0, "file", NODE_PROPERTY_FILE)->Inode;
+		uint8_t *content = (uint8_t*)malloc(fileSize);
+		memset(content, 0xA5, fileSize);
+		environment->FS->WriteNode(file, 0, fileSize, content);
+
+		uint64_t sum = 0;
+
+		timer->Start();
+		for (size_t pass = 0; pass < passes; ++pass) {
+			if(!mapped) {
+				FSScatterNodeRequest readRequest;
+				readRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+				readRequest.Request = NODE_READ_SCATTER;
+				readRequest.Node = file;
+				readRequest.Offset = 0;
+				readRequest.Size = fileSize;
+				readRequest.Address = (uintptr_t)content;
+				vfs->DoFilesystemOperation(environment->Descriptor, &readRequest);
+
+				for (size_t i = 0; i < fileSize; i += 64) sum += content[i];
+				continue;
+			}
+
+			FileMmapRequest mmapRequest;
+			mmapRequest.MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+			mmapRequest.Request = FOPS_MMAP;
+			strcpy(mmapRequest.Path, "/file");
+			mmapRequest.Offset = 0;
+			mmapRequest.Size = fileSize;
+			mmapRequest.Flags = MMAP_READ;
+			if(vfs->DoFileOperation(&mmapRequest) != 0) break;
+
+			for (size_t page = 0; page < fileSize; page += MMAP_PAGE_SIZE) {
+				FileFaultRequest faultRequest;
+				faultRequest.MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+				faultRequest.Request = FOPS_FAULT;
+				faultRequest.Mapping = mmapRequest.Mapping;
+				faultRequest.Offset = page;
+				faultRequest.Access = MMAP_READ;
+				if(vfs->DoFileOperation(&faultRequest) != 0) break;
+
+				const uint8_t *data = (const uint8_t*)faultRequest.Address;
+				for (size_t i = 0; i < MMAP_PAGE_SIZE; i += 64) sum += data[i];
+			}
+
+			FileMunmapRequest munmapRequest;
+			munmapRequest.MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+			munmapRequest.Request = FOPS_MUNMAP;
+			munmapRequest.Mapping = mmapRequest.Mapping;
+			vfs->DoFileOperation(&munmapRequest);
+		}
+		timer->Stop();
+
+		timer->Operations = passes;
+		timer->Bytes = passes * fileSize;
+
+		if(sum != passes * (fileSize / 64) * 0xA5) BenchFail("vfs.mapped_read", "wrong sum");
+
+		free(content);
+		DestroyEnvironment(environment);
+	});
+}
+
+/* Lists a directory and everything under it the way a client would have to without
+   walks, opening and reading one directory at a time, and counts what it saw */
+static size_t ListThroughReadDir(VirtualFilesystem *vfs, const char *path, FileReadDirRequest *readDirRequest, size_t size) {
+	/* The path of the request is const, so it is filled in as raw memory */
+	uint8_t openDirStorage[sizeof(FileOpenDirRequest)];
+	FileOpenDirRequest &openDirRequest = *(FileOpenDirRequest*)openDirStorage;
+	openDirRequest.MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+	openDirRequest.Request = FOPS_OPENDIR;
+	strcpy((char*)openDirRequest.Path, path);
+	if(vfs->DoFileOperation(&openDirRequest) != 0) return 0;
+
+	size_t count = 0;
+	uintmax_t cursor = 0;
+
+	while(true) {
+		readDirRequest->MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+		readDirRequest->Request = FOPS_READDIR;
+		readDirRequest->Directory = openDirRequest.DirectoryHandle;
+		readDirRequest->Cursor = cursor;
+		readDirRequest->Size = size;
+		if(vfs->DoFileOperation(readDirRequest) <= 0) break;
+
+		cursor = readDirRequest->Cursor;
+
+		/* The buffer is needed again below, so the directories are picked out first */
+		DirNode *entries = (DirNode*)&readDirRequest->Buffer;
+		size_t entryCount = readDirRequest->Result;
+		count += entryCount;
+
+		char (*children)[MAX_PATH_SIZE] = NULL;
+		size_t childCount = 0;
+		for (size_t i = 0; i < entryCount; ++i) {
+			if(!(entries[i].Properties & NODE_PROPERTY_DIRECTORY)) continue;
+
+			if(children == NULL) children = new char[entryCount][MAX_PATH_SIZE];
+			snprintf(children[childCount++], MAX_PATH_SIZE, "%s/%s", path, entries[i].Name);
+		}
+
+		for (size_t i = 0; i < childCount; ++i) count += ListThroughReadDir(vfs, children[i], readDirRequest, size);
+		delete[] children;
+	}
+
+	FileCloseDirRequest closeDirRequest;
+	closeDirRequest.MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+	closeDirRequest.Request = FOPS_CLOSEDIR;
+	closeDirRequest.DirectoryHandle = openDirRequest.DirectoryHandle;
+	vfs->DoFileOperation(&closeDirRequest);
+
+	return count;
+}
+
+/* Lists a tree of directories full of files, in one walk or a directory at a time */
+static void BenchWalkTree(bool walk) {
+	const size_t directories = 16;
+	const size_t files = 64;
+	const size_t bufferSize = 0x4000;
+
+	char params[64];
+	snprintf(params, sizeof(params), "\"method\":\"%s\",\"entries\":%zu", walk ? "walk" : "readdir", directories * (files + 1) + 1);
+
+	size_t passes = Options.Quick ? 50 : 500;
+
+	Bench("vfs.walk_tree", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(directories * (files + 1) + 2);
+		VirtualFilesystem *vfs = environment->VFS;
+
+		inode_t top = CreateNamed(environment->FS, 0, "tree", NODE_PROPERTY_DIRECTORY)->Inode;
+		for (size_t i = 0; i < directories; ++i) {
+			char name[MAX_NAME_SIZE] = { 0 };
+			snprintf(name, sizeof(name), "directory%zu", i);
+			inode_t directory = environment->FS->CreateNode(top, name, NODE_PROPERTY_DIRECTORY)->Inode;
+
+			for (size_t j = 0; j < files; ++j) {
+				snprintf(name, sizeof(name), "file%zu", j);
+				environment->FS->CreateNode(directory, name, NODE_PROPERTY_FILE);
+			}
+		}
+
+		size_t requestSize = (walk ? sizeof(FileWalkRequest) : sizeof(FileReadDirRequest)) + bufferSize;
+		uint8_t *request = (uint8_t*)malloc(requestSize);
+		size_t listed = 0;
+
+		timer->Start();
+		for (size_t pass = 0; pass < passes; ++pass) {
+			if(!walk) {
+				listed += ListThroughReadDir(vfs, "/tree", (FileReadDirRequest*)request, bufferSize);
+				continue;
+			}
+
+			FileWalkRequest *walkRequest = (FileWalkRequest*)request;
+			memset(&walkRequest->Cursor, 0, sizeof(WalkCursor));
+
+			while(true) {
+				walkRequest->MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+				walkRequest->Request = FOPS_WALK;
+				strcpy(walkRequest->Path, "/tree");
+				walkRequest->MaxDepth = 0;
+				walkRequest->Filter[0] = '\0';
+				walkRequest->Size = bufferSize;
+				result_t result = vfs->DoFileOperation(walkRequest);
+				if(result <= 0) break;
+
+				listed += result;
+			}
+		}
+		timer->Stop();
+
+		timer->Operations = listed;
+
+		if(listed != passes * directories * (files + 1)) BenchFail("vfs.walk_tree", "listed %zu entries", listed);
+
+		free(request);
+		DestroyEnvironment(environment);
+	});
+}
+
+/* Loads or stores a small file whole, in one request or through an open file */
+static void BenchWholeFile(bool write, bool whole) {
+	const size_t fileSize = 512;
+
+	char params[64];
+	snprintf(params, sizeof(params), "\"method\":\"%s\",\"size\":%zu",
+	         whole ? (write ? "writefile" : "readfile") : (write ? "open_write_close" : "open_read_close"), fileSize);
+
+	size_t operations = Options.Quick ? 20000 : 200000;
+
+	Bench(write ? "vfs.write_whole_file" : "vfs.read_whole_file", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(16);
+		VirtualFilesystem *vfs = environment->VFS;
+
+		inode_t file = CreateNamed(environment->FS, 0, "config", NODE_PROPERTY_FILE)->Inode;
+		uint8_t content[fileSize];
+		memset(content, 0xA5, fileSize);
+		environment->FS->WriteNode(file, 0, fileSize, content);
+
+		/* Writes put down another pattern, so that they can be told from what was there */
+		if(write) memset(content, 0x5A, fileSize);
+
+		size_t requestSize = sizeof(FileReadFileRequest) + sizeof(FileWriteRequest) + fileSize;
+		uint8_t *request = (uint8_t*)malloc(requestSize);
+		uint64_t bytes = 0;
+
+		timer->Start();
+		for (size_t i = 0; i < operations; ++i) {
+			if(whole && write) {
+				FileWriteFileRequest *writeFileRequest = (FileWriteFileRequest*)request;
+				writeFileRequest->MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+				writeFileRequest->Request = FOPS_WRITEFILE;
+				strcpy(writeFileRequest->Path, "/config");
+				writeFileRequest->Size = fileSize;
+				memcpy(&writeFileRequest->Buffer, content, fileSize);
+
+				if(vfs->DoFileOperation(writeFileRequest) > 0) bytes += writeFileRequest->Result;
+				continue;
+			}
+
+			if(whole) {
+				FileReadFileRequest *readFileRequest = (FileReadFileRequest*)request;
+				readFileRequest->MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+				readFileRequest->Request = FOPS_READFILE;
+				strcpy(readFileRequest->Path, "/config");
+				readFileRequest->Size = fileSize;
+
+				if(vfs->DoFileOperation(readFileRequest) > 0) bytes += readFileRequest->Result;
+				continue;
+			}
+
+			FileOpenRequest *openRequest = (FileOpenRequest*)request;
+			openRequest->MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+			openRequest->Request = FOPS_OPEN;
+			strcpy(openRequest->Path, "/config");
+			if(vfs->DoFileOperation(openRequest) != 0) break;
+
+			fd_t handle = openRequest->FileHandle;
+
+			if(write) {
+				FileWriteRequest *writeRequest = (FileWriteRequest*)request;
+				writeRequest->MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+				writeRequest->Request = FOPS_WRITE;
+				writeRequest->FileHandle = handle;
+				writeRequest->Offset = 0;
+				writeRequest->Size = fileSize;
+				memcpy(&writeRequest->Buffer, content, fileSize);
+
+				if(vfs->DoFileOperation(writeRequest) > 0) bytes += writeRequest->Result;
+			} else {
+				FileReadRequest *readRequest = (FileReadRequest*)request;
+				readRequest->MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+				readRequest->Request = FOPS_READ;
+				readRequest->FileHandle = handle;
+				readRequest->Offset = 0;
+				readRequest->Size = fileSize;
+
+				if(vfs->DoFileOperation(readRequest) > 0) bytes += readRequest->Result;
+			}
+
+			FileCloseRequest *closeRequest = (FileCloseRequest*)request;
+			closeRequest->MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+			closeRequest->Request = FOPS_CLOSE;
+			closeRequest->FileHandle = handle;
+			vfs->DoFileOperation(closeRequest);
+		}
+		timer->Stop();
+
+		timer->Operations = operations;
+		timer->Bytes = bytes;
+
+		const char *name = write ? "vfs.write_whole_file" : "vfs.read_whole_file";
+		if(bytes != operations * fileSize) BenchFail(name, "moved %llu bytes", (unsigned long long)bytes);
+
+		/* What was written has to be in the file, what was read has to be what it held.
+		   Writing the file whole puts a new node in its place */
+		char configName[MAX_NAME_SIZE] = "config";
+		VNode *node = environment->FS->GetByName(0, configName);
+		uint8_t check[fileSize];
+		memset(check, 0, fileSize);
+		if(node != NULL) environment->FS->ReadNode(node->Inode, 0, fileSize, check);
+		if(!BenchFilled(check, fileSize, write ? 0x5A : 0xA5)) BenchFail(name, "wrong data in the file");
+		if(!write && !BenchFilled(whole ? &((FileReadFileRequest*)request)->Buffer : &((FileReadRequest*)request)->Buffer, fileSize, 0xA5)) {
+			BenchFail(name, "wrong data read");
+		}
+
+		free(request);
+		DestroyEnvironment(environment);
+	});
+}
+
+/* Looks up every file of a tree, a request per path or all of them in one,
+   with the paths in the order a listing gives them or shuffled */
+static void BenchGetAttributes(bool batch, bool shuffled) {
+	const size_t directories = 4;
+	const size_t subdirectories = 4;
+	const size_t files = 16;
+	const size_t count = directories * subdirectories * files;
+
+	char params[64];
+	snprintf(params, sizeof(params), "\"method\":\"%s\",\"paths\":%zu,\"order\":\"%s\"",
+	         batch ? "getattrs" : "getattr", count, shuffled ? "shuffled" : "sorted");
+
+	size_t passes = Options.Quick ? 50 : 500;
+
+	Bench("vfs.getattr", params, [&](BenchTimer *timer) {
+		BenchEnvironment *environment = CreateEnvironment(count + directories * (subdirectories + 1) + 2);
+		VirtualFilesystem *vfs = environment->VFS;
+
+		char *paths = (char*)malloc(count * 32);
+		size_t pathsSize = 0;
+
+		/* Which slot each path goes into, swapped around with a fixed seed when shuffled */
+		size_t slots[count];
+		for (size_t i = 0; i < count; ++i) slots[i] = i;
+
+		srand(1);
+		for (size_t i = count; shuffled && i > 1; --i) {
+			size_t j = rand() % i;
+			size_t swap = slots[i - 1];
+			slots[i - 1] = slots[j];
+			slots[j] = swap;
+		}
+
+		char (*sorted)[32] = new char[count][32];
+		size_t made = 0;
+
+		inode_t top = CreateNamed(environment->FS, 0, "tree", NODE_PROPERTY_DIRECTORY)->Inode;
+		for (size_t i = 0; i < directories; ++i) {
+			char name[MAX_NAME_SIZE] = { 0 };
+			snprintf(name, sizeof(name), "d%zu", i);
+			inode_t directory = environment->FS->CreateNode(top, name, NODE_PROPERTY_DIRECTORY)->Inode;
+
+			for (size_t j = 0; j < subdirectories; ++j) {
+				snprintf(name, sizeof(name), "s%zu", j);
+				inode_t subdirectory = environment->FS->CreateNode(directory, name, NODE_PROPERTY_DIRECTORY)->Inode;
+
+				for (size_t k = 0; k < files; ++k) {
+					snprintf(name, sizeof(name), "f%zu", k);
+					environment->FS->CreateNode(subdirectory, name, NODE_PROPERTY_FILE);
+
+					snprintf(sorted[slots[made++]], 32, "/tree/d%zu/s%zu/f%zu", i, j, k);
+				}
+			}
+		}
+
+		for (size_t i = 0; i < count; ++i) pathsSize += snprintf(paths + pathsSize, 32, "%s", sorted[i]) + 1;
+		delete[] sorted;
+
+		size_t requestSize = sizeof(FileGetAttrsRequest) + count * sizeof(NodeAttributes) + pathsSize;
+		uint8_t *request = (uint8_t*)malloc(requestSize);
+		size_t found = 0;
+
+		timer->Start();
+		for (size_t pass = 0; pass < passes; ++pass) {
+			if(batch) {
+				FileGetAttrsRequest *getAttrsRequest = (FileGetAttrsRequest*)request;
+				getAttrsRequest->MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+				getAttrsRequest->Request = FOPS_GETATTRS;
+				getAttrsRequest->Count = count;
+				getAttrsRequest->Size = count * sizeof(NodeAttributes) + pathsSize;
+				memcpy(&getAttrsRequest->Buffer + count * sizeof(NodeAttributes), paths, pathsSize);
+
+				result_t result = vfs->DoFileOperation(getAttrsRequest);
+				if(result > 0) found += result;
+				continue;
+			}
+
+			const char *path = paths;
+			for (size_t i = 0; i < count; ++i) {
+				FileGetAttrRequest *getAttrRequest = (FileGetAttrRequest*)request;
+				getAttrRequest->MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+				getAttrRequest->Request = FOPS_GETATTR;
+				strcpy(getAttrRequest->Path, path);
+				path += strlen(path) + 1;
+
+				if(vfs->DoFileOperation(getAttrRequest) == 0) ++found;
+			}
+		}
+		timer->Stop();
+
+		timer->Operations = passes * count;
+
+		if(found != passes * count) BenchFail("vfs.getattr", "found %zu paths", found);
+
+		/* The attributes left over from the last pass have to be those of files */
+		NodeAttributes last = ((FileGetAttrRequest*)request)->Attributes;
+		NodeAttributes *attributes = batch ? (NodeAttributes*)&((FileGetAttrsRequest*)request)->Buffer : &last;
+		size_t checked = batch ? count : 1;
+		for (size_t i = 0; i < checked; ++i) {
+			if(attributes[i].Result != 0 || !(attributes[i].Properties & NODE_PROPERTY_FILE)) {
+				BenchFail("vfs.getattr", "wrong attributes");
+				break;
+			}
+		}
+
+		free(request);
+		free(paths);
+		DestroyEnvironment(environment);
+	});
+}
+
+void RunVFSBenchmarks() {
+	const size_t depths[] = { 1, 4, 16, 64 };
+	for (size_t depth : depths) BenchResolvePath(depth);
+
+	const size_t sizes[] = { 64, 4096, 65536 };
+	for (size_t size : sizes) {
+		BenchReadRequest(size, REQUEST_HEAP);
+		BenchReadRequest(size, REQUEST_POOL);
+		BenchReadRequest(size, REQUEST_SCATTER);
+	}
+
+	BenchMappedRead(false);
+	BenchMappedRead(true);
+
+	BenchWalkTree(false);
+	BenchWalkTree(true);
+
+	BenchWholeFile(false, false);
+	BenchWholeFile(false, true);
+	BenchWholeFile(true, false);
+	BenchWholeFile(true, true);
+
+	BenchGetAttributes(false, false);
+	BenchGetAttributes(true, false);
+	BenchGetAttributes(true, true);
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#define EFAULT       1
+#define ENOTPRESENT  2
+#define EBADREQUEST  3
+#define ENODRIVER    4
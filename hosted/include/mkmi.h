@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/* The parts of mkmi the filesystem code uses, backed by the C library.
+ * Only meant for building and measuring that code on a regular host,
+ * nothing here talks to a kernel.
+ */
+
+void *Malloc(size_t size);
+void Free(void *pointer);
+
+void *Memset(void *destination, int value, size_t size);
+void *Memcpy(void *destination, const void *source, size_t size);
+int Memcmp(const void *first, const void *second, size_t size);
+
+char *Strcpy(char *destination, const char *source);
+size_t Strlen(const char *string);
+int Strcmp(const char *first, const char *second);
+char *Strtok(const char *string, const char *delimiters);
+
+void MKMI_Printf(const char *format, ...);
+
+#define SYSCALL_PROC_EXEC 10
+
+/* Calls are counted and otherwise ignored */
+size_t Syscall(size_t number, ...);
+extern size_t HostedSyscallCount;
@@ -0,0 +1,62 @@
+#include <mkmi.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+size_t HostedSyscallCount = 0;
+
+void *Malloc(size_t size) {
+	return malloc(size);
+}
+
+void Free(void *pointer) {
+	free(pointer);
+}
+
+void *Memset(void *destination, int value, size_t size) {
+	return memset(destination, value, size);
+}
+
+void *Memcpy(void *destination, const void *source, size_t size) {
+	return memcpy(destination, source, size);
+}
+
+int Memcmp(const void *first, const void *second, size_t size) {
+	return memcmp(first, second, size);
+}
+
+char *Strcpy(char *destination, const char *source) {
+	return strcpy(destination, source);
+}
+
+size_t Strlen(const char *string) {
+	return strlen(string);
+}
+
+int Strcmp(const char *first, const char *second) {
+	return strcmp(first, second);
+}
+
+char *Strtok(const char *string, const char *delimiters) {
+	return strtok((char*)string, delimiters);
+}
+
+/* Kernel log output is only shown when asked for, so it doesn't get in the way of results */
+void MKMI_Printf(const char *format, ...) {
+	static int verbose = -1;
+	if(verbose < 0) verbose = getenv("MKMI_VERBOSE") != NULL;
+	if(!verbose) return;
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+size_t Syscall(size_t number, ...) {
+	(void)number;
+	++HostedSyscallCount;
+	return 0;
+}
@@ -10,18 +10,80 @@
 #include "vfs/vfs.h"
 #include "vfs/ustar.h"
 #include "ramfs/ramfs.h"
+#include "tarfs/tarfs.h"
+#include "preload/preload.h"
+#include "statsfs/statsfs.h"
+#include "util/span.h"
+
+/* Serve the initrd in place through TarFS instead of unpacking it into RamFS.
+ * It is mounted at /initrd rather than at the root, and nothing can be written
+ * over it, so it stays off until RamFS can overlay it
+ */
+// #define INITRD_MOUNT_TARFS
+
+/* Write the tree out as a RamFS image once the initrd is unpacked,
+ * so that later boots can restore it instead of unpacking again
+ */
+// #define RAMFS_DUMP_IMAGE "ramfs.img"
+
+#if defined(INITRD_MOUNT_TARFS) && defined(RAMFS_DUMP_IMAGE)
+#error "RAMFS_DUMP_IMAGE would write out an empty tree, the initrd is not unpacked into RamFS with INITRD_MOUNT_TARFS"
+#endif
+
+/* Record every VFS request made during boot and write them out once it is done.
+ * The trace can be replayed on the host with fsbench --replay
+ */
+// #define VFS_TRACE_FILE "vfs.trace"
+#define VFS_TRACE_RECORDS 65536
+
+/* Boot phases, archive entries and module launches are timed and summed up
+ * once init is done. With BOOT_SPANS_FILE they are also written to the root
+ * as a Chrome trace, which chrome://tracing and Perfetto can open
+ */
+#define BOOT_SPANS 8192
+#define BOOT_SPANS_FILE "boot.json"
+
+/* Compress the RamFS blocks that went cold while more than this many bytes are held in them.
+ * Nothing runs the compactor in the background yet, so once init is done it goes over
+ * the tree with this much budget, which is enough for two passes of most trees
+ */
+// #define RAMFS_COMPACT_THRESHOLD 0x4000000
+#define RAMFS_COMPACT_BUDGET 0x100000
+/* Merge RamFS blocks with the same content into one, in the same pass */
+// #define RAMFS_DEDUPLICATE
 
 extern "C" uint32_t VendorID = 0xCAFEBABE;
 extern "C" uint32_t ProductID = 0xDEADBEEF;
 
 void VFSInit();
+void ReadmeInit();
 void InitrdInit();
+void TarFSInit(const char *path);
+void StatsFSInit(const char *path);
+void PreloadModules(const char *config, size_t size);
+void PreloadFromFilesystem();
+void DumpImage(const char *name);
+void DumpTrace(const char *name);
+void DumpSpans(const char *name);
+bool WriteRootFile(const char *name, const void *data, size_t size);
+char *ReadFile(const char *path, size_t *size);
 	
 VirtualFilesystem *vfs;
 RamFS *rootRamfs;
 filesystem_t ramfsDesc;
+ArchiveIndex *initrdIndex;
+TarFS *initrdTarfs;
+filesystem_t tarfsDesc;
+StatsFS *vfsStatsfs;
+filesystem_t statsfsDesc;
+SpanRecorder *bootSpans;
 
 extern "C" size_t OnInit() {
+	bootSpans = new SpanRecorder(BOOT_SPANS);
+	intmax_t initSpan = bootSpans->Begin("init");
+
+	intmax_t span = bootSpans->Begin("ipc");
+
 	QueueOperationStruct queueCtl;
 	queueCtl.Operation = QueueOperations::CREATE;
 	queueCtl.Create.PreallocateSize = 8192;
@@ -38,8 +100,55 @@ extern "C" size_t OnInit() {
 	IPCMessageReceive(id, newMsgBuffer, 32, 0, 0);
 	MKMI_Printf("Message: %s\r\n", newMsgBuffer); 
 
+	bootSpans->End(span);
+
+	span = bootSpans->Begin("vfs");
 	VFSInit();
+	bootSpans->End(span);
+
+	span = bootSpans->Begin("initrd");
 	InitrdInit();
+	bootSpans->End(span);
+
+	/* Only after the initrd, as a RamFS image can only be restored into an empty tree.
+	   This also keeps them out of the image dumped there */
+	span = bootSpans->Begin("readme");
+	ReadmeInit();
+	bootSpans->End(span);
+
+	span = bootSpans->Begin("statsfs");
+	StatsFSInit("/stats");
+	bootSpans->End(span);
+
+#if defined(RAMFS_COMPACT_THRESHOLD) || defined(RAMFS_DEDUPLICATE)
+	span = bootSpans->Begin("compact");
+	size_t saved = vfs->CompactFilesystems(RAMFS_COMPACT_BUDGET);
+	bootSpans->End(span);
+
+	const CompactionStats *compaction = rootRamfs->GetCompactionStats();
+	MKMI_Printf("Compacted %d bytes, %d blocks now hold %d bytes in %d.\r\n", saved,
+	            compaction->CompressedBlocks, compaction->OriginalBytes, compaction->CompressedBytes);
+
+	const DedupStats *dedup = rootRamfs->GetDedupStats();
+	MKMI_Printf("Deduplication saved %d bytes: %d blocks merged and %d zeroed out of %d, index of %d bytes.\r\n",
+	            dedup->SavedBytes, dedup->Merged, dedup->Zeroed, dedup->Scanned, dedup->IndexBytes);
+#endif
+
+#ifdef VFS_TRACE_FILE
+	span = bootSpans->Begin("trace dump");
+	DumpTrace(VFS_TRACE_FILE);
+	bootSpans->End(span);
+#endif
+
+	bootSpans->End(initSpan);
+
+	bootSpans->PrintSummary();
+#ifdef BOOT_SPANS_FILE
+	DumpSpans(BOOT_SPANS_FILE);
+#endif
+
+	delete bootSpans;
+	bootSpans = NULL;
 
 	return 0;
 }
@@ -54,23 +163,49 @@ void VFSInit() {
 	vfs = new VirtualFilesystem();
 	rootRamfs = new RamFS(2048);
 
-	FSOperations *ramfsOps = new FSOperations;
+#ifdef RAMFS_COMPACT_THRESHOLD
+	rootRamfs->SetCompactionThreshold(RAMFS_COMPACT_THRESHOLD);
+#endif
+#ifdef RAMFS_DEDUPLICATE
+	rootRamfs->SetDeduplication(true);
+#endif
+
+#ifdef VFS_TRACE_FILE
+	if (vfs->StartTrace(VFS_TRACE_RECORDS) != 0) MKMI_Printf("Not enough memory to trace the VFS.\r\n");
+#endif
+
+	FSOperations *ramfsOps = new FSOperations();
 	
 	ramfsOps->CreateNode = rootRamfs->CreateNodeWrapper;
 	ramfsOps->DeleteNode = rootRamfs->DeleteNodeWrapper;
+	ramfsOps->RenameNode = rootRamfs->RenameNodeWrapper;
 	ramfsOps->GetByInode = rootRamfs->GetByInodeWrapper;
 	ramfsOps->GetByName = rootRamfs->GetByNameWrapper;
 	ramfsOps->GetByIndex = rootRamfs->GetByIndexWrapper;
 	ramfsOps->GetRootNode = rootRamfs->GetRootNodeWrapper;
 	ramfsOps->ReadNode = rootRamfs->ReadNodeWrapper;
 	ramfsOps->WriteNode = rootRamfs->WriteNodeWrapper;
+	ramfsOps->ReadNodeVector = rootRamfs->ReadNodeVectorWrapper;
+	ramfsOps->WriteNodeVector = rootRamfs->WriteNodeVectorWrapper;
+	ramfsOps->BindNode = rootRamfs->BindNodeWrapper;
+	ramfsOps->MapNode = rootRamfs->MapNodeWrapper;
+	ramfsOps->MapBlock = rootRamfs->MapBlockWrapper;
+	ramfsOps->UnmapNode = rootRamfs->UnmapNodeWrapper;
+	ramfsOps->CloneNode = rootRamfs->CloneNodeWrapper;
+	ramfsOps->CopyRange = rootRamfs->CopyRangeWrapper;
+	ramfsOps->Snapshot = rootRamfs->SnapshotWrapper;
+	ramfsOps->CompactBlocks = rootRamfs->CompactBlocksWrapper;
+	ramfsOps->ReadDirectory = rootRamfs->ReadDirectoryWrapper;
 
 	ramfsDesc = vfs->RegisterFilesystem(0, 0, rootRamfs, ramfsOps);
 
 	rootRamfs->SetDescriptor(ramfsDesc);
 
 	vfs->SetRootFS(ramfsDesc);
+}
 
+/* Writes a README to the root and reads it back, to show the tree works */
+void ReadmeInit() {
 	intmax_t result = 0;
 
 	FSGetRootRequest rootRequest;
@@ -94,7 +229,9 @@ void VFSInit() {
 	size_t writeSize = Strlen(writeData);
 	size_t requestSize = sizeof(FSWriteNodeRequest) + writeSize + 1;
 
-	FSWriteNodeRequest *writeRequest = (FSWriteNodeRequest*)Malloc(requestSize);
+	RequestPool *pool = vfs->GetRequestPool();
+
+	FSWriteNodeRequest *writeRequest = (FSWriteNodeRequest*)pool->Allocate(requestSize);
 	Memset((void*)writeRequest, 0, requestSize);
 
 	writeRequest->Request = NODE_WRITE;
@@ -106,7 +243,7 @@ void VFSInit() {
 	result = vfs->DoFilesystemOperation(ramfsDesc, writeRequest);
 	MKMI_Printf("Node write: %d\r\n", writeRequest->Result);
 
-	FSReadNodeRequest *readRequest = (FSReadNodeRequest*)Malloc(requestSize);
+	FSReadNodeRequest *readRequest = (FSReadNodeRequest*)pool->Allocate(requestSize);
 	Memset((void*)readRequest, 0, requestSize);
 
 	readRequest->Request = NODE_READ;
@@ -118,8 +255,8 @@ void VFSInit() {
 	MKMI_Printf("Node read: %d\r\n", readRequest->Result);
 	MKMI_Printf("Read result: %s\r\n", &readRequest->Buffer);
 
-	Free(writeRequest);
-	Free(readRequest);
+	pool->Release(writeRequest);
+	pool->Release(readRequest);
 }
 
 void InitrdInit() {
@@ -129,8 +266,41 @@ void InitrdInit() {
 	UserTCB *tcb = GetUserTCB();
 	TableListElement *systemTableList = GetSystemTableList(tcb);
 	BFST *bfst = (BFST*)GetTableWithSignature(systemTableList, tcb->SystemTables, "BFST");
+
+	/* A RamFS image makes the initrd unnecessary, as it already holds the unpacked tree */
+	BootFile *image = GetFileFromBFST(bfst, "/ramfs.img");
+	if (image != NULL) {
+		const uintptr_t imageMapping = 0x200000000;
+
+		MKMI_Printf("Loading file ramfs.img from 0x%x with size %dkb.\r\n", image->Address, image->Size / 1024);
+
+		VMMap(image->Address, imageMapping, image->Size, PAGE_PROTECTION_READ);
+
+		intmax_t span = bootSpans->Begin("restore image");
+		bool restored = rootRamfs->RestoreImage((void*)imageMapping, image->Size);
+		bootSpans->End(span);
+
+		if (restored) {
+			rootRamfs->ListDirectory(0);
+
+			PreloadFromFilesystem();
+			return;
+		}
+
+		MKMI_Printf("The RamFS image can't be used, falling back to the initrd.\r\n");
+	}
+
 	BootFile *initrd = GetFileFromBFST(bfst, "/initrd.tar");
 
+	/* Compressed images are only looked for when there is no plain one */
+	bool compressed = false;
+	if (initrd == NULL) {
+		initrd = GetFileFromBFST(bfst, "/initrd.tar.lz4");
+		if (initrd == NULL) initrd = GetFileFromBFST(bfst, "/initrd.tar.gz");
+
+		compressed = initrd != NULL;
+	}
+
 	const uintptr_t initrdMapping = 0x100000000;
 
 	/* Here we check whether it exists 
@@ -141,49 +311,267 @@ void InitrdInit() {
 
 		VMMap(initrd->Address, initrdMapping, initrd->Size, PAGE_PROTECTION_READ);
 
-		UnpackArchive(vfs, initrdMapping, "/");
+		if (compressed) {
+			/* The archive is unpacked while it is decompressed, it never exists whole in memory */
+			intmax_t span = bootSpans->Begin("unpack compressed");
+			if (!UnpackCompressedArchive(vfs, (uint8_t*)initrdMapping, initrd->Size, "/", bootSpans)) {
+				MKMI_Printf("Decompressing the initrd failed.\r\n");
+			}
+			bootSpans->End(span);
+
+			rootRamfs->ListDirectory(0);
+
+#ifdef RAMFS_DUMP_IMAGE
+			DumpImage(RAMFS_DUMP_IMAGE);
+#endif
+
+			PreloadFromFilesystem();
+			return;
+		}
+
+		/* Every later lookup in the archive goes through this index */
+		intmax_t span = bootSpans->Begin("index");
+		initrdIndex = IndexArchive((uint8_t*)initrdMapping, initrd->Size);
+		bootSpans->End(span);
+
+		if (initrdIndex == NULL) {
+			MKMI_Printf("Indexing the initrd failed.\r\n");
+			return;
+		}
+
+#ifdef INITRD_MOUNT_TARFS
+		span = bootSpans->Begin("mount tarfs");
+		TarFSInit("/initrd");
+		bootSpans->End(span);
+#else
+		span = bootSpans->Begin("unpack");
+		UnpackArchive(vfs, initrdIndex, "/", bootSpans);
+		bootSpans->End(span);
+#endif
 
 		rootRamfs->ListDirectory(0);
 
+#ifdef RAMFS_DUMP_IMAGE
+		DumpImage(RAMFS_DUMP_IMAGE);
+#endif
+
 		uint8_t *configFile = NULL;
 		size_t configFileSize = 0;
 
-		uint8_t *execFile = NULL;
-		size_t execFileSize = 0;
-	
 		MKMI_Printf("Finding preload.conf...\r\n");
-		FindInArchive(initrdMapping, "etc/modules.d/preload.conf", &configFile, &configFileSize);
+		FindInArchive(initrdIndex, "etc/modules.d/preload.conf", &configFile, &configFileSize);
 		if(configFile == NULL || configFileSize == 0) return;
 
-		size_t fileLength = Strlen(configFile);
-		char fileData[fileLength + 1] = { '\0' };
-		Memcpy(fileData, configFile, fileLength);
-
-		char *id = Strtok(fileData, "=");
-		if(id == NULL) return;
-		char *val = Strtok(NULL, "\r\n");
-		if (val == NULL) return;
-				
-		while(true) {
-			if(Strcmp(id, "always") == 0) {
-				char fileName[256] = {0};
-				Strcpy(fileName, "modules/");
-				Strcpy(fileName + 8, val);
-
-				MKMI_Printf("Starting %s\r\n", fileName);
-
-				FindInArchive(initrdMapping, fileName, &execFile, &execFileSize);
-				if(execFile != NULL && execFileSize != 0) {
-					Syscall(SYSCALL_PROC_EXEC, execFile, execFileSize, 0, 0, 0, 0);
-				}
-			}
-			
-			id = Strtok(NULL, "=");
-			if(id == NULL) break;
-			val = Strtok(NULL, "\r\n");
-			if (val == NULL) break;
-		}
+		PreloadModules((const char*)configFile, configFileSize);
 	} else {
 		MKMI_Printf("No initrd found");
 	}
 }
+
+void PreloadModules(const char *config, size_t size) {
+	intmax_t span = bootSpans->Begin("preload");
+	PreloadScheduler *scheduler = new PreloadScheduler(vfs, initrdIndex, bootSpans);
+
+	if(scheduler->Parse(config, size)) {
+		scheduler->Run();
+		scheduler->PrintTimes();
+	}
+
+	delete scheduler;
+	bootSpans->End(span);
+}
+
+void PreloadFromFilesystem() {
+	MKMI_Printf("Finding preload.conf...\r\n");
+	size_t configFileSize = 0;
+	char *configFile = ReadFile("/etc/modules.d/preload.conf", &configFileSize);
+	if(configFile == NULL) return;
+
+	PreloadModules(configFile, configFileSize);
+
+	Free(configFile);
+}
+
+void DumpImage(const char *name) {
+	intmax_t imageSize = rootRamfs->DumpImage(NULL, 0);
+	if(imageSize < 0) return;
+
+	/* The image is taken before the file that holds it exists, so it doesn't contain itself */
+	void *image = Malloc(imageSize);
+	if(image == NULL) return;
+
+	if(rootRamfs->DumpImage(image, imageSize) != imageSize) {
+		Free(image);
+		return;
+	}
+
+	if(WriteRootFile(name, image, imageSize)) {
+		MKMI_Printf("Wrote a %dkb RamFS image to /%s.\r\n", imageSize / 1024, name);
+	}
+
+	Free(image);
+}
+
+void DumpTrace(const char *name) {
+	/* Writing the trace out would otherwise add to it */
+	VFSTrace *trace = vfs->StopTrace();
+	if(trace == NULL) return;
+
+	intmax_t traceSize = trace->Dump(NULL, 0);
+
+	TraceHeader *header = (TraceHeader*)Malloc(traceSize);
+	if(header == NULL) {
+		delete trace;
+		return;
+	}
+
+	traceSize = trace->Dump(header, traceSize);
+	delete trace;
+
+	if(traceSize > 0 && WriteRootFile(name, header, traceSize)) {
+		MKMI_Printf("Wrote %d traced requests to /%s, %d dropped.\r\n", header->RecordCount, name, header->Dropped);
+	}
+
+	Free(header);
+}
+
+void DumpSpans(const char *name) {
+	TextBuffer text = { NULL, 0, 0 };
+
+	if(bootSpans->WriteChromeTrace(&text) && WriteRootFile(name, text.Buffer, text.Length)) {
+		MKMI_Printf("Wrote the boot spans to /%s.\r\n", name);
+	}
+
+	if(text.Buffer != NULL) Free(text.Buffer);
+}
+
+/* Creates name in the root and fills it with size bytes of data */
+bool WriteRootFile(const char *name, const void *data, size_t size) {
+	FileCreateRequest createRequest;
+	createRequest.MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+	createRequest.Request = FOPS_CREATE;
+	Strcpy(createRequest.Path, "/");
+	Strcpy(createRequest.Name, name);
+	createRequest.Properties = NODE_PROPERTY_FILE;
+	vfs->DoFileOperation(&createRequest);
+
+	char filePath[MAX_PATH_SIZE] = {0};
+	filePath[0] = '/';
+	Strcpy(filePath + 1, name);
+
+	VNode file;
+	if(vfs->ResolvePath(filePath, &file) != 0) return false;
+
+	FSScatterNodeRequest writeRequest;
+	writeRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+	writeRequest.Request = NODE_WRITE_SCATTER;
+	writeRequest.Node = file.Inode;
+	writeRequest.Offset = 0;
+	writeRequest.Size = size;
+	writeRequest.Address = (uintptr_t)data;
+
+	return vfs->DoFilesystemOperation(file.FSDescriptor, &writeRequest) == (result_t)size;
+}
+
+char *ReadFile(const char *path, size_t *size) {
+	char filePath[MAX_PATH_SIZE] = {0};
+	Strcpy(filePath, path);
+
+	VNode file;
+	if(vfs->ResolvePath(filePath, &file) != 0) return NULL;
+	if(!(file.Properties & NODE_PROPERTY_FILE)) return NULL;
+
+	/* Read straight into what the caller gets back */
+	char *data = (char*)Malloc(file.Size + 1);
+	if(data == NULL) return NULL;
+
+	FSScatterNodeRequest readRequest;
+	readRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+	readRequest.Request = NODE_READ_SCATTER;
+	readRequest.Node = file.Inode;
+	readRequest.Offset = 0;
+	readRequest.Size = file.Size;
+	readRequest.Address = (uintptr_t)data;
+
+	vfs->DoFilesystemOperation(file.FSDescriptor, &readRequest);
+
+	if(readRequest.Result < 0) {
+		Free(data);
+		return NULL;
+	}
+
+	*size = readRequest.Result;
+	data[*size] = '\0';
+
+	return data;
+}
+
+void TarFSInit(const char *path) {
+	initrdTarfs = new TarFS(initrdIndex);
+
+	FSOperations *tarfsOps = new FSOperations();
+
+	tarfsOps->CreateNode = initrdTarfs->CreateNodeWrapper;
+	tarfsOps->DeleteNode = initrdTarfs->DeleteNodeWrapper;
+	tarfsOps->RenameNode = initrdTarfs->RenameNodeWrapper;
+	tarfsOps->GetByInode = initrdTarfs->GetByInodeWrapper;
+	tarfsOps->GetByName = initrdTarfs->GetByNameWrapper;
+	tarfsOps->GetByIndex = initrdTarfs->GetByIndexWrapper;
+	tarfsOps->GetRootNode = initrdTarfs->GetRootNodeWrapper;
+	tarfsOps->ReadNode = initrdTarfs->ReadNodeWrapper;
+	tarfsOps->WriteNode = initrdTarfs->WriteNodeWrapper;
+	tarfsOps->MapNode = initrdTarfs->MapNodeWrapper;
+	tarfsOps->ReadDirectory = initrdTarfs->ReadDirectoryWrapper;
+
+	tarfsDesc = vfs->RegisterFilesystem(0, 0, initrdTarfs, tarfsOps);
+
+	initrdTarfs->SetDescriptor(tarfsDesc);
+
+	/* The mountpoint itself lives in RamFS */
+	FileCreateRequest createRequest;
+	createRequest.MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+	createRequest.Request = FOPS_CREATE;
+	Strcpy(createRequest.Path, "/");
+	Strcpy(createRequest.Name, path + 1);
+	createRequest.Properties = NODE_PROPERTY_DIRECTORY;
+	vfs->DoFileOperation(&createRequest);
+
+	result_t result = vfs->MountFilesystem(path, tarfsDesc);
+	if(result != 0) {
+		MKMI_Printf("Mounting the initrd failed.\r\n");
+	}
+}
+
+void StatsFSInit(const char *path) {
+	vfsStatsfs = new StatsFS(vfs->GetStats(), vfs->GetRequestPool());
+
+	FSOperations *statsfsOps = new FSOperations();
+
+	statsfsOps->CreateNode = vfsStatsfs->CreateNodeWrapper;
+	statsfsOps->DeleteNode = vfsStatsfs->DeleteNodeWrapper;
+	statsfsOps->RenameNode = vfsStatsfs->RenameNodeWrapper;
+	statsfsOps->GetByInode = vfsStatsfs->GetByInodeWrapper;
+	statsfsOps->GetByName = vfsStatsfs->GetByNameWrapper;
+	statsfsOps->GetByIndex = vfsStatsfs->GetByIndexWrapper;
+	statsfsOps->GetRootNode = vfsStatsfs->GetRootNodeWrapper;
+	statsfsOps->ReadNode = vfsStatsfs->ReadNodeWrapper;
+	statsfsOps->WriteNode = vfsStatsfs->WriteNodeWrapper;
+	statsfsOps->ReadDirectory = vfsStatsfs->ReadDirectoryWrapper;
+
+	statsfsDesc = vfs->RegisterFilesystem(0, 0, vfsStatsfs, statsfsOps);
+
+	vfsStatsfs->SetDescriptor(statsfsDesc);
+
+	FileCreateRequest createRequest;
+	createRequest.MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+	createRequest.Request = FOPS_CREATE;
+	Strcpy(createRequest.Path, "/");
+	Strcpy(createRequest.Name, path + 1);
+	createRequest.Properties = NODE_PROPERTY_DIRECTORY;
+	vfs->DoFileOperation(&createRequest);
+
+	result_t result = vfs->MountFilesystem(path, statsfsDesc);
+	if(result != 0) {
+		MKMI_Printf("Mounting the stats filesystem failed.\r\n");
+	}
+}
@@ -0,0 +1,396 @@
+#include "preload.h"
+
+#include <mkmi.h>
+
+#include "../vfs/fops.h"
+#include "../util/timestamp.h"
+
+static bool IsBlank(char c) {
+	return c == ' ' || c == '\t';
+}
+
+static bool IsLineEnd(char c) {
+	return c == '\0' || c == '\r' || c == '\n';
+}
+
+/* Returns the end of the field starting at start, trimming the blanks around it */
+static size_t TrimField(char *config, size_t *start, size_t end) {
+	while(*start < end && IsBlank(config[*start])) ++*start;
+	while(end > *start && IsBlank(config[end - 1])) --end;
+
+	return end - *start;
+}
+
+PreloadScheduler::PreloadScheduler(VirtualFilesystem *vfs, ArchiveIndex *index, SpanRecorder *spans) {
+	VFS = vfs;
+	Index = index;
+	Spans = spans;
+
+	Config = NULL;
+
+	Modules = NULL;
+	ModuleCount = 0;
+	ModuleCapacity = 0;
+
+	WaveCount = 0;
+	Total = 0;
+}
+
+PreloadScheduler::~PreloadScheduler() {
+	if(Modules != NULL) {
+		for (size_t i = 0; i < ModuleCount; ++i) Release(&Modules[i]);
+		Free(Modules);
+	}
+
+	if(Config != NULL) Free(Config);
+}
+
+bool PreloadScheduler::Parse(const char *config, size_t size) {
+	if(Config != NULL) return false;
+
+	/* Names are terminated in place, so we keep our own copy */
+	Config = (char*)Malloc(size + 1);
+	if(Config == NULL) return false;
+
+	Memcpy(Config, config, size);
+	Config[size] = '\0';
+
+	size_t position = 0;
+	while(position < size) {
+		size_t lineStart = position;
+		while(position < size && !IsLineEnd(Config[position])) ++position;
+		size_t lineEnd = position;
+
+		/* Step over the line break, whatever its style */
+		while(position < size && IsLineEnd(Config[position])) ++position;
+
+		while(lineStart < lineEnd && IsBlank(Config[lineStart])) ++lineStart;
+		if(lineStart == lineEnd || Config[lineStart] == '#') continue;
+
+		size_t equals = lineStart;
+		while(equals < lineEnd && Config[equals] != '=') ++equals;
+		if(equals == lineEnd) continue;
+
+		size_t keyStart = lineStart;
+		size_t keyLength = TrimField(Config, &keyStart, equals);
+		if(keyLength != 6 || Memcmp(&Config[keyStart], "always", 6) != 0) continue;
+
+		size_t colon = equals + 1;
+		while(colon < lineEnd && Config[colon] != ':') ++colon;
+
+		size_t nameStart = equals + 1;
+		size_t nameLength = TrimField(Config, &nameStart, colon);
+		if(nameLength == 0) continue;
+
+		if(nameLength + 9 >= MAX_PATH_SIZE) {
+			MKMI_Printf("Preload: module name too long.\r\n");
+			continue;
+		}
+
+		PreloadModule *module = AddModule(&Config[nameStart], nameLength);
+		if(module == NULL) return false;
+
+		/* The colon has been found already, so the name can be terminated */
+		Config[nameStart + nameLength] = '\0';
+
+		size_t dependencyStart = colon + 1;
+		while(dependencyStart < lineEnd) {
+			size_t comma = dependencyStart;
+			while(comma < lineEnd && Config[comma] != ',') ++comma;
+
+			size_t start = dependencyStart;
+			size_t length = TrimField(Config, &start, comma);
+			dependencyStart = comma + 1;
+
+			if(length == 0) continue;
+
+			if(module->DependencyCount == PRELOAD_MAX_DEPENDENCIES) {
+				MKMI_Printf("Preload: %s has too many dependencies.\r\n", module->Name);
+				break;
+			}
+
+			module->DependencyNames[module->DependencyCount] = &Config[start];
+			module->DependencyLengths[module->DependencyCount] = length;
+			++module->DependencyCount;
+
+			Config[start + length] = '\0';
+		}
+	}
+
+	ResolveDependencies();
+
+	return true;
+}
+
+PreloadModule *PreloadScheduler::AddModule(const char *name, size_t length) {
+	intmax_t existing = FindModule(name, length);
+	if(existing >= 0) return &Modules[existing];
+
+	if(ModuleCount == ModuleCapacity) {
+		size_t newCapacity = ModuleCapacity == 0 ? 8 : ModuleCapacity * 2;
+		PreloadModule *modules = (PreloadModule*)Malloc(newCapacity * sizeof(PreloadModule));
+		if(modules == NULL) return NULL;
+
+		if(Modules != NULL) {
+			Memcpy(modules, Modules, ModuleCount * sizeof(PreloadModule));
+			Free(Modules);
+		}
+
+		Modules = modules;
+		ModuleCapacity = newCapacity;
+	}
+
+	PreloadModule *module = &Modules[ModuleCount++];
+	Memset(module, 0, sizeof(PreloadModule));
+
+	module->Name = name;
+	module->NameLength = length;
+	module->Wave = PRELOAD_NO_WAVE;
+	module->State = PRELOAD_PENDING;
+	module->CriticalParent = -1;
+
+	return module;
+}
+
+intmax_t PreloadScheduler::FindModule(const char *name, size_t length) {
+	for (size_t i = 0; i < ModuleCount; ++i) {
+		if(Modules[i].NameLength == length && Memcmp(Modules[i].Name, name, length) == 0) return i;
+	}
+
+	return -1;
+}
+
+void PreloadScheduler::ResolveDependencies() {
+	for (size_t i = 0; i < ModuleCount; ++i) {
+		PreloadModule *module = &Modules[i];
+
+		size_t kept = 0;
+		for (size_t j = 0; j < module->DependencyCount; ++j) {
+			intmax_t dependency = FindModule(module->DependencyNames[j], module->DependencyLengths[j]);
+
+			if(dependency < 0) {
+				MKMI_Printf("Preload: %s depends on %s, which is not preloaded.\r\n", module->Name, module->DependencyNames[j]);
+				continue;
+			}
+
+			if((size_t)dependency == i) continue;
+
+			module->DependencyNames[kept] = module->DependencyNames[j];
+			module->DependencyLengths[kept] = module->DependencyLengths[j];
+			module->Dependencies[kept] = dependency;
+			++kept;
+		}
+
+		module->DependencyCount = kept;
+	}
+
+	/* A module goes one wave after the latest of its dependencies.
+	   Every round places at least one module unless the rest form a cycle */
+	size_t placed = 0;
+	bool progress = true;
+	while(placed < ModuleCount && progress) {
+		progress = false;
+
+		for (size_t i = 0; i < ModuleCount; ++i) {
+			PreloadModule *module = &Modules[i];
+			if(module->Wave != PRELOAD_NO_WAVE) continue;
+
+			intmax_t wave = 0;
+			bool ready = true;
+			for (size_t j = 0; j < module->DependencyCount; ++j) {
+				PreloadModule *dependency = &Modules[module->Dependencies[j]];
+
+				if(dependency->Wave == PRELOAD_NO_WAVE) {
+					ready = false;
+					break;
+				}
+
+				if(dependency->Wave + 1 > wave) wave = dependency->Wave + 1;
+			}
+
+			if(!ready) continue;
+
+			module->Wave = wave;
+			if(wave + 1 > WaveCount) WaveCount = wave + 1;
+
+			++placed;
+			progress = true;
+		}
+	}
+
+	for (size_t i = 0; i < ModuleCount; ++i) {
+		if(Modules[i].Wave != PRELOAD_NO_WAVE) continue;
+
+		MKMI_Printf("Preload: %s is part of a dependency cycle, not starting it.\r\n", Modules[i].Name);
+		Modules[i].State = PRELOAD_FAILED;
+	}
+}
+
+void PreloadScheduler::Locate(PreloadModule *module) {
+	char path[MAX_PATH_SIZE];
+
+	if(Index != NULL) {
+		Strcpy(path, "modules/");
+		Strcpy(path + 8, module->Name);
+
+		FindInArchive(Index, path, &module->Image, &module->ImageSize);
+	} else {
+		/* Nothing but the filesystem to go by */
+		Strcpy(path, "/modules/");
+		Strcpy(path + 9, module->Name);
+
+		VNode executable;
+		if(VFS->ResolvePath(path, &executable) != 0) return;
+		if(!(executable.Properties & NODE_PROPERTY_FILE)) return;
+
+		FSMapNodeRequest mapRequest;
+		mapRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+		mapRequest.Request = NODE_MAP;
+		mapRequest.Node = executable.Inode;
+		mapRequest.Address = 0;
+		mapRequest.Size = 0;
+
+		if(VFS->DoFilesystemOperation(executable.FSDescriptor, &mapRequest) == 0 && mapRequest.Address != 0) {
+			module->Image = (uint8_t*)mapRequest.Address;
+			module->ImageSize = mapRequest.Size;
+		} else if(executable.Size != 0) {
+			uint8_t *image = (uint8_t*)VFS->GetRequestPool()->Allocate(executable.Size);
+			if(image == NULL) return;
+
+			FSScatterNodeRequest readRequest;
+			readRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+			readRequest.Request = NODE_READ_SCATTER;
+			readRequest.Node = executable.Inode;
+			readRequest.Offset = 0;
+			readRequest.Size = executable.Size;
+			readRequest.Address = (uintptr_t)image;
+
+			VFS->DoFilesystemOperation(executable.FSDescriptor, &readRequest);
+			if(readRequest.Result != (result_t)executable.Size) {
+				VFS->GetRequestPool()->Release(image);
+				return;
+			}
+
+			module->Allocation = image;
+			module->Image = image;
+			module->ImageSize = executable.Size;
+		}
+	}
+
+	if(module->Image != NULL && module->ImageSize != 0) module->State = PRELOAD_LOCATED;
+}
+
+void PreloadScheduler::Launch(PreloadModule *module) {
+	Syscall(SYSCALL_PROC_EXEC, module->Image, module->ImageSize, 0, 0, 0, 0);
+	module->State = PRELOAD_LAUNCHED;
+}
+
+void PreloadScheduler::Release(PreloadModule *module) {
+	if(module->Allocation != NULL) VFS->GetRequestPool()->Release(module->Allocation);
+
+	module->Allocation = NULL;
+	module->Image = NULL;
+	module->ImageSize = 0;
+}
+
+void PreloadScheduler::Run() {
+	uint64_t start = ReadTimestamp();
+
+	/* Lookups do not depend on each other, so they all happen up front */
+	for (size_t i = 0; i < ModuleCount; ++i) {
+		PreloadModule *module = &Modules[i];
+		if(module->State != PRELOAD_PENDING) continue;
+
+		intmax_t span = Spans == NULL ? SPAN_NONE : Spans->Begin("locate", module->Name, module->NameLength);
+
+		uint64_t before = ReadTimestamp();
+		Locate(module);
+		module->LocateTime = ReadTimestamp() - before;
+
+		if(Spans != NULL) Spans->End(span);
+
+		if(module->State != PRELOAD_LOCATED) {
+			MKMI_Printf("Preload: %s not found.\r\n", module->Name);
+			module->State = PRELOAD_FAILED;
+		}
+	}
+
+	for (intmax_t wave = 0; wave < WaveCount; ++wave) {
+		intmax_t waveSpan = Spans == NULL ? SPAN_NONE : Spans->Begin("wave");
+
+		for (size_t i = 0; i < ModuleCount; ++i) {
+			PreloadModule *module = &Modules[i];
+			if(module->Wave != wave || module->State != PRELOAD_LOCATED) continue;
+
+			uint64_t parentFinish = 0;
+			bool ready = true;
+			for (size_t j = 0; j < module->DependencyCount; ++j) {
+				PreloadModule *dependency = &Modules[module->Dependencies[j]];
+
+				if(dependency->State != PRELOAD_LAUNCHED) {
+					ready = false;
+					break;
+				}
+
+				if(dependency->Finish >= parentFinish) {
+					parentFinish = dependency->Finish;
+					module->CriticalParent = module->Dependencies[j];
+				}
+			}
+
+			if(!ready) {
+				MKMI_Printf("Preload: not starting %s, a dependency failed.\r\n", module->Name);
+				module->State = PRELOAD_FAILED;
+				Release(module);
+				continue;
+			}
+
+			MKMI_Printf("Starting modules/%s\r\n", module->Name);
+
+			intmax_t span = Spans == NULL ? SPAN_NONE : Spans->Begin("launch", module->Name, module->NameLength);
+
+			uint64_t before = ReadTimestamp();
+			Launch(module);
+			module->LaunchTime = ReadTimestamp() - before;
+
+			if(Spans != NULL) Spans->End(span);
+
+			module->Finish = parentFinish + module->LocateTime + module->LaunchTime;
+
+			Release(module);
+		}
+
+		if(Spans != NULL) Spans->End(waveSpan);
+	}
+
+	Total = ReadTimestamp() - start;
+}
+
+void PreloadScheduler::PrintTimes() {
+	MKMI_Printf("Preload took %d ticks over %d waves.\r\n", Total, WaveCount);
+
+	intmax_t slowest = -1;
+	for (size_t i = 0; i < ModuleCount; ++i) {
+		PreloadModule *module = &Modules[i];
+
+		if(module->State != PRELOAD_LAUNCHED) {
+			MKMI_Printf(" %s: not started\r\n", module->Name);
+			continue;
+		}
+
+		MKMI_Printf(" %s: wave %d, located in %d, launched in %d ticks\r\n",
+				module->Name, module->Wave, module->LocateTime, module->LaunchTime);
+
+		if(slowest < 0 || module->Finish > Modules[slowest].Finish) slowest = i;
+	}
+
+	if(slowest < 0) return;
+
+	/* Walk the slowest chain back to where it started */
+	MKMI_Printf("Critical path (%d ticks):", Modules[slowest].Finish);
+	for (intmax_t i = slowest; i >= 0; i = Modules[i].CriticalParent) {
+		MKMI_Printf(" %s", Modules[i].Name);
+		if(Modules[i].CriticalParent >= 0) MKMI_Printf(" <-");
+	}
+	MKMI_Printf("\r\n");
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../vfs/vfs.h"
+#include "../vfs/ustar.h"
+#include "../util/span.h"
+
+#define PRELOAD_MAX_DEPENDENCIES 8
+#define PRELOAD_NO_WAVE          -1
+
+enum PreloadState {
+	PRELOAD_PENDING,
+	PRELOAD_LOCATED,
+	PRELOAD_LAUNCHED,
+	PRELOAD_FAILED,
+};
+
+struct PreloadModule {
+	/* Points into the scheduler's copy of the config */
+	const char *Name;
+	size_t NameLength;
+
+	const char *DependencyNames[PRELOAD_MAX_DEPENDENCIES];
+	size_t DependencyLengths[PRELOAD_MAX_DEPENDENCIES];
+	size_t Dependencies[PRELOAD_MAX_DEPENDENCIES];
+	size_t DependencyCount;
+
+	/* Modules in the same wave do not depend on each other */
+	intmax_t Wave;
+	PreloadState State;
+
+	uint8_t *Image;
+	size_t ImageSize;
+	/* Set when the image had to be read out of the filesystem, into a block of the request pool */
+	void *Allocation;
+
+	uint64_t LocateTime;
+	uint64_t LaunchTime;
+
+	/* Time from the start of the preload until this module was launched,
+	   following the slowest chain of dependencies */
+	uint64_t Finish;
+	intmax_t CriticalParent;
+};
+
+/* Starts the modules listed in preload.conf.
+ * Every line has the form always=<module>[:<dependency>[,<dependency>...]],
+ * where dependencies are other modules of the same file.
+ * Modules are located all at once, then launched in waves so that a module
+ * is only started after everything it depends on.
+ */
+class PreloadScheduler {
+public:
+	/* Locating and launching every module gets a span, if there is a recorder */
+	PreloadScheduler(VirtualFilesystem *vfs, ArchiveIndex *index, SpanRecorder *spans);
+	~PreloadScheduler();
+
+	bool Parse(const char *config, size_t size);
+	void Run();
+	void PrintTimes();
+private:
+	PreloadModule *AddModule(const char *name, size_t length);
+	intmax_t FindModule(const char *name, size_t length);
+	void ResolveDependencies();
+	void Locate(PreloadModule *module);
+	void Launch(PreloadModule *module);
+	void Release(PreloadModule *module);
+
+	VirtualFilesystem *VFS;
+	ArchiveIndex *Index;
+	SpanRecorder *Spans;
+
+	char *Config;
+
+	PreloadModule *Modules;
+	size_t ModuleCount;
+	size_t ModuleCapacity;
+
+	intmax_t WaveCount;
+	uint64_t Total;
+};
@@ -0,0 +1,288 @@
+#include "ramfs.h"
+#include "image.h"
+
+#include <mkmi.h>
+
+static size_t AlignImage(size_t value) {
+	return (value + RAMFS_IMAGE_ALIGNMENT - 1) & ~(size_t)(RAMFS_IMAGE_ALIGNMENT - 1);
+}
+
+size_t RamFS::CountSlots(InodeTableObject *dir) {
+	size_t count = 0;
+	size_t slot = 0;
+
+	for (DirectoryVNodeTable *table = dir->DirectoryTable; table != NULL; table = table->NextTable) {
+		for (size_t i = 0; i < NODES_IN_VNODE_TABLE; ++i, ++slot) {
+			if(table->Elements[i] == NULL || table->Elements[i] == FREED_SLOT) continue;
+			count = slot + 1;
+		}
+	}
+
+	return count;
+}
+
+intmax_t RamFS::DumpImage(void *buffer, const size_t size) {
+	size_t nodeCount = 0;
+	size_t slotCount = 0;
+	size_t namesSize = 0;
+	size_t dataSize = 0;
+
+	for (inode_t i = 0; i < MaxInodes; ++i) {
+		InodeTableObject *node = &InodeTable[i];
+		if(node->Available) continue;
+
+		nodeCount = i + 1;
+		namesSize += Strlen(node->NodeData.Name);
+
+		if(node->NodeData.Properties & NODE_PROPERTY_DIRECTORY) {
+			slotCount += CountSlots(node);
+		} else if(node->NodeData.Properties & NODE_PROPERTY_FILE) {
+			dataSize += AlignImage(node->NodeData.Size);
+		}
+	}
+
+	size_t nodesOffset = AlignImage(sizeof(RamFSImageHeader));
+	size_t slotsOffset = AlignImage(nodesOffset + nodeCount * sizeof(RamFSImageNode));
+	size_t namesOffset = slotsOffset + slotCount * sizeof(int64_t);
+	size_t dataOffset = AlignImage(namesOffset + namesSize);
+	size_t imageSize = dataOffset + dataSize;
+
+	/* Callers that do not have room yet get to know how much they need */
+	if(buffer == NULL || size < imageSize) return imageSize;
+
+	uint8_t *image = (uint8_t*)buffer;
+	Memset(image, 0, dataOffset);
+
+	RamFSImageHeader *header = (RamFSImageHeader*)image;
+	Memcpy(header->Magic, RAMFS_IMAGE_MAGIC, sizeof(header->Magic));
+	header->Version = RAMFS_IMAGE_VERSION;
+	header->NodeSize = sizeof(RamFSImageNode);
+	header->NodeCount = nodeCount;
+	header->NodesOffset = nodesOffset;
+	header->SlotCount = slotCount;
+	header->SlotsOffset = slotsOffset;
+	header->NamesSize = namesSize;
+	header->NamesOffset = namesOffset;
+	header->DataOffset = dataOffset;
+	header->ImageSize = imageSize;
+
+	RamFSImageNode *records = (RamFSImageNode*)(image + nodesOffset);
+	int64_t *slots = (int64_t*)(image + slotsOffset);
+
+	size_t slot = 0;
+	size_t name = namesOffset;
+	size_t data = dataOffset;
+
+	for (size_t i = 0; i < nodeCount; ++i) {
+		InodeTableObject *node = &InodeTable[i];
+		RamFSImageNode *record = &records[i];
+
+		record->Directory = RAMFS_IMAGE_NO_NODE;
+		if(node->Available) continue;
+
+		record->Used = 1;
+		record->Properties = node->NodeData.Properties;
+		if(i != 0) record->Directory = node->NodeData.Directory;
+
+		record->NameOffset = name;
+		record->NameLength = Strlen(node->NodeData.Name);
+		Memcpy(image + name, node->NodeData.Name, record->NameLength);
+		name += record->NameLength;
+
+		if(node->NodeData.Properties & NODE_PROPERTY_DIRECTORY) {
+			size_t count = CountSlots(node);
+
+			record->Offset = slot;
+			record->Size = count;
+
+			DirectoryVNodeTable *table = node->DirectoryTable;
+			for (size_t j = 0; j < count; ++j) {
+				if(j != 0 && j % NODES_IN_VNODE_TABLE == 0) table = table->NextTable;
+
+				InodeTableObject *child = table->Elements[j % NODES_IN_VNODE_TABLE];
+				if(child == NULL || child == FREED_SLOT) {
+					slots[slot++] = RAMFS_IMAGE_NO_NODE;
+				} else {
+					slots[slot++] = child->NodeData.Inode;
+				}
+			}
+		} else if(node->NodeData.Properties & NODE_PROPERTY_FILE) {
+			size_t fileSize = node->NodeData.Size;
+
+			record->Offset = data;
+			record->Size = fileSize;
+
+			if(ReadNode(i, 0, fileSize, image + data) != (intmax_t)fileSize) return -1;
+			Memset(image + data + fileSize, 0, AlignImage(fileSize) - fileSize);
+
+			data += AlignImage(fileSize);
+		}
+	}
+
+	return imageSize;
+}
+
+bool RamFS::CheckImage(const uint8_t *image, const size_t size) {
+	if(size < sizeof(RamFSImageHeader)) return false;
+
+	const RamFSImageHeader *header = (const RamFSImageHeader*)image;
+
+	if(Memcmp(header->Magic, RAMFS_IMAGE_MAGIC, sizeof(header->Magic)) != 0) return false;
+	if(header->Version != RAMFS_IMAGE_VERSION) return false;
+	if(header->NodeSize != sizeof(RamFSImageNode)) return false;
+	if(header->ImageSize > size) return false;
+
+	size_t imageSize = header->ImageSize;
+
+	if(header->NodeCount == 0 || header->NodeCount > (uint64_t)MaxInodes) return false;
+	if(header->NodesOffset > imageSize ||
+	   header->NodeCount > (imageSize - header->NodesOffset) / sizeof(RamFSImageNode)) return false;
+	if(header->SlotsOffset > imageSize ||
+	   header->SlotCount > (imageSize - header->SlotsOffset) / sizeof(int64_t)) return false;
+	if(header->NamesOffset > imageSize || header->NamesSize > imageSize - header->NamesOffset) return false;
+	if(header->DataOffset > imageSize) return false;
+
+	/* One flag per node, for those a directory has already claimed */
+	uint8_t *seen = (uint8_t*)Malloc(header->NodeCount);
+	if(seen == NULL) return false;
+
+	Memset(seen, 0, header->NodeCount);
+	bool valid = CheckImageNodes(image, imageSize, seen);
+	Free(seen);
+
+	return valid;
+}
+
+bool RamFS::CheckImageNodes(const uint8_t *image, size_t imageSize, uint8_t *seen) {
+	const RamFSImageHeader *header = (const RamFSImageHeader*)image;
+	const RamFSImageNode *records = (const RamFSImageNode*)(image + header->NodesOffset);
+	const int64_t *slots = (const int64_t*)(image + header->SlotsOffset);
+
+	if(!records[0].Used || !(records[0].Properties & NODE_PROPERTY_DIRECTORY)) return false;
+
+	/* Every node but the root has to show up in exactly one directory */
+	size_t used = 0;
+	size_t referenced = 0;
+
+	for (size_t i = 0; i < header->NodeCount; ++i) {
+		const RamFSImageNode *record = &records[i];
+		if(!record->Used) continue;
+
+		++used;
+
+		if(record->NameLength >= MAX_NAME_SIZE || record->NameLength > header->NamesSize) return false;
+		if(record->NameOffset < header->NamesOffset ||
+		   record->NameOffset - header->NamesOffset > header->NamesSize - record->NameLength) return false;
+
+		if(record->Properties & NODE_PROPERTY_DIRECTORY) {
+			if(record->Offset > header->SlotCount || record->Size > header->SlotCount - record->Offset) return false;
+
+			for (size_t j = 0; j < record->Size; ++j) {
+				int64_t child = slots[record->Offset + j];
+				if(child == RAMFS_IMAGE_NO_NODE) continue;
+
+				if(child <= 0 || (uint64_t)child >= header->NodeCount) return false;
+				if(!records[child].Used || records[child].Directory != (int64_t)i) return false;
+
+				/* A node in two slots would be restored into the last, leaving the first dangling */
+				if(seen[child]) return false;
+				seen[child] = 1;
+
+				++referenced;
+			}
+		} else if(record->Properties & NODE_PROPERTY_FILE) {
+			if(record->Offset < header->DataOffset || record->Offset > imageSize) return false;
+			if(record->Size > imageSize - record->Offset) return false;
+		} else {
+			return false;
+		}
+	}
+
+	return referenced == used - 1;
+}
+
+bool RamFS::RestoreImage(const void *image, const size_t size) {
+	const uint8_t *base = (const uint8_t*)image;
+
+	/* Only an empty tree can be replaced, and never that of a snapshot */
+	if(ReadOnly || CountSlots(&InodeTable[0]) != 0) return false;
+
+	/* A bad image is turned down before anything is touched */
+	if(!CheckImage(base, size)) return false;
+
+	const RamFSImageHeader *header = (const RamFSImageHeader*)base;
+	const RamFSImageNode *records = (const RamFSImageNode*)(base + header->NodesOffset);
+	const int64_t *slots = (const int64_t*)(base + header->SlotsOffset);
+
+	for (size_t i = 0; i < header->NodeCount; ++i) {
+		const RamFSImageNode *record = &records[i];
+		if(!record->Used) continue;
+
+		InodeTableObject *node = &InodeTable[i];
+
+		/* The root is already there, and keeps its table */
+		if(i != 0) {
+			node->Available = false;
+
+			Memset(node->NodeData.Name, 0, MAX_NAME_SIZE);
+			Memcpy(node->NodeData.Name, base + record->NameOffset, record->NameLength);
+
+			node->NodeData.FSDescriptor = Descriptor;
+			node->NodeData.Inode = i;
+			node->NodeData.Directory = record->Directory;
+			node->NodeData.Size = 0;
+			node->BackingData = NULL;
+			node->BackingSize = 0;
+		}
+
+		if(record->Properties & NODE_PROPERTY_DIRECTORY) {
+			if(i != 0) {
+				node->NodeData.Properties = NODE_PROPERTY_DIRECTORY;
+				node->DirectoryTable = new DirectoryVNodeTable;
+				node->DirectoryTable->NextTable = NULL;
+				Memset(node->DirectoryTable->Elements, 0, NODES_IN_VNODE_TABLE * sizeof(uintptr_t));
+			}
+
+			node->FreeSlotHint = record->Size;
+
+			DirectoryVNodeTable *table = node->DirectoryTable;
+			for (size_t j = 0; j < record->Size; ++j) {
+				if(j != 0 && j % NODES_IN_VNODE_TABLE == 0) {
+					if(table->NextTable == NULL) {
+						table->NextTable = new DirectoryVNodeTable;
+						table->NextTable->NextTable = NULL;
+						Memset(table->NextTable->Elements, 0, NODES_IN_VNODE_TABLE * sizeof(uintptr_t));
+					}
+
+					table = table->NextTable;
+				}
+
+				int64_t child = slots[record->Offset + j];
+				InodeTableObject **slot = &table->Elements[j % NODES_IN_VNODE_TABLE];
+
+				if(child == RAMFS_IMAGE_NO_NODE) {
+					*slot = NULL;
+					if(j < node->FreeSlotHint) node->FreeSlotHint = j;
+					continue;
+				}
+
+				*slot = &InodeTable[child];
+				InodeTable[child].DirectorySlot = slot;
+				InodeTable[child].SlotIndex = j;
+			}
+		} else {
+			node->NodeData.Properties = NODE_PROPERTY_FILE;
+			node->BlockTable = CreateBlockTable(0, BLOCK_SHIFT);
+
+			/* The contents stay in the image */
+			node->BackingData = base + record->Offset;
+			node->BackingSize = record->Size;
+			node->NodeData.Size = record->Size;
+		}
+	}
+
+	FreeInodeHint = 1;
+	while(FreeInodeHint < MaxInodes && !InodeTable[FreeInodeHint].Available) ++FreeInodeHint;
+
+	return true;
+}
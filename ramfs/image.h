@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/* A RamFS image is a single position independent blob.
+ * Every reference inside it is an offset from the start of the image,
+ * so it can be used from wherever it happens to be mapped.
+ *
+ * Layout: header, node records indexed by inode, directory slots,
+ * names, then file contents. File contents are used in place as the
+ * backing data of their nodes and are never copied on restore.
+ */
+
+#define RAMFS_IMAGE_MAGIC      "RAMFSIMG"
+#define RAMFS_IMAGE_VERSION    1
+
+/* File contents are aligned to this inside the image */
+#define RAMFS_IMAGE_ALIGNMENT  16
+
+/* Slot that is empty in its directory */
+#define RAMFS_IMAGE_NO_NODE    -1
+
+struct RamFSImageHeader {
+	char Magic[8];
+	uint32_t Version;
+	uint32_t NodeSize;
+
+	uint64_t NodeCount;
+	uint64_t NodesOffset;
+
+	uint64_t SlotCount;
+	uint64_t SlotsOffset;
+
+	uint64_t NamesSize;
+	uint64_t NamesOffset;
+
+	uint64_t DataOffset;
+	uint64_t ImageSize;
+}__attribute__((packed));
+
+struct RamFSImageNode {
+	uint8_t Used;
+	uint32_t Properties;
+
+	int64_t Directory;
+
+	uint64_t NameOffset;
+	uint32_t NameLength;
+
+	/* For files, where the contents are and how long they are.
+	   For directories, their first slot and how many slots they have */
+	uint64_t Offset;
+	uint64_t Size;
+}__attribute__((packed));
@@ -2,10 +2,43 @@
 
 #include <mkmi.h>
 
+#include "../compress/lz4.h"
+#include "../util/timestamp.h"
+
+static inline bool IsShared(BlockTable *table, size_t index) {
+	return table->Flags[index] & BLOCK_SHARED;
+}
+
+static inline void SetShared(BlockTable *table, size_t index, bool shared) {
+	if(shared) table->Flags[index] |= BLOCK_SHARED;
+	else table->Flags[index] &= ~BLOCK_SHARED;
+}
+
+static inline bool IsCompressed(BlockTable *table, size_t index) {
+	return table->Flags[index] & BLOCK_COMPRESSED;
+}
+
 RamFS::RamFS(inode_t maxInodes) {
 	Descriptor = 0;
 	MaxInodes = maxInodes;
 	InodeTable = new InodeTableObject[MaxInodes];
+	FreeInodeHint = 1;
+
+	Shares = new BlockShares;
+	Memset(Shares, 0, sizeof(BlockShares));
+	Shares->Users = 1;
+
+	ReadOnly = false;
+
+	CompactThreshold = SIZE_MAX;
+	CompactInode = 0;
+	CompactOffset = 0;
+	CompactBuffer = NULL;
+	CompactBufferSize = 0;
+
+	Deduplicate = false;
+	DedupInode = 0;
+	DedupOffset = 0;
 
 	InodeTableObject *node = &InodeTable[0];
 	node->Available = false;
@@ -13,6 +46,7 @@ RamFS::RamFS(inode_t maxInodes) {
 	node->NodeData.FSDescriptor = 0;
 	node->NodeData.Properties = NODE_PROPERTY_DIRECTORY;
 	node->NodeData.Inode = 0;
+	node->NodeData.Size = 0;
 
 	node->DirectoryTable = new DirectoryVNodeTable;
 	node->DirectoryTable->NextTable = NULL;
@@ -21,7 +55,32 @@ RamFS::RamFS(inode_t maxInodes) {
 }
 
 RamFS::~RamFS() {
-	delete InodeTable;
+	for (inode_t i = 0; i < MaxInodes; ++i) {
+		InodeTableObject *node = &InodeTable[i];
+		if(node->Available) continue;
+
+		if(node->NodeData.Properties & NODE_PROPERTY_DIRECTORY) {
+			DirectoryVNodeTable *table = node->DirectoryTable;
+			while(table != NULL) {
+				DirectoryVNodeTable *next = table->NextTable;
+				delete table;
+				table = next;
+			}
+		} else if(node->NodeData.Properties & NODE_PROPERTY_FILE) {
+			/* Blocks may still be in use by a snapshot, or by what this is a snapshot of */
+			ReleaseBlockTables(node->BlockTable);
+		}
+	}
+
+	delete[] InodeTable;
+
+	if(CompactBuffer != NULL) Free(CompactBuffer);
+
+	if(--Shares->Users != 0) return;
+
+	if(Shares->Blocks != NULL) Free(Shares->Blocks);
+	if(Shares->Index != NULL) Free(Shares->Index);
+	delete Shares;
 }
 
 int RamFS::ListDirectory(const inode_t directory) {
@@ -47,7 +106,7 @@ int RamFS::ListDirectory(const inode_t directory) {
 	MKMI_Printf("   Name   Inode\r\n");
 	while(true) {
 		for (size_t i = 0; i < NODES_IN_VNODE_TABLE; ++i) {
-			if(table->Elements[i] == NULL || table->Elements[i] == -1) continue;
+			if(table->Elements[i] == NULL || table->Elements[i] == FREED_SLOT) continue;
 
 			MKMI_Printf(" -> %s   %d\r\n", table->Elements[i]->NodeData.Name, table->Elements[i]->NodeData.Inode);
 		}
@@ -60,6 +119,7 @@ int RamFS::ListDirectory(const inode_t directory) {
 }
 
 VNode *RamFS::CreateNode(const inode_t directory, const char name[MAX_NAME_SIZE], property_t flags) {
+	if (ReadOnly) return 0;
 	if (directory > MaxInodes) return 0;
 	if (flags == 0) return 0;
 				
@@ -78,49 +138,39 @@ VNode *RamFS::CreateNode(const inode_t directory, const char name[MAX_NAME_SIZE]
 */
 	if(dir->DirectoryTable == NULL) return 0;
 			
-	DirectoryVNodeTable *table = dir->DirectoryTable;
-
-	for (size_t i = 1; i < MaxInodes; ++i) {
+	for (size_t i = FreeInodeHint; i < (size_t)MaxInodes; ++i) {
 		if(InodeTable[i].Available) {
+			size_t slotIndex;
+			InodeTableObject **slot = AllocateSlot(dir, &slotIndex);
+			if(slot == NULL) return 0;
+
+			FreeInodeHint = i + 1;
 			InodeTable[i].Available = false;
 			
 			InodeTable[i].NodeData.FSDescriptor = Descriptor;
 
 			Memcpy(InodeTable[i].NodeData.Name, name, MAX_NAME_SIZE);
 			InodeTable[i].NodeData.Inode = i;
+			InodeTable[i].NodeData.Properties = 0;
+			InodeTable[i].NodeData.Size = 0;
+			InodeTable[i].BackingData = NULL;
+			InodeTable[i].BackingSize = 0;
 
 			if(flags & NODE_PROPERTY_DIRECTORY) {
 				InodeTable[i].NodeData.Properties |= NODE_PROPERTY_DIRECTORY; 
 				InodeTable[i].DirectoryTable = new DirectoryVNodeTable;
 				InodeTable[i].DirectoryTable->NextTable = NULL;
+				InodeTable[i].FreeSlotHint = 0;
 				Memset(InodeTable[i].DirectoryTable->Elements, 0, NODES_IN_VNODE_TABLE * sizeof(uintptr_t));
 			} else if (flags & NODE_PROPERTY_FILE) {
 				InodeTable[i].NodeData.Properties |= NODE_PROPERTY_FILE;
-				InodeTable[i].BlockTable = new BlockTable;
-				InodeTable[i].BlockTable->NextTable = NULL;
-				Memset(InodeTable[i].BlockTable->Blocks, 0, BLOCKS_IN_BLOCK_TABLE * sizeof(uintptr_t));
+				InodeTable[i].BlockTable = CreateBlockTable(0, BLOCK_SHIFT);
 			}
 
-			bool found = false;
-			while(true) {
-				for (size_t j = 0; j < NODES_IN_VNODE_TABLE; ++j) {
-					if(table->Elements[j] != NULL && table->Elements[j] != -1) continue;
-
-					table->Elements[j] = &InodeTable[i];
-					found = true;
-					break;
-				}
-
-				if(found) break;
-
-				if(table->NextTable == NULL) {
-					table->NextTable = new DirectoryVNodeTable;
-					table->NextTable->NextTable = NULL;
-					if (table->NextTable == NULL || table->NextTable == -1) return 0;
-					Memset(table->NextTable->Elements, 0, NODES_IN_VNODE_TABLE * sizeof(uintptr_t));
-				}
-				table = table->NextTable;
-			}
+			*slot = &InodeTable[i];
+			InodeTable[i].DirectorySlot = slot;
+			InodeTable[i].SlotIndex = slotIndex;
+			InodeTable[i].NodeData.Directory = directory;
 
 			return &InodeTable[i].NodeData;
 		}
@@ -129,20 +179,171 @@ VNode *RamFS::CreateNode(const inode_t directory, const char name[MAX_NAME_SIZE]
 	return 0;
 }
 
+InodeTableObject **RamFS::AllocateSlot(InodeTableObject *dir, size_t *index) {
+	DirectoryVNodeTable *table = dir->DirectoryTable;
+
+	/* Start looking from the first slot that may be free */
+	size_t slot = dir->FreeSlotHint;
+	for (size_t i = 0; i < slot / NODES_IN_VNODE_TABLE; ++i) {
+		if(table->NextTable == NULL) {
+			table->NextTable = new DirectoryVNodeTable;
+			if (table->NextTable == NULL || table->NextTable == FREED_SLOT) return NULL;
+			table->NextTable->NextTable = NULL;
+			Memset(table->NextTable->Elements, 0, NODES_IN_VNODE_TABLE * sizeof(uintptr_t));
+		}
+		table = table->NextTable;
+	}
+
+	while(true) {
+		for (size_t j = slot % NODES_IN_VNODE_TABLE; j < NODES_IN_VNODE_TABLE; ++j, ++slot) {
+			if(table->Elements[j] != NULL && table->Elements[j] != FREED_SLOT) continue;
+
+			dir->FreeSlotHint = slot + 1;
+			*index = slot;
+			return &table->Elements[j];
+		}
+
+		if(table->NextTable == NULL) {
+			table->NextTable = new DirectoryVNodeTable;
+			if (table->NextTable == NULL || table->NextTable == FREED_SLOT) return NULL;
+			table->NextTable->NextTable = NULL;
+			Memset(table->NextTable->Elements, 0, NODES_IN_VNODE_TABLE * sizeof(uintptr_t));
+		}
+		table = table->NextTable;
+	}
+
+	return NULL;
+}
+
+void RamFS::ReleaseSlot(InodeTableObject *node) {
+	if(node->DirectorySlot == NULL) return;
+
+	*node->DirectorySlot = NULL;
+	node->DirectorySlot = NULL;
+
+	InodeTableObject *parent = &InodeTable[node->NodeData.Directory];
+	if(node->SlotIndex < parent->FreeSlotHint) parent->FreeSlotHint = node->SlotIndex;
+}
+
+InodeTableObject *RamFS::FindInDirectory(DirectoryVNodeTable *table, const char name[MAX_NAME_SIZE]) {
+	while(table != NULL) {
+		for (size_t i = 0; i < NODES_IN_VNODE_TABLE; ++i) {
+			if(table->Elements[i] == NULL || table->Elements[i] == FREED_SLOT) continue;
+
+			if(Strcmp(name, table->Elements[i]->NodeData.Name) == 0) {
+				return table->Elements[i];
+			}
+		}
+
+		table = table->NextTable;
+	}
+
+	return NULL;
+}
+
 uintmax_t RamFS::DeleteNode(const inode_t inode) {
-	if (inode > MaxInodes) return 0;
+	if (ReadOnly) return -1;
+	/* The root can't go away */
+	if (inode <= 0 || inode >= MaxInodes) return -1;
 
 	InodeTableObject *node = &InodeTable[inode];
 
-	if(node->Available) return 0;
+	if(node->Available) return -1;
+
+	if(node->NodeData.Properties & NODE_PROPERTY_DIRECTORY) {
+		DirectoryVNodeTable *table = node->DirectoryTable;
+
+		/* Only empty directories may be deleted */
+		for (DirectoryVNodeTable *check = table; check != NULL; check = check->NextTable) {
+			for (size_t i = 0; i < NODES_IN_VNODE_TABLE; ++i) {
+				if(check->Elements[i] != NULL && check->Elements[i] != FREED_SLOT) return -1;
+			}
+		}
+
+		while(table != NULL) {
+			DirectoryVNodeTable *next = table->NextTable;
+			delete table;
+			table = next;
+		}
+	} else if(node->NodeData.Properties & NODE_PROPERTY_FILE) {
+		ReleaseBlockTables(node->BlockTable);
+	}
 
-	/* Todo */
+	ReleaseSlot(node);
+
+	node->BlockTable = NULL;
+	node->BackingData = NULL;
+	node->BackingSize = 0;
+	node->Mapped = false;
+	Memset(&node->NodeData, 0, sizeof(VNode));
+	node->Available = true;
+
+	if(inode < FreeInodeHint) FreeInodeHint = inode;
 
 	return 0;
 }
 
+VNode *RamFS::RenameNode(const inode_t inode, const inode_t directory, const char name[MAX_NAME_SIZE]) {
+	if (ReadOnly) return 0;
+	if (inode <= 0 || inode >= MaxInodes) return 0;
+	if (directory < 0 || directory >= MaxInodes) return 0;
+
+	InodeTableObject *node = &InodeTable[inode];
+	InodeTableObject *dir = &InodeTable[directory];
+
+	if(node->Available || node->DirectorySlot == NULL) return 0;
+	if(dir->Available) return 0;
+	if(!(dir->NodeData.Properties & NODE_PROPERTY_DIRECTORY)) return 0;
+	if(dir->DirectoryTable == NULL) return 0;
+
+	/* A directory can't be moved inside of itself */
+	for (inode_t parent = directory; parent != 0; parent = InodeTable[parent].NodeData.Directory) {
+		if(parent == inode) return 0;
+	}
+
+	InodeTableObject *target = FindInDirectory(dir->DirectoryTable, name);
+	if(target == node) return &node->NodeData;
+
+	InodeTableObject **slot = NULL;
+	size_t slotIndex = 0;
+
+	if(target != NULL) {
+		/* Only a node of the same kind can be replaced */
+		property_t kind = NODE_PROPERTY_FILE | NODE_PROPERTY_DIRECTORY;
+		if((target->NodeData.Properties & kind) != (node->NodeData.Properties & kind)) return 0;
+
+		if(target->NodeData.Properties & NODE_PROPERTY_DIRECTORY) {
+			uintmax_t cursor = 0;
+			DirNode entry;
+			if(ReadDirectory(target->NodeData.Inode, &cursor, sizeof(DirNode), &entry) != 0) return 0;
+		}
+
+		/* The target's slot is taken over directly, so the name never
+		   stops resolving while the old node goes away */
+		slot = target->DirectorySlot;
+		slotIndex = target->SlotIndex;
+		target->DirectorySlot = NULL;
+	} else {
+		slot = AllocateSlot(dir, &slotIndex);
+		if(slot == NULL) return 0;
+	}
+
+	ReleaseSlot(node);
+	*slot = node;
+	node->DirectorySlot = slot;
+	node->SlotIndex = slotIndex;
+
+	Memset(node->NodeData.Name, 0, MAX_NAME_SIZE);
+	Strcpy(node->NodeData.Name, name);
+	node->NodeData.Directory = directory;
+
+	if(target != NULL) DeleteNode(target->NodeData.Inode);
+
+	return &node->NodeData;
+}
+
 VNode *RamFS::GetByInode(const inode_t inode) {
-	if (inode > MaxInodes) return 0;
+	if (inode < 0 || inode >= MaxInodes) return 0;
 
 	InodeTableObject *node = &InodeTable[inode];
 
@@ -166,24 +367,10 @@ VNode *RamFS::GetByName(const inode_t directory, const char name[MAX_NAME_SIZE])
 
 	if(dir->DirectoryTable == NULL) return 0;
 
-	DirectoryVNodeTable *table = dir->DirectoryTable;
-
-	while(true) {
-		for (size_t i = 0; i < NODES_IN_VNODE_TABLE; ++i) {
-			if(table->Elements[i] == NULL || table->Elements[i] == -1) continue;
-
-			if(Strcmp(name, table->Elements[i]->NodeData.Name) == 0) {
-				return &table->Elements[i]->NodeData;
-			}
-		}
-
-		if(table->NextTable == NULL) {
-			return 0;
-		}
-		table = table->NextTable;
-	}
+	InodeTableObject *node = FindInDirectory(dir->DirectoryTable, name);
+	if(node == NULL) return 0;
 
-	return 0;
+	return &node->NodeData;
 }
 	
 VNode *RamFS::GetByIndex(const inode_t directory, const size_t index) {
@@ -216,145 +403,1109 @@ VNode *RamFS::GetByIndex(const inode_t directory, const size_t index) {
 		table = table->NextTable;
 	}
 
-	if(table->Elements[tableIndex] == NULL || table->Elements[tableIndex] == -1) return 0;
+	if(table->Elements[tableIndex] == NULL || table->Elements[tableIndex] == FREED_SLOT) return 0;
 	if(table->Elements[tableIndex]->Available) return 0;
 
 	return &table->Elements[tableIndex]->NodeData;
 }
 	
+intmax_t RamFS::ReadDirectory(const inode_t directory, uintmax_t *cursor, const size_t size, void *buffer) {
+	if (directory >= MaxInodes) return -1;
+
+	InodeTableObject *dir = &InodeTable[directory];
+
+	if(dir->Available) return -1;
+	if(!(dir->NodeData.Properties & NODE_PROPERTY_DIRECTORY)) return -1;
+
+	if(dir->DirectoryTable == NULL) return -1;
+
+	DirectoryVNodeTable *table = dir->DirectoryTable;
+
+	/* The cursor is the index of the next slot to look at. Slots are never
+	   moved around, so it stays valid across calls, and freed slots are
+	   simply skipped instead of being reported as holes */
+	uintmax_t index = *cursor;
+	size_t tablesToCross = index / NODES_IN_VNODE_TABLE;
+
+	for (size_t i = 0; i < tablesToCross; ++i) {
+		if(table->NextTable == NULL) return 0;
+		table = table->NextTable;
+	}
+
+	DirNode *entries = (DirNode*)buffer;
+	size_t maxEntries = size / sizeof(DirNode);
+	size_t count = 0;
+
+	while(true) {
+		for (size_t i = index % NODES_IN_VNODE_TABLE; i < NODES_IN_VNODE_TABLE; ++i, ++index) {
+			if(count >= maxEntries) {
+				*cursor = index;
+				return count;
+			}
+
+			InodeTableObject *element = table->Elements[i];
+			if(element == NULL || element == FREED_SLOT || element->Available) continue;
+
+			DirNode *entry = &entries[count++];
+			Memcpy(entry->Name, element->NodeData.Name, MAX_NAME_SIZE);
+			entry->Inode = element->NodeData.Inode;
+			entry->Properties = element->NodeData.Properties;
+			entry->Size = element->NodeData.Size;
+		}
+
+		if(table->NextTable == NULL) break;
+		table = table->NextTable;
+	}
+
+	*cursor = index;
+	return count;
+}
+
 VNode *RamFS::GetRootNode() {
 	VNode *node = &InodeTable[0].NodeData;
 	return node;
 }
 
 intmax_t RamFS::ReadNode(const inode_t node, const size_t offset, const size_t size, void *buffer) {
-	if (node > MaxInodes) return -1;
+	if (node >= MaxInodes) return -1;
 
 	InodeTableObject *file = &InodeTable[node];
 
 	if(file->Available) return -1;
-/*	if((file->NodeData.Properties & NODE_PROPERTY_DIRECTORY)) return -1; */
+	if(!(file->NodeData.Properties & NODE_PROPERTY_FILE)) return -1;
 	
 	if(file->BlockTable == NULL) return -1;
 
-	BlockTable *table = file->BlockTable;
+	BlockTable *hint = NULL;
+	return ReadBlocks(file, &hint, offset, size, (uint8_t*)buffer);
+}
 
-	size_t startIndexInBlock = offset % BLOCK_SIZE;
-	size_t startRoundedOffset = offset - offset % BLOCK_SIZE;
-	size_t startBlockIndex = startRoundedOffset / BLOCK_SIZE % BLOCKS_IN_BLOCK_TABLE;
-	size_t startTablesToCross = (startRoundedOffset % BLOCK_SIZE - startBlockIndex) / BLOCKS_IN_BLOCK_TABLE;
+intmax_t RamFS::ReadNodeVector(const inode_t node, const IOSegment *segments, const size_t count) {
+	if (node >= MaxInodes) return -1;
 
-	size_t end = offset + size;
-	size_t endIndexInBlock = end % BLOCK_SIZE;
-	size_t endRoundedOffset = end - end % BLOCK_SIZE;
-	size_t endBlockIndex = endRoundedOffset / BLOCK_SIZE % BLOCKS_IN_BLOCK_TABLE;
-	size_t endTablesToCross = (endRoundedOffset % BLOCK_SIZE - endBlockIndex) / BLOCKS_IN_BLOCK_TABLE;
+	InodeTableObject *file = &InodeTable[node];
 
-	for (size_t i = 0; i < startTablesToCross; ++i) {
-		if(table->NextTable == NULL) return -1;
-		table = table->NextTable;
+	if(file->Available) return -1;
+	if(!(file->NodeData.Properties & NODE_PROPERTY_FILE)) return -1;
+	
+	if(file->BlockTable == NULL) return -1;
+
+	/* Each segment starts from the table the last one was in, so ascending ones walk the chain once */
+	BlockTable *hint = NULL;
+	size_t readAmount = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		size_t read = ReadBlocks(file, &hint, segments[i].Offset, segments[i].Size, (uint8_t*)segments[i].Address);
+
+		readAmount += read;
+		if(read < segments[i].Size) break;
 	}
 
-	size_t crossedTables = startTablesToCross;
+	return readAmount;
+}
+
+size_t RamFS::ReadBlocks(InodeTableObject *file, BlockTable **hint, size_t offset, size_t size, uint8_t *buffer) {
+	if(offset >= file->NodeData.Size) return 0;
+
+	size_t toRead = size;
+	if(toRead > file->NodeData.Size - offset) toRead = file->NodeData.Size - offset;
+
+	/* Tables past the last written block may not exist yet */
+	BlockTable *table = *hint != NULL && offset >= (*hint)->Start ? *hint : file->BlockTable;
+	while(table != NULL && offset >= table->End) table = table->NextTable;
+	if(table != NULL) *hint = table;
+
+	/* Past the last table, blocks are as small as they come */
+	size_t shift = table != NULL ? table->Shift : BLOCK_SHIFT;
+	size_t relative = table != NULL ? offset - table->Start : offset;
+	size_t block = relative >> shift;
+	size_t index = relative & (((size_t)1 << shift) - 1);
+
 	size_t readAmount = 0;
-	size_t block = startBlockIndex;
-	size_t index = startIndexInBlock;
-	do {
-		while(block < BLOCKS_IN_BLOCK_TABLE) {
-			if(readAmount >= size) return readAmount;
-
-			if(table->Blocks[block] == NULL || table->Blocks[block] == -1) return -1;
-
-			if(crossedTables == endTablesToCross - 1 && block == endBlockIndex - 1) {
-				Memcpy(buffer + readAmount, &table->Blocks[block][index], BLOCK_SIZE - endBlockIndex - index);
-				readAmount += BLOCK_SIZE - endBlockIndex - index;
-			} else if(size - readAmount + index < BLOCK_SIZE) {
-				Memcpy((uintptr_t)buffer + readAmount, &table->Blocks[block][index], size);
-				readAmount += size;
-			} else {
-				Memcpy(buffer + readAmount, &table->Blocks[block][index], BLOCK_SIZE - index);
-				readAmount += BLOCK_SIZE - index;
-			}
 
-			index = 0;
-			++block;
+	while(readAmount < toRead) {
+		if(table != NULL && block == BLOCKS_IN_BLOCK_TABLE) {
+			table = table->NextTable;
+			if(table != NULL) {
+				shift = table->Shift;
+				*hint = table;
+			}
+			block = 0;
 		}
 
-		if (crossedTables < endTablesToCross) {
-			if(table->NextTable == NULL) return -1;
-			table = table->NextTable;
+		size_t chunk = ((size_t)1 << shift) - index;
+		if(chunk > toRead - readAmount) chunk = toRead - readAmount;
+
+		/* Blocks that were never written read back from the backing data, or as zeroes */
+		if(table == NULL || table->Blocks[block] == NULL || table->Blocks[block] == FREED_SLOT) {
+			FillFromBacking(file, offset + readAmount, buffer + readAmount, chunk);
 		} else {
-			break;
+			if(IsCompressed(table, block) && DecompressBlock(table, block) == NULL) break;
+
+			table->Flags[block] |= BLOCK_ACCESSED;
+			Memcpy(buffer + readAmount, &table->Blocks[block][index], chunk);
 		}
-	} while(true);
+
+		readAmount += chunk;
+		index = 0;
+		++block;
+	}
 
 	return readAmount;
 }
 
 intmax_t RamFS::WriteNode(const inode_t node, const size_t offset, const size_t size, void *buffer) {
-	if (node > MaxInodes) return -1;
+	if (ReadOnly) return -1;
+	if (node >= MaxInodes) return -1;
 
 	InodeTableObject *file = &InodeTable[node];
 
 	if(file->Available) return -1;
-/*	if(file->NodeData.Properties & NODE_PROPERTY_DIRECTORY) return -1;*/
+	if(!(file->NodeData.Properties & NODE_PROPERTY_FILE)) return -1;
 	
 	if(file->BlockTable == NULL) return -1;
 
-	BlockTable *table = file->BlockTable;
+	BlockTable *hint = NULL;
+	return WriteBlocks(file, &hint, offset, size, (uint8_t*)buffer);
+}
 
-	size_t startIndexInBlock = offset % BLOCK_SIZE;
-	size_t startRoundedOffset = offset - offset % BLOCK_SIZE;
-	size_t startBlockIndex = startRoundedOffset / BLOCK_SIZE % BLOCKS_IN_BLOCK_TABLE;
-	size_t startTablesToCross = (startRoundedOffset % BLOCK_SIZE - startBlockIndex) / BLOCKS_IN_BLOCK_TABLE;
+intmax_t RamFS::WriteNodeVector(const inode_t node, const IOSegment *segments, const size_t count) {
+	if (ReadOnly) return -1;
+	if (node >= MaxInodes) return -1;
 
-	size_t end = offset + size;
-	size_t endIndexInBlock = end % BLOCK_SIZE;
-	size_t endRoundedOffset = end - end % BLOCK_SIZE;
-	size_t endBlockIndex = endRoundedOffset / BLOCK_SIZE % BLOCKS_IN_BLOCK_TABLE;
-	size_t endTablesToCross = (endRoundedOffset % BLOCK_SIZE - endBlockIndex) / BLOCKS_IN_BLOCK_TABLE;
+	InodeTableObject *file = &InodeTable[node];
 
-	for (size_t i = 0; i < startTablesToCross; ++i) {
-		if(table->NextTable == NULL) return -1;
-		table = table->NextTable;
+	if(file->Available) return -1;
+	if(!(file->NodeData.Properties & NODE_PROPERTY_FILE)) return -1;
+	
+	if(file->BlockTable == NULL) return -1;
+
+	BlockTable *hint = NULL;
+	size_t writtenAmount = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		size_t written = WriteBlocks(file, &hint, segments[i].Offset, segments[i].Size, (uint8_t*)segments[i].Address);
+
+		writtenAmount += written;
+		if(written < segments[i].Size) break;
 	}
 
-	size_t crossedTables = startTablesToCross;
+	return writtenAmount;
+}
+
+size_t RamFS::WriteBlocks(InodeTableObject *file, BlockTable **hint, size_t offset, size_t size, uint8_t *buffer) {
+	/* Only files written from within or at their end get bigger blocks as they grow */
+	bool sequential = offset <= file->NodeData.Size;
+	BlockTable *table = *hint != NULL && offset >= (*hint)->Start ? *hint : file->BlockTable;
+	table = FindBlockTable(table, offset, true, sequential);
+
 	size_t writtenAmount = 0;
-	size_t block = startBlockIndex;
-	size_t index = startIndexInBlock;
 
-	do {
-		while(block < BLOCKS_IN_BLOCK_TABLE) {
-			if(writtenAmount >= size) return writtenAmount;
+	while(writtenAmount < size) {
+		size_t position = offset + writtenAmount;
+		if(position >= table->End) table = FindBlockTable(table, position, true, sequential);
+
+		size_t relative = position - table->Start;
+		size_t blockSize = (size_t)1 << table->Shift;
+		size_t index = relative & (blockSize - 1);
+		size_t blockIndex = relative >> table->Shift;
+		uint8_t **block = &table->Blocks[blockIndex];
+
+		size_t chunk = blockSize - index;
+		if(chunk > size - writtenAmount) chunk = size - writtenAmount;
+
+		/* Compressed blocks that are overwritten whole are not worth bringing back */
+		if(*block != NULL && *block != FREED_SLOT && IsCompressed(table, blockIndex) && chunk == blockSize) ReleaseBlock(table, blockIndex);
+
+		if(*block == NULL || *block == FREED_SLOT) {
+			*block = AllocateBlock(blockSize);
+			if(*block == NULL) break;
+
+			/* This is where backed blocks get their private copy */
+			if(chunk != blockSize) FillFromBacking(file, position - index, *block, blockSize);
+		} else if(IsCompressed(table, blockIndex)) {
+			if(DecompressBlock(table, blockIndex) == NULL) break;
+		} else if(IsShared(table, blockIndex)) {
+			/* So are shared ones, unless all of it is about to be overwritten */
+			if(UnshareBlock(table, blockIndex, chunk != blockSize) == NULL) break;
+		}
+
+		table->Flags[blockIndex] = (table->Flags[blockIndex] & ~BLOCK_INCOMPRESSIBLE) | BLOCK_ACCESSED;
+		Memcpy(&(*block)[index], buffer + writtenAmount, chunk);
+
+		writtenAmount += chunk;
+	}
+
+	if(offset + writtenAmount > file->NodeData.Size) file->NodeData.Size = offset + writtenAmount;
+
+	*hint = table;
+	return writtenAmount;
+}
+
+BlockTable *RamFS::CreateBlockTable(size_t start, uint8_t shift) {
+	BlockTable *table = new BlockTable;
+
+	table->Start = start;
+	table->End = start + ((size_t)BLOCKS_IN_BLOCK_TABLE << shift);
+	table->Shift = shift;
+	table->NextTable = NULL;
+	Memset(table->Blocks, 0, BLOCKS_IN_BLOCK_TABLE * sizeof(uintptr_t));
+	Memset(table->Flags, 0, sizeof(table->Flags));
+
+	return table;
+}
+
+BlockTable *RamFS::FindBlockTable(BlockTable *table, size_t offset, bool grow, bool sequential) {
+	while(offset >= table->End) {
+		if(table->NextTable == NULL) {
+			if(!grow) return NULL;
+
+			/* Each table a file grows into from its end has blocks BLOCK_SHIFT_STEP times larger,
+			   up to BLOCK_MAX_SHIFT. Tables made to reach past the end keep the smallest blocks */
+			uint8_t shift = BLOCK_SHIFT;
+			if(sequential) {
+				shift = table->Shift + BLOCK_SHIFT_STEP;
+				if(shift > BLOCK_MAX_SHIFT) shift = BLOCK_MAX_SHIFT;
+			}
+
+			table->NextTable = CreateBlockTable(table->End, shift);
+		}
+
+		table = table->NextTable;
+	}
+
+	return table;
+}
+
+void RamFS::FillFromBacking(InodeTableObject *file, size_t position, uint8_t *destination, size_t length) {
+	size_t backed = 0;
+
+	if(file->BackingData != NULL && position < file->BackingSize) {
+		backed = file->BackingSize - position;
+		if(backed > length) backed = length;
+
+		Memcpy(destination, file->BackingData + position, backed);
+	}
+
+	if(backed < length) Memset(destination + backed, 0, length - backed);
+}
+
+intmax_t RamFS::BindNode(const inode_t node, const void *data, const size_t size) {
+	if (ReadOnly) return -1;
+	if (node >= MaxInodes) return -1;
+
+	InodeTableObject *file = &InodeTable[node];
+
+	if(file->Available) return -1;
+	if(!(file->NodeData.Properties & NODE_PROPERTY_FILE)) return -1;
+
+	/* Only files that hold nothing yet can be bound */
+	if(file->BlockTable == NULL) return -1;
+	if(file->NodeData.Size != 0 || file->BackingData != NULL) return -1;
+
+	file->BackingData = (const uint8_t*)data;
+	file->BackingSize = size;
+	file->NodeData.Size = size;
+
+	return size;
+}
+
+void *RamFS::MapNode(const inode_t node, size_t *size) {
+	if (node >= MaxInodes) return NULL;
+
+	InodeTableObject *file = &InodeTable[node];
+
+	if(file->Available) return NULL;
+	if(!(file->NodeData.Properties & NODE_PROPERTY_FILE)) return NULL;
+
+	if(file->BlockTable == NULL) return NULL;
+
+	*size = file->NodeData.Size;
+	if(*size == 0) return NULL;
+
+	/* Backed files are contiguous for as long as nothing was copied out */
+	bool backed = file->BackingData != NULL && *size <= file->BackingSize;
+
+	uint8_t *base = file->BlockTable->Blocks[0];
+	if(!backed && (base == NULL || base == FREED_SLOT)) return NULL;
+
+	/* Otherwise the file can only be handed out as is if its blocks
+	   happen to follow each other in memory */
+	size_t covered = 0;
+	for (BlockTable *table = file->BlockTable; table != NULL && table->Start < *size; table = table->NextTable) {
+		for (size_t i = 0; i < BLOCKS_IN_BLOCK_TABLE; ++i) {
+			size_t start = table->Start + (i << table->Shift);
+			if(start >= *size) break;
+
+			uint8_t *block = table->Blocks[i];
+			bool empty = block == NULL || block == FREED_SLOT;
+
+			if(backed ? !empty : block != base + start) return NULL;
+		}
+
+		covered = table->End;
+	}
+
+	if(backed) return (void*)file->BackingData;
+	if(covered < *size) return NULL;
+
+	file->Mapped = true;
+	return base;
+}
+
+/* What holes look like to readers of mapped files, on filesystems nothing writes to */
+static uint8_t ZeroBlock[BLOCK_SIZE] __attribute__((aligned(BLOCK_SIZE)));
+
+uint8_t *RamFS::MapBlock(const inode_t node, const size_t offset, const bool write) {
+	if (write && ReadOnly) return NULL;
+	if (node >= MaxInodes) return NULL;
+	if (offset % BLOCK_SIZE != 0) return NULL;
+
+	InodeTableObject *file = &InodeTable[node];
+
+	if(file->Available) return NULL;
+	if(!(file->NodeData.Properties & NODE_PROPERTY_FILE)) return NULL;
+
+	if(file->BlockTable == NULL) return NULL;
+
+	/* Pages handed out for reading get a block of the file's own, as those for writing do.
+	   Otherwise a later write would allocate, copy out or unshare the block somewhere
+	   else, and readers of the mapping would go on seeing what it held before */
+	bool own = write || !ReadOnly;
+
+	BlockTable *table = FindBlockTable(file->BlockTable, offset, own, false);
+
+	size_t relative = 0;
+	size_t blockSize = BLOCK_SIZE;
+	uint8_t **block = NULL;
+
+	if(table != NULL) {
+		relative = offset - table->Start;
+		blockSize = (size_t)1 << table->Shift;
+		block = &table->Blocks[relative >> table->Shift];
+
+		/* Large blocks are handed out a page at a time. Shared ones are copied out before they can be written */
+		if(*block != NULL && *block != FREED_SLOT) {
+			size_t blockIndex = relative >> table->Shift;
+			if(IsCompressed(table, blockIndex) && DecompressBlock(table, blockIndex) == NULL) return NULL;
+			if(own && IsShared(table, blockIndex) && UnshareBlock(table, blockIndex, true) == NULL) return NULL;
+
+			file->Mapped = true;
+			return *block + (relative & (blockSize - 1));
+		}
+	}
+
+	if(!own) {
+		/* Blocks that were never written are handed out from the backing data when it covers them
+		   whole, and as zeroes past its end. A block the backing data ends in has to be copied */
+		if(file->BackingData == NULL || offset >= file->BackingSize) return ZeroBlock;
+		if(offset + BLOCK_SIZE <= file->BackingSize) return (uint8_t*)file->BackingData + offset;
+
+		return NULL;
+	}
+
+	/* The first mapping of a hole is where its block comes into being */
+	*block = AllocateBlock(blockSize);
+	if(*block == NULL) return NULL;
+
+	size_t index = relative & (blockSize - 1);
+	FillFromBacking(file, offset - index, *block, blockSize);
+
+	file->Mapped = true;
+	return *block + index;
+}
+
+void RamFS::UnmapNode(const inode_t node) {
+	if (node < 0 || node >= MaxInodes) return;
+
+	InodeTable[node].Mapped = false;
+}
+
+
+static size_t HashBlock(uint8_t *block) {
+	/* Compressed blocks are small allocations, so all but the alignment counts */
+	uint64_t key = (uint64_t)(uintptr_t)block >> 4;
+	key *= 0x9E3779B97F4A7C15ull;
+
+	return key >> 17;
+}
+
+SharedBlock *RamFS::FindShared(uint8_t *block, bool add) {
+	/* Kept at most half full */
+	if(add && (Shares->Count + 1) * 2 > Shares->Capacity) {
+		size_t capacity = Shares->Capacity == 0 ? 64 : Shares->Capacity * 2;
+		SharedBlock *blocks = (SharedBlock*)Malloc(capacity * sizeof(SharedBlock));
+		if(blocks == NULL) return NULL;
+
+		Memset(blocks, 0, capacity * sizeof(SharedBlock));
+
+		for (size_t i = 0; i < Shares->Capacity; ++i) {
+			if(Shares->Blocks[i].Block == NULL) continue;
+
+			size_t bucket = HashBlock(Shares->Blocks[i].Block) & (capacity - 1);
+			while(blocks[bucket].Block != NULL) bucket = (bucket + 1) & (capacity - 1);
+			blocks[bucket] = Shares->Blocks[i];
+		}
+
+		if(Shares->Blocks != NULL) Free(Shares->Blocks);
+		Shares->Blocks = blocks;
+		Shares->Capacity = capacity;
+	}
+
+	if(Shares->Capacity == 0) return NULL;
+
+	SharedBlock *blocks = Shares->Blocks;
+	size_t mask = Shares->Capacity - 1;
+	for (size_t bucket = HashBlock(block) & mask; ; bucket = (bucket + 1) & mask) {
+		if(blocks[bucket].Block == block) return &blocks[bucket];
+		if(blocks[bucket].Block != NULL) continue;
+
+		if(!add) return NULL;
+
+		blocks[bucket].Block = block;
+		blocks[bucket].References = 0;
+		blocks[bucket].Hash = 0;
+		++Shares->Count;
+
+		return &blocks[bucket];
+	}
+}
+
+void RamFS::ForgetShared(uint8_t *block) {
+	if(Shares->Capacity == 0) return;
+
+	SharedBlock *blocks = Shares->Blocks;
+	size_t mask = Shares->Capacity - 1;
+	size_t bucket = HashBlock(block) & mask;
+	while(blocks[bucket].Block != block) {
+		if(blocks[bucket].Block == NULL) return;
+		bucket = (bucket + 1) & mask;
+	}
+
+	/* Later entries of the same run are moved back, so that no lookup stops short of them */
+	for (size_t next = (bucket + 1) & mask; blocks[next].Block != NULL; next = (next + 1) & mask) {
+		size_t home = HashBlock(blocks[next].Block) & mask;
+		if(((next - home) & mask) < ((next - bucket) & mask)) continue;
+
+		blocks[bucket] = blocks[next];
+		bucket = next;
+	}
+
+	blocks[bucket].Block = NULL;
+	blocks[bucket].References = 0;
+	blocks[bucket].Hash = 0;
+	--Shares->Count;
+}
+
+bool RamFS::ShareBlock(BlockTable *table, size_t index) {
+	SharedBlock *shared = FindShared(table->Blocks[index], true);
+	if(shared == NULL) return false;
+
+	/* A block that was only this table's is counted for it first */
+	if(!IsShared(table, index)) {
+		SetShared(table, index, true);
+		shared->References = 1;
+	}
+
+	++shared->References;
+
+	return true;
+}
+
+bool RamFS::ReleaseBlock(BlockTable *table, size_t index) {
+	uint8_t *block = table->Blocks[index];
+	uint8_t flags = table->Flags[index];
+	size_t blockSize = (size_t)1 << table->Shift;
+
+	table->Blocks[index] = NULL;
+	table->Flags[index] = 0;
+
+	if(!(flags & BLOCK_SHARED)) {
+		FreeBlock(block, flags, blockSize);
+		return true;
+	}
+
+	SharedBlock *shared = FindShared(block, false);
+	if(shared != NULL) {
+		/* Nobody would ever get to a block only the index still points to */
+		if(--shared->References == 1 && shared->Hash != 0) ForgetIndexed(shared);
+		if(shared->References != 0) return false;
+	}
+
+	ForgetShared(block);
+	FreeBlock(block, flags, blockSize);
+
+	return true;
+}
+
+uint8_t *RamFS::AllocateBlock(size_t size) {
+	uint8_t *block = (uint8_t*)Malloc(size);
+	if(block != NULL) Shares->Stats.ResidentBytes += size;
+
+	return block;
+}
+
+void RamFS::FreeBlock(uint8_t *block, uint8_t flags, size_t size) {
+	CompactionStats *stats = &Shares->Stats;
+
+	if(flags & BLOCK_COMPRESSED) {
+		--stats->CompressedBlocks;
+		stats->CompressedBytes -= sizeof(CompressedBlock) + ((CompressedBlock*)block)->Size;
+		stats->OriginalBytes -= size;
+	} else {
+		stats->ResidentBytes -= size;
+	}
+
+	Free(block);
+}
+
+uint8_t *RamFS::UnshareBlock(BlockTable *table, size_t index, bool copy) {
+	uint8_t *block = table->Blocks[index];
+	SharedBlock *shared = FindShared(block, false);
 
-			if(table->Blocks[block] == NULL || table->Blocks[block] == -1) {
-				table->Blocks[block] = Malloc(BLOCK_SIZE);
-				Memset(table->Blocks[block], 0, BLOCK_SIZE);
+	/* The last one left pointing to a block gets to keep it, from the index as well */
+	if(shared == NULL || shared->References - (shared->Hash != 0) <= 1) {
+		if(shared != NULL && shared->Hash != 0) ForgetIndexed(shared);
+		ForgetShared(block);
+		SetShared(table, index, false);
+
+		return block;
+	}
+
+	size_t blockSize = (size_t)1 << table->Shift;
+	uint8_t *own = AllocateBlock(blockSize);
+	if(own == NULL) return NULL;
+
+	if(copy) Memcpy(own, block, blockSize);
+
+	--shared->References;
+	table->Blocks[index] = own;
+	SetShared(table, index, false);
+
+	return own;
+}
+
+/* Also tells whether the block is all zeroes */
+static uint64_t HashContent(const uint8_t *block, size_t size, bool *zero) {
+	const uint64_t *words = (const uint64_t*)block;
+	uint64_t hash = size;
+	uint64_t any = 0;
+
+	for (size_t i = 0; i < size / sizeof(uint64_t); ++i) {
+		hash = (hash ^ words[i]) * 0x100000001B3ull;
+		hash ^= hash >> 29;
+		any |= words[i];
+	}
+
+	*zero = any == 0;
+
+	hash ^= hash >> 32;
+	hash *= 0x9E3779B97F4A7C15ull;
+	hash ^= hash >> 29;
+
+	/* A hash of zero is a block that is not indexed */
+	return hash == 0 ? 1 : hash;
+}
+
+uint8_t *RamFS::FindIndexed(uint8_t *block, uint8_t shift, uint64_t hash) {
+	if(Shares->IndexCapacity == 0) return NULL;
+
+	IndexedBlock *index = Shares->Index;
+	size_t mask = Shares->IndexCapacity - 1;
+	for (size_t bucket = hash & mask; index[bucket].Block != NULL; bucket = (bucket + 1) & mask) {
+		if(index[bucket].Hash != hash || index[bucket].Shift != shift) continue;
+		if(Memcmp(index[bucket].Block, block, (size_t)1 << shift) == 0) return index[bucket].Block;
+	}
+
+	return NULL;
+}
+
+bool RamFS::AddIndexed(uint8_t *block, uint8_t shift, uint64_t hash) {
+	/* Kept at most half full, like the shared blocks */
+	if((Shares->IndexCount + 1) * 2 > Shares->IndexCapacity) {
+		size_t capacity = Shares->IndexCapacity == 0 ? 64 : Shares->IndexCapacity * 2;
+		IndexedBlock *index = (IndexedBlock*)Malloc(capacity * sizeof(IndexedBlock));
+		if(index == NULL) return false;
+
+		Memset(index, 0, capacity * sizeof(IndexedBlock));
+
+		for (size_t i = 0; i < Shares->IndexCapacity; ++i) {
+			if(Shares->Index[i].Block == NULL) continue;
+
+			size_t bucket = Shares->Index[i].Hash & (capacity - 1);
+			while(index[bucket].Block != NULL) bucket = (bucket + 1) & (capacity - 1);
+			index[bucket] = Shares->Index[i];
+		}
+
+		if(Shares->Index != NULL) Free(Shares->Index);
+		Shares->Index = index;
+		Shares->IndexCapacity = capacity;
+		Shares->Dedup.IndexBytes = capacity * sizeof(IndexedBlock);
+	}
+
+	IndexedBlock *index = Shares->Index;
+	size_t mask = Shares->IndexCapacity - 1;
+	size_t bucket = hash & mask;
+	while(index[bucket].Block != NULL) bucket = (bucket + 1) & mask;
+
+	index[bucket].Block = block;
+	index[bucket].Hash = hash;
+	index[bucket].Shift = shift;
+	++Shares->IndexCount;
+	++Shares->Dedup.IndexedBlocks;
+
+	return true;
+}
+
+void RamFS::ForgetIndexed(SharedBlock *shared) {
+	IndexedBlock *index = Shares->Index;
+	size_t mask = Shares->IndexCapacity - 1;
+	size_t bucket = shared->Hash & mask;
+	while(index[bucket].Block != shared->Block) bucket = (bucket + 1) & mask;
+
+	for (size_t next = (bucket + 1) & mask; index[next].Block != NULL; next = (next + 1) & mask) {
+		size_t home = index[next].Hash & mask;
+		if(((next - home) & mask) < ((next - bucket) & mask)) continue;
+
+		index[bucket] = index[next];
+		bucket = next;
+	}
+
+	index[bucket].Block = NULL;
+	index[bucket].Hash = 0;
+	--Shares->IndexCount;
+	--Shares->Dedup.IndexedBlocks;
+
+	shared->Hash = 0;
+	--shared->References;
+}
+
+size_t RamFS::DeduplicateBlocks(size_t budget) {
+	size_t saved = 0;
+	DedupStats *stats = &Shares->Dedup;
+
+	for (; budget > 0; --budget) {
+		InodeTableObject *file = &InodeTable[DedupInode];
+
+		BlockTable *table = NULL;
+		if(!file->Available && file->NodeData.Properties & NODE_PROPERTY_FILE && file->BlockTable != NULL && !file->Mapped &&
+		   DedupOffset < file->NodeData.Size) {
+			table = FindBlockTable(file->BlockTable, DedupOffset, false, false);
+		}
+
+		if(table == NULL) {
+			DedupInode = (DedupInode + 1) % MaxInodes;
+			DedupOffset = 0;
+			continue;
+		}
+
+		size_t index = (DedupOffset - table->Start) >> table->Shift;
+		size_t position = table->Start + (index << table->Shift);
+		DedupOffset = position + ((size_t)1 << table->Shift);
+
+		uint8_t *block = table->Blocks[index];
+		if(block == NULL || block == FREED_SLOT || IsCompressed(table, index)) continue;
+
+		bool shared = IsShared(table, index);
+		if(shared) {
+			SharedBlock *entry = FindShared(block, false);
+			if(entry != NULL && entry->Hash != 0) continue;
+		}
+
+		++stats->Scanned;
+
+		size_t blockSize = (size_t)1 << table->Shift;
+		bool zero;
+		uint64_t hash = HashContent(block, blockSize, &zero);
+
+		/* Past the backing data, holes read as zeroes just as well */
+		if(zero && !shared && (file->BackingData == NULL || position >= file->BackingSize)) {
+			ReleaseBlock(table, index);
+
+			++stats->Zeroed;
+			stats->SavedBytes += blockSize;
+			saved += blockSize;
+			continue;
+		}
+
+		uint8_t *twin = FindIndexed(block, table->Shift, hash);
+		if(twin != NULL) {
+			++FindShared(twin, false)->References;
+
+			uint8_t accessed = table->Flags[index] & BLOCK_ACCESSED;
+			if(ReleaseBlock(table, index)) {
+				stats->SavedBytes += blockSize;
+				saved += blockSize;
 			}
 
-			if(crossedTables == endTablesToCross - 1 && block == endBlockIndex - 1) {
-				Memcpy(&table->Blocks[block][index], buffer + writtenAmount, BLOCK_SIZE - endBlockIndex - index);
-				writtenAmount += BLOCK_SIZE - endBlockIndex - index;
-			} else if(size - writtenAmount + index < BLOCK_SIZE) {
-				Memcpy(&table->Blocks[block][index], buffer + writtenAmount, size);
-				writtenAmount += size;
-			} else {
-				Memcpy(&table->Blocks[block][index], buffer + writtenAmount, BLOCK_SIZE - index);
-				writtenAmount += BLOCK_SIZE - index;
+			table->Blocks[index] = twin;
+			table->Flags[index] = BLOCK_SHARED | accessed;
+			++stats->Merged;
+			continue;
+		}
+
+		/* Otherwise the block is the one later blocks like it are merged into */
+		SharedBlock *entry = FindShared(block, true);
+		if(entry == NULL) continue;
+
+		if(!shared) {
+			SetShared(table, index, true);
+			entry->References = 1;
+		}
+
+		if(!AddIndexed(block, table->Shift, hash)) {
+			if(!shared) {
+				ForgetShared(block);
+				SetShared(table, index, false);
 			}
 
-			index = 0;
-			++block;
+			continue;
 		}
 
-		if (crossedTables < endTablesToCross) {
-			if(table->NextTable == NULL) return -1;
-			table = table->NextTable;
+		++entry->References;
+		entry->Hash = hash;
+	}
+
+	return saved;
+}
+
+uint8_t *RamFS::DecompressBlock(BlockTable *table, size_t index) {
+	if(!IsCompressed(table, index)) return table->Blocks[index];
+
+	CompressedBlock *compressed = (CompressedBlock*)table->Blocks[index];
+	size_t blockSize = (size_t)1 << table->Shift;
+
+	uint8_t *block = AllocateBlock(blockSize);
+	if(block == NULL) return NULL;
+
+	uint64_t start = ReadTimestamp();
+	intmax_t size = LZ4DecompressBlock(compressed->Data, compressed->Size, block, blockSize);
+	uint64_t ticks = ReadTimestamp() - start;
+
+	if(size != (intmax_t)blockSize) {
+		FreeBlock(block, 0, blockSize);
+		return NULL;
+	}
+
+	CompactionStats *stats = &Shares->Stats;
+	++stats->Decompressions;
+	stats->DecompressTicks += ticks;
+	if(ticks > stats->SlowestDecompress) stats->SlowestDecompress = ticks;
+
+	/* Anything else pointing to the compressed block keeps it */
+	ReleaseBlock(table, index);
+	table->Blocks[index] = block;
+
+	return block;
+}
+
+size_t RamFS::CompressBlock(BlockTable *table, size_t index) {
+	uint8_t *block = table->Blocks[index];
+	size_t blockSize = (size_t)1 << table->Shift;
+
+	if(CompactBufferSize < blockSize) {
+		if(CompactBuffer != NULL) Free(CompactBuffer);
+
+		CompactBuffer = (uint8_t*)Malloc(blockSize);
+		CompactBufferSize = CompactBuffer == NULL ? 0 : blockSize;
+		if(CompactBuffer == NULL) return 0;
+	}
+
+	/* Blocks are only kept compressed if that saves at least an eighth of them */
+	size_t capacity = blockSize - blockSize / 8 - sizeof(CompressedBlock);
+	size_t size = LZ4CompressBlock(block, blockSize, CompactBuffer, capacity);
+
+	CompactionStats *stats = &Shares->Stats;
+
+	if(size == 0) {
+		++stats->Rejected;
+		table->Flags[index] |= BLOCK_INCOMPRESSIBLE;
+		return 0;
+	}
+
+	CompressedBlock *compressed = (CompressedBlock*)Malloc(sizeof(CompressedBlock) + size);
+	if(compressed == NULL) return 0;
+
+	compressed->Size = size;
+	Memcpy(compressed->Data, CompactBuffer, size);
+
+	FreeBlock(block, 0, blockSize);
+	table->Blocks[index] = (uint8_t*)compressed;
+	table->Flags[index] |= BLOCK_COMPRESSED;
+
+	++stats->Compressions;
+	++stats->CompressedBlocks;
+	stats->CompressedBytes += sizeof(CompressedBlock) + size;
+	stats->OriginalBytes += blockSize;
+
+	return blockSize - sizeof(CompressedBlock) - size;
+}
+
+size_t RamFS::CompactBlocks(size_t budget) {
+	size_t saved = Deduplicate ? DeduplicateBlocks(budget) : 0;
+
+	for (; budget > 0 && Shares->Stats.ResidentBytes > CompactThreshold; --budget) {
+		InodeTableObject *file = &InodeTable[CompactInode];
+
+		/* Tables go on past the end of the file, but there are no blocks there */
+		BlockTable *table = NULL;
+		if(!file->Available && file->NodeData.Properties & NODE_PROPERTY_FILE && file->BlockTable != NULL && !file->Mapped &&
+		   CompactOffset < file->NodeData.Size) {
+			table = FindBlockTable(file->BlockTable, CompactOffset, false, false);
+		}
+
+		if(table == NULL) {
+			CompactInode = (CompactInode + 1) % MaxInodes;
+			CompactOffset = 0;
+			continue;
+		}
+
+		size_t index = (CompactOffset - table->Start) >> table->Shift;
+		CompactOffset = table->Start + ((index + 1) << table->Shift);
+
+		if(table->Blocks[index] == NULL || table->Blocks[index] == FREED_SLOT) continue;
+
+		uint8_t flags = table->Flags[index];
+		if(flags & (BLOCK_COMPRESSED | BLOCK_INCOMPRESSIBLE)) continue;
+
+		/* Like a clock, blocks get one more pass to be accessed again before they are compressed */
+		if(flags & BLOCK_ACCESSED) {
+			table->Flags[index] &= ~BLOCK_ACCESSED;
+			continue;
+		}
+
+		/* Shared blocks are also pointed to from tables that would not know they were compressed.
+		   Blocks only the content index shares with are taken back from it */
+		if(flags & BLOCK_SHARED) {
+			SharedBlock *shared = FindShared(table->Blocks[index], false);
+			if(shared == NULL || shared->Hash == 0 || shared->References != 2) continue;
+
+			UnshareBlock(table, index, true);
+		}
+
+		saved += CompressBlock(table, index);
+	}
+
+	return saved;
+}
+
+VNode *RamFS::CloneNode(const inode_t node, const inode_t directory, const char name[MAX_NAME_SIZE]) {
+	if (ReadOnly) return 0;
+	if (node <= 0 || node >= MaxInodes) return 0;
+	if (directory < 0 || directory >= MaxInodes) return 0;
+
+	InodeTableObject *source = &InodeTable[node];
+
+	if(source->Available) return 0;
+	if(!(source->NodeData.Properties & NODE_PROPERTY_FILE)) return 0;
+	if(source->BlockTable == NULL) return 0;
+
+	/* A clone never takes the place of another node */
+	if(GetByName(directory, name) != NULL) return 0;
+
+	VNode *created = CreateNode(directory, name, NODE_PROPERTY_FILE);
+	if(created == NULL) return 0;
+
+	InodeTableObject *clone = &InodeTable[created->Inode];
+
+	if(!ShareBlockTables(source->BlockTable, clone->BlockTable)) {
+		DeleteNode(clone->NodeData.Inode);
+		return 0;
+	}
+
+	clone->NodeData.Size = source->NodeData.Size;
+	clone->BackingData = source->BackingData;
+	clone->BackingSize = source->BackingSize;
+
+	return &clone->NodeData;
+}
+
+bool RamFS::ShareBlockTables(BlockTable *from, BlockTable *to) {
+	for (BlockTable *table = from; table != NULL; table = table->NextTable) {
+		if(table != from) {
+			to->NextTable = CreateBlockTable(table->Start, table->Shift);
+			to = to->NextTable;
+		}
+
+		for (size_t i = 0; i < BLOCKS_IN_BLOCK_TABLE; ++i) {
+			if(table->Blocks[i] == NULL || table->Blocks[i] == FREED_SLOT) continue;
+			if(!ShareBlock(table, i)) return false;
+
+			to->Blocks[i] = table->Blocks[i];
+			to->Flags[i] = table->Flags[i] & (BLOCK_SHARED | BLOCK_COMPRESSED);
+		}
+	}
+
+	return true;
+}
+
+void RamFS::ReleaseBlockTables(BlockTable *table) {
+	while(table != NULL) {
+		for (size_t i = 0; i < BLOCKS_IN_BLOCK_TABLE; ++i) {
+			if(table->Blocks[i] == NULL || table->Blocks[i] == FREED_SLOT) continue;
+			ReleaseBlock(table, i);
+		}
+
+		BlockTable *next = table->NextTable;
+		delete table;
+		table = next;
+	}
+}
+
+intmax_t RamFS::CopyRange(const inode_t source, const size_t sourceOffset, const inode_t destination, const size_t destinationOffset, const size_t size) {
+	if (ReadOnly) return -1;
+	if (source >= MaxInodes || destination >= MaxInodes) return -1;
+
+	InodeTableObject *from = &InodeTable[source];
+	InodeTableObject *to = &InodeTable[destination];
+
+	if(from->Available || to->Available) return -1;
+	if(!(from->NodeData.Properties & NODE_PROPERTY_FILE) || !(to->NodeData.Properties & NODE_PROPERTY_FILE)) return -1;
+	if(from->BlockTable == NULL || to->BlockTable == NULL) return -1;
+
+	if(size == 0 || sourceOffset >= from->NodeData.Size) return 0;
+
+	size_t toCopy = size;
+	if(toCopy > from->NodeData.Size - sourceOffset) toCopy = from->NodeData.Size - sourceOffset;
+
+	/* Overlapping ranges of one file would read back what was just copied */
+	if(source == destination && sourceOffset < destinationOffset + toCopy && destinationOffset < sourceOffset + toCopy) return -1;
+
+	bool sequential = destinationOffset <= to->NodeData.Size;
+	BlockTable *fromTable = from->BlockTable;
+	BlockTable *toTable = to->BlockTable;
+
+	size_t copied = 0;
+
+	while(copied < toCopy) {
+		size_t position = sourceOffset + copied;
+		size_t target = destinationOffset + copied;
+
+		if(fromTable != NULL) fromTable = FindBlockTable(fromTable, position, false, false);
+		toTable = FindBlockTable(toTable, target, true, sequential);
+
+		/* Past the last table of the source, it is all holes */
+		size_t fromShift = fromTable != NULL ? fromTable->Shift : BLOCK_SHIFT;
+		size_t fromRelative = fromTable != NULL ? position - fromTable->Start : position;
+		size_t fromIndex = fromRelative >> fromShift;
+		size_t index = fromRelative & (((size_t)1 << fromShift) - 1);
+
+		uint8_t *block = fromTable != NULL ? fromTable->Blocks[fromIndex] : NULL;
+		if(block == FREED_SLOT) block = NULL;
+
+		size_t toRelative = target - toTable->Start;
+		size_t blockSize = (size_t)1 << toTable->Shift;
+
+		/* Whole blocks that line up on both sides are shared instead of copied */
+		if(block != NULL && index == 0 && fromShift == toTable->Shift &&
+		   (toRelative & (blockSize - 1)) == 0 && toCopy - copied >= blockSize) {
+			size_t toIndex = toRelative >> toTable->Shift;
+
+			if(toTable->Blocks[toIndex] != block) {
+				if(!ShareBlock(fromTable, fromIndex)) break;
+
+				if(toTable->Blocks[toIndex] != NULL && toTable->Blocks[toIndex] != FREED_SLOT) ReleaseBlock(toTable, toIndex);
+				toTable->Blocks[toIndex] = block;
+				toTable->Flags[toIndex] = fromTable->Flags[fromIndex] & (BLOCK_SHARED | BLOCK_COMPRESSED);
+			}
+
+			copied += blockSize;
+			continue;
+		}
+
+		/* Everything else is written from wherever the source keeps it */
+		size_t chunk = ((size_t)1 << fromShift) - index;
+		if(chunk > toCopy - copied) chunk = toCopy - copied;
+
+		const uint8_t *data = NULL;
+		if(block != NULL) {
+			if(IsCompressed(fromTable, fromIndex)) {
+				block = DecompressBlock(fromTable, fromIndex);
+				if(block == NULL) break;
+			}
+
+			data = block + index;
+		} else if(from->BackingData != NULL && position < from->BackingSize) {
+			data = from->BackingData + position;
+			if(chunk > from->BackingSize - position) chunk = from->BackingSize - position;
 		} else {
-			break;
+			data = ZeroBlock;
+			if(chunk > BLOCK_SIZE) chunk = BLOCK_SIZE;
 		}
-	} while(true);
 
-	return writtenAmount;
+		intmax_t written = WriteNode(destination, target, chunk, (void*)data);
+		if(written <= 0) break;
+
+		copied += written;
+	}
+
+	/* A copy that stopped before its first byte leaves the destination as it was */
+	if(copied != 0 && destinationOffset + copied > to->NodeData.Size) to->NodeData.Size = destinationOffset + copied;
+
+	return copied;
+}
+
+RamFS *RamFS::Snapshot(filesystem_t descriptor) {
+	RamFS *snapshot = new RamFS(MaxInodes);
+
+	/* Shared blocks have to be counted in one place, whichever side lets go of them last */
+	delete snapshot->Shares;
+	snapshot->Shares = Shares;
+	++Shares->Users;
+
+	delete snapshot->InodeTable[0].DirectoryTable;
+	snapshot->InodeTable[0].DirectoryTable = NULL;
+
+	snapshot->Descriptor = descriptor;
+	snapshot->FreeInodeHint = FreeInodeHint;
+
+	for (inode_t i = 0; i < MaxInodes; ++i) {
+		InodeTableObject *from = &InodeTable[i];
+		InodeTableObject *to = &snapshot->InodeTable[i];
+
+		if(from->Available) continue;
+
+		to->Available = false;
+		to->NodeData = from->NodeData;
+		to->NodeData.FSDescriptor = descriptor;
+		to->SlotIndex = from->SlotIndex;
+		to->FreeSlotHint = from->FreeSlotHint;
+		to->BackingData = from->BackingData;
+		to->BackingSize = from->BackingSize;
+		to->BlockTable = NULL;
+
+		if(from->NodeData.Properties & NODE_PROPERTY_DIRECTORY) {
+			/* Entries point to the snapshot's own nodes, and those back to where they are listed */
+			DirectoryVNodeTable **next = &to->DirectoryTable;
+			for (DirectoryVNodeTable *table = from->DirectoryTable; table != NULL; table = table->NextTable) {
+				DirectoryVNodeTable *copy = new DirectoryVNodeTable;
+				copy->NextTable = NULL;
+
+				for (size_t j = 0; j < NODES_IN_VNODE_TABLE; ++j) {
+					InodeTableObject *element = table->Elements[j];
+					if(element == NULL || element == FREED_SLOT) {
+						copy->Elements[j] = element;
+						continue;
+					}
+
+					copy->Elements[j] = &snapshot->InodeTable[element->NodeData.Inode];
+					copy->Elements[j]->DirectorySlot = &copy->Elements[j];
+				}
+
+				*next = copy;
+				next = &copy->NextTable;
+			}
+		} else if(from->NodeData.Properties & NODE_PROPERTY_FILE && from->BlockTable != NULL) {
+			to->BlockTable = CreateBlockTable(0, BLOCK_SHIFT);
+
+			if(!ShareBlockTables(from->BlockTable, to->BlockTable)) {
+				delete snapshot;
+				return NULL;
+			}
+		}
+	}
+
+	snapshot->ReadOnly = true;
+
+	return snapshot;
 }
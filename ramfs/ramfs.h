@@ -5,6 +5,13 @@
 #define NODES_IN_VNODE_TABLE     0x0100
 #define BLOCKS_IN_BLOCK_TABLE    0x0100
 #define BLOCK_SIZE    0x1000
+#define BLOCK_SHIFT   12
+/* Blocks of files that keep growing go up to 2MiB, 8 times larger with every table */
+#define BLOCK_MAX_SHIFT   21
+#define BLOCK_SHIFT_STEP  3
+
+/* Table slots are empty when NULL, or when marked as freed with this */
+#define FREED_SLOT    ((void*)-1)
 
 struct InodeTableObject;
 
@@ -14,21 +21,128 @@ struct DirectoryVNodeTable {
 	DirectoryVNodeTable *NextTable;
 };
 
+/* The block may be pointed to from somewhere else as well */
+#define BLOCK_SHARED      0x01
+/* The slot points to a CompressedBlock that stands for the block */
+#define BLOCK_COMPRESSED  0x02
+/* Read or written since the compactor last went by */
+#define BLOCK_ACCESSED    0x04
+/* Did not shrink enough the last time it was compressed, and was not written since */
+#define BLOCK_INCOMPRESSIBLE  0x08
+
+/* Tables follow each other through the file. Every block of a table is 1 << Shift bytes,
+   so the table covers BLOCKS_IN_BLOCK_TABLE << Shift bytes, from Start up to End */
 struct BlockTable {
+	size_t Start;
+	size_t End;
+	uint8_t Shift;
+
 	uint8_t *Blocks[BLOCKS_IN_BLOCK_TABLE];
+	uint8_t Flags[BLOCKS_IN_BLOCK_TABLE];
 
 	BlockTable *NextTable;
 };
 
+/* How many table slots point to a block that was cloned or copied by reference */
+struct SharedBlock {
+	uint8_t *Block;
+	size_t References;
+
+	/* Hash of the content while the block is in the content index, which holds one of the references */
+	uint64_t Hash;
+};
+
+/* Blocks whose content is known, so that blocks found to be the same can point to them instead.
+   Indexed blocks are shared, so they can't change while they are here */
+struct IndexedBlock {
+	uint8_t *Block;
+	uint64_t Hash;
+	uint8_t Shift;
+};
+
+/* A cold block squeezed with LZ4, allocated to fit */
+struct CompressedBlock {
+	uint32_t Size;
+	uint8_t Data[];
+};
+
+struct CompactionStats {
+	/* Bytes in blocks as they are */
+	size_t ResidentBytes;
+
+	/* Compressed blocks held, the bytes they take and the bytes they stand for */
+	size_t CompressedBlocks;
+	size_t CompressedBytes;
+	size_t OriginalBytes;
+
+	uint64_t Compressions;
+	/* Blocks that did not shrink enough to be worth keeping compressed */
+	uint64_t Rejected;
+
+	uint64_t Decompressions;
+	uint64_t DecompressTicks;
+	uint64_t SlowestDecompress;
+};
+
+struct DedupStats {
+	uint64_t Scanned;
+	/* Blocks that turned out to be the same as an indexed one */
+	uint64_t Merged;
+	/* Blocks of zeroes that went back to being holes */
+	uint64_t Zeroed;
+	/* What the two above gave back */
+	size_t SavedBytes;
+
+	size_t IndexedBlocks;
+	size_t IndexBytes;
+};
+
+/* Open addressing over the blocks that are shared, an empty bucket has no block.
+   A filesystem and all of its snapshots count their blocks in the same one */
+struct BlockShares {
+	SharedBlock *Blocks;
+	size_t Capacity;
+	size_t Count;
+
+	size_t Users;
+
+	/* Blocks are counted where they are held, which is the same place for all of them */
+	CompactionStats Stats;
+
+	/* Open addressing over content hashes, an empty bucket has no block */
+	IndexedBlock *Index;
+	size_t IndexCapacity;
+	size_t IndexCount;
+
+	DedupStats Dedup;
+};
+
 struct InodeTableObject {
 	bool Available = true;
 
 	VNode NodeData;
 
+	/* Where this node is referenced from in its parent directory */
+	InodeTableObject **DirectorySlot = NULL;
+	size_t SlotIndex = 0;
+
+	/* For directories, every slot before this one is taken */
+	size_t FreeSlotHint = 0;
+
 	union {
-		BlockTable *BlockTable;
+		struct BlockTable *BlockTable;
 		DirectoryVNodeTable *DirectoryTable;
 	};
+
+	/* Read-only memory the file contents come from, if any.
+	   Blocks that are still empty are served from here, and
+	   are copied out the first time they are written to */
+	const uint8_t *BackingData = NULL;
+	size_t BackingSize = 0;
+
+	/* Blocks were handed out by address, so they have to stay where they are.
+	   Cleared once the VFS has no mapping of the file left */
+	bool Mapped = false;
 };
 
 class RamFS {
@@ -56,6 +170,11 @@ public:
 		return static_cast<RamFS*>(instance)->DeleteNode(inode);
 	}
 
+	VNode *RenameNode(const inode_t inode, const inode_t directory, const char name[MAX_NAME_SIZE]);
+	static VNode *RenameNodeWrapper(void *instance, const inode_t inode, const inode_t directory, const char name[MAX_NAME_SIZE]) {
+		return static_cast<RamFS*>(instance)->RenameNode(inode, directory, name);
+	}
+
 	VNode *GetByInode(const inode_t inode);
 	static VNode *GetByInodeWrapper(void *instance, const inode_t inode) {
 		return static_cast<RamFS*>(instance)->GetByInode(inode);
@@ -85,9 +204,150 @@ public:
 	static intmax_t WriteNodeWrapper(void *instance, const inode_t node, const size_t offset, const size_t size, void *buffer) {
 		return static_cast<RamFS*>(instance)->WriteNode(node, offset, size, buffer);
 	}
+
+	/* All segments are served in one walk of the block tables, as long as they go forward */
+	intmax_t ReadNodeVector(const inode_t node, const IOSegment *segments, const size_t count);
+	static intmax_t ReadNodeVectorWrapper(void *instance, const inode_t node, const IOSegment *segments, const size_t count) {
+		return static_cast<RamFS*>(instance)->ReadNodeVector(node, segments, count);
+	}
+
+	intmax_t WriteNodeVector(const inode_t node, const IOSegment *segments, const size_t count);
+	static intmax_t WriteNodeVectorWrapper(void *instance, const inode_t node, const IOSegment *segments, const size_t count) {
+		return static_cast<RamFS*>(instance)->WriteNodeVector(node, segments, count);
+	}
+
+	intmax_t BindNode(const inode_t node, const void *data, const size_t size);
+	static intmax_t BindNodeWrapper(void *instance, const inode_t node, const void *data, const size_t size) {
+		return static_cast<RamFS*>(instance)->BindNode(node, data, size);
+	}
+
+	void *MapNode(const inode_t node, size_t *size);
+	static void *MapNodeWrapper(void *instance, const inode_t node, size_t *size) {
+		return static_cast<RamFS*>(instance)->MapNode(node, size);
+	}
+
+	uint8_t *MapBlock(const inode_t node, const size_t offset, const bool write);
+	static uint8_t *MapBlockWrapper(void *instance, const inode_t node, const size_t offset, const bool write) {
+		return static_cast<RamFS*>(instance)->MapBlock(node, offset, write);
+	}
+
+	void UnmapNode(const inode_t node);
+	static void UnmapNodeWrapper(void *instance, const inode_t node) {
+		static_cast<RamFS*>(instance)->UnmapNode(node);
+	}
+
+	/* Makes a new file in directory that shares every block with node, until either is written to */
+	VNode *CloneNode(const inode_t node, const inode_t directory, const char name[MAX_NAME_SIZE]);
+	static VNode *CloneNodeWrapper(void *instance, const inode_t node, const inode_t directory, const char name[MAX_NAME_SIZE]) {
+		return static_cast<RamFS*>(instance)->CloneNode(node, directory, name);
+	}
+
+	intmax_t CopyRange(const inode_t source, const size_t sourceOffset, const inode_t destination, const size_t destinationOffset, const size_t size);
+	static intmax_t CopyRangeWrapper(void *instance, const inode_t source, const size_t sourceOffset, const inode_t destination, const size_t destinationOffset, const size_t size) {
+		return static_cast<RamFS*>(instance)->CopyRange(source, sourceOffset, destination, destinationOffset, size);
+	}
+
+	intmax_t ReadDirectory(const inode_t directory, uintmax_t *cursor, const size_t size, void *buffer);
+	static intmax_t ReadDirectoryWrapper(void *instance, const inode_t directory, uintmax_t *cursor, const size_t size, void *buffer) {
+		return static_cast<RamFS*>(instance)->ReadDirectory(directory, cursor, size, buffer);
+	}
+
+	/* Makes a read-only copy of the whole tree whose nodes belong to descriptor.
+	   Only the metadata is copied, every block is shared until this filesystem writes to it */
+	RamFS *Snapshot(filesystem_t descriptor);
+	static void *SnapshotWrapper(void *instance, filesystem_t descriptor) {
+		return static_cast<RamFS*>(instance)->Snapshot(descriptor);
+	}
+
+	/* Blocks are compressed by CompactBlocks only while more than threshold bytes are held in
+	   blocks as they are. It starts out at SIZE_MAX, which leaves everything as it is */
+	void SetCompactionThreshold(size_t threshold) { CompactThreshold = threshold; }
+	const CompactionStats *GetCompactionStats() { return &Shares->Stats; }
+
+	/* One step of the compactor, looking at up to budget block slots and nodes from where the last
+	   step stopped. Blocks that were not accessed since it last went by are compressed, the rest
+	   are marked to be looked at again. Returns how many bytes it gave back */
+	size_t CompactBlocks(size_t budget);
+
+	/* Makes CompactBlocks look for blocks with the same content first, whatever the threshold.
+	   They are merged into one shared block, copied out again once written to */
+	void SetDeduplication(bool enabled) { Deduplicate = enabled; }
+	const DedupStats *GetDedupStats() { return &Shares->Dedup; }
+
+	/* One step of the scan for blocks with the same content, looking at up to budget
+	   block slots and nodes. Returns how many bytes it gave back */
+	size_t DeduplicateBlocks(size_t budget);
+	static size_t CompactBlocksWrapper(void *instance, size_t budget) {
+		return static_cast<RamFS*>(instance)->CompactBlocks(budget);
+	}
+
+	/* Writes the whole tree out as an image (see image.h).
+	   Returns the size of the image, which is only written if it fits */
+	intmax_t DumpImage(void *buffer, const size_t size);
+	/* Fills an empty tree from an image, which has to stay mapped for as long as the filesystem lives */
+	bool RestoreImage(const void *image, const size_t size);
 private:
+	size_t CountSlots(InodeTableObject *dir);
+	bool CheckImage(const uint8_t *image, const size_t size);
+	bool CheckImageNodes(const uint8_t *image, size_t imageSize, uint8_t *seen);
+	InodeTableObject **AllocateSlot(InodeTableObject *dir, size_t *index);
+	void ReleaseSlot(InodeTableObject *node);
+	InodeTableObject *FindInDirectory(DirectoryVNodeTable *table, const char name[MAX_NAME_SIZE]);
+	void FillFromBacking(InodeTableObject *file, size_t position, uint8_t *destination, size_t length);
+	BlockTable *CreateBlockTable(size_t start, uint8_t shift);
+	/* Gives to a chain of tables laid out like from's, pointing to the same blocks */
+	bool ShareBlockTables(BlockTable *from, BlockTable *to);
+	void ReleaseBlockTables(BlockTable *table);
+	/* Walks from table to the one that covers offset, making the missing ones if grow is set */
+	BlockTable *FindBlockTable(BlockTable *table, size_t offset, bool grow, bool sequential);
+	/* Move data between the file and buffer, starting the walk from *hint if it is not past offset.
+	   *hint is left at the last table that was used */
+	size_t ReadBlocks(InodeTableObject *file, BlockTable **hint, size_t offset, size_t size, uint8_t *buffer);
+	size_t WriteBlocks(InodeTableObject *file, BlockTable **hint, size_t offset, size_t size, uint8_t *buffer);
+
+	SharedBlock *FindShared(uint8_t *block, bool add);
+	void ForgetShared(uint8_t *block);
+	/* Looks for an indexed block with the same content as block */
+	uint8_t *FindIndexed(uint8_t *block, uint8_t shift, uint64_t hash);
+	bool AddIndexed(uint8_t *block, uint8_t shift, uint64_t hash);
+	/* Takes the block out of the index, along with the reference the index held */
+	void ForgetIndexed(SharedBlock *shared);
+	/* Counts one more slot pointing to the block in table at index */
+	bool ShareBlock(BlockTable *table, size_t index);
+	/* Drops the block at index from table, freeing it if nothing else points to it.
+	   Returns whether it was freed */
+	bool ReleaseBlock(BlockTable *table, size_t index);
+	/* Gives table a block at index that is its own, with the old content if copy is set */
+	uint8_t *UnshareBlock(BlockTable *table, size_t index, bool copy);
+
+	uint8_t *AllocateBlock(size_t size);
+	void FreeBlock(uint8_t *block, uint8_t flags, size_t size);
+	/* Brings the block at index back as it was if it is compressed, as this table's own */
+	uint8_t *DecompressBlock(BlockTable *table, size_t index);
+	size_t CompressBlock(BlockTable *table, size_t index);
+
 	filesystem_t Descriptor;
 
 	inode_t MaxInodes;
 	InodeTableObject *InodeTable;
+
+	/* Every inode before this one is taken */
+	inode_t FreeInodeHint;
+
+	BlockShares *Shares;
+
+	/* Snapshots refuse every change */
+	bool ReadOnly;
+
+	size_t CompactThreshold;
+	/* Where the compactor goes on from */
+	inode_t CompactInode;
+	size_t CompactOffset;
+	/* Blocks are compressed here first, as they may not shrink enough to keep */
+	uint8_t *CompactBuffer;
+	size_t CompactBufferSize;
+
+	bool Deduplicate;
+	inode_t DedupInode;
+	size_t DedupOffset;
 };
@@ -0,0 +1,210 @@
+#include "statsfs.h"
+
+#include <mkmi.h>
+
+static const char *NodeNames[STATSFS_NODE_COUNT] = {
+	"", "file_operations", "node_operations", "errors", "cache", "pool",
+};
+
+static const char *CacheNames[STATS_CACHE_COUNT] = {
+	"execute_map", "mmap_fault", "copy_range",
+};
+
+/* count=.. errors=.. bytes=.. ticks=.. histogram=<bucket>:<count>,...
+   Only buckets that were hit are listed, bucket n holding requests under 2^n ticks */
+static bool AppendOperation(TextBuffer *text, OperationStats *stats) {
+	bool ok = TextAppendString(text, " count=") && TextAppendNumber(text, stats->Count) &&
+		  TextAppendString(text, " errors=") && TextAppendNumber(text, stats->Errors) &&
+		  TextAppendString(text, " bytes=") && TextAppendNumber(text, stats->Bytes) &&
+		  TextAppendString(text, " ticks=") && TextAppendNumber(text, stats->Ticks) &&
+		  TextAppendString(text, " histogram=");
+
+	bool first = true;
+	for (size_t i = 0; i < STATS_HISTOGRAM_BUCKETS && ok; ++i) {
+		if(stats->Histogram[i] == 0) continue;
+
+		if(!first) ok = TextAppendString(text, ",");
+		ok = ok && TextAppendNumber(text, i) && TextAppendString(text, ":") && TextAppendNumber(text, stats->Histogram[i]);
+		first = false;
+	}
+
+	return ok && TextAppendString(text, "\n");
+}
+
+StatsFS::StatsFS(VFSStats *stats, RequestPool *pool) {
+	Descriptor = 0;
+	Stats = stats;
+	Pool = pool;
+
+	for (size_t i = 0; i < STATSFS_NODE_COUNT; ++i) {
+		VNode *node = &Nodes[i];
+
+		Memset(node->Name, 0, MAX_NAME_SIZE);
+		Strcpy(node->Name, NodeNames[i]);
+
+		node->FSDescriptor = 0;
+		node->Inode = i;
+		node->Properties = i == STATSFS_ROOT ? NODE_PROPERTY_DIRECTORY : NODE_PROPERTY_FILE;
+		node->Directory = STATSFS_ROOT;
+		node->Size = 0;
+	}
+}
+
+void StatsFS::SetDescriptor(filesystem_t desc) {
+	if (Descriptor != 0) return;
+	Descriptor = desc;
+
+	for (size_t i = 0; i < STATSFS_NODE_COUNT; ++i) Nodes[i].FSDescriptor = Descriptor;
+}
+
+bool StatsFS::Render(const inode_t node, TextBuffer *text) {
+	bool ok = true;
+
+	switch(node) {
+		case STATSFS_FILE_OPERATIONS:
+			for (uint16_t request = 0; request < STATS_MAX_REQUESTS && ok; ++request) {
+				OperationStats stats;
+				Stats->GetFileOperation(request, &stats);
+				if(stats.Count == 0) continue;
+
+				ok = TextAppendString(text, FileOperationName(request)) && AppendOperation(text, &stats);
+			}
+			break;
+		case STATSFS_NODE_OPERATIONS:
+			for (filesystem_t fs = 0; fs < STATS_MAX_FILESYSTEMS && ok; ++fs) {
+				for (uint16_t request = 0; request < STATS_MAX_REQUESTS && ok; ++request) {
+					OperationStats stats;
+					Stats->GetNodeOperation(fs, request, &stats);
+					if(stats.Count == 0) continue;
+
+					ok = TextAppendString(text, "fs") && TextAppendNumber(text, fs) && TextAppendString(text, " ") &&
+					     TextAppendString(text, NodeOperationName(request)) && AppendOperation(text, &stats);
+				}
+			}
+			break;
+		case STATSFS_ERRORS:
+			for (size_t error = 1; error < STATS_MAX_ERRORS && ok; ++error) {
+				uint64_t count = Stats->GetErrors(error);
+				if(count == 0) continue;
+
+				ok = TextAppendString(text, "-") && TextAppendNumber(text, error) && TextAppendString(text, " ") &&
+				     TextAppendNumber(text, count) && TextAppendString(text, "\n");
+			}
+			break;
+		case STATSFS_CACHE:
+			for (size_t cache = 0; cache < STATS_CACHE_COUNT && ok; ++cache) {
+				uint64_t hits, misses;
+				Stats->GetCache((StatsCache)cache, &hits, &misses);
+
+				ok = TextAppendString(text, CacheNames[cache]) &&
+				     TextAppendString(text, " hits=") && TextAppendNumber(text, hits) &&
+				     TextAppendString(text, " misses=") && TextAppendNumber(text, misses) && TextAppendString(text, "\n");
+			}
+			break;
+		case STATSFS_POOL:
+			/* One line per size class that was ever used */
+			for (size_t sizeClass = 0; sizeClass < POOL_CLASSES && ok; ++sizeClass) {
+				PoolOccupancy occupancy;
+				Pool->GetOccupancy(sizeClass, &occupancy);
+				if(occupancy.Blocks == 0) continue;
+
+				ok = TextAppendString(text, "size=") && TextAppendNumber(text, occupancy.BlockSize) &&
+				     TextAppendString(text, " blocks=") && TextAppendNumber(text, occupancy.Blocks) &&
+				     TextAppendString(text, " in_use=") && TextAppendNumber(text, occupancy.InUse) &&
+				     TextAppendString(text, " peak=") && TextAppendNumber(text, occupancy.Peak) &&
+				     TextAppendString(text, " allocations=") && TextAppendNumber(text, occupancy.Allocations) &&
+				     TextAppendString(text, " grows=") && TextAppendNumber(text, occupancy.Grows) && TextAppendString(text, "\n");
+			}
+
+			ok = ok && TextAppendString(text, "oversize in_use=") && TextAppendNumber(text, Pool->GetOversize()) && TextAppendString(text, "\n");
+			break;
+		default:
+			return false;
+	}
+
+	return ok;
+}
+
+VNode *StatsFS::Refresh(const inode_t node) {
+	if(node < 0 || node >= STATSFS_NODE_COUNT) return 0;
+	if(node == STATSFS_ROOT) return &Nodes[node];
+
+	TextBuffer text = { NULL, 0, 0 };
+	if(Render(node, &text)) Nodes[node].Size = text.Length;
+	if(text.Buffer != NULL) Free(text.Buffer);
+
+	return &Nodes[node];
+}
+
+VNode *StatsFS::GetByInode(const inode_t inode) {
+	return Refresh(inode);
+}
+
+VNode *StatsFS::GetByName(const inode_t directory, const char name[MAX_NAME_SIZE]) {
+	if(directory != STATSFS_ROOT) return 0;
+
+	for (size_t i = 1; i < STATSFS_NODE_COUNT; ++i) {
+		if(Strcmp(name, Nodes[i].Name) == 0) return Refresh(i);
+	}
+
+	return 0;
+}
+
+VNode *StatsFS::GetByIndex(const inode_t directory, const size_t index) {
+	if(directory != STATSFS_ROOT) return 0;
+	if(index + 1 >= STATSFS_NODE_COUNT) return 0;
+
+	return Refresh(index + 1);
+}
+
+VNode *StatsFS::GetRootNode() {
+	return &Nodes[STATSFS_ROOT];
+}
+
+intmax_t StatsFS::ReadNode(const inode_t node, const size_t offset, const size_t size, void *buffer) {
+	if(node <= STATSFS_ROOT || node >= STATSFS_NODE_COUNT) return -1;
+
+	TextBuffer text = { NULL, 0, 0 };
+	if(!Render(node, &text)) {
+		if(text.Buffer != NULL) Free(text.Buffer);
+		return -1;
+	}
+
+	Nodes[node].Size = text.Length;
+
+	size_t toRead = 0;
+	if(offset < text.Length) {
+		toRead = text.Length - offset;
+		if(toRead > size) toRead = size;
+
+		Memcpy(buffer, text.Buffer + offset, toRead);
+	}
+
+	if(text.Buffer != NULL) Free(text.Buffer);
+
+	return toRead;
+}
+
+intmax_t StatsFS::ReadDirectory(const inode_t directory, uintmax_t *cursor, const size_t size, void *buffer) {
+	if(directory != STATSFS_ROOT) return -1;
+
+	DirNode *entries = (DirNode*)buffer;
+	size_t maxEntries = size / sizeof(DirNode);
+	size_t count = 0;
+
+	/* The cursor is the index of the next file */
+	while(*cursor + 1 < STATSFS_NODE_COUNT && count < maxEntries) {
+		/* Sizes are only known once the content is rendered */
+		VNode *node = Refresh(*cursor + 1);
+
+		DirNode *entry = &entries[count++];
+		Memcpy(entry->Name, node->Name, MAX_NAME_SIZE);
+		entry->Inode = node->Inode;
+		entry->Properties = node->Properties;
+		entry->Size = node->Size;
+
+		++*cursor;
+	}
+
+	return count;
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "../vfs/typedefs.h"
+#include "../vfs/vnode.h"
+#include "../vfs/stats.h"
+#include "../vfs/pool.h"
+#include "../util/text.h"
+
+enum StatsFSNode {
+	STATSFS_ROOT,
+	STATSFS_FILE_OPERATIONS,
+	STATSFS_NODE_OPERATIONS,
+	STATSFS_ERRORS,
+	STATSFS_CACHE,
+	STATSFS_POOL,
+	STATSFS_NODE_COUNT,
+};
+
+/* A read-only filesystem whose files show the VFS counters as text.
+ * Reports are put together at the moment they are read, one line per
+ * request type that has been seen, so they are always current.
+ */
+class StatsFS {
+public:
+	StatsFS(VFSStats *stats, RequestPool *pool);
+
+	void SetDescriptor(filesystem_t desc);
+
+	static VNode *CreateNodeWrapper(void *, const inode_t, const char [MAX_NAME_SIZE], property_t) {
+		return 0;
+	}
+
+	static uintmax_t DeleteNodeWrapper(void *, const inode_t) {
+		return -1;
+	}
+
+	static VNode *RenameNodeWrapper(void *, const inode_t, const inode_t, const char [MAX_NAME_SIZE]) {
+		return 0;
+	}
+
+	VNode *GetByInode(const inode_t inode);
+	static VNode *GetByInodeWrapper(void *instance, const inode_t inode) {
+		return static_cast<StatsFS*>(instance)->GetByInode(inode);
+	}
+
+	VNode *GetByName(const inode_t directory, const char name[MAX_NAME_SIZE]);
+	static VNode *GetByNameWrapper(void *instance, const inode_t directory, const char name[MAX_NAME_SIZE]) {
+		return static_cast<StatsFS*>(instance)->GetByName(directory, name);
+	}
+
+	VNode *GetByIndex(const inode_t directory, const size_t index);
+	static VNode *GetByIndexWrapper(void *instance, const inode_t directory, const size_t index) {
+		return static_cast<StatsFS*>(instance)->GetByIndex(directory, index);
+	}
+
+	VNode *GetRootNode();
+	static VNode *GetRootNodeWrapper(void *instance) {
+		return static_cast<StatsFS*>(instance)->GetRootNode();
+	}
+
+	intmax_t ReadNode(const inode_t node, const size_t offset, const size_t size, void *buffer);
+	static intmax_t ReadNodeWrapper(void *instance, const inode_t node, const size_t offset, const size_t size, void *buffer) {
+		return static_cast<StatsFS*>(instance)->ReadNode(node, offset, size, buffer);
+	}
+
+	static intmax_t WriteNodeWrapper(void *, const inode_t, const size_t, const size_t, void *) {
+		return -1;
+	}
+
+	intmax_t ReadDirectory(const inode_t directory, uintmax_t *cursor, const size_t size, void *buffer);
+	static intmax_t ReadDirectoryWrapper(void *instance, const inode_t directory, uintmax_t *cursor, const size_t size, void *buffer) {
+		return static_cast<StatsFS*>(instance)->ReadDirectory(directory, cursor, size, buffer);
+	}
+private:
+	/* Writes the report for a file, returning false if memory ran out */
+	bool Render(const inode_t node, TextBuffer *text);
+	/* Brings the size of a file up to date with what it would show now */
+	VNode *Refresh(const inode_t node);
+
+	filesystem_t Descriptor;
+	VFSStats *Stats;
+	RequestPool *Pool;
+
+	VNode Nodes[STATSFS_NODE_COUNT];
+};
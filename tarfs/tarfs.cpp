@@ -0,0 +1,295 @@
+#include "tarfs.h"
+
+#include <mkmi.h>
+
+TarFS::TarFS(ArchiveIndex *index) {
+	Descriptor = 0;
+	Index = index;
+
+	Built = false;
+	BuildFailed = false;
+	Nodes = NULL;
+	NodeCount = 0;
+	NodeCapacity = 0;
+
+	Buckets = NULL;
+	BucketCount = 0;
+}
+
+TarFS::~TarFS() {
+	if(Nodes != NULL) Free(Nodes);
+	if(Buckets != NULL) Free(Buckets);
+}
+
+bool TarFS::BuildNodes() {
+	NodeCapacity = Index->EntryCount + 1;
+	Nodes = (TarFSNode*)Malloc(NodeCapacity * sizeof(TarFSNode));
+	if(Nodes == NULL) {
+		BuildFailed = true;
+		return false;
+	}
+
+	BucketCount = 16;
+	while(BucketCount < NodeCapacity * 2) BucketCount *= 2;
+
+	Buckets = (inode_t*)Malloc(BucketCount * sizeof(inode_t));
+	if(Buckets == NULL) {
+		Free(Nodes);
+		Nodes = NULL;
+		BuildFailed = true;
+		return false;
+	}
+
+	for (size_t i = 0; i < BucketCount; ++i) Buckets[i] = TARFS_NO_NODE;
+
+	/* The root has no path and is never looked up by name */
+	TarFSNode *root = &Nodes[0];
+	Memset(root, 0, sizeof(TarFSNode));
+	root->NodeData.FSDescriptor = Descriptor;
+	root->NodeData.Inode = 0;
+	root->NodeData.Properties = NODE_PROPERTY_DIRECTORY;
+	root->Path = "";
+	root->FirstChild = TARFS_NO_NODE;
+	root->LastChild = TARFS_NO_NODE;
+	root->NextSibling = TARFS_NO_NODE;
+	root->NextInBucket = TARFS_NO_NODE;
+	NodeCount = 1;
+
+	for (size_t i = 0; i < Index->EntryCount; ++i) {
+		ArchiveEntry *entry = &Index->Entries[i];
+
+		const char *path = entry->Name;
+		size_t length = entry->NameLength;
+
+		while(length >= 2 && path[0] == '.' && path[1] == '/') {
+			path += 2;
+			length -= 2;
+		}
+
+		while(length > 0 && path[length - 1] == '/') --length;
+		if(length == 0) continue;
+
+		property_t properties;
+		if(entry->Type == TAR_TYPE_DIRECTORY) properties = NODE_PROPERTY_DIRECTORY;
+		else if(entry->Type == TAR_TYPE_FILE) properties = NODE_PROPERTY_FILE;
+		else continue;
+
+		inode_t inode = AddNode(path, length, properties);
+		if(inode == TARFS_NO_NODE) continue;
+
+		/* The path may already be taken by a node of the other kind, made up as a parent
+		   or listed earlier. The first one stays, as its children may already hang from it */
+		if(!(Nodes[inode].NodeData.Properties & properties)) continue;
+
+		if(properties & NODE_PROPERTY_FILE) {
+			Nodes[inode].Data = entry->Data;
+			Nodes[inode].NodeData.Size = entry->Size;
+		}
+	}
+
+	Built = true;
+	return true;
+}
+
+inode_t TarFS::FindNode(const char *path, size_t length, uint64_t hash) {
+	inode_t inode = Buckets[hash & (BucketCount - 1)];
+
+	while(inode != TARFS_NO_NODE) {
+		TarFSNode *node = &Nodes[inode];
+
+		if(node->Hash == hash &&
+		   node->PathLength == length &&
+		   Memcmp(node->Path, path, length) == 0) {
+			return inode;
+		}
+
+		inode = node->NextInBucket;
+	}
+
+	return TARFS_NO_NODE;
+}
+
+inode_t TarFS::AddNode(const char *path, size_t length, property_t properties) {
+	uint64_t hash = HashArchiveName(path, length);
+
+	inode_t existing = FindNode(path, length, hash);
+	if(existing != TARFS_NO_NODE) return existing;
+
+	size_t nameStart = length;
+	while(nameStart > 0 && path[nameStart - 1] != '/') --nameStart;
+
+	if(length - nameStart >= MAX_NAME_SIZE) return TARFS_NO_NODE;
+
+	/* Parents that have no entry of their own are made up on the way */
+	inode_t parent = 0;
+	if(nameStart > 0) {
+		parent = AddNode(path, nameStart - 1, NODE_PROPERTY_DIRECTORY);
+		if(parent == TARFS_NO_NODE) return TARFS_NO_NODE;
+		if(!(Nodes[parent].NodeData.Properties & NODE_PROPERTY_DIRECTORY)) return TARFS_NO_NODE;
+	}
+
+	if(NodeCount == NodeCapacity) {
+		size_t newCapacity = NodeCapacity * 2;
+		TarFSNode *nodes = (TarFSNode*)Malloc(newCapacity * sizeof(TarFSNode));
+		if(nodes == NULL) return TARFS_NO_NODE;
+
+		Memcpy(nodes, Nodes, NodeCount * sizeof(TarFSNode));
+		Free(Nodes);
+
+		Nodes = nodes;
+		NodeCapacity = newCapacity;
+	}
+
+	inode_t inode = NodeCount++;
+	TarFSNode *node = &Nodes[inode];
+	Memset(node, 0, sizeof(TarFSNode));
+
+	Memcpy(node->NodeData.Name, &path[nameStart], length - nameStart);
+	node->NodeData.FSDescriptor = Descriptor;
+	node->NodeData.Inode = inode;
+	node->NodeData.Properties = properties;
+	node->NodeData.Directory = parent;
+
+	node->Path = path;
+	node->PathLength = length;
+	node->Hash = hash;
+
+	node->FirstChild = TARFS_NO_NODE;
+	node->LastChild = TARFS_NO_NODE;
+	node->NextSibling = TARFS_NO_NODE;
+
+	size_t bucket = hash & (BucketCount - 1);
+	node->NextInBucket = Buckets[bucket];
+	Buckets[bucket] = inode;
+
+	/* Children are kept in archive order */
+	TarFSNode *directory = &Nodes[parent];
+	if(directory->LastChild == TARFS_NO_NODE) {
+		directory->FirstChild = inode;
+	} else {
+		Nodes[directory->LastChild].NextSibling = inode;
+	}
+	directory->LastChild = inode;
+
+	return inode;
+}
+
+TarFSNode *TarFS::GetNode(const inode_t inode) {
+	if(!Built && (BuildFailed || !BuildNodes())) return NULL;
+	if(inode < 0 || (size_t)inode >= NodeCount) return NULL;
+
+	return &Nodes[inode];
+}
+
+VNode *TarFS::GetByInode(const inode_t inode) {
+	TarFSNode *node = GetNode(inode);
+	if(node == NULL) return 0;
+
+	return &node->NodeData;
+}
+
+VNode *TarFS::GetByName(const inode_t directory, const char name[MAX_NAME_SIZE]) {
+	TarFSNode *dir = GetNode(directory);
+	if(dir == NULL) return 0;
+	if(!(dir->NodeData.Properties & NODE_PROPERTY_DIRECTORY)) return 0;
+
+	size_t nameLength = Strlen(name);
+	if(dir->PathLength + nameLength + 1 >= MAX_PATH_SIZE) return 0;
+
+	char path[MAX_PATH_SIZE];
+	size_t length = 0;
+
+	if(dir->PathLength != 0) {
+		Memcpy(path, dir->Path, dir->PathLength);
+		path[dir->PathLength] = '/';
+		length = dir->PathLength + 1;
+	}
+
+	Memcpy(path + length, name, nameLength);
+	length += nameLength;
+
+	inode_t inode = FindNode(path, length, HashArchiveName(path, length));
+	if(inode == TARFS_NO_NODE) return 0;
+
+	return &Nodes[inode].NodeData;
+}
+
+VNode *TarFS::GetByIndex(const inode_t directory, const size_t index) {
+	TarFSNode *dir = GetNode(directory);
+	if(dir == NULL) return 0;
+	if(!(dir->NodeData.Properties & NODE_PROPERTY_DIRECTORY)) return 0;
+
+	inode_t child = dir->FirstChild;
+	for (size_t i = 0; i < index && child != TARFS_NO_NODE; ++i) {
+		child = Nodes[child].NextSibling;
+	}
+
+	if(child == TARFS_NO_NODE) return 0;
+
+	return &Nodes[child].NodeData;
+}
+
+VNode *TarFS::GetRootNode() {
+	TarFSNode *root = GetNode(0);
+	if(root == NULL) return 0;
+
+	return &root->NodeData;
+}
+
+intmax_t TarFS::ReadNode(const inode_t node, const size_t offset, const size_t size, void *buffer) {
+	TarFSNode *file = GetNode(node);
+	if(file == NULL) return -1;
+	if(!(file->NodeData.Properties & NODE_PROPERTY_FILE)) return -1;
+
+	if(offset >= file->NodeData.Size) return 0;
+
+	size_t toRead = size;
+	if(toRead > file->NodeData.Size - offset) toRead = file->NodeData.Size - offset;
+
+	Memcpy(buffer, file->Data + offset, toRead);
+
+	return toRead;
+}
+
+void *TarFS::MapNode(const inode_t node, size_t *size) {
+	TarFSNode *file = GetNode(node);
+	if(file == NULL) return NULL;
+	if(!(file->NodeData.Properties & NODE_PROPERTY_FILE)) return NULL;
+
+	*size = file->NodeData.Size;
+	if(*size == 0) return NULL;
+
+	return file->Data;
+}
+
+intmax_t TarFS::ReadDirectory(const inode_t directory, uintmax_t *cursor, const size_t size, void *buffer) {
+	TarFSNode *dir = GetNode(directory);
+	if(dir == NULL) return -1;
+	if(!(dir->NodeData.Properties & NODE_PROPERTY_DIRECTORY)) return -1;
+
+	/* The cursor is the next child to report, zero meaning the first one
+	   as the root is never anybody's child */
+	if(*cursor == (uintmax_t)TARFS_NO_NODE) return 0;
+	inode_t child = *cursor == 0 ? dir->FirstChild : (inode_t)*cursor;
+
+	DirNode *entries = (DirNode*)buffer;
+	size_t maxEntries = size / sizeof(DirNode);
+	size_t count = 0;
+
+	while(child != TARFS_NO_NODE && count < maxEntries) {
+		if(child <= 0 || (size_t)child >= NodeCount) return -1;
+
+		TarFSNode *node = &Nodes[child];
+
+		DirNode *entry = &entries[count++];
+		Memcpy(entry->Name, node->NodeData.Name, MAX_NAME_SIZE);
+		entry->Inode = node->NodeData.Inode;
+		entry->Properties = node->NodeData.Properties;
+		entry->Size = node->NodeData.Size;
+
+		child = node->NextSibling;
+	}
+
+	*cursor = (uintmax_t)child;
+	return count;
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include "../vfs/typedefs.h"
+#include "../vfs/vnode.h"
+#include "../vfs/ustar.h"
+
+#define TARFS_NO_NODE -1
+
+struct TarFSNode {
+	VNode NodeData;
+
+	/* Full path inside the archive, without trailing slashes.
+	   It always points into the archive index, never copied */
+	const char *Path;
+	size_t PathLength;
+	uint64_t Hash;
+
+	uint8_t *Data;
+
+	inode_t FirstChild;
+	inode_t LastChild;
+	inode_t NextSibling;
+
+	inode_t NextInBucket;
+};
+
+/* A read-only filesystem served straight out of a mapped tar archive.
+ * Nothing is done until the first request comes in, then the node
+ * table is built with a single pass over the archive index.
+ */
+class TarFS {
+public:
+	TarFS(ArchiveIndex *index);
+	~TarFS();
+
+	void SetDescriptor(filesystem_t desc) {
+		if (Descriptor != 0) return;
+		Descriptor = desc;
+	}
+
+	static VNode *CreateNodeWrapper(void *, const inode_t, const char [MAX_NAME_SIZE], property_t) {
+		return 0;
+	}
+
+	static uintmax_t DeleteNodeWrapper(void *, const inode_t) {
+		return -1;
+	}
+
+	static VNode *RenameNodeWrapper(void *, const inode_t, const inode_t, const char [MAX_NAME_SIZE]) {
+		return 0;
+	}
+
+	VNode *GetByInode(const inode_t inode);
+	static VNode *GetByInodeWrapper(void *instance, const inode_t inode) {
+		return static_cast<TarFS*>(instance)->GetByInode(inode);
+	}
+
+	VNode *GetByName(const inode_t directory, const char name[MAX_NAME_SIZE]);
+	static VNode *GetByNameWrapper(void *instance, const inode_t directory, const char name[MAX_NAME_SIZE]) {
+		return static_cast<TarFS*>(instance)->GetByName(directory, name);
+	}
+
+	VNode *GetByIndex(const inode_t directory, const size_t index);
+	static VNode *GetByIndexWrapper(void *instance, const inode_t directory, const size_t index) {
+		return static_cast<TarFS*>(instance)->GetByIndex(directory, index);
+	}
+
+	VNode *GetRootNode();
+	static VNode *GetRootNodeWrapper(void *instance) {
+		return static_cast<TarFS*>(instance)->GetRootNode();
+	}
+
+	intmax_t ReadNode(const inode_t node, const size_t offset, const size_t size, void *buffer);
+	static intmax_t ReadNodeWrapper(void *instance, const inode_t node, const size_t offset, const size_t size, void *buffer) {
+		return static_cast<TarFS*>(instance)->ReadNode(node, offset, size, buffer);
+	}
+
+	static intmax_t WriteNodeWrapper(void *, const inode_t, const size_t, const size_t, void *) {
+		return -1;
+	}
+
+	void *MapNode(const inode_t node, size_t *size);
+	static void *MapNodeWrapper(void *instance, const inode_t node, size_t *size) {
+		return static_cast<TarFS*>(instance)->MapNode(node, size);
+	}
+
+	intmax_t ReadDirectory(const inode_t directory, uintmax_t *cursor, const size_t size, void *buffer);
+	static intmax_t ReadDirectoryWrapper(void *instance, const inode_t directory, uintmax_t *cursor, const size_t size, void *buffer) {
+		return static_cast<TarFS*>(instance)->ReadDirectory(directory, cursor, size, buffer);
+	}
+private:
+	bool BuildNodes();
+	TarFSNode *GetNode(const inode_t inode);
+	inode_t FindNode(const char *path, size_t length, uint64_t hash);
+	inode_t AddNode(const char *path, size_t length, property_t properties);
+
+	filesystem_t Descriptor;
+
+	ArchiveIndex *Index;
+
+	bool Built;
+	/* Memory will not be there on a retry either, so a failed build is not redone */
+	bool BuildFailed;
+	TarFSNode *Nodes;
+	size_t NodeCount;
+	size_t NodeCapacity;
+
+	inode_t *Buckets;
+	size_t BucketCount;
+};
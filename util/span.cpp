@@ -0,0 +1,132 @@
+#include "span.h"
+#include "timestamp.h"
+
+#include <mkmi.h>
+
+SpanRecorder::SpanRecorder(size_t capacity) {
+	Spans = (Span*)Malloc(capacity * sizeof(Span));
+	Count = 0;
+	Capacity = Spans == NULL ? 0 : capacity;
+	Dropped = 0;
+
+	Open = SPAN_NONE;
+	Origin = ReadTimestamp();
+}
+
+SpanRecorder::~SpanRecorder() {
+	if(Spans != NULL) Free(Spans);
+}
+
+intmax_t SpanRecorder::Begin(const char *name, const char *detail, size_t detailLength) {
+	if(Count >= Capacity) {
+		++Dropped;
+		return SPAN_NONE;
+	}
+
+	Span *span = &Spans[Count];
+	span->Name = name;
+	span->Parent = Open;
+	span->Depth = Open == SPAN_NONE ? 0 : Spans[Open].Depth + 1;
+	span->End = 0;
+
+	if(detail != NULL && detailLength == 0) detailLength = Strlen(detail);
+	if(detailLength >= SPAN_DETAIL_SIZE) {
+		detail += detailLength - (SPAN_DETAIL_SIZE - 1);
+		detailLength = SPAN_DETAIL_SIZE - 1;
+	}
+
+	if(detailLength != 0) Memcpy(span->Detail, detail, detailLength);
+	span->Detail[detailLength] = '\0';
+
+	Open = Count++;
+
+	/* Taken last, so that the bookkeeping above is not part of the span */
+	span->Start = ReadTimestamp();
+
+	return Open;
+}
+
+void SpanRecorder::End(intmax_t span) {
+	if(span == SPAN_NONE) return;
+
+	Spans[span].End = ReadTimestamp();
+	Open = Spans[span].Parent;
+}
+
+static uint64_t Duration(Span *span) {
+	return span->End > span->Start ? span->End - span->Start : 0;
+}
+
+void SpanRecorder::PrintSummary() {
+	MKMI_Printf("Boot spans, in ticks:\r\n");
+
+	for (size_t i = 0; i < Count; ++i) {
+		Span *span = &Spans[i];
+
+		char indent[2 * 16 + 1];
+		size_t width = span->Depth > 16 ? 32 : span->Depth * 2;
+		Memset(indent, ' ', width);
+		indent[width] = '\0';
+
+		if(span->Detail[0] == '\0') {
+			MKMI_Printf("%s%s: %d\r\n", indent, span->Name, Duration(span));
+			continue;
+		}
+
+		/* Only the first of a group is printed, for all of them */
+		bool seen = false;
+		for (size_t j = i; j-- > 0 && Spans[j].Depth >= span->Depth; ) {
+			if(Spans[j].Parent == span->Parent && Spans[j].Detail[0] != '\0' && Strcmp(Spans[j].Name, span->Name) == 0) {
+				seen = true;
+				break;
+			}
+		}
+
+		if(seen) continue;
+
+		size_t count = 0;
+		uint64_t total = 0;
+		Span *slowest = span;
+
+		for (size_t j = i; j < Count && (j == i || Spans[j].Depth >= span->Depth); ++j) {
+			if(Spans[j].Parent != span->Parent || Spans[j].Detail[0] == '\0' || Strcmp(Spans[j].Name, span->Name) != 0) continue;
+
+			++count;
+			total += Duration(&Spans[j]);
+			if(Duration(&Spans[j]) > Duration(slowest)) slowest = &Spans[j];
+		}
+
+		MKMI_Printf("%s%s x%d: %d total, %d average, slowest %s at %d\r\n", indent, span->Name, count,
+		            total, total / count, slowest->Detail, Duration(slowest));
+	}
+
+	if(Dropped != 0) MKMI_Printf("%d spans did not fit and were not timed.\r\n", Dropped);
+}
+
+bool SpanRecorder::WriteChromeTrace(TextBuffer *text) {
+	/* Timestamps are raw ticks from the start of the recorder.
+	   The viewer shows them as microseconds, so only their proportions mean anything */
+	bool ok = TextAppendString(text, "{\"otherData\":{\"unit\":\"ticks\"},\"traceEvents\":[");
+
+	for (size_t i = 0; i < Count && ok; ++i) {
+		Span *span = &Spans[i];
+
+		ok = TextAppendString(text, i == 0 ? "\n" : ",\n") &&
+		     TextAppendString(text, "{\"name\":\"") &&
+		     TextAppendEscaped(text, span->Name, Strlen(span->Name)) &&
+		     TextAppendString(text, "\",\"cat\":\"boot\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":") &&
+		     TextAppendNumber(text, span->Start - Origin) &&
+		     TextAppendString(text, ",\"dur\":") &&
+		     TextAppendNumber(text, Duration(span));
+
+		if(ok && span->Detail[0] != '\0') {
+			ok = TextAppendString(text, ",\"args\":{\"detail\":\"") &&
+			     TextAppendEscaped(text, span->Detail, Strlen(span->Detail)) &&
+			     TextAppendString(text, "\"}");
+		}
+
+		ok = ok && TextAppendString(text, "}");
+	}
+
+	return ok && TextAppendString(text, "\n]}\n");
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "text.h"
+
+/* Details longer than this keep their end, which is the part that tells them apart */
+#define SPAN_DETAIL_SIZE 48
+#define SPAN_NONE        -1
+
+struct Span {
+	/* Expected to outlive the recorder, usually a literal */
+	const char *Name;
+	char Detail[SPAN_DETAIL_SIZE];
+
+	uint64_t Start;
+	uint64_t End;
+
+	intmax_t Parent;
+	size_t Depth;
+};
+
+/* Timed, nested spans of work, kept in memory in the order they were opened.
+ * A span opened while another is open becomes its child, so spans have to be
+ * closed in the reverse order they were opened. Once the recorder is full,
+ * further spans are only counted.
+ */
+class SpanRecorder {
+public:
+	SpanRecorder(size_t capacity);
+	~SpanRecorder();
+
+	intmax_t Begin(const char *name, const char *detail = NULL, size_t detailLength = 0);
+	void End(intmax_t span);
+
+	/* Prints the tree of spans. Siblings that share a name and have a detail,
+	   like one span per archive entry, are folded into a single line */
+	void PrintSummary();
+	/* Writes the spans as Chrome trace events, returning false if memory ran out */
+	bool WriteChromeTrace(TextBuffer *text);
+private:
+	Span *Spans;
+	size_t Count;
+	size_t Capacity;
+	size_t Dropped;
+
+	intmax_t Open;
+	uint64_t Origin;
+};
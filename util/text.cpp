@@ -0,0 +1,65 @@
+#include "text.h"
+
+#include <mkmi.h>
+
+bool TextAppend(TextBuffer *text, const char *string, size_t length) {
+	if(text->Length + length > text->Capacity) {
+		size_t capacity = text->Capacity == 0 ? 1024 : text->Capacity * 2;
+		while(capacity < text->Length + length) capacity *= 2;
+
+		char *buffer = (char*)Malloc(capacity);
+		if(buffer == NULL) return false;
+
+		if(text->Buffer != NULL) {
+			Memcpy(buffer, text->Buffer, text->Length);
+			Free(text->Buffer);
+		}
+
+		text->Buffer = buffer;
+		text->Capacity = capacity;
+	}
+
+	Memcpy(text->Buffer + text->Length, string, length);
+	text->Length += length;
+
+	return true;
+}
+
+bool TextAppendString(TextBuffer *text, const char *string) {
+	return TextAppend(text, string, Strlen(string));
+}
+
+bool TextAppendNumber(TextBuffer *text, uint64_t value) {
+	char digits[20];
+	size_t count = 0;
+
+	do {
+		digits[sizeof(digits) - ++count] = '0' + value % 10;
+		value /= 10;
+	} while(value != 0);
+
+	return TextAppend(text, &digits[sizeof(digits) - count], count);
+}
+
+bool TextAppendEscaped(TextBuffer *text, const char *string, size_t length) {
+	static const char hex[] = "0123456789abcdef";
+
+	size_t start = 0;
+	for (size_t i = 0; i < length; ++i) {
+		unsigned char c = string[i];
+		if(c != '"' && c != '\\' && c >= 0x20) continue;
+
+		if(!TextAppend(text, string + start, i - start)) return false;
+		start = i + 1;
+
+		if(c == '"' || c == '\\') {
+			char escaped[2] = { '\\', (char)c };
+			if(!TextAppend(text, escaped, 2)) return false;
+		} else {
+			char escaped[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+			if(!TextAppend(text, escaped, 6)) return false;
+		}
+	}
+
+	return TextAppend(text, string + start, length - start);
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/* Growing text buffer that reports are written into.
+ * Start it zeroed and Free its Buffer when done.
+ * Every append returns false once memory has run out.
+ */
+struct TextBuffer {
+	char *Buffer;
+	size_t Length;
+	size_t Capacity;
+};
+
+bool TextAppend(TextBuffer *text, const char *string, size_t length);
+bool TextAppendString(TextBuffer *text, const char *string);
+bool TextAppendNumber(TextBuffer *text, uint64_t value);
+/* Adds a string as the inside of a JSON string, escaping what has to be */
+bool TextAppendEscaped(TextBuffer *text, const char *string, size_t length);
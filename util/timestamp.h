@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+
+/* Reads the free running cycle counter of the CPU.
+ * Only differences between two readings on the same CPU are meaningful.
+ */
+static inline uint64_t ReadTimestamp() {
+#if defined(__x86_64__)
+	uint32_t low, high;
+	asm volatile("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+#elif defined(__aarch64__)
+	uint64_t value;
+	asm volatile("isb; mrs %0, cntvct_el0" : "=r"(value) :: "memory");
+	return value;
+#else
+	return 0;
+#endif
+}
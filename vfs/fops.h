@@ -5,6 +5,8 @@
 struct FSOperations {
 	VNode *(*CreateNode)(void *instance, const inode_t directory, const char name[MAX_NAME_SIZE], property_t flags);
 	uintmax_t (*DeleteNode)(void *instance, const inode_t node);
+	/* Moves node into directory under name, replacing any node of the same kind already there */
+	VNode *(*RenameNode)(void *instance, const inode_t node, const inode_t directory, const char name[MAX_NAME_SIZE]);
 
 	VNode *(*GetByInode)(void *instance, const inode_t node);
 	VNode *(*GetByName)(void *instance, const inode_t directory, const char name[MAX_NAME_SIZE]);
@@ -13,6 +15,37 @@ struct FSOperations {
 	
 	intmax_t (*ReadNode)(void *instance, const inode_t node, const size_t offset, const size_t size, void *buffer);
 	intmax_t (*WriteNode)(void *instance, const inode_t node, const size_t offset, const size_t size, void *buffer);
+	/* Same as the above for each segment in turn, stopping at the first that comes up short.
+	   Returns how many bytes were moved in all. Drivers without them get one call per segment */
+	intmax_t (*ReadNodeVector)(void *instance, const inode_t node, const IOSegment *segments, const size_t count);
+	intmax_t (*WriteNodeVector)(void *instance, const inode_t node, const IOSegment *segments, const size_t count);
+
+	/* Makes read-only memory the content of an empty file, without copying it */
+	intmax_t (*BindNode)(void *instance, const inode_t node, const void *data, const size_t size);
+	/* Returns the whole content of node as one contiguous range, if the driver can do so */
+	void *(*MapNode)(void *instance, const inode_t node, size_t *size);
+	/* Returns the MMAP_PAGE_SIZE bytes of node starting at offset, where they are stored.
+	   Holes are allocated and shared blocks copied out first, unless nothing can write to them */
+	uint8_t *(*MapBlock)(void *instance, const inode_t node, const size_t offset, const bool write);
+	/* Nothing handed out for node is in use any more, so its storage may move again */
+	void (*UnmapNode)(void *instance, const inode_t node);
+
+	/* Makes a new file in directory with the content of node, sharing its storage where the driver can */
+	VNode *(*CloneNode)(void *instance, const inode_t node, const inode_t directory, const char name[MAX_NAME_SIZE]);
+	/* Copies up to size bytes between two files of the filesystem, returning how many were copied */
+	intmax_t (*CopyRange)(void *instance, const inode_t source, const size_t sourceOffset, const inode_t destination, const size_t destinationOffset, const size_t size);
+
+	/* Returns a new instance holding a read-only copy of the whole filesystem as it is now,
+	   which works with these same operations. Its nodes carry descriptor */
+	void *(*Snapshot)(void *instance, filesystem_t descriptor);
+
+	/* Gives memory back by compressing what was not used lately or merging what is the same,
+	   doing at most budget units of work. Returns how many bytes were given back */
+	size_t (*CompactBlocks)(void *instance, size_t budget);
+
+	/* Fills buffer with as many DirNodes as fit, starting from *cursor.
+	   The cursor is updated so that the next call resumes where this one stopped */
+	intmax_t (*ReadDirectory)(void *instance, const inode_t directory, uintmax_t *cursor, const size_t size, void *buffer);
 };
 
 struct FSOperationRequest {
@@ -34,6 +67,14 @@ struct FSDeleteNodeRequest : public FSOperationRequest {
 	inode_t Node;
 }__attribute__((packed));
 
+struct FSRenameNodeRequest : public FSOperationRequest {
+	VNode ResultNode;
+
+	inode_t Node;
+	inode_t Directory;
+	char Name[MAX_NAME_SIZE];
+}__attribute__((packed));
+
 struct FSGetByNodeRequest : public FSOperationRequest {
 	VNode ResultNode;
 
@@ -76,6 +117,134 @@ struct FSWriteNodeRequest : public FSOperationRequest {
 	uint8_t Buffer;
 }__attribute__((packed));
 
+/* Same as a read or a write, but the payload is wherever Address points
+   instead of following the request, so it never has to be copied in or out */
+struct FSScatterNodeRequest : public FSOperationRequest {
+	inode_t Node;
+	size_t Offset;
+	size_t Size;
+
+	uintptr_t Address;
+}__attribute__((packed));
+
+/* Result holds how many bytes were moved, over all the segments */
+struct FSVectorNodeRequest : public FSOperationRequest {
+	inode_t Node;
+	size_t Count;
+
+	/* The segments extend for an amount defined by Count */
+	IOSegment Segments;
+}__attribute__((packed));
+
+struct FSBindNodeRequest : public FSOperationRequest {
+	inode_t Node;
+
+	uintptr_t Address;
+	size_t Size;
+}__attribute__((packed));
+
+struct FSMapNodeRequest : public FSOperationRequest {
+	inode_t Node;
+
+	uintptr_t Address;
+	size_t Size;
+}__attribute__((packed));
+
+struct FSMapBlockRequest : public FSOperationRequest {
+	inode_t Node;
+	size_t Offset;
+	uint8_t Write;
+
+	uintptr_t Address;
+}__attribute__((packed));
+
+struct FSUnmapNodeRequest : public FSOperationRequest {
+	inode_t Node;
+}__attribute__((packed));
+
+struct FSCloneNodeRequest : public FSOperationRequest {
+	VNode ResultNode;
+
+	inode_t Node;
+	inode_t Directory;
+	char Name[MAX_NAME_SIZE];
+}__attribute__((packed));
+
+/* Result holds how many bytes were copied, which is short only at the end of Source */
+struct FSCopyRangeRequest : public FSOperationRequest {
+	inode_t Source;
+	size_t SourceOffset;
+	inode_t Destination;
+	size_t DestinationOffset;
+	size_t Size;
+}__attribute__((packed));
+
+/* Descriptor is the one the snapshot will be registered under, Instance is where it comes back */
+struct FSSnapshotRequest : public FSOperationRequest {
+	filesystem_t Descriptor;
+
+	uintptr_t Instance;
+}__attribute__((packed));
+
+struct FSReadDirectoryRequest : public FSOperationRequest {
+	inode_t Directory;
+	uintmax_t Cursor;
+	size_t Size;
+
+	/* The buffer extends for an amount defined by Size,
+	   and is filled with packed DirNodes */
+	uint8_t Buffer;
+}__attribute__((packed));
+
+/* One entry of a tree walk. Entries are packed one after the other,
+   each as long as the structure plus its path and the terminator */
+struct WalkEntry {
+	filesystem_t FSDescriptor;
+	inode_t Inode;
+	property_t Properties;
+	size_t Size;
+
+	/* 1 for what is right in the directory walked */
+	uint16_t Depth;
+	uint16_t PathLength;
+
+	/* Relative to the directory walked, without a leading slash */
+	char Path[];
+}__attribute__((packed));
+
+struct WalkLevel {
+	filesystem_t FSDescriptor;
+	inode_t Directory;
+	uintmax_t Cursor;
+
+	/* How much of the cursor path leads to this directory */
+	uint16_t PathLength;
+}__attribute__((packed));
+
+/* Where a walk is, kept by the caller and passed back as it was to carry on.
+   A zeroed cursor starts from the top */
+struct WalkCursor {
+	uint8_t Started;
+	uint8_t Finished;
+
+	/* The directories being read, the last one innermost */
+	uint16_t Depth;
+	WalkLevel Levels[WALK_MAX_DEPTH];
+
+	char Path[MAX_PATH_SIZE];
+}__attribute__((packed));
+
+/* What there is to know about a node without opening it */
+struct NodeAttributes {
+	/* Only used by batches, where each path succeeds or fails by itself */
+	result_t Result : 64;
+
+	filesystem_t FSDescriptor;
+	inode_t Inode;
+	property_t Properties;
+	size_t Size;
+}__attribute__((packed));
+
 struct FileOperations {
 	/* Universal */
 	result_t (*Create)(const char *path, const char *name, property_t properties);
@@ -88,19 +257,48 @@ struct FileOperations {
 	result_t (*Close)(fd_t file, mode_t capabilities);
 	result_t (*Read)(fd_t file, size_t offset, void *buffer, size_t count);
 	result_t (*Write)(fd_t file, size_t offset, const void *buffer, size_t count);
+	result_t (*ReadVector)(fd_t file, const IOSegment *segments, size_t count);
+	result_t (*WriteVector)(fd_t file, const IOSegment *segments, size_t count);
 
 	/* Just for directories */
 	dir_t (*OpenDir)(const char *path);
 	result_t (*CloseDir)(dir_t directory);
-	result_t (*ReadDir)(dir_t directory, size_t offset, DirNode *dirNode);
+	result_t (*ReadDir)(dir_t directory, uintmax_t *cursor, DirNode *dirNodes, size_t count);
 	
 	result_t (*Execute)(const char *path, property_t options);
+
+	/* Memory mapping */
+	map_t (*Mmap)(const char *path, size_t offset, size_t size, uint32_t flags);
+	result_t (*Munmap)(map_t mapping);
+	void *(*Fault)(map_t mapping, size_t offset, uint32_t access);
+
+	/* Copying without going through a buffer */
+	result_t (*Clone)(const char *path, const char *newPath);
+	result_t (*CopyRange)(const char *sourcePath, size_t sourceOffset, const char *destinationPath, size_t destinationOffset, size_t count);
+
+	/* Returns the filesystem a read-only copy of the one path is on was mounted as */
+	filesystem_t (*Snapshot)(const char *path, const char *mountPath);
+
+	/* Whole files in one go. ReadFile returns how much it copied and sets fileSize to how
+	   large the file really is, WriteFile swaps the old content for the new all at once */
+	result_t (*ReadFile)(const char *path, void *buffer, size_t size, size_t *fileSize);
+	result_t (*WriteFile)(const char *path, const void *buffer, size_t size);
+
+	/* Lists the whole tree under path, packing as many WalkEntries into entries as fit */
+	result_t (*Walk)(const char *path, uint32_t maxDepth, const char *filter, WalkCursor *cursor, void *entries, size_t size);
+
+	/* Looks up what is at path, or at each of count paths, without opening anything.
+	   GetAttributesBatch returns how many of the paths were found */
+	result_t (*GetAttributes)(const char *path, NodeAttributes *attributes);
+	result_t (*GetAttributesBatch)(const char **paths, size_t count, NodeAttributes *attributes);
 };
 
 struct FileOperationRequest {
 	uint32_t MagicNumber;
 	uint16_t Request;
 			
+	/* Requests that count what they did, bytes moved or entries listed,
+	   return that count as well as putting it here. Errors are negative */
 	result_t Result : 64;
 }__attribute__((packed));
 
@@ -125,6 +323,8 @@ struct FileChmodRequest : public FileOperationRequest {
 }__attribute__((packed));
 
 struct FileOpenRequest : public FileOperationRequest {
+	fd_t FileHandle;
+
 	char Path[MAX_PATH_SIZE];
 	mode_t Capabilities;
 }__attribute__((packed));
@@ -153,6 +353,16 @@ struct FileWriteRequest : public FileOperationRequest {
 	uint8_t Buffer;
 }__attribute__((packed));
 
+/* Reads or writes every segment in turn, stopping at the first that comes up short.
+   Result holds how many bytes were moved in all */
+struct FileVectorRequest : public FileOperationRequest {
+	fd_t FileHandle;
+	size_t Count;
+
+	/* The segments extend for an amount defined by Count */
+	IOSegment Segments;
+}__attribute__((packed));
+
 struct FileOpenDirRequest : public FileOperationRequest {
 	dir_t DirectoryHandle;
 
@@ -166,12 +376,126 @@ struct FileCloseDirRequest : public FileOperationRequest {
 
 struct FileReadDirRequest : public FileOperationRequest {
 	dir_t Directory;
-	size_t Offset;
+	uintmax_t Cursor; /* Opaque, start from 0 and pass back what is returned */
+	size_t Size;
 
-	DirNode NodeData; /* The resulting data is put here */
+	/* The buffer extends for an amount defined by Size.
+	   The resulting DirNodes are packed here, Result holds their count */
+	uint8_t Buffer;
 }__attribute__((packed));
 	
 struct FileExecuteRequest : public FileOperationRequest {
 	char Path[MAX_PATH_SIZE];
 	property_t Options;
 }__attribute__((packed));
+
+/* Maps Size bytes of the file at Path, from a page aligned Offset.
+   Pages are handed out one at a time by FOPS_FAULT as they are touched */
+struct FileMmapRequest : public FileOperationRequest {
+	map_t Mapping;
+
+	char Path[MAX_PATH_SIZE];
+	size_t Offset;
+	size_t Size;
+	uint32_t Flags;
+}__attribute__((packed));
+
+struct FileMunmapRequest : public FileOperationRequest {
+	map_t Mapping;
+}__attribute__((packed));
+
+/* Returns in Address the page holding Offset, counted from the start of the mapping.
+   A write fault on a shared mapping may move the page, so earlier addresses for it go stale */
+struct FileFaultRequest : public FileOperationRequest {
+	map_t Mapping;
+	size_t Offset;
+	uint32_t Access;
+
+	uintptr_t Address;
+}__attribute__((packed));
+
+/* Copies up to Size bytes of the file at Path into Buffer, and sets FileSize to its
+   whole size. Result holds how many bytes were copied, so a FileSize larger than that
+   means the file did not fit and can be asked for again with a larger buffer */
+struct FileReadFileRequest : public FileOperationRequest {
+	char Path[MAX_PATH_SIZE];
+	size_t FileSize;
+	size_t Size;
+
+	/* The buffer extends for an amount defined by Size */
+	uint8_t Buffer;
+}__attribute__((packed));
+
+/* Makes the Size bytes in Buffer the content of the file at Path, creating it if needed.
+   The content is written to a new file that then takes the place of the old one,
+   so the file is never seen half written. Result holds how many bytes were written */
+struct FileWriteFileRequest : public FileOperationRequest {
+	char Path[MAX_PATH_SIZE];
+	size_t Size;
+
+	/* The buffer extends for an amount defined by Size */
+	uint8_t Buffer;
+}__attribute__((packed));
+
+/* Walks the directory at Path and everything under it, parents before their children.
+   Entries down to MaxDepth levels are listed, with 0 going as deep as WALK_MAX_DEPTH.
+   If Filter is not empty, only entries whose name matches it are listed, where '*'
+   matches any run of characters and '?' any one; directories are still walked into.
+   Result holds how many entries were packed into Buffer, 0 once the walk is over */
+struct FileWalkRequest : public FileOperationRequest {
+	char Path[MAX_PATH_SIZE];
+	uint32_t MaxDepth;
+	char Filter[MAX_NAME_SIZE];
+
+	WalkCursor Cursor;
+	size_t Size;
+
+	/* The buffer extends for an amount defined by Size */
+	uint8_t Buffer;
+}__attribute__((packed));
+
+/* Fills Attributes with what is at Path */
+struct FileGetAttrRequest : public FileOperationRequest {
+	char Path[MAX_PATH_SIZE];
+
+	NodeAttributes Attributes;
+}__attribute__((packed));
+
+/* Looks up Count paths in one request. Buffer starts with Count NodeAttributes, one
+   for each path in order, followed by the paths one after the other, each ending in
+   its terminator. The paths may come in any order: each directory they share is
+   looked up once for all of them, and so is one that is not there.
+   Result holds how many paths were found, each entry has its own Result */
+struct FileGetAttrsRequest : public FileOperationRequest {
+	size_t Count;
+	size_t Size;
+
+	/* The buffer extends for an amount defined by Size */
+	uint8_t Buffer;
+}__attribute__((packed));
+
+/* Makes a new file at NewPath with the content of the file at Path.
+   Both have to be on the same filesystem, and nothing may be at NewPath yet */
+struct FileCloneRequest : public FileOperationRequest {
+	char Path[MAX_PATH_SIZE];
+	char NewPath[MAX_PATH_SIZE];
+}__attribute__((packed));
+
+/* Copies Size bytes from one file to another, which may be on different filesystems.
+   Result holds how many bytes were copied */
+struct FileCopyRangeRequest : public FileOperationRequest {
+	char SourcePath[MAX_PATH_SIZE];
+	size_t SourceOffset;
+	char DestinationPath[MAX_PATH_SIZE];
+	size_t DestinationOffset;
+	size_t Size;
+}__attribute__((packed));
+
+/* Takes a snapshot of the filesystem Path is on, which is mounted on the directory at MountPath.
+   Snapshot is the filesystem it was registered as. Refused while any of its files are mapped */
+struct FileSnapshotRequest : public FileOperationRequest {
+	filesystem_t Snapshot;
+
+	char Path[MAX_PATH_SIZE];
+	char MountPath[MAX_PATH_SIZE];
+}__attribute__((packed));
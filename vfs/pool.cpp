@@ -0,0 +1,168 @@
+#include "pool.h"
+
+#include <mkmi.h>
+
+#define POOL_BLOCK_MAGIC  0x504F4F4C
+#define POOL_OVERSIZE     0xFFFFFFFF
+
+/* Sits right before the memory handed out */
+struct PoolBlock {
+	PoolBlock *Next;
+	uint32_t Class;
+	uint32_t Magic;
+}__attribute__((aligned(16)));
+
+struct PoolSlab {
+	PoolSlab *Next;
+}__attribute__((aligned(16)));
+
+static size_t ClassFor(size_t size) {
+	if(size <= ((size_t)1 << POOL_MIN_SHIFT)) return 0;
+
+	/* Bits needed for size - 1 is the shift of the smallest power of two that fits */
+	size_t shift = 64 - __builtin_clzll((uint64_t)size - 1);
+	return shift - POOL_MIN_SHIFT;
+}
+
+RequestPool::RequestPool() {
+	Memset(Classes, 0, sizeof(Classes));
+
+	Slabs = NULL;
+	SlabLock = 0;
+	Oversize = 0;
+}
+
+RequestPool::~RequestPool() {
+	/* Blocks still out are gone along with their slabs */
+	while(Slabs != NULL) {
+		PoolSlab *next = Slabs->Next;
+		Free(Slabs);
+		Slabs = next;
+	}
+}
+
+void RequestPool::Lock(PoolClass *sizeClass) {
+	while(__atomic_test_and_set(&sizeClass->Lock, __ATOMIC_ACQUIRE)) {
+		while(__atomic_load_n(&sizeClass->Lock, __ATOMIC_RELAXED));
+	}
+}
+
+void RequestPool::Unlock(PoolClass *sizeClass) {
+	__atomic_clear(&sizeClass->Lock, __ATOMIC_RELEASE);
+}
+
+/* Called with the class locked */
+bool RequestPool::Grow(PoolClass *sizeClass, size_t index) {
+	size_t stride = sizeof(PoolBlock) + ((size_t)1 << (index + POOL_MIN_SHIFT));
+	size_t count = POOL_SLAB_SIZE / stride;
+	if(count == 0) count = 1;
+
+	PoolSlab *slab = (PoolSlab*)Malloc(sizeof(PoolSlab) + count * stride);
+	if(slab == NULL) return false;
+
+	while(__atomic_test_and_set(&SlabLock, __ATOMIC_ACQUIRE));
+	slab->Next = Slabs;
+	Slabs = slab;
+	__atomic_clear(&SlabLock, __ATOMIC_RELEASE);
+
+	uint8_t *position = (uint8_t*)(slab + 1);
+	for (size_t i = 0; i < count; ++i, position += stride) {
+		PoolBlock *block = (PoolBlock*)position;
+		block->Class = index;
+		block->Magic = POOL_BLOCK_MAGIC;
+		block->Next = sizeClass->FreeList;
+		sizeClass->FreeList = block;
+	}
+
+	sizeClass->Blocks += count;
+	++sizeClass->Grows;
+
+	return true;
+}
+
+void *RequestPool::Allocate(size_t size) {
+	size_t index = ClassFor(size);
+
+	if(index >= POOL_CLASSES) {
+		PoolBlock *block = (PoolBlock*)Malloc(sizeof(PoolBlock) + size);
+		if(block == NULL) return NULL;
+
+		block->Class = POOL_OVERSIZE;
+		block->Magic = POOL_BLOCK_MAGIC;
+		__atomic_fetch_add(&Oversize, 1, __ATOMIC_RELAXED);
+
+		return block + 1;
+	}
+
+	PoolClass *sizeClass = &Classes[index];
+	Lock(sizeClass);
+
+	if(sizeClass->FreeList == NULL && !Grow(sizeClass, index)) {
+		Unlock(sizeClass);
+		return NULL;
+	}
+
+	PoolBlock *block = sizeClass->FreeList;
+	sizeClass->FreeList = block->Next;
+
+	++sizeClass->Allocations;
+	if(++sizeClass->InUse > sizeClass->Peak) sizeClass->Peak = sizeClass->InUse;
+
+	Unlock(sizeClass);
+
+	block->Next = NULL;
+	return block + 1;
+}
+
+void RequestPool::Release(void *pointer) {
+	if(pointer == NULL) return;
+
+	PoolBlock *block = (PoolBlock*)pointer - 1;
+	if(block->Magic != POOL_BLOCK_MAGIC) return;
+
+	if(block->Class == POOL_OVERSIZE) {
+		__atomic_fetch_sub(&Oversize, 1, __ATOMIC_RELAXED);
+		Free(block);
+		return;
+	}
+
+	PoolClass *sizeClass = &Classes[block->Class];
+	Lock(sizeClass);
+
+	block->Next = sizeClass->FreeList;
+	sizeClass->FreeList = block;
+	--sizeClass->InUse;
+
+	Unlock(sizeClass);
+}
+
+void RequestPool::Reserve(size_t size, size_t count) {
+	size_t index = ClassFor(size);
+	if(index >= POOL_CLASSES) return;
+
+	PoolClass *sizeClass = &Classes[index];
+	Lock(sizeClass);
+
+	while(sizeClass->Blocks - sizeClass->InUse < count) {
+		if(!Grow(sizeClass, index)) break;
+	}
+
+	Unlock(sizeClass);
+}
+
+void RequestPool::GetOccupancy(size_t index, PoolOccupancy *occupancy) {
+	Memset(occupancy, 0, sizeof(PoolOccupancy));
+	if(index >= POOL_CLASSES) return;
+
+	PoolClass *sizeClass = &Classes[index];
+	Lock(sizeClass);
+
+	occupancy->BlockSize = (size_t)1 << (index + POOL_MIN_SHIFT);
+	occupancy->Blocks = sizeClass->Blocks;
+	occupancy->InUse = sizeClass->InUse;
+	occupancy->Peak = sizeClass->Peak;
+	occupancy->Allocations = sizeClass->Allocations;
+	occupancy->Grows = sizeClass->Grows;
+
+	Unlock(sizeClass);
+}
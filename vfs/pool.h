@@ -0,0 +1,69 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/* Blocks come in powers of two from 2^POOL_MIN_SHIFT to 2^POOL_MAX_SHIFT bytes */
+#define POOL_MIN_SHIFT   8
+#define POOL_MAX_SHIFT   20
+#define POOL_CLASSES     (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+/* Small blocks are carved out of slabs of this size, larger ones get a slab each */
+#define POOL_SLAB_SIZE   0x10000
+
+struct PoolBlock;
+struct PoolSlab;
+
+struct PoolClass {
+	PoolBlock *FreeList;
+	uint8_t Lock;
+
+	size_t Blocks;
+	size_t InUse;
+	size_t Peak;
+
+	uint64_t Allocations;
+	/* Times the class ran dry and had to go to the heap */
+	uint64_t Grows;
+};
+
+struct PoolOccupancy {
+	size_t BlockSize;
+
+	size_t Blocks;
+	size_t InUse;
+	size_t Peak;
+
+	uint64_t Allocations;
+	uint64_t Grows;
+};
+
+/* Size classed blocks for requests and their payloads.
+ * Released blocks go back to their class and are never handed back to the heap,
+ * so once the pool has grown to fit the load, requests are built without Malloc.
+ * Anything larger than the largest class goes straight to the heap.
+ */
+class RequestPool {
+public:
+	RequestPool();
+	~RequestPool();
+
+	void *Allocate(size_t size);
+	void Release(void *block);
+
+	/* Grows a class ahead of time so that the first requests don't have to */
+	void Reserve(size_t size, size_t count);
+
+	void GetOccupancy(size_t sizeClass, PoolOccupancy *occupancy);
+	/* Blocks too large for any class, currently out */
+	size_t GetOversize() { return __atomic_load_n(&Oversize, __ATOMIC_RELAXED); }
+private:
+	bool Grow(PoolClass *sizeClass, size_t index);
+
+	void Lock(PoolClass *sizeClass);
+	void Unlock(PoolClass *sizeClass);
+
+	PoolClass Classes[POOL_CLASSES];
+	PoolSlab *Slabs;
+	uint8_t SlabLock;
+
+	size_t Oversize;
+};
@@ -0,0 +1,140 @@
+#include "stats.h"
+
+#include <mkmi.h>
+
+#define STATS_ADD(counter, value) __atomic_fetch_add(&(counter), (value), __ATOMIC_RELAXED)
+#define STATS_LOAD(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+static const char *FileOperationNames[STATS_MAX_REQUESTS] = {
+	"unknown", "create", "delete", "rename", "chmod", "open", "close", "read",
+	"write", "opendir", "closedir", "readdir", "execute", "mmap", "munmap", "fault",
+	"clone", "copyrange", "snapshot", "readv", "writev", "walk", "readfile", "writefile",
+	"getattr", "getattrs", "unknown", "unknown", "unknown", "unknown", "unknown", "other",
+};
+
+static const char *NodeOperationNames[STATS_MAX_REQUESTS] = {
+	"unknown", "create", "delete", "getbynode", "getbyname", "getbyindex", "getroot", "read",
+	"write", "readdir", "rename", "map", "bind", "readscatter", "writescatter", "mapblock",
+	"clone", "copyrange", "snapshot", "readvector", "writevector", "unmap", "unknown", "unknown",
+	"unknown", "unknown", "unknown", "unknown", "unknown", "unknown", "unknown", "other",
+};
+
+static size_t RequestSlot(uint16_t request) {
+	return request < STATS_MAX_REQUESTS ? request : STATS_MAX_REQUESTS - 1;
+}
+
+const char *FileOperationName(uint16_t request) {
+	return FileOperationNames[RequestSlot(request)];
+}
+
+const char *NodeOperationName(uint16_t request) {
+	return NodeOperationNames[RequestSlot(request)];
+}
+
+VFSStats::VFSStats() {
+	/* Shards start on a cache line of their own */
+	Allocation = Malloc(STATS_SHARDS * sizeof(StatsShard) + 64);
+	Shards = (StatsShard*)(((uintptr_t)Allocation + 63) & ~(uintptr_t)63);
+
+	Memset(Shards, 0, STATS_SHARDS * sizeof(StatsShard));
+}
+
+VFSStats::~VFSStats() {
+	Free(Allocation);
+}
+
+StatsShard *VFSStats::CurrentShard() {
+	/* There is no way to ask which CPU we are on, but every thread has its own stack,
+	   which is a good enough way to keep concurrent callers apart */
+	uintptr_t stack = (uintptr_t)__builtin_frame_address(0);
+
+	return &Shards[(stack >> 16) % STATS_SHARDS];
+}
+
+void VFSStats::Record(StatsShard *shard, OperationStats *stats, result_t result, uint64_t bytes, uint64_t ticks) {
+	size_t bucket = ticks == 0 ? 0 : 64 - __builtin_clzll(ticks);
+	if(bucket >= STATS_HISTOGRAM_BUCKETS) bucket = STATS_HISTOGRAM_BUCKETS - 1;
+
+	STATS_ADD(stats->Count, 1);
+	STATS_ADD(stats->Ticks, ticks);
+	STATS_ADD(stats->Histogram[bucket], 1);
+
+	if(bytes != 0) STATS_ADD(stats->Bytes, bytes);
+
+	if(result < 0) {
+		size_t error = -result;
+		if(error >= STATS_MAX_ERRORS) error = STATS_MAX_ERRORS - 1;
+
+		STATS_ADD(stats->Errors, 1);
+		STATS_ADD(shard->Errors[error], 1);
+	}
+}
+
+void VFSStats::RecordFileOperation(uint16_t request, result_t result, uint64_t bytes, uint64_t ticks) {
+	StatsShard *shard = CurrentShard();
+	Record(shard, &shard->FileOperations[RequestSlot(request)], result, bytes, ticks);
+}
+
+void VFSStats::RecordNodeOperation(filesystem_t fs, uint16_t request, result_t result, uint64_t bytes, uint64_t ticks) {
+	if(fs < 0 || fs >= STATS_MAX_FILESYSTEMS) fs = STATS_MAX_FILESYSTEMS - 1;
+
+	StatsShard *shard = CurrentShard();
+	Record(shard, &shard->NodeOperations[fs][RequestSlot(request)], result, bytes, ticks);
+}
+
+void VFSStats::RecordCache(StatsCache cache, bool hit) {
+	StatsShard *shard = CurrentShard();
+
+	if(hit) {
+		STATS_ADD(shard->CacheHits[cache], 1);
+	} else {
+		STATS_ADD(shard->CacheMisses[cache], 1);
+	}
+}
+
+void VFSStats::Sum(OperationStats *destination, OperationStats *source) {
+	destination->Count += STATS_LOAD(source->Count);
+	destination->Errors += STATS_LOAD(source->Errors);
+	destination->Bytes += STATS_LOAD(source->Bytes);
+	destination->Ticks += STATS_LOAD(source->Ticks);
+
+	for (size_t i = 0; i < STATS_HISTOGRAM_BUCKETS; ++i) {
+		destination->Histogram[i] += STATS_LOAD(source->Histogram[i]);
+	}
+}
+
+void VFSStats::GetFileOperation(uint16_t request, OperationStats *stats) {
+	Memset(stats, 0, sizeof(OperationStats));
+
+	for (size_t i = 0; i < STATS_SHARDS; ++i) {
+		Sum(stats, &Shards[i].FileOperations[RequestSlot(request)]);
+	}
+}
+
+void VFSStats::GetNodeOperation(filesystem_t fs, uint16_t request, OperationStats *stats) {
+	Memset(stats, 0, sizeof(OperationStats));
+	if(fs < 0 || fs >= STATS_MAX_FILESYSTEMS) return;
+
+	for (size_t i = 0; i < STATS_SHARDS; ++i) {
+		Sum(stats, &Shards[i].NodeOperations[fs][RequestSlot(request)]);
+	}
+}
+
+uint64_t VFSStats::GetErrors(size_t error) {
+	if(error >= STATS_MAX_ERRORS) return 0;
+
+	uint64_t total = 0;
+	for (size_t i = 0; i < STATS_SHARDS; ++i) total += STATS_LOAD(Shards[i].Errors[error]);
+
+	return total;
+}
+
+void VFSStats::GetCache(StatsCache cache, uint64_t *hits, uint64_t *misses) {
+	*hits = 0;
+	*misses = 0;
+
+	for (size_t i = 0; i < STATS_SHARDS; ++i) {
+		*hits += STATS_LOAD(Shards[i].CacheHits[cache]);
+		*misses += STATS_LOAD(Shards[i].CacheMisses[cache]);
+	}
+}
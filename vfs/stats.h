@@ -0,0 +1,75 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "typedefs.h"
+
+/* Request codes are small, anything past this is counted in the last slot */
+#define STATS_MAX_REQUESTS        32
+/* Filesystems past this share the last slot */
+#define STATS_MAX_FILESYSTEMS     8
+/* Bucket n counts requests that took less than 2^n ticks, the last one everything slower */
+#define STATS_HISTOGRAM_BUCKETS   32
+/* Errors by their negated code, the last slot takes any other code */
+#define STATS_MAX_ERRORS          8
+/* Counters are spread over shards so that concurrent callers rarely touch the same lines */
+#define STATS_SHARDS              4
+
+enum StatsCache {
+	/* FOPS_EXECUTE could hand the image over in place rather than staging a copy */
+	STATS_CACHE_EXECUTE_MAP,
+	/* FOPS_FAULT found the page already resolved for that kind of access */
+	STATS_CACHE_MMAP_FAULT,
+	/* FOPS_COPY_RANGE was left to the filesystem rather than copied through a buffer */
+	STATS_CACHE_COPY_RANGE,
+	STATS_CACHE_COUNT,
+};
+
+struct OperationStats {
+	uint64_t Count;
+	uint64_t Errors;
+	uint64_t Bytes;
+	uint64_t Ticks;
+
+	uint64_t Histogram[STATS_HISTOGRAM_BUCKETS];
+};
+
+struct StatsShard {
+	OperationStats FileOperations[STATS_MAX_REQUESTS];
+	OperationStats NodeOperations[STATS_MAX_FILESYSTEMS][STATS_MAX_REQUESTS];
+
+	uint64_t Errors[STATS_MAX_ERRORS];
+
+	uint64_t CacheHits[STATS_CACHE_COUNT];
+	uint64_t CacheMisses[STATS_CACHE_COUNT];
+}__attribute__((aligned(64)));
+
+/* Counters and latency histograms for every request that goes through the VFS.
+ * Updates are relaxed atomic adds on one shard, so nothing ever takes a lock.
+ * Readers add the shards up, and may see a request half counted.
+ */
+class VFSStats {
+public:
+	VFSStats();
+	~VFSStats();
+
+	void RecordFileOperation(uint16_t request, result_t result, uint64_t bytes, uint64_t ticks);
+	void RecordNodeOperation(filesystem_t fs, uint16_t request, result_t result, uint64_t bytes, uint64_t ticks);
+	void RecordCache(StatsCache cache, bool hit);
+
+	/* Totals over all shards */
+	void GetFileOperation(uint16_t request, OperationStats *stats);
+	void GetNodeOperation(filesystem_t fs, uint16_t request, OperationStats *stats);
+	uint64_t GetErrors(size_t error);
+	void GetCache(StatsCache cache, uint64_t *hits, uint64_t *misses);
+private:
+	StatsShard *CurrentShard();
+	void Record(StatsShard *shard, OperationStats *stats, result_t result, uint64_t bytes, uint64_t ticks);
+	void Sum(OperationStats *destination, OperationStats *source);
+
+	void *Allocation;
+	StatsShard *Shards;
+};
+
+const char *FileOperationName(uint16_t request);
+const char *NodeOperationName(uint16_t request);
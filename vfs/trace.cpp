@@ -0,0 +1,370 @@
+#include "trace.h"
+
+#include <mkmi.h>
+
+static uint8_t NameLength(const char *name, size_t maximum) {
+	size_t length = 0;
+	while(length < maximum && name[length] != '\0') ++length;
+
+	return length > 0xFF ? 0xFF : length;
+}
+
+/* Vectors are kept as where their first segment starts and how much they move in all */
+static void DescribeSegments(const IOSegment *segments, size_t count, TraceRecord *record) {
+	if(count != 0) record->Offset = segments[0].Offset;
+
+	for (size_t i = 0; i < count; ++i) record->Size += segments[i].Size;
+}
+
+VFSTrace::VFSTrace(size_t count) {
+	size_t capacity = 1;
+	while(capacity * 2 <= count && capacity * 2 <= SIZE_MAX / sizeof(TraceRecord)) capacity *= 2;
+
+	Records = (TraceRecord*)Malloc(capacity * sizeof(TraceRecord));
+	Sequences = (uint64_t*)Malloc(capacity * sizeof(uint64_t));
+	Mask = 0;
+	Head = 0;
+
+	/* Without both, the ring stays empty and nothing is recorded */
+	if(Records == NULL || Sequences == NULL) {
+		if(Records != NULL) Free(Records);
+		if(Sequences != NULL) Free(Sequences);
+
+		Records = NULL;
+		Sequences = NULL;
+		return;
+	}
+
+	Mask = capacity - 1;
+
+	/* A sequence of zero is a slot nobody has written yet */
+	Memset(Sequences, 0, capacity * sizeof(uint64_t));
+}
+
+VFSTrace::~VFSTrace() {
+	if(Records != NULL) Free(Records);
+	if(Sequences != NULL) Free(Sequences);
+}
+
+void VFSTrace::DescribeFileOperation(FileOperationRequest *request, TraceRecord *record) {
+	Memset(record, 0, sizeof(TraceRecord));
+
+	record->Kind = TRACE_FILE_OPERATION;
+	record->Request = request->Request;
+	record->FS = TRACE_NO_FS;
+	record->Inode = TRACE_NO_NODE;
+	record->Target = TRACE_NO_NODE;
+
+	switch(request->Request) {
+		case FOPS_CREATE: {
+			FileCreateRequest *createRequest = (FileCreateRequest*)request;
+			record->NameLength = NameLength(createRequest->Name, MAX_NAME_SIZE);
+			record->Size = createRequest->Properties;
+			}
+			break;
+		case FOPS_DELETE:
+			record->NameLength = NameLength(((FileDeleteRequest*)request)->Path, MAX_PATH_SIZE);
+			break;
+		case FOPS_RENAME:
+			record->NameLength = NameLength(((FileRenameRequest*)request)->NewPath, MAX_PATH_SIZE);
+			break;
+		case FOPS_OPEN:
+			record->NameLength = NameLength(((FileOpenRequest*)request)->Path, MAX_PATH_SIZE);
+			break;
+		case FOPS_CLOSE:
+			record->Inode = ((FileCloseRequest*)request)->FileHandle;
+			break;
+		case FOPS_READ: {
+			FileReadRequest *readRequest = (FileReadRequest*)request;
+			record->Inode = readRequest->FileHandle;
+			record->Offset = readRequest->Offset;
+			record->Size = readRequest->Size;
+			}
+			break;
+		case FOPS_WRITE: {
+			FileWriteRequest *writeRequest = (FileWriteRequest*)request;
+			record->Inode = writeRequest->FileHandle;
+			record->Offset = writeRequest->Offset;
+			record->Size = writeRequest->Size;
+			}
+			break;
+		case FOPS_READV:
+		case FOPS_WRITEV: {
+			FileVectorRequest *vectorRequest = (FileVectorRequest*)request;
+			record->Inode = vectorRequest->FileHandle;
+			DescribeSegments(&vectorRequest->Segments, vectorRequest->Count, record);
+			}
+			break;
+		case FOPS_READFILE: {
+			FileReadFileRequest *readFileRequest = (FileReadFileRequest*)request;
+			record->NameLength = NameLength(readFileRequest->Path, MAX_PATH_SIZE);
+			record->Size = readFileRequest->Size;
+			}
+			break;
+		case FOPS_WRITEFILE: {
+			FileWriteFileRequest *writeFileRequest = (FileWriteFileRequest*)request;
+			record->NameLength = NameLength(writeFileRequest->Path, MAX_PATH_SIZE);
+			record->Size = writeFileRequest->Size;
+			}
+			break;
+		case FOPS_WALK: {
+			FileWalkRequest *walkRequest = (FileWalkRequest*)request;
+			record->NameLength = NameLength(walkRequest->Path, MAX_PATH_SIZE);
+			record->Offset = walkRequest->Cursor.Depth;
+			record->Size = walkRequest->Size;
+			}
+			break;
+		case FOPS_GETATTR:
+			record->NameLength = NameLength(((FileGetAttrRequest*)request)->Path, MAX_PATH_SIZE);
+			break;
+		case FOPS_GETATTRS: {
+			FileGetAttrsRequest *getAttrsRequest = (FileGetAttrsRequest*)request;
+			record->Offset = getAttrsRequest->Count;
+			record->Size = getAttrsRequest->Size;
+			}
+			break;
+		case FOPS_OPENDIR:
+			record->NameLength = NameLength(((FileOpenDirRequest*)request)->Path, MAX_PATH_SIZE);
+			break;
+		case FOPS_CLOSEDIR:
+			record->Inode = ((FileCloseDirRequest*)request)->DirectoryHandle;
+			break;
+		case FOPS_READDIR: {
+			FileReadDirRequest *readDirRequest = (FileReadDirRequest*)request;
+			record->Inode = readDirRequest->Directory;
+			record->Offset = readDirRequest->Cursor;
+			record->Size = readDirRequest->Size;
+			}
+			break;
+		case FOPS_EXECUTE:
+			record->NameLength = NameLength(((FileExecuteRequest*)request)->Path, MAX_PATH_SIZE);
+			break;
+		case FOPS_MMAP: {
+			FileMmapRequest *mmapRequest = (FileMmapRequest*)request;
+			record->NameLength = NameLength(mmapRequest->Path, MAX_PATH_SIZE);
+			record->Offset = mmapRequest->Offset;
+			record->Size = mmapRequest->Size;
+			}
+			break;
+		case FOPS_MUNMAP:
+			record->Inode = ((FileMunmapRequest*)request)->Mapping;
+			break;
+		case FOPS_FAULT: {
+			FileFaultRequest *faultRequest = (FileFaultRequest*)request;
+			record->Inode = faultRequest->Mapping;
+			record->Offset = faultRequest->Offset;
+			record->Size = faultRequest->Access;
+			}
+			break;
+		case FOPS_CLONE:
+			record->NameLength = NameLength(((FileCloneRequest*)request)->NewPath, MAX_PATH_SIZE);
+			break;
+		case FOPS_COPY_RANGE: {
+			FileCopyRangeRequest *copyRequest = (FileCopyRangeRequest*)request;
+			record->NameLength = NameLength(copyRequest->DestinationPath, MAX_PATH_SIZE);
+			record->Offset = copyRequest->SourceOffset;
+			record->Size = copyRequest->Size;
+			}
+			break;
+		case FOPS_SNAPSHOT:
+			record->NameLength = NameLength(((FileSnapshotRequest*)request)->MountPath, MAX_PATH_SIZE);
+			break;
+	}
+}
+
+void VFSTrace::DescribeNodeOperation(filesystem_t fs, FSOperationRequest *request, TraceRecord *record) {
+	Memset(record, 0, sizeof(TraceRecord));
+
+	record->Kind = TRACE_NODE_OPERATION;
+	record->Request = request->Request;
+	record->FS = fs;
+	record->Inode = TRACE_NO_NODE;
+	record->Target = TRACE_NO_NODE;
+
+	switch(request->Request) {
+		case NODE_CREATE: {
+			FSCreateNodeRequest *createRequest = (FSCreateNodeRequest*)request;
+			record->Inode = createRequest->Directory;
+			record->NameLength = NameLength(createRequest->Name, MAX_NAME_SIZE);
+			record->Size = createRequest->Flags;
+			}
+			break;
+		case NODE_DELETE:
+			record->Inode = ((FSDeleteNodeRequest*)request)->Node;
+			break;
+		case NODE_RENAME: {
+			FSRenameNodeRequest *renameRequest = (FSRenameNodeRequest*)request;
+			record->Inode = renameRequest->Node;
+			record->Offset = renameRequest->Directory;
+			record->NameLength = NameLength(renameRequest->Name, MAX_NAME_SIZE);
+			}
+			break;
+		case NODE_GETBYNODE:
+			record->Inode = ((FSGetByNodeRequest*)request)->Node;
+			break;
+		case NODE_GETBYNAME: {
+			FSGetByNameRequest *getByNameRequest = (FSGetByNameRequest*)request;
+			record->Inode = getByNameRequest->Directory;
+			record->NameLength = NameLength(getByNameRequest->Name, MAX_NAME_SIZE);
+			}
+			break;
+		case NODE_GETBYINDEX: {
+			FSGetByIndexRequest *getByIndexRequest = (FSGetByIndexRequest*)request;
+			record->Inode = getByIndexRequest->Directory;
+			record->Offset = getByIndexRequest->Index;
+			}
+			break;
+		case NODE_READ: {
+			FSReadNodeRequest *readRequest = (FSReadNodeRequest*)request;
+			record->Inode = readRequest->Node;
+			record->Offset = readRequest->Offset;
+			record->Size = readRequest->Size;
+			}
+			break;
+		case NODE_WRITE: {
+			FSWriteNodeRequest *writeRequest = (FSWriteNodeRequest*)request;
+			record->Inode = writeRequest->Node;
+			record->Offset = writeRequest->Offset;
+			record->Size = writeRequest->Size;
+			}
+			break;
+		case NODE_READ_SCATTER:
+		case NODE_WRITE_SCATTER: {
+			FSScatterNodeRequest *scatterRequest = (FSScatterNodeRequest*)request;
+			record->Inode = scatterRequest->Node;
+			record->Offset = scatterRequest->Offset;
+			record->Size = scatterRequest->Size;
+			}
+			break;
+		case NODE_READ_VECTOR:
+		case NODE_WRITE_VECTOR: {
+			FSVectorNodeRequest *vectorRequest = (FSVectorNodeRequest*)request;
+			record->Inode = vectorRequest->Node;
+			DescribeSegments(&vectorRequest->Segments, vectorRequest->Count, record);
+			}
+			break;
+		case NODE_BIND: {
+			FSBindNodeRequest *bindRequest = (FSBindNodeRequest*)request;
+			record->Inode = bindRequest->Node;
+			record->Size = bindRequest->Size;
+			}
+			break;
+		case NODE_MAP:
+			record->Inode = ((FSMapNodeRequest*)request)->Node;
+			break;
+		case NODE_UNMAP:
+			record->Inode = ((FSUnmapNodeRequest*)request)->Node;
+			break;
+		case NODE_MAP_BLOCK: {
+			FSMapBlockRequest *mapBlockRequest = (FSMapBlockRequest*)request;
+			record->Inode = mapBlockRequest->Node;
+			record->Offset = mapBlockRequest->Offset;
+			record->Size = mapBlockRequest->Write;
+			}
+			break;
+		case NODE_CLONE: {
+			FSCloneNodeRequest *cloneRequest = (FSCloneNodeRequest*)request;
+			record->Inode = cloneRequest->Node;
+			record->Offset = cloneRequest->Directory;
+			record->NameLength = NameLength(cloneRequest->Name, MAX_NAME_SIZE);
+			}
+			break;
+		case NODE_COPY_RANGE: {
+			FSCopyRangeRequest *copyRequest = (FSCopyRangeRequest*)request;
+			record->Inode = copyRequest->Source;
+			record->Target = copyRequest->Destination;
+			record->Offset = copyRequest->SourceOffset;
+			record->Size = copyRequest->Size;
+			}
+			break;
+		case NODE_SNAPSHOT:
+			record->Target = ((FSSnapshotRequest*)request)->Descriptor;
+			break;
+		case NODE_READDIR: {
+			FSReadDirectoryRequest *readDirRequest = (FSReadDirectoryRequest*)request;
+			record->Inode = readDirRequest->Directory;
+			record->Offset = readDirRequest->Cursor;
+			record->Size = readDirRequest->Size;
+			}
+			break;
+	}
+}
+
+void VFSTrace::Append(TraceRecord *record, FSOperationRequest *request, result_t result, uint64_t start, uint64_t ticks) {
+	if(Records == NULL) return;
+
+	record->Timestamp = start;
+	record->Ticks = ticks > 0xFFFFFFFF ? 0xFFFFFFFF : ticks;
+	record->Result = result;
+
+	/* Requests that hand back a node say which one */
+	if(request != NULL && result == 0) {
+		switch(record->Request) {
+			case NODE_CREATE:
+				record->Target = ((FSCreateNodeRequest*)request)->ResultNode.Inode;
+				break;
+			case NODE_RENAME:
+				record->Target = ((FSRenameNodeRequest*)request)->ResultNode.Inode;
+				break;
+			case NODE_CLONE:
+				record->Target = ((FSCloneNodeRequest*)request)->ResultNode.Inode;
+				break;
+			case NODE_GETBYNAME:
+				record->Target = ((FSGetByNameRequest*)request)->ResultNode.Inode;
+				break;
+			case NODE_GETBYINDEX:
+				record->Target = ((FSGetByIndexRequest*)request)->ResultNode.Inode;
+				break;
+			case NODE_GETROOT:
+				record->Target = ((FSGetRootRequest*)request)->ResultNode.Inode;
+				break;
+		}
+	}
+
+	uint64_t sequence = __atomic_fetch_add(&Head, 1, __ATOMIC_RELAXED);
+	uint64_t slot = sequence & Mask;
+
+	/* The slot reads as empty while it is being filled */
+	__atomic_store_n(&Sequences[slot], 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	Memcpy(&Records[slot], record, sizeof(TraceRecord));
+
+	__atomic_store_n(&Sequences[slot], sequence + 1, __ATOMIC_RELEASE);
+}
+
+intmax_t VFSTrace::Dump(void *buffer, size_t size) {
+	uint64_t head = __atomic_load_n(&Head, __ATOMIC_ACQUIRE);
+	uint64_t count = head > Mask + 1 ? Mask + 1 : head;
+
+	if(buffer == NULL) return sizeof(TraceHeader) + count * sizeof(TraceRecord);
+	if(size < sizeof(TraceHeader)) return -1;
+
+	uint64_t fit = (size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+	if(count > fit) count = fit;
+
+	TraceHeader *header = (TraceHeader*)buffer;
+	TraceRecord *records = (TraceRecord*)(header + 1);
+
+	uint64_t written = 0;
+	for (uint64_t sequence = head - count; sequence < head; ++sequence) {
+		uint64_t slot = sequence & Mask;
+
+		if(__atomic_load_n(&Sequences[slot], __ATOMIC_ACQUIRE) != sequence + 1) continue;
+		Memcpy(&records[written], &Records[slot], sizeof(TraceRecord));
+
+		/* A writer that lapped us while we copied leaves a torn record behind */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&Sequences[slot], __ATOMIC_RELAXED) != sequence + 1) continue;
+
+		++written;
+	}
+
+	Memcpy(header->Magic, TRACE_MAGIC, sizeof(header->Magic));
+	header->Version = TRACE_VERSION;
+	header->RecordSize = sizeof(TraceRecord);
+	header->RecordCount = written;
+	header->Dropped = head - written;
+
+	return sizeof(TraceHeader) + written * sizeof(TraceRecord);
+}
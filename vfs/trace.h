@@ -0,0 +1,88 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "typedefs.h"
+#include "fops.h"
+
+/* A dumped trace is a header followed by its records, oldest first */
+#define TRACE_MAGIC    "VFSTRACE"
+#define TRACE_VERSION  1
+
+#define TRACE_FILE_OPERATION  1
+#define TRACE_NODE_OPERATION  2
+
+/* File requests have no filesystem of their own */
+#define TRACE_NO_FS    -1
+#define TRACE_NO_NODE  -1
+
+struct TraceHeader {
+	char Magic[8];
+	uint32_t Version;
+	uint32_t RecordSize;
+
+	uint64_t RecordCount;
+	/* Records that were overwritten or still being written when the trace was dumped */
+	uint64_t Dropped;
+}__attribute__((packed));
+
+/* One request as it went through the VFS.
+ * Inode is the node the request works on: the directory for lookups, creation and
+ * directory reads, the open handle or mapping for file requests, the source of clones
+ * and copies. Target is the node a request found, made, moved or copied into, and
+ * the filesystem a snapshot was taken as.
+ * Offset holds the offset of reads, writes, mappings and faults, the index of
+ * NODE_GETBYINDEX, the starting cursor of directory reads, how deep a walk was when
+ * it went on, how many paths a batched getattr had, the new directory of a rename or
+ * clone and the source offset of a copy, whose destination offset is not kept.
+ * Vectored transfers keep the offset of their first segment, and the size of all of
+ * them together. Size holds the size of transfers, copies, mappings and the buffers
+ * of walks and batched getattrs, the flags of new nodes and whether a fault or block
+ * mapping was for writing.
+ */
+struct TraceRecord {
+	uint64_t Timestamp;
+	uint32_t Ticks;
+	uint16_t Request;
+	uint8_t Kind;
+	/* Names and paths are not kept, only how long they were */
+	uint8_t NameLength;
+
+	int32_t FS;
+	uint32_t Reserved;
+
+	int64_t Inode;
+	int64_t Target;
+	uint64_t Offset;
+	uint64_t Size;
+	int64_t Result;
+}__attribute__((packed));
+
+/* Fixed size ring of the most recent requests.
+ * Writers claim a slot with an atomic add and publish it with a sequence number,
+ * so recording never takes a lock and never waits on a reader.
+ */
+class VFSTrace {
+public:
+	/* The ring holds the largest power of two of records not above count */
+	VFSTrace(size_t count);
+	~VFSTrace();
+
+	/* Whether the ring could be allocated. If not, nothing is ever recorded */
+	bool IsRecording() { return Records != NULL; }
+
+	/* Inputs are taken before the request runs, as some are reused in place */
+	void DescribeFileOperation(FileOperationRequest *request, TraceRecord *record);
+	void DescribeNodeOperation(filesystem_t fs, FSOperationRequest *request, TraceRecord *record);
+	void Append(TraceRecord *record, FSOperationRequest *request, result_t result, uint64_t start, uint64_t ticks);
+
+	/* Writes a header and as many of the latest records as fit, returning the size used.
+	   Without a buffer, returns the size needed for everything in the ring */
+	intmax_t Dump(void *buffer, size_t size);
+private:
+	TraceRecord *Records;
+	uint64_t *Sequences;
+	uint64_t Mask;
+
+	uint64_t Head;
+};
@@ -14,6 +14,19 @@
 #define NODE_GETROOT             0x0006
 #define NODE_READ                0x0007
 #define NODE_WRITE               0x0008
+#define NODE_READDIR             0x0009
+#define NODE_RENAME              0x000A
+#define NODE_MAP                 0x000B
+#define NODE_BIND                0x000C
+#define NODE_READ_SCATTER        0x000D
+#define NODE_WRITE_SCATTER       0x000E
+#define NODE_MAP_BLOCK           0x000F
+#define NODE_CLONE               0x0010
+#define NODE_COPY_RANGE          0x0011
+#define NODE_SNAPSHOT            0x0012
+#define NODE_READ_VECTOR         0x0013
+#define NODE_WRITE_VECTOR        0x0014
+#define NODE_UNMAP               0x0015
 
 #define FOPS_CREATE              0x0001
 #define FOPS_DELETE              0x0002
@@ -27,6 +40,19 @@
 #define FOPS_CLOSEDIR            0x000A
 #define FOPS_READDIR             0x000B
 #define FOPS_EXECUTE             0x000C
+#define FOPS_MMAP                0x000D
+#define FOPS_MUNMAP              0x000E
+#define FOPS_FAULT               0x000F
+#define FOPS_CLONE               0x0010
+#define FOPS_COPY_RANGE          0x0011
+#define FOPS_SNAPSHOT            0x0012
+#define FOPS_READV               0x0013
+#define FOPS_WRITEV              0x0014
+#define FOPS_WALK                0x0015
+#define FOPS_READFILE            0x0016
+#define FOPS_WRITEFILE           0x0017
+#define FOPS_GETATTR             0x0018
+#define FOPS_GETATTRS            0x0019
 
 #define NODE_PROPERTY_FILE       0x0001
 #define NODE_PROPERTY_DIRECTORY  0x0002
@@ -36,6 +62,14 @@
 #define NODE_PROPERTY_SYMLINK    0x0020
 #define NODE_PROPERTY_MOUNTPOINT 0x0040
 
+#define MMAP_PAGE_SIZE           0x1000
+#define MMAP_READ                0x0001
+#define MMAP_WRITE               0x0002
+#define MMAP_PRIVATE             0x0004
+
+/* Directories a walk can be inside of at once */
+#define WALK_MAX_DEPTH           0x0020
+
 #define FILE_OPERATION_REQUEST_MAGIC_NUMBER  0x4690738
 #define FS_OPERATION_REQUEST_MAGIC_NUMBER    0x5740336
 #define FILE_OPERATION_RESPONSE_MAGIC_NUMBER 0x7502513
@@ -44,6 +78,7 @@ typedef intmax_t filesystem_t;
 typedef intmax_t fd_t;
 typedef intmax_t inode_t;
 typedef intmax_t dir_t;
+typedef intmax_t map_t;
 typedef intmax_t result_t;
 typedef uint32_t property_t;
 typedef uint32_t mode_t;
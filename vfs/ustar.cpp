@@ -2,6 +2,7 @@
 #include "fops.h"
 #include "typedefs.h"
 #include "vfs.h"
+#include "../compress/compress.h"
 
 #include <mkmi.h>
 
@@ -16,120 +17,488 @@ static int oct2bin(unsigned char *str, int size) {
         return n;
 }
 
-void FindInArchive(uint8_t *archive, const char *name, uint8_t **file, size_t *size) {
-	unsigned char *ptr = archive;
+uint64_t HashArchiveName(const char *name, size_t length) {
+	/* FNV-1a */
+	uint64_t hash = 0xCBF29CE484222325;
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= (uint8_t)name[i];
+		hash *= 0x100000001B3;
+	}
 
-	while (!Memcmp(ptr + 257, "ustar", 5)) { // Until we have a valid header
-		TarHeader *header = (TarHeader*)ptr;
-		size_t fileSize = oct2bin(ptr + 0x7c, 11);
+	return hash;
+}
+
+static size_t FieldLength(const char *field, size_t maxLength) {
+	size_t length = 0;
+	while(length < maxLength && field[length] != '\0') ++length;
+	return length;
+}
 
-		if(Strcmp(header->Filename, name) == 0) {
-			*file = ptr + 512;
-			*size = fileSize;
-			return;
+static bool FillEntry(ArchiveEntry *entry, unsigned char *ptr) {
+	TarHeader *header = (TarHeader*)ptr;
+
+	size_t filenameLength = FieldLength(header->Filename, sizeof(header->Filename));
+	size_t prefixLength = FieldLength(header->FilenamePefix, sizeof(header->FilenamePefix));
+
+	if(prefixLength == 0 && filenameLength < sizeof(header->Filename)) {
+		/* The common case: the name is terminated inside the header itself */
+		entry->Name = header->Filename;
+		entry->NameLength = filenameLength;
+	} else {
+		size_t length = prefixLength + (prefixLength != 0) + filenameLength;
+		char *name = (char*)Malloc(length + 1);
+		if(name == NULL) return false;
+
+		size_t position = 0;
+		if(prefixLength != 0) {
+			Memcpy(name, header->FilenamePefix, prefixLength);
+			name[prefixLength] = '/';
+			position = prefixLength + 1;
 		}
 
-		ptr += (((fileSize + 511) / 512) + 1) * 512;
+		Memcpy(name + position, header->Filename, filenameLength);
+		name[length] = '\0';
+
+		entry->Name = name;
+		entry->NameLength = length;
 	}
 
-	*file = NULL;
-	*size = 0;
+	entry->Hash = HashArchiveName(entry->Name, entry->NameLength);
+	entry->Data = ptr + 512;
+	entry->Size = oct2bin(ptr + 0x7c, 11);
+	entry->Type = header->TypeFlag[0] == '\0' ? TAR_TYPE_FILE : header->TypeFlag[0];
+	entry->NextInBucket = NULL;
 
-	return;
+	if(entry->NameLength != 0 && entry->Name[entry->NameLength - 1] == '/') entry->Type = TAR_TYPE_DIRECTORY;
+
+	return true;
 }
 
-void LoadArchive(uint8_t *archive) {
+ArchiveIndex *IndexArchive(uint8_t *archive, size_t size) {
+	ArchiveIndex *index = new ArchiveIndex;
+	if(index == NULL) return NULL;
+
+	index->Archive = archive;
+	index->Entries = NULL;
+	index->EntryCount = 0;
+	index->Buckets = NULL;
+	index->BucketCount = 0;
+
+	size_t capacity = 0;
 	unsigned char *ptr = archive;
+	unsigned char *end = archive + size;
+
+	/* Until we run out of archive or of valid headers */
+	while ((size_t)(end - ptr) >= 512 && !Memcmp(ptr + 257, "ustar", 5)) {
+		if(index->EntryCount == capacity) {
+			size_t newCapacity = capacity == 0 ? 64 : capacity * 2;
+			ArchiveEntry *entries = (ArchiveEntry*)Malloc(newCapacity * sizeof(ArchiveEntry));
+			if(entries == NULL) break;
 
-	while (!Memcmp(ptr + 257, "ustar", 5)) { // Until we have a valid header
-		TarHeader *header = (TarHeader*)ptr;
-		size_t fileSize = oct2bin(ptr + 0x7c, 11);
-		
-		MKMI_Printf(" - %s\r\n", header->Filename);
+			if(index->Entries != NULL) {
+				Memcpy(entries, index->Entries, index->EntryCount * sizeof(ArchiveEntry));
+				Free(index->Entries);
+			}
 
-		ptr += (((fileSize + 511) / 512) + 1) * 512;
+			index->Entries = entries;
+			capacity = newCapacity;
+		}
+
+		ArchiveEntry *entry = &index->Entries[index->EntryCount];
+		if(!FillEntry(entry, ptr)) break;
+
+		/* A truncated archive ends with the last entry that is there whole */
+		if(entry->Size > (size_t)(end - entry->Data)) {
+			if(entry->Name != ((TarHeader*)ptr)->Filename) Free((void*)entry->Name);
+			break;
+		}
+
+		++index->EntryCount;
+
+		/* The padding of the last entry may be missing as well */
+		size_t padded = ((entry->Size + 511) / 512) * 512;
+		if(padded >= (size_t)(end - entry->Data)) break;
+
+		ptr = entry->Data + padded;
 	}
+
+	/* Keep the load factor at or under one half */
+	index->BucketCount = 16;
+	while(index->BucketCount < index->EntryCount * 2) index->BucketCount *= 2;
+
+	index->Buckets = (ArchiveEntry**)Malloc(index->BucketCount * sizeof(ArchiveEntry*));
+	if(index->Buckets == NULL) {
+		FreeArchiveIndex(index);
+		return NULL;
+	}
+
+	Memset(index->Buckets, 0, index->BucketCount * sizeof(ArchiveEntry*));
+
+	for (size_t i = 0; i < index->EntryCount; ++i) {
+		ArchiveEntry *entry = &index->Entries[i];
+		size_t bucket = entry->Hash & (index->BucketCount - 1);
+
+		entry->NextInBucket = index->Buckets[bucket];
+		index->Buckets[bucket] = entry;
+	}
+
+	return index;
 }
 
-void UnpackArchive(VirtualFilesystem *vfs, uint8_t *archive, const char *directory) {
-	unsigned char *ptr = archive;
+void FreeArchiveIndex(ArchiveIndex *index) {
+	for (size_t i = 0; i < index->EntryCount; ++i) {
+		ArchiveEntry *entry = &index->Entries[i];
 
-	FileCreateRequest createRequest;
-	createRequest.MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
-	createRequest.Request = FOPS_CREATE;
+		/* Only joined names were allocated */
+		TarHeader *header = (TarHeader*)(entry->Data - 512);
+		if(entry->Name != header->Filename) Free((void*)entry->Name);
+	}
 
-	while (!Memcmp(ptr + 257, "ustar", 5)) { // Until we have a valid header
-		TarHeader *header = (TarHeader*)ptr;
-		size_t fileSize = oct2bin(ptr + 0x7c, 11);
-		char path[MAX_PATH_SIZE] = {0};
-		char name[MAX_NAME_SIZE] = {0};
+	if(index->Entries != NULL) Free(index->Entries);
+	if(index->Buckets != NULL) Free(index->Buckets);
 
-		size_t len = Strlen(header->Filename);
+	delete index;
+}
 
-		Strcpy(path, directory);
-		size_t baseDirectoryLength = Strlen(directory);
+ArchiveEntry *FindEntryInArchive(ArchiveIndex *index, const char *name, size_t nameLength) {
+	uint64_t hash = HashArchiveName(name, nameLength);
+	ArchiveEntry *entry = index->Buckets[hash & (index->BucketCount - 1)];
 
-		char *lastSlashPointer = NULL;
-		size_t lastSlashSize = 0;
+	while(entry != NULL) {
+		if(entry->Hash == hash &&
+		   entry->NameLength == nameLength &&
+		   Memcmp(entry->Name, name, nameLength) == 0) {
+			return entry;
+		}
 
-		bool isDirectory = false;
+		entry = entry->NextInBucket;
+	}
 
-		if(header->Filename[len - 1] == '/') {
-			isDirectory= true;
-			lastSlashPointer = &header->Filename[len - 2];
-		} else {
-			isDirectory = false;
-			lastSlashPointer = &header->Filename[len - 1];
+	return NULL;
+}
+
+void FindInArchive(ArchiveIndex *index, const char *name, uint8_t **file, size_t *size) {
+	ArchiveEntry *entry = FindEntryInArchive(index, name, Strlen(name));
+
+	if(entry == NULL) {
+		*file = NULL;
+		*size = 0;
+
+		return;
+	}
+
+	*file = entry->Data;
+	*size = entry->Size;
+
+	return;
+}
+
+void LoadArchive(ArchiveIndex *index) {
+	for (size_t i = 0; i < index->EntryCount; ++i) {
+		MKMI_Printf(" - %s\r\n", index->Entries[i].Name);
+	}
+}
+
+static bool UnpackCreate(ArchiveUnpacker *unpacker, inode_t directory, const char *name, size_t nameLength, property_t flags) {
+	FSCreateNodeRequest *createRequest = &unpacker->CreateRequest;
+	createRequest->MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+	createRequest->Request = NODE_CREATE;
+	createRequest->Directory = directory;
+	createRequest->Flags = flags;
+
+	/* Only the component itself is copied, the rest of the name is left as it is */
+	Memcpy(createRequest->Name, name, nameLength);
+	createRequest->Name[nameLength] = '\0';
+
+	return unpacker->VFS->DoFilesystemOperation(unpacker->FS, createRequest) == 0;
+}
+
+ArchiveUnpacker *BeginUnpack(VirtualFilesystem *vfs, const char *directory, SpanRecorder *spans) {
+	char basePath[MAX_PATH_SIZE] = {0};
+	Strcpy(basePath, directory);
+
+	/* The target directory is the only path that gets resolved */
+	VNode base;
+	if(vfs->ResolvePath(basePath, &base) != 0) return NULL;
+
+	ArchiveUnpacker *unpacker = new ArchiveUnpacker;
+	unpacker->VFS = vfs;
+	unpacker->FS = base.FSDescriptor;
+
+	unpacker->Stack[0].Inode = base.Inode;
+	unpacker->Stack[0].NameLength = 0;
+	unpacker->Depth = 1;
+
+	unpacker->Unpacked = 0;
+	unpacker->Spans = spans;
+
+	return unpacker;
+}
+
+void EndUnpack(ArchiveUnpacker *unpacker) {
+	delete unpacker;
+}
+
+inode_t UnpackEntry(ArchiveUnpacker *unpacker, const char *filename, size_t length, char type) {
+	UnpackDirectory *stack = unpacker->Stack;
+
+	while(length > 0 && filename[length - 1] == '/') --length;
+
+	bool isDirectory = type == TAR_TYPE_DIRECTORY;
+	if(!isDirectory && type != TAR_TYPE_FILE) return -1;
+
+	size_t level = 1;
+	size_t position = 0;
+
+	while(position < length) {
+		size_t start = position;
+		while(position < length && filename[position] != '/') ++position;
+
+		const char *component = &filename[start];
+		size_t componentLength = position - start;
+		bool isLast = position >= length;
+
+		/* Skip over separators */
+		++position;
+
+		if(componentLength == 0 || (componentLength == 1 && component[0] == '.')) {
+			if(isLast) break;
+			continue;
 		}
 
-		while(lastSlashPointer >= header->Filename && *lastSlashPointer != '/') {
-			--lastSlashPointer;
-			++lastSlashSize;
+		if(componentLength >= MAX_NAME_SIZE || level >= UNPACK_MAX_DEPTH) break;
+
+		/* Directories may already be there, either because the archive
+		   skipped their own entry or because they were seen before */
+		if(!isLast || isDirectory) {
+			if(level < unpacker->Depth &&
+			   stack[level].NameLength == componentLength &&
+			   Memcmp(stack[level].Name, component, componentLength) == 0) {
+				if(isLast) ++unpacker->Unpacked;
+
+				++level;
+				continue;
+			}
+
+			/* A directory we haven't seen yet, look it up and create it if needed */
+			FSGetByNameRequest getRequest;
+			getRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+			getRequest.Request = NODE_GETBYNAME;
+			getRequest.Directory = stack[level - 1].Inode;
+			Memcpy(getRequest.Name, component, componentLength);
+			getRequest.Name[componentLength] = '\0';
+
+			inode_t parent;
+			if(unpacker->VFS->DoFilesystemOperation(unpacker->FS, &getRequest) == 0) {
+				parent = getRequest.ResultNode.Inode;
+			} else if(UnpackCreate(unpacker, stack[level - 1].Inode, component, componentLength, NODE_PROPERTY_DIRECTORY)) {
+				parent = unpacker->CreateRequest.ResultNode.Inode;
+			} else {
+				break;
+			}
+
+			stack[level].Inode = parent;
+			Memcpy(stack[level].Name, component, componentLength);
+			stack[level].NameLength = componentLength;
+			unpacker->Depth = ++level;
+
+			if(isLast) ++unpacker->Unpacked;
+
+			continue;
+		}
+
+		if(!UnpackCreate(unpacker, stack[level - 1].Inode, component, componentLength, NODE_PROPERTY_FILE)) {
+			break;
+		}
+
+		++unpacker->Unpacked;
+
+		return unpacker->CreateRequest.ResultNode.Inode;
+	}
+
+	return -1;
+}
+
+void UnpackArchive(VirtualFilesystem *vfs, ArchiveIndex *index, const char *directory, SpanRecorder *spans) {
+	ArchiveUnpacker *unpacker = BeginUnpack(vfs, directory, spans);
+	if(unpacker == NULL) return;
+
+	FSBindNodeRequest bindRequest;
+	bindRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+	bindRequest.Request = NODE_BIND;
+
+	for (size_t entryIndex = 0; entryIndex < index->EntryCount; ++entryIndex) {
+		ArchiveEntry *entry = &index->Entries[entryIndex];
+
+		intmax_t span = spans == NULL ? SPAN_NONE : spans->Begin("entry", entry->Name, entry->NameLength);
+
+		inode_t file = UnpackEntry(unpacker, entry->Name, entry->NameLength, entry->Type);
+		if(file >= 0) {
+			/* The contents stay where they are in the archive, the file just points to them */
+			bindRequest.Node = file;
+			bindRequest.Address = (uintptr_t)entry->Data;
+			bindRequest.Size = entry->Size;
+
+			vfs->DoFilesystemOperation(unpacker->FS, &bindRequest);
 		}
-			
-		Memcpy(name, lastSlashPointer + 1, lastSlashSize);
-		Memcpy(path + baseDirectoryLength, header->Filename, len - lastSlashSize - 1);
-		if(isDirectory && baseDirectoryLength + len - lastSlashSize - 2 > 0)
-			*(char*)(path + baseDirectoryLength + len - lastSlashSize - 2) = '\0';
-		
-		MKMI_Printf("Path: %s  %s\r\n", path, name);
-		
-		createRequest.Properties = 0;
-		createRequest.Properties |= isDirectory ? NODE_PROPERTY_DIRECTORY : NODE_PROPERTY_FILE;
-
-		Memset(createRequest.Path, 0, MAX_PATH_SIZE);
-		Strcpy(createRequest.Path, path);
-		Memset(createRequest.Name, 0, MAX_NAME_SIZE);
-		Strcpy(createRequest.Name, name);
-
-		vfs->DoFileOperation(&createRequest);
-
-		MKMI_Printf("Result: %d\r\n", createRequest.Result);
-	
-		if(!isDirectory) {
-			/*
-			request->Request = FOPS_OPEN;
-
-			Memset(request->Data.Open.Path, 0, MAX_PATH_SIZE);
-			Strcpy(request->Data.Open.Path, directory);
-			*(char*)&request->Data.Open.Path[baseDirectoryLength-1] = '/';
-			Strcpy(request->Data.Open.Path + baseDirectoryLength, header->Filename);
-
-			request->Data.Open.Capabilities = 0;
-		
-			vfs->DoFileOperation(request, &response, &responseSize);
-
-			MKMI_Printf("Path: %s\r\n", request->Data.Open.Path);
-
-			request->Request = FOPS_CHMOD;
-			vfs->DoFileOperation(request, &response, &responseSize);
-			request->Request = FOPS_WRITE;
-			vfs->DoFileOperation(request, &response, &responseSize);
-			request->Request = FOPS_CLOSE;
-			vfs->DoFileOperation(request, &response, &responseSize);
-*/
+
+		if(spans != NULL) spans->End(span);
+	}
+
+	MKMI_Printf("Unpacked %d of %d archive entries.\r\n", unpacker->Unpacked, index->EntryCount);
+
+	EndUnpack(unpacker);
+}
+
+struct TarStream {
+	ArchiveUnpacker *Unpacker;
+
+	uint8_t Header[512];
+	size_t HeaderFill;
+
+	/* The entry whose data is coming in, if it is a file */
+	inode_t File;
+	size_t Offset;
+	size_t Remaining;
+	size_t Padding;
+
+	bool Done;
+
+	/* Entries come in pieces, so the span of one ends when the next header shows up */
+	intmax_t EntrySpan;
+};
+
+static bool TarStreamHeader(TarStream *stream) {
+	TarHeader *header = (TarHeader*)stream->Header;
+	SpanRecorder *spans = stream->Unpacker->Spans;
+
+	if(spans != NULL) spans->End(stream->EntrySpan);
+	stream->EntrySpan = SPAN_NONE;
+
+	if(Memcmp(stream->Header + 257, "ustar", 5) != 0) {
+		/* Zeroed blocks mark the end of the archive */
+		for (size_t i = 0; i < 512; ++i) {
+			if(stream->Header[i] != 0) return false;
 		}
 
-		ptr += (((fileSize + 511) / 512) + 1) * 512;
+		stream->Done = true;
+		return true;
+	}
+
+	char name[MAX_PATH_SIZE];
+	size_t filenameLength = FieldLength(header->Filename, sizeof(header->Filename));
+	size_t prefixLength = FieldLength(header->FilenamePefix, sizeof(header->FilenamePefix));
+	size_t length = 0;
+
+	if(prefixLength != 0) {
+		Memcpy(name, header->FilenamePefix, prefixLength);
+		name[prefixLength] = '/';
+		length = prefixLength + 1;
+	}
+
+	Memcpy(name + length, header->Filename, filenameLength);
+	length += filenameLength;
+	name[length] = '\0';
+
+	char type = header->TypeFlag[0] == '\0' ? TAR_TYPE_FILE : header->TypeFlag[0];
+	if(length != 0 && name[length - 1] == '/') type = TAR_TYPE_DIRECTORY;
+
+	size_t size = oct2bin(stream->Header + 0x7c, 11);
+
+	if(spans != NULL) stream->EntrySpan = spans->Begin("entry", name, length);
+
+	stream->File = UnpackEntry(stream->Unpacker, name, length, type);
+	stream->Offset = 0;
+	stream->Remaining = type == TAR_TYPE_DIRECTORY ? 0 : size;
+	stream->Padding = (512 - stream->Remaining % 512) % 512;
+
+	return true;
+}
+
+static bool TarStreamData(TarStream *stream, const uint8_t *data, size_t size) {
+	if(stream->File < 0) return true;
+
+	/* The decompressed piece is written from where it lies, without staging it */
+	FSScatterNodeRequest request;
+	request.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+	request.Request = NODE_WRITE_SCATTER;
+	request.Node = stream->File;
+	request.Offset = stream->Offset;
+	request.Size = size;
+	request.Address = (uintptr_t)data;
+
+	stream->Unpacker->VFS->DoFilesystemOperation(stream->Unpacker->FS, &request);
+	if(request.Result != (result_t)size) return false;
+
+	stream->Offset += size;
+
+	return true;
+}
+
+/* Takes the decompressed archive in whatever pieces it comes in */
+static bool TarStreamFeed(void *context, const uint8_t *data, size_t size) {
+	TarStream *stream = (TarStream*)context;
+
+	while(size > 0 && !stream->Done) {
+		if(stream->Remaining > 0) {
+			size_t chunk = size > stream->Remaining ? stream->Remaining : size;
+			if(!TarStreamData(stream, data, chunk)) return false;
+
+			stream->Remaining -= chunk;
+			data += chunk;
+			size -= chunk;
+		} else if(stream->Padding > 0) {
+			size_t chunk = size > stream->Padding ? stream->Padding : size;
+
+			stream->Padding -= chunk;
+			data += chunk;
+			size -= chunk;
+		} else {
+			size_t chunk = 512 - stream->HeaderFill;
+			if(chunk > size) chunk = size;
+
+			Memcpy(stream->Header + stream->HeaderFill, data, chunk);
+			stream->HeaderFill += chunk;
+			data += chunk;
+			size -= chunk;
+
+			if(stream->HeaderFill == 512) {
+				stream->HeaderFill = 0;
+				if(!TarStreamHeader(stream)) return false;
+			}
+		}
 	}
+
+	return true;
+}
+
+bool UnpackCompressedArchive(VirtualFilesystem *vfs, uint8_t *archive, size_t size, const char *directory, SpanRecorder *spans) {
+	ArchiveUnpacker *unpacker = BeginUnpack(vfs, directory, spans);
+	if(unpacker == NULL) return false;
+
+	TarStream *stream = new TarStream;
+	stream->Unpacker = unpacker;
+	stream->HeaderFill = 0;
+	stream->File = -1;
+	stream->Offset = 0;
+	stream->Remaining = 0;
+	stream->Padding = 0;
+	stream->Done = false;
+	stream->EntrySpan = SPAN_NONE;
+
+	intmax_t result = DecompressStream(archive, size, TarStreamFeed, stream);
+
+	/* An archive cut short must have at least stopped between two entries */
+	bool complete = stream->Done ||
+		(stream->HeaderFill == 0 && stream->Remaining == 0 && stream->Padding == 0);
+	if(result >= 0 && !complete) MKMI_Printf("Compressed archive ends in the middle of an entry.\r\n");
+
+	if(spans != NULL) spans->End(stream->EntrySpan);
+
+	MKMI_Printf("Unpacked %d entries out of %dkb of compressed archive.\r\n", unpacker->Unpacked, size / 1024);
+
+	delete stream;
+	EndUnpack(unpacker);
+
+	return result >= 0 && complete;
 }
@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "vfs.h"
+#include "../util/span.h"
 
 struct TarHeader {
 	char Filename[100];
@@ -22,6 +23,75 @@ struct TarHeader {
 	char FilenamePefix[155];
 }__attribute__((packed));
 
-void FindInArchive(uint8_t *archive, const char *name, uint8_t **file, size_t *size);
-void LoadArchive(uint8_t *archive);
-void UnpackArchive(VirtualFilesystem *vfs, uint8_t *archive, const char *directory);
+#define TAR_TYPE_FILE      '0'
+#define TAR_TYPE_DIRECTORY '5'
+
+/* How deep UnpackArchive follows directories */
+#define UNPACK_MAX_DEPTH   64
+
+struct ArchiveEntry {
+	/* Full path, prefix included */
+	const char *Name;
+	size_t NameLength;
+	uint64_t Hash;
+
+	uint8_t *Data;
+	size_t Size;
+	char Type;
+
+	ArchiveEntry *NextInBucket;
+};
+
+struct ArchiveIndex {
+	uint8_t *Archive;
+
+	/* Entries are kept in archive order */
+	ArchiveEntry *Entries;
+	size_t EntryCount;
+
+	ArchiveEntry **Buckets;
+	size_t BucketCount;
+};
+
+uint64_t HashArchiveName(const char *name, size_t length);
+
+struct UnpackDirectory {
+	inode_t Inode;
+
+	char Name[MAX_NAME_SIZE];
+	size_t NameLength;
+};
+
+struct ArchiveUnpacker {
+	VirtualFilesystem *VFS;
+	filesystem_t FS;
+
+	/* The directories leading to the last entry. Archives list parents
+	   before their children, so usually only the last component of an
+	   entry is new and its parent is already on top of the stack */
+	UnpackDirectory Stack[UNPACK_MAX_DEPTH];
+	size_t Depth;
+
+	FSCreateNodeRequest CreateRequest;
+
+	size_t Unpacked;
+
+	/* Every entry gets a span here, if there is a recorder */
+	SpanRecorder *Spans;
+};
+
+/* Indexes the entries in the first size bytes of archive. Returns NULL if the index can't be allocated */
+ArchiveIndex *IndexArchive(uint8_t *archive, size_t size);
+void FreeArchiveIndex(ArchiveIndex *index);
+
+ArchiveEntry *FindEntryInArchive(ArchiveIndex *index, const char *name, size_t nameLength);
+void FindInArchive(ArchiveIndex *index, const char *name, uint8_t **file, size_t *size);
+void LoadArchive(ArchiveIndex *index);
+ArchiveUnpacker *BeginUnpack(VirtualFilesystem *vfs, const char *directory, SpanRecorder *spans);
+/* Creates the node for an entry, returning its inode if it is a file that can take data */
+inode_t UnpackEntry(ArchiveUnpacker *unpacker, const char *name, size_t length, char type);
+void EndUnpack(ArchiveUnpacker *unpacker);
+
+void UnpackArchive(VirtualFilesystem *vfs, ArchiveIndex *index, const char *directory, SpanRecorder *spans);
+/* Decompresses an LZ4 or gzip archive straight into the filesystem, never holding it whole */
+bool UnpackCompressedArchive(VirtualFilesystem *vfs, uint8_t *archive, size_t size, const char *directory, SpanRecorder *spans);
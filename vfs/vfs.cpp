@@ -4,14 +4,27 @@
 
 #include <mkmi.h>
 
+#include "../util/timestamp.h"
+
 VirtualFilesystem::VirtualFilesystem() {
 	BaseNode = new RegisteredFilesystemNode;
 	BaseNode->FS = NULL;
 	BaseNode->Next = NULL;
+
+	OpenFiles.Head = NULL;
+	OpenFiles.Tail = NULL;
+
+	Stats = new VFSStats();
+	Pool = new RequestPool();
 }
 
 
 VirtualFilesystem::~VirtualFilesystem() {
+	while(Mappings != NULL) RemoveMapping(Mappings);
+
+	delete Trace;
+	delete Pool;
+	delete Stats;
 	delete BaseNode;
 }
 	
@@ -20,6 +33,36 @@ VirtualFilesystem::~VirtualFilesystem() {
 	if ((x)->FS->OwnerVendorID == 0 && (x)->FS->OwnerProductID == 0)
 
 result_t VirtualFilesystem::DoFileOperation(FileOperationRequest *request) {
+	/* Some requests are reused in place for the filesystem, so the type is kept aside */
+	uint16_t type = request->Request;
+
+	VFSTrace *trace = Trace;
+	TraceRecord record;
+	if(trace != NULL) trace->DescribeFileOperation(request, &record);
+
+	uint64_t start = ReadTimestamp();
+
+	result_t result = HandleFileOperation(request);
+
+	uint64_t ticks = ReadTimestamp() - start;
+	bool transfer = type == FOPS_READ || type == FOPS_WRITE || type == FOPS_READV || type == FOPS_WRITEV ||
+	                type == FOPS_READFILE || type == FOPS_WRITEFILE;
+	uint64_t bytes = transfer && result > 0 ? result : 0;
+	Stats->RecordFileOperation(type, result, bytes, ticks);
+
+	if(trace != NULL) trace->Append(&record, NULL, result, start, ticks);
+
+	return result;
+}
+
+static void FillAttributes(VNode *node, NodeAttributes *attributes) {
+	attributes->FSDescriptor = node->FSDescriptor;
+	attributes->Inode = node->Inode;
+	attributes->Properties = node->Properties;
+	attributes->Size = node->Size;
+}
+
+result_t VirtualFilesystem::HandleFileOperation(FileOperationRequest *request) {
 	result_t result = 0;
 	switch(request->Request) {
 		case FOPS_CREATE: {
@@ -52,187 +95,1584 @@ result_t VirtualFilesystem::DoFileOperation(FileOperationRequest *request) {
 			createRequest->Result = result;
 			}
 			break;
+		case FOPS_DELETE: {
+			FileDeleteRequest *deleteRequest = (FileDeleteRequest*)request;
+			VNode node;
+
+			result = ResolvePath(deleteRequest->Path, &node);
+
+			if (result != 0) {
+				deleteRequest->Result = result;
+
+				break;
+			}
+
+			FSDeleteNodeRequest fsDeleteRequest;
+			fsDeleteRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+			fsDeleteRequest.Request = NODE_DELETE;
+			fsDeleteRequest.Node = node.Inode;
+
+			result = DoFilesystemOperation(node.FSDescriptor, &fsDeleteRequest);
+			deleteRequest->Result = result;
+			}
+			break;
+		case FOPS_RENAME: {
+			FileRenameRequest *renameRequest = (FileRenameRequest*)request;
+			VNode node, newDir;
+
+			char parent[MAX_PATH_SIZE] = {0};
+			char name[MAX_NAME_SIZE] = {0};
+
+			/* Resolving mangles the path, so it is split beforehand */
+			result = SplitPath(renameRequest->NewPath, parent, name);
+			if (result != 0) {
+				renameRequest->Result = result;
+
+				break;
+			}
+
+			result = ResolvePath(renameRequest->InitialPath, &node);
+			if (result != 0) {
+				renameRequest->Result = result;
+
+				break;
+			}
+
+			result = ResolvePath(parent, &newDir);
+			if (result != 0) {
+				renameRequest->Result = result;
+
+				break;
+			}
+
+			/* Nodes can only be moved around inside their own filesystem */
+			if (newDir.FSDescriptor != node.FSDescriptor) {
+				result = -EBADREQUEST;
+				renameRequest->Result = result;
+
+				break;
+			}
+
+			FSRenameNodeRequest fsRenameRequest;
+			fsRenameRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+			fsRenameRequest.Request = NODE_RENAME;
+			fsRenameRequest.Node = node.Inode;
+			fsRenameRequest.Directory = newDir.Inode;
+			Strcpy(fsRenameRequest.Name, name);
+
+			result = DoFilesystemOperation(node.FSDescriptor, &fsRenameRequest);
+			renameRequest->Result = result;
+			}
+			break;
 		case FOPS_OPEN: {
-			FileOpenRequest *createRequest = (FileOpenRequest*)request;
+			FileOpenRequest *openRequest = (FileOpenRequest*)request;
+			VNode file;
+
+			result = ResolvePath(openRequest->Path, &file);
+
+			if (result != 0) {
+				openRequest->Result = result;
+
+				break;
+			}
+
+			if(!(file.Properties & NODE_PROPERTY_FILE)) {
+				result = -EBADREQUEST;
+				openRequest->Result = result;
 
+				break;
+			}
+
+			FileHandle *handle = AddHandle(file.FSDescriptor, file.Inode);
+			openRequest->FileHandle = handle->FileDescriptor;
+
+			result = 0;
+			openRequest->Result = result;
 			}
 			break;
 		case FOPS_CLOSE: {
 			FileCloseRequest *closeRequest = (FileCloseRequest*)request;
 
+			FileHandle *handle = FindHandle(closeRequest->FileHandle);
+			if(handle == NULL) {
+				result = -ENOTPRESENT;
+				closeRequest->Result = result;
+
+				break;
+			}
+
+			RemoveHandle(handle);
+
+			result = 0;
+			closeRequest->Result = result;
 			}
 			break;
 		case FOPS_READ: {
 			FileReadRequest *readRequest = (FileReadRequest*)request;
 
 			fd_t fileHandle = readRequest->FileHandle;
+			FileHandle *handle = FindHandle(fileHandle);
+			if(handle == NULL) {
+				result = -ENOTPRESENT;
+				readRequest->Result = result;
+
+				break;
+			}
 
-			/* Get our file through our handle */
-			
 			/* Fun fact: FSReadNodeRequest and FileReadRequest are of the same size 
 			   So, we can avoid any allocation */
 			FSReadNodeRequest *fsReadNodeRequest = (FSReadNodeRequest*)request;
 			fsReadNodeRequest->MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
 			fsReadNodeRequest->Request = NODE_READ;
-			fsReadNodeRequest->Node = /* Get node */ 0;
-			fsReadNodeRequest->Offset = readRequest->Offset;
-			fsReadNodeRequest->Size = readRequest->Size;
+			fsReadNodeRequest->Node = handle->Inode;
 
-			result = DoFilesystemOperation(0 /* FS Descriptor */, fsReadNodeRequest);
-			if(result != 0) {
-				readRequest->Result = result;
+			result = DoFilesystemOperation(handle->FSDescriptor, fsReadNodeRequest);
+
+			readRequest->MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+			readRequest->Request = FOPS_READ;
+			readRequest->FileHandle = fileHandle;
+			readRequest->Result = result;
+			}
+			break;
+		case FOPS_WRITE: {
+			FileWriteRequest *writeRequest = (FileWriteRequest*)request;
+
+			FileHandle *handle = FindHandle(writeRequest->FileHandle);
+			if(handle == NULL) {
+				result = -ENOTPRESENT;
+				writeRequest->Result = result;
+
+				break;
+			}
+
+			/* The capabilities are in the way of reusing the request, so the payload is pointed to */
+			FSScatterNodeRequest fsWriteRequest;
+			fsWriteRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+			fsWriteRequest.Request = NODE_WRITE_SCATTER;
+			fsWriteRequest.Node = handle->Inode;
+			fsWriteRequest.Offset = writeRequest->Offset;
+			fsWriteRequest.Size = writeRequest->Size;
+			fsWriteRequest.Address = (uintptr_t)&writeRequest->Buffer;
+
+			result = DoFilesystemOperation(handle->FSDescriptor, &fsWriteRequest);
+			writeRequest->Result = result;
+			}
+			break;
+		case FOPS_READV:
+		case FOPS_WRITEV: {
+			FileVectorRequest *vectorRequest = (FileVectorRequest*)request;
+
+			uint16_t type = vectorRequest->Request;
+			fd_t fileHandle = vectorRequest->FileHandle;
+			FileHandle *handle = FindHandle(fileHandle);
+			if(handle == NULL) {
+				result = -ENOTPRESENT;
+				vectorRequest->Result = result;
+
+				break;
+			}
+
+			/* FSVectorNodeRequest and FileVectorRequest share the same layout,
+			   so the segments are handed on where they are */
+			FSVectorNodeRequest *fsVectorRequest = (FSVectorNodeRequest*)request;
+			fsVectorRequest->MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+			fsVectorRequest->Request = type == FOPS_READV ? NODE_READ_VECTOR : NODE_WRITE_VECTOR;
+			fsVectorRequest->Node = handle->Inode;
+
+			result = DoFilesystemOperation(handle->FSDescriptor, fsVectorRequest);
+
+			vectorRequest->MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+			vectorRequest->Request = type;
+			vectorRequest->FileHandle = fileHandle;
+			vectorRequest->Result = result;
+			}
+			break;
+		case FOPS_OPENDIR: {
+			FileOpenDirRequest *openDirRequest = (FileOpenDirRequest*)request;
+			VNode directory;
+
+			result = ResolvePath(openDirRequest->Path, &directory);
+
+			if (result != 0) {
+				openDirRequest->Result = result;
+
+				break;
+			}
+
+			if(!(directory.Properties & NODE_PROPERTY_DIRECTORY)) {
+				result = -EBADREQUEST;
+				openDirRequest->Result = result;
+
+				break;
+			}
+
+			FileHandle *handle = AddHandle(directory.FSDescriptor, directory.Inode);
+			openDirRequest->DirectoryHandle = handle->FileDescriptor;
+
+			result = 0;
+			openDirRequest->Result = result;
+			}
+			break;
+		case FOPS_CLOSEDIR: {
+			FileCloseDirRequest *closeDirRequest = (FileCloseDirRequest*)request;
+
+			FileHandle *handle = FindHandle(closeDirRequest->DirectoryHandle);
+			if(handle == NULL) {
+				result = -ENOTPRESENT;
+				closeDirRequest->Result = result;
+
+				break;
+			}
+
+			RemoveHandle(handle);
+
+			result = 0;
+			closeDirRequest->Result = result;
+			}
+			break;
+		case FOPS_READDIR: {
+			FileReadDirRequest *readDirRequest = (FileReadDirRequest*)request;
+
+			dir_t directoryHandle = readDirRequest->Directory;
+			FileHandle *handle = FindHandle(directoryHandle);
+			if(handle == NULL) {
+				result = -ENOTPRESENT;
+				readDirRequest->Result = result;
+
+				break;
+			}
+
+			/* FSReadDirectoryRequest and FileReadDirRequest share the same layout,
+			   so the entries are packed straight into the caller's buffer */
+			FSReadDirectoryRequest *fsReadDirRequest = (FSReadDirectoryRequest*)request;
+			fsReadDirRequest->MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+			fsReadDirRequest->Request = NODE_READDIR;
+			fsReadDirRequest->Directory = handle->Inode;
+
+			result = DoFilesystemOperation(handle->FSDescriptor, fsReadDirRequest);
+
+			readDirRequest->MagicNumber = FILE_OPERATION_REQUEST_MAGIC_NUMBER;
+			readDirRequest->Request = FOPS_READDIR;
+			readDirRequest->Directory = directoryHandle;
+			readDirRequest->Result = result;
+			}
+			break;
+		case FOPS_EXECUTE: {
+			FileExecuteRequest *executeRequest = (FileExecuteRequest*)request;
+			VNode executable;
+
+			result = ResolvePath(executeRequest->Path, &executable);
+
+			if (result != 0) {
+				executeRequest->Result = result;
+
+				break;
+			}
+
+			if(!(executable.Properties & NODE_PROPERTY_FILE)) {
+				result = -EBADREQUEST;
+				executeRequest->Result = result;
+
+				break;
+			}
+
+			/* If the filesystem can present the file as one contiguous range,
+			   the kernel loader reads it in place and nothing gets copied */
+			FSMapNodeRequest fsMapRequest;
+			fsMapRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+			fsMapRequest.Request = NODE_MAP;
+			fsMapRequest.Node = executable.Inode;
+			fsMapRequest.Address = 0;
+			fsMapRequest.Size = 0;
+
+			result = DoFilesystemOperation(executable.FSDescriptor, &fsMapRequest);
+
+			bool mapped = result == 0 && fsMapRequest.Address != 0;
+			Stats->RecordCache(STATS_CACHE_EXECUTE_MAP, mapped);
+
+			if(mapped) {
+				Syscall(SYSCALL_PROC_EXEC, fsMapRequest.Address, fsMapRequest.Size, 0, 0, 0, 0);
+				ReleaseNode(executable.FSDescriptor, executable.Inode);
+
+				executeRequest->Result = result;
+				break;
+			}
+
+			/* Otherwise, stage the file in a temporary buffer */
+			size_t fileSize = executable.Size;
+			if(fileSize == 0) {
+				result = -EBADREQUEST;
+				executeRequest->Result = result;
+
+				break;
+			}
+
+			void *staging = Pool->Allocate(fileSize);
+			if(staging == NULL) {
+				result = -EFAULT;
+				executeRequest->Result = result;
+
+				break;
+			}
+
+			FSScatterNodeRequest fsReadRequest;
+			fsReadRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+			fsReadRequest.Request = NODE_READ_SCATTER;
+			fsReadRequest.Node = executable.Inode;
+			fsReadRequest.Offset = 0;
+			fsReadRequest.Size = fileSize;
+			fsReadRequest.Address = (uintptr_t)staging;
+
+			DoFilesystemOperation(executable.FSDescriptor, &fsReadRequest);
+			if(fsReadRequest.Result == (result_t)fileSize) {
+				Syscall(SYSCALL_PROC_EXEC, (uintptr_t)staging, fileSize, 0, 0, 0, 0);
+				result = 0;
+			} else {
+				result = -EFAULT;
+			}
+
+			Pool->Release(staging);
+
+			executeRequest->Result = result;
+			}
+			break;
+		case FOPS_MMAP: {
+			FileMmapRequest *mmapRequest = (FileMmapRequest*)request;
+			VNode file;
+
+			result = ResolvePath(mmapRequest->Path, &file);
+
+			if (result != 0) {
+				mmapRequest->Result = result;
+
+				break;
+			}
+
+			/* Mappings start on a page and stay within the file, holes included */
+			if(!(file.Properties & NODE_PROPERTY_FILE) || mmapRequest->Size == 0 ||
+			   mmapRequest->Offset % MMAP_PAGE_SIZE != 0 || mmapRequest->Size > file.Size || mmapRequest->Offset > file.Size - mmapRequest->Size) {
+				result = -EBADREQUEST;
+				mmapRequest->Result = result;
+
+				break;
+			}
+
+			FileMapping *mapping = AddMapping(file.FSDescriptor, file.Inode, mmapRequest->Offset, mmapRequest->Size, mmapRequest->Flags);
+			if(mapping == NULL) {
+				result = -EFAULT;
+				mmapRequest->Result = result;
+
+				break;
+			}
+
+			mmapRequest->Mapping = mapping->Descriptor;
+
+			result = 0;
+			mmapRequest->Result = result;
+			}
+			break;
+		case FOPS_MUNMAP: {
+			FileMunmapRequest *munmapRequest = (FileMunmapRequest*)request;
+
+			FileMapping *mapping = FindMapping(munmapRequest->Mapping);
+			if(mapping == NULL) {
+				result = -ENOTPRESENT;
+				munmapRequest->Result = result;
+
+				break;
+			}
+
+			filesystem_t fs = mapping->FSDescriptor;
+			inode_t inode = mapping->Inode;
+			RemoveMapping(mapping);
+			ReleaseNode(fs, inode);
+
+			result = 0;
+			munmapRequest->Result = result;
+			}
+			break;
+		case FOPS_FAULT: {
+			FileFaultRequest *faultRequest = (FileFaultRequest*)request;
+
+			FileMapping *mapping = FindMapping(faultRequest->Mapping);
+			if(mapping == NULL) {
+				result = -ENOTPRESENT;
+				faultRequest->Result = result;
+
+				break;
+			}
+
+			uintptr_t address = 0;
+			result = FaultMapping(mapping, faultRequest->Offset, faultRequest->Access, &address);
+
+			faultRequest->Address = address;
+			faultRequest->Result = result;
+			}
+			break;
+		case FOPS_CLONE: {
+			FileCloneRequest *cloneRequest = (FileCloneRequest*)request;
+			VNode file, newDir;
+
+			char parent[MAX_PATH_SIZE] = {0};
+			char name[MAX_NAME_SIZE] = {0};
+
+			result = SplitPath(cloneRequest->NewPath, parent, name);
+			if (result != 0) {
+				cloneRequest->Result = result;
+
+				break;
+			}
+
+			result = ResolvePath(cloneRequest->Path, &file);
+			if (result != 0) {
+				cloneRequest->Result = result;
+
+				break;
+			}
+
+			result = ResolvePath(parent, &newDir);
+			if (result != 0) {
+				cloneRequest->Result = result;
+
+				break;
+			}
+
+			/* Storage can only be shared inside of one filesystem */
+			if (!(file.Properties & NODE_PROPERTY_FILE) || newDir.FSDescriptor != file.FSDescriptor) {
+				result = -EBADREQUEST;
+				cloneRequest->Result = result;
+
+				break;
+			}
+
+			FSCloneNodeRequest fsCloneRequest;
+			fsCloneRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+			fsCloneRequest.Request = NODE_CLONE;
+			fsCloneRequest.Node = file.Inode;
+			fsCloneRequest.Directory = newDir.Inode;
+			Strcpy(fsCloneRequest.Name, name);
+
+			result = DoFilesystemOperation(file.FSDescriptor, &fsCloneRequest);
+			cloneRequest->Result = result;
+			}
+			break;
+		case FOPS_COPY_RANGE: {
+			FileCopyRangeRequest *copyRequest = (FileCopyRangeRequest*)request;
+			VNode source, destination;
+
+			result = ResolvePath(copyRequest->SourcePath, &source);
+			if (result != 0) {
+				copyRequest->Result = result;
+
+				break;
+			}
+
+			result = ResolvePath(copyRequest->DestinationPath, &destination);
+			if (result != 0) {
+				copyRequest->Result = result;
+
+				break;
+			}
+
+			if(!(source.Properties & NODE_PROPERTY_FILE) || !(destination.Properties & NODE_PROPERTY_FILE)) {
+				result = -EBADREQUEST;
+				copyRequest->Result = result;
+
+				break;
+			}
+
+			/* Within one filesystem, the driver may be able to share storage instead of copying it */
+			bool offloaded = false;
+			if(source.FSDescriptor == destination.FSDescriptor) {
+				FSCopyRangeRequest fsCopyRequest;
+				fsCopyRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+				fsCopyRequest.Request = NODE_COPY_RANGE;
+				fsCopyRequest.Source = source.Inode;
+				fsCopyRequest.SourceOffset = copyRequest->SourceOffset;
+				fsCopyRequest.Destination = destination.Inode;
+				fsCopyRequest.DestinationOffset = copyRequest->DestinationOffset;
+				fsCopyRequest.Size = copyRequest->Size;
+
+				result = DoFilesystemOperation(source.FSDescriptor, &fsCopyRequest);
+				offloaded = result != -EBADREQUEST;
+			}
+
+			Stats->RecordCache(STATS_CACHE_COPY_RANGE, offloaded);
+
+			if(!offloaded) {
+				result = CopyThrough(&source, copyRequest->SourceOffset, &destination, copyRequest->DestinationOffset, copyRequest->Size);
+			}
+
+			copyRequest->Result = result;
+			}
+			break;
+		case FOPS_SNAPSHOT: {
+			FileSnapshotRequest *snapshotRequest = (FileSnapshotRequest*)request;
+			VNode node, mountPoint;
+
+			result = ResolvePath(snapshotRequest->Path, &node);
+			if (result != 0) {
+				snapshotRequest->Result = result;
 
 				break;
 			}
 
-			result = 0;
-			readRequest->Result = result;
+			/* Resolving mangles the path, and mounting resolves it again */
+			char mountPath[MAX_PATH_SIZE] = {0};
+			Strcpy(mountPath, snapshotRequest->MountPath);
+
+			result = ResolvePath(mountPath, &mountPoint);
+			if (result != 0) {
+				snapshotRequest->Result = result;
+
+				break;
+			}
+
+			/* Snapshots can't be dropped yet, so nothing is taken that could not be mounted */
+			if(!(mountPoint.Properties & NODE_PROPERTY_DIRECTORY)) {
+				result = -EBADREQUEST;
+				snapshotRequest->Result = result;
+
+				break;
+			}
+
+			filesystem_t snapshot = SnapshotFilesystem(node.FSDescriptor);
+			if(snapshot < 0) {
+				result = snapshot;
+				snapshotRequest->Result = result;
+
+				break;
+			}
+
+			result = MountFilesystem(snapshotRequest->MountPath, snapshot);
+
+			snapshotRequest->Snapshot = snapshot;
+			snapshotRequest->Result = result;
+			}
+			break;
+		case FOPS_READFILE: {
+			FileReadFileRequest *readFileRequest = (FileReadFileRequest*)request;
+			VNode file;
+
+			result = ResolvePath(readFileRequest->Path, &file);
+			if (result != 0) {
+				readFileRequest->Result = result;
+
+				break;
+			}
+
+			if(!(file.Properties & NODE_PROPERTY_FILE)) {
+				result = -EBADREQUEST;
+				readFileRequest->Result = result;
+
+				break;
+			}
+
+			readFileRequest->FileSize = file.Size;
+
+			/* Straight into the reply, so nothing is staged on the way */
+			FSScatterNodeRequest fsReadRequest;
+			fsReadRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+			fsReadRequest.Request = NODE_READ_SCATTER;
+			fsReadRequest.Node = file.Inode;
+			fsReadRequest.Offset = 0;
+			fsReadRequest.Size = file.Size < readFileRequest->Size ? file.Size : readFileRequest->Size;
+			fsReadRequest.Address = (uintptr_t)&readFileRequest->Buffer;
+
+			result = DoFilesystemOperation(file.FSDescriptor, &fsReadRequest);
+			readFileRequest->Result = result;
+			}
+			break;
+		case FOPS_WRITEFILE: {
+			FileWriteFileRequest *writeFileRequest = (FileWriteFileRequest*)request;
+
+			result = ReplaceFile(writeFileRequest->Path, &writeFileRequest->Buffer, writeFileRequest->Size);
+			writeFileRequest->Result = result;
+			}
+			break;
+		case FOPS_GETATTR: {
+			FileGetAttrRequest *getAttrRequest = (FileGetAttrRequest*)request;
+			VNode node;
+
+			result = ResolvePath(getAttrRequest->Path, &node);
+			getAttrRequest->Attributes.Result = result;
+			getAttrRequest->Result = result;
+
+			if(result != 0) break;
+
+			FillAttributes(&node, &getAttrRequest->Attributes);
+			}
+			break;
+		case FOPS_GETATTRS: {
+			FileGetAttrsRequest *getAttrsRequest = (FileGetAttrsRequest*)request;
+
+			result = GetAttributesBatch(getAttrsRequest);
+			getAttrsRequest->Result = result;
+			}
+			break;
+		case FOPS_WALK: {
+			FileWalkRequest *walkRequest = (FileWalkRequest*)request;
+
+			result = WalkTree(walkRequest);
+			walkRequest->Result = result;
+			}
+			break;
+		default:
+			result = -EBADREQUEST;
+			break;
+	}
+
+	return result;
+}
+	
+filesystem_t VirtualFilesystem::RegisterFilesystem(uint32_t vendorID, uint32_t productID, void *instance, FSOperations *ops) {
+	Filesystem *fs = new Filesystem;
+
+	fs->FSDescriptor = GetFSDescriptor();
+	fs->OwnerVendorID = vendorID;
+	fs->OwnerProductID = productID;
+	fs->Instance = instance;
+	fs->Operations = ops;
+
+	RegisteredFilesystemNode *node = AddNode(fs);
+
+	MKMI_Printf("Registered filesystem (ID: %x, VID: %x, PID: %x)\r\n",
+			node->FS->FSDescriptor,
+			node->FS->OwnerVendorID,
+			node->FS->OwnerProductID);
+
+	return fs->FSDescriptor;
+}
+	
+filesystem_t VirtualFilesystem::SnapshotFilesystem(filesystem_t fs) {
+	bool found = false;
+	RegisteredFilesystemNode *previous;
+	RegisteredFilesystemNode *node = FindNode(fs, &previous, &found);
+
+	if (node == NULL || !found) return -ENODRIVER;
+
+	FSSnapshotRequest fsSnapshotRequest;
+	fsSnapshotRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+	fsSnapshotRequest.Request = NODE_SNAPSHOT;
+	fsSnapshotRequest.Descriptor = GetFSDescriptor();
+	fsSnapshotRequest.Instance = 0;
+
+	result_t result = DoFilesystemOperation(fs, &fsSnapshotRequest);
+	if(result != 0) return result;
+
+	/* The snapshot is run by the same driver as what it was taken of */
+	Filesystem *snapshot = new Filesystem;
+
+	snapshot->FSDescriptor = fsSnapshotRequest.Descriptor;
+	snapshot->OwnerVendorID = node->FS->OwnerVendorID;
+	snapshot->OwnerProductID = node->FS->OwnerProductID;
+	snapshot->Instance = (void*)fsSnapshotRequest.Instance;
+	snapshot->Operations = node->FS->Operations;
+
+	AddNode(snapshot);
+
+	return snapshot->FSDescriptor;
+}
+
+result_t VirtualFilesystem::DoFilesystemOperation(filesystem_t fs, FSOperationRequest *request) {
+	if (request == NULL) return -EBADREQUEST;
+
+	uint16_t type = request->Request;
+
+	VFSTrace *trace = Trace;
+	TraceRecord record;
+	if(trace != NULL) trace->DescribeNodeOperation(fs, request, &record);
+
+	uint64_t start = ReadTimestamp();
+
+	result_t result = HandleFilesystemOperation(fs, request);
+
+	uint64_t ticks = ReadTimestamp() - start;
+	bool transfer = type == NODE_READ || type == NODE_WRITE || type == NODE_READ_SCATTER || type == NODE_WRITE_SCATTER ||
+	                type == NODE_READ_VECTOR || type == NODE_WRITE_VECTOR;
+	uint64_t bytes = transfer && result > 0 ? result : 0;
+	Stats->RecordNodeOperation(fs, type, result, bytes, ticks);
+
+	if(trace != NULL) trace->Append(&record, request, result, start, ticks);
+
+	return result;
+}
+
+result_t VirtualFilesystem::HandleFilesystemOperation(filesystem_t fs, FSOperationRequest *request) {
+	result_t result = 0;
+
+	bool found = false;
+	RegisteredFilesystemNode *previous; 
+	RegisteredFilesystemNode *node = FindNode(fs, &previous, &found);
+
+	if (node == NULL || !found) return -ENODRIVER;
+	if (request == NULL) return -EBADREQUEST;
+
+	switch(request->Request) {
+		case NODE_CREATE:
+			IF_IS_OURS(node) {
+				FSCreateNodeRequest *createRequest = (FSCreateNodeRequest*)request;
+				VNode *resultNode = node->FS->Operations->CreateNode(node->FS->Instance, createRequest->Directory, createRequest->Name, createRequest->Flags);
+				if(resultNode == NULL) {
+					result = -EFAULT;
+				} else {
+					result = 0;
+					createRequest->ResultNode = *resultNode;
+				}
+
+				createRequest->Result = result;
+			}
+			break;
+		case NODE_DELETE:
+			IF_IS_OURS(node) {
+				FSDeleteNodeRequest *deleteRequest = (FSDeleteNodeRequest*)request;
+
+				/* Mapped pages would be freed from under their users */
+				if(IsMapped(fs, deleteRequest->Node)) {
+					result = -EBADREQUEST;
+				} else if(node->FS->Operations->DeleteNode(node->FS->Instance, deleteRequest->Node) != 0) {
+					result = -EFAULT;
+				} else {
+					result = 0;
+				}
+
+				deleteRequest->Result = result;
+			}
+			break;
+		case NODE_RENAME:
+			IF_IS_OURS(node) {
+				FSRenameNodeRequest *renameRequest = (FSRenameNodeRequest*)request;
+
+				/* Neither can a mapped file be replaced */
+				VNode *replaced = node->FS->Operations->GetByName(node->FS->Instance, renameRequest->Directory, renameRequest->Name);
+				VNode *resultNode = NULL;
+
+				if(replaced == NULL || replaced->Inode == renameRequest->Node || !IsMapped(fs, replaced->Inode)) {
+					resultNode = node->FS->Operations->RenameNode(node->FS->Instance, renameRequest->Node, renameRequest->Directory, renameRequest->Name);
+				}
+
+				if(resultNode == NULL) {
+					result = -EFAULT;
+				} else {
+					result = 0;
+					renameRequest->ResultNode = *resultNode;
+				}
+
+				renameRequest->Result = result;
+			}
+			break;
+		case NODE_GETBYNODE:
+			IF_IS_OURS(node) {
+				FSGetByNodeRequest *getByNodeRequest = (FSGetByNodeRequest*)request;
+
+				VNode *resultNode = node->FS->Operations->GetByInode(node->FS->Instance, getByNodeRequest->Node);
+				if(resultNode == NULL) {
+					result = -EFAULT;
+				} else {
+					result = 0;
+					getByNodeRequest->ResultNode = *resultNode;
+				}
+
+				getByNodeRequest->Result = result;
+			}
+			break;
+		case NODE_GETBYNAME:
+			IF_IS_OURS(node) {
+				FSGetByNameRequest *getByNameRequest = (FSGetByNameRequest*)request;
+				
+				VNode *resultNode = node->FS->Operations->GetByName(node->FS->Instance, getByNameRequest->Directory, getByNameRequest->Name);
+				if(resultNode == NULL) {
+					result = -EFAULT;
+				} else {
+					result = 0;
+					getByNameRequest->ResultNode = *resultNode;
+				}
+
+				getByNameRequest->Result = result;
+			}
+			break;
+		case NODE_GETBYINDEX:
+			IF_IS_OURS(node) {
+				FSGetByIndexRequest *getByIndexRequest = (FSGetByIndexRequest*)request;
+
+				VNode *resultNode = node->FS->Operations->GetByIndex(node->FS->Instance, getByIndexRequest->Directory, getByIndexRequest->Index);
+				if(resultNode == NULL) {
+					result = -EFAULT;
+				} else {
+					result = 0;
+					getByIndexRequest->ResultNode = *resultNode;
+				}
+
+				getByIndexRequest->Result = result;
+			}
+			break;
+		case NODE_GETROOT:
+			IF_IS_OURS(node) {
+				FSGetRootRequest *getRootRequest = (FSGetRootRequest*)request;
+				VNode *resultNode = node->FS->Operations->GetRootNode(node->FS->Instance);
+
+				if(resultNode == NULL) {
+					result = -EFAULT;
+				} else {
+					result = 0;
+					getRootRequest->ResultNode = *resultNode;
+				}
+
+				getRootRequest->Result = result;
+			}
+			break;
+		case NODE_READ:
+			IF_IS_OURS(node) {
+				FSReadNodeRequest *nodeReadRequest = (FSReadNodeRequest*)request;
+				intmax_t readAmount = node->FS->Operations->ReadNode(node->FS->Instance, nodeReadRequest->Node, nodeReadRequest->Offset, nodeReadRequest->Size, (void*)&nodeReadRequest->Buffer);
+
+				if(readAmount < 0) {
+					result = -EFAULT;
+				} else {
+					result = readAmount;
+				}
+
+				nodeReadRequest->Result = result;
+			}
+			break;
+		case NODE_WRITE:
+			IF_IS_OURS(node) {
+				FSWriteNodeRequest *nodeWriteRequest = (FSWriteNodeRequest*)request;
+				intmax_t writeAmount = node->FS->Operations->WriteNode(node->FS->Instance, nodeWriteRequest->Node, nodeWriteRequest->Offset, nodeWriteRequest->Size, (void*)&nodeWriteRequest->Buffer);
+
+				if(writeAmount < 0) {
+					result = -EFAULT;
+				} else {
+					result = writeAmount;
+				}
+
+				nodeWriteRequest->Result = result;
+			}
+			break;
+		case NODE_BIND:
+			IF_IS_OURS(node) {
+				FSBindNodeRequest *bindRequest = (FSBindNodeRequest*)request;
+
+				if(node->FS->Operations->BindNode == NULL ||
+				   node->FS->Operations->BindNode(node->FS->Instance, bindRequest->Node, (const void*)bindRequest->Address, bindRequest->Size) < 0) {
+					result = -EFAULT;
+				} else {
+					result = 0;
+				}
+
+				bindRequest->Result = result;
+			}
+			break;
+		case NODE_MAP:
+			IF_IS_OURS(node) {
+				FSMapNodeRequest *mapRequest = (FSMapNodeRequest*)request;
+
+				if(node->FS->Operations->MapNode == NULL) {
+					result = -EBADREQUEST;
+				} else {
+					size_t size = 0;
+					void *address = node->FS->Operations->MapNode(node->FS->Instance, mapRequest->Node, &size);
+
+					mapRequest->Address = (uintptr_t)address;
+					mapRequest->Size = address == NULL ? 0 : size;
+					result = 0;
+				}
+
+				mapRequest->Result = result;
+			}
+			break;
+		case NODE_MAP_BLOCK:
+			IF_IS_OURS(node) {
+				FSMapBlockRequest *mapBlockRequest = (FSMapBlockRequest*)request;
+
+				if(node->FS->Operations->MapBlock == NULL) {
+					result = -EBADREQUEST;
+				} else {
+					uint8_t *block = node->FS->Operations->MapBlock(node->FS->Instance, mapBlockRequest->Node, mapBlockRequest->Offset, mapBlockRequest->Write != 0);
+
+					mapBlockRequest->Address = (uintptr_t)block;
+					result = 0;
+				}
+
+				mapBlockRequest->Result = result;
+			}
+			break;
+		case NODE_UNMAP:
+			IF_IS_OURS(node) {
+				FSUnmapNodeRequest *unmapRequest = (FSUnmapNodeRequest*)request;
+
+				/* Filesystems that never move their storage have nothing to do */
+				if(node->FS->Operations->UnmapNode != NULL) {
+					node->FS->Operations->UnmapNode(node->FS->Instance, unmapRequest->Node);
+				}
+
+				result = 0;
+				unmapRequest->Result = result;
+			}
+			break;
+		case NODE_CLONE:
+			IF_IS_OURS(node) {
+				FSCloneNodeRequest *cloneRequest = (FSCloneNodeRequest*)request;
+
+				/* Pages mapped for writing go straight to the blocks the clone would share */
+				if(node->FS->Operations->CloneNode == NULL || IsMapped(fs, cloneRequest->Node)) {
+					result = -EBADREQUEST;
+				} else {
+					VNode *resultNode = node->FS->Operations->CloneNode(node->FS->Instance, cloneRequest->Node, cloneRequest->Directory, cloneRequest->Name);
+					if(resultNode == NULL) {
+						result = -EFAULT;
+					} else {
+						result = 0;
+						cloneRequest->ResultNode = *resultNode;
+					}
+				}
+
+				cloneRequest->Result = result;
+			}
+			break;
+		case NODE_COPY_RANGE:
+			IF_IS_OURS(node) {
+				FSCopyRangeRequest *copyRequest = (FSCopyRangeRequest*)request;
+
+				/* Same for mapped sources, and the blocks of a mapped destination may be swapped out from under it */
+				if(node->FS->Operations->CopyRange == NULL || IsMapped(fs, copyRequest->Source) || IsMapped(fs, copyRequest->Destination)) {
+					result = -EBADREQUEST;
+				} else {
+					intmax_t copied = node->FS->Operations->CopyRange(node->FS->Instance, copyRequest->Source, copyRequest->SourceOffset,
+					                                                  copyRequest->Destination, copyRequest->DestinationOffset, copyRequest->Size);
+
+					result = copied < 0 ? -EFAULT : copied;
+				}
+
+				copyRequest->Result = result;
+			}
+			break;
+		case NODE_SNAPSHOT:
+			IF_IS_OURS(node) {
+				FSSnapshotRequest *snapshotRequest = (FSSnapshotRequest*)request;
+
+				/* Pages handed out of a mapping would be written straight into the
+				   blocks the snapshot shares, and drift off the file once it unshares them */
+				if(node->FS->Operations->Snapshot == NULL || HasMappings(fs)) {
+					result = -EBADREQUEST;
+				} else {
+					void *instance = node->FS->Operations->Snapshot(node->FS->Instance, snapshotRequest->Descriptor);
+
+					snapshotRequest->Instance = (uintptr_t)instance;
+					result = instance == NULL ? -EFAULT : 0;
+				}
+
+				snapshotRequest->Result = result;
+			}
+			break;
+		case NODE_READ_SCATTER:
+			IF_IS_OURS(node) {
+				FSScatterNodeRequest *scatterRequest = (FSScatterNodeRequest*)request;
+				intmax_t readAmount = node->FS->Operations->ReadNode(node->FS->Instance, scatterRequest->Node, scatterRequest->Offset, scatterRequest->Size, (void*)scatterRequest->Address);
+
+				if(readAmount < 0) {
+					result = -EFAULT;
+				} else {
+					result = readAmount;
+				}
+
+				scatterRequest->Result = result;
+			}
+			break;
+		case NODE_WRITE_SCATTER:
+			IF_IS_OURS(node) {
+				FSScatterNodeRequest *scatterRequest = (FSScatterNodeRequest*)request;
+				intmax_t writeAmount = node->FS->Operations->WriteNode(node->FS->Instance, scatterRequest->Node, scatterRequest->Offset, scatterRequest->Size, (void*)scatterRequest->Address);
+
+				if(writeAmount < 0) {
+					result = -EFAULT;
+				} else {
+					result = writeAmount;
+				}
+
+				scatterRequest->Result = result;
+			}
+			break;
+		case NODE_READ_VECTOR:
+		case NODE_WRITE_VECTOR:
+			IF_IS_OURS(node) {
+				FSVectorNodeRequest *vectorRequest = (FSVectorNodeRequest*)request;
+				FSOperations *ops = node->FS->Operations;
+				bool write = request->Request == NODE_WRITE_VECTOR;
+
+				intmax_t amount = 0;
+				if(write && ops->WriteNodeVector != NULL) {
+					amount = ops->WriteNodeVector(node->FS->Instance, vectorRequest->Node, &vectorRequest->Segments, vectorRequest->Count);
+				} else if(!write && ops->ReadNodeVector != NULL) {
+					amount = ops->ReadNodeVector(node->FS->Instance, vectorRequest->Node, &vectorRequest->Segments, vectorRequest->Count);
+				} else {
+					/* One segment at a time, as far as the first one that comes up short */
+					IOSegment *segments = &vectorRequest->Segments;
+					for (size_t i = 0; i < vectorRequest->Count; ++i) {
+						intmax_t moved = write ?
+							ops->WriteNode(node->FS->Instance, vectorRequest->Node, segments[i].Offset, segments[i].Size, (void*)segments[i].Address) :
+							ops->ReadNode(node->FS->Instance, vectorRequest->Node, segments[i].Offset, segments[i].Size, (void*)segments[i].Address);
+
+						if(moved < 0) {
+							if(amount == 0) amount = moved;
+							break;
+						}
+
+						amount += moved;
+						if((size_t)moved < segments[i].Size) break;
+					}
+				}
+
+				if(amount < 0) {
+					result = -EFAULT;
+				} else {
+					result = amount;
+				}
+
+				vectorRequest->Result = result;
+			}
+			break;
+		case NODE_READDIR:
+			IF_IS_OURS(node) {
+				FSReadDirectoryRequest *readDirRequest = (FSReadDirectoryRequest*)request;
+
+				/* The request is packed, so the cursor goes through an aligned copy */
+				uintmax_t cursor = readDirRequest->Cursor;
+				intmax_t entries = node->FS->Operations->ReadDirectory(node->FS->Instance, readDirRequest->Directory, &cursor, readDirRequest->Size, (void*)&readDirRequest->Buffer);
+				readDirRequest->Cursor = cursor;
+
+				if(entries < 0) {
+					result = -EFAULT;
+				} else {
+					result = entries;
+				}
+
+				readDirRequest->Result = result;
+			}
+			break;
+		default:
+			return -EBADREQUEST;
+	}
+
+	return result;
+}
+
+result_t VirtualFilesystem::CopyThrough(VNode *source, size_t sourceOffset, VNode *destination, size_t destinationOffset, size_t size) {
+	if(sourceOffset >= source->Size) return 0;
+	if(size > source->Size - sourceOffset) size = source->Size - sourceOffset;
+
+	size_t bufferSize = size < POOL_SLAB_SIZE ? size : POOL_SLAB_SIZE;
+	uint8_t *buffer = (uint8_t*)Pool->Allocate(bufferSize);
+	if(buffer == NULL) return -EFAULT;
+
+	FSScatterNodeRequest fsReadRequest;
+	fsReadRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+	fsReadRequest.Request = NODE_READ_SCATTER;
+	fsReadRequest.Node = source->Inode;
+	fsReadRequest.Address = (uintptr_t)buffer;
+
+	FSScatterNodeRequest fsWriteRequest;
+	fsWriteRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+	fsWriteRequest.Request = NODE_WRITE_SCATTER;
+	fsWriteRequest.Node = destination->Inode;
+	fsWriteRequest.Address = (uintptr_t)buffer;
+
+	result_t result = 0;
+	size_t copied = 0;
+
+	while(copied < size) {
+		fsReadRequest.Offset = sourceOffset + copied;
+		fsReadRequest.Size = size - copied < bufferSize ? size - copied : bufferSize;
+
+		result = DoFilesystemOperation(source->FSDescriptor, &fsReadRequest);
+		if(result <= 0) break;
+
+		fsWriteRequest.Offset = destinationOffset + copied;
+		fsWriteRequest.Size = result;
+
+		result = DoFilesystemOperation(destination->FSDescriptor, &fsWriteRequest);
+		if(result <= 0) break;
+
+		copied += result;
+	}
+
+	Pool->Release(buffer);
+
+	/* What made it across counts, an error only if nothing did */
+	return copied == 0 && result < 0 ? result : copied;
+}
+
+/* Names of files that are being written before they take the place of another */
+static void TemporaryName(char *name, uintmax_t number) {
+	static const char *prefix = ".writefile-";
+
+	Memset(name, 0, MAX_NAME_SIZE);
+	Strcpy(name, prefix);
+
+	size_t length = Strlen(prefix);
+	size_t digits = 1;
+	for (uintmax_t rest = number >> 4; rest != 0; rest >>= 4) ++digits;
+
+	for (size_t i = digits; i-- > 0; number >>= 4) name[length + i] = "0123456789abcdef"[number & 0xF];
+}
+
+result_t VirtualFilesystem::ReplaceFile(const char *path, const void *data, size_t size) {
+	char parent[MAX_PATH_SIZE] = {0};
+	char name[MAX_NAME_SIZE] = {0};
+
+	result_t result = SplitPath(path, parent, name);
+	if (result != 0) return result;
+
+	VNode directory;
+	result = ResolvePath(parent, &directory);
+	if (result != 0) return result;
+
+	if(!(directory.Properties & NODE_PROPERTY_DIRECTORY)) return -EBADREQUEST;
+
+	/* Whatever is there now has to be a file, and the new one takes on its properties */
+	FSGetByNameRequest fsGetByNameRequest;
+	fsGetByNameRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+	fsGetByNameRequest.Request = NODE_GETBYNAME;
+	fsGetByNameRequest.Directory = directory.Inode;
+	Strcpy(fsGetByNameRequest.Name, name);
+
+	property_t properties = NODE_PROPERTY_FILE;
+	if(DoFilesystemOperation(directory.FSDescriptor, &fsGetByNameRequest) == 0) {
+		if(!(fsGetByNameRequest.ResultNode.Properties & NODE_PROPERTY_FILE)) return -EBADREQUEST;
+		properties = fsGetByNameRequest.ResultNode.Properties;
+	}
+
+	/* The new content goes next to the file under a name nobody uses,
+	   as it can only be renamed over it inside of the same directory */
+	FSCreateNodeRequest fsCreateRequest;
+	fsCreateRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+	fsCreateRequest.Request = NODE_CREATE;
+	fsCreateRequest.Directory = directory.Inode;
+	fsCreateRequest.Flags = properties;
+
+	bool unused = false;
+	for (size_t attempt = 0; attempt < 16 && !unused; ++attempt) {
+		TemporaryName(fsCreateRequest.Name, ++MaxTemporaryName);
+		Strcpy(fsGetByNameRequest.Name, fsCreateRequest.Name);
+
+		unused = DoFilesystemOperation(directory.FSDescriptor, &fsGetByNameRequest) != 0;
+	}
+
+	if(!unused) return -EFAULT;
+
+	result = DoFilesystemOperation(directory.FSDescriptor, &fsCreateRequest);
+	if (result != 0) return result;
+
+	inode_t temporary = fsCreateRequest.ResultNode.Inode;
+
+	if(size != 0) {
+		FSScatterNodeRequest fsWriteRequest;
+		fsWriteRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+		fsWriteRequest.Request = NODE_WRITE_SCATTER;
+		fsWriteRequest.Node = temporary;
+		fsWriteRequest.Offset = 0;
+		fsWriteRequest.Size = size;
+		fsWriteRequest.Address = (uintptr_t)data;
+
+		result = DoFilesystemOperation(directory.FSDescriptor, &fsWriteRequest);
+		result = result == (result_t)size ? 0 : result < 0 ? result : -EFAULT;
+	}
+
+	if(result == 0) {
+		FSRenameNodeRequest fsRenameRequest;
+		fsRenameRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+		fsRenameRequest.Request = NODE_RENAME;
+		fsRenameRequest.Node = temporary;
+		fsRenameRequest.Directory = directory.Inode;
+		Strcpy(fsRenameRequest.Name, name);
+
+		result = DoFilesystemOperation(directory.FSDescriptor, &fsRenameRequest);
+	}
+
+	/* The old content stays as it was if anything went wrong */
+	if(result != 0) {
+		FSDeleteNodeRequest fsDeleteRequest;
+		fsDeleteRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+		fsDeleteRequest.Request = NODE_DELETE;
+		fsDeleteRequest.Node = temporary;
+
+		DoFilesystemOperation(directory.FSDescriptor, &fsDeleteRequest);
+
+		return result;
+	}
+
+	return size;
+}
+
+/* Directory entries asked of a filesystem at once while walking */
+#define WALK_BATCH 16
+
+/* Names are matched against filters with '*' for any run of characters and '?' for any one */
+static bool MatchName(const char *filter, const char *name) {
+	const char *star = NULL, *resume = NULL;
+
+	while(*name != '\0') {
+		if(*filter == '*') {
+			star = filter++;
+			resume = name;
+		} else if(*filter == '?' || *filter == *name) {
+			++filter;
+			++name;
+		} else if(star != NULL) {
+			/* Let the last star take one more character and try again from there */
+			filter = star + 1;
+			name = ++resume;
+		} else {
+			return false;
+		}
+	}
+
+	while(*filter == '*') ++filter;
+	return *filter == '\0';
+}
+
+result_t VirtualFilesystem::ReadWalkLevel(WalkLevel *level, uintmax_t *cursor, FSReadDirectoryRequest *request, size_t count) {
+	request->MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+	request->Request = NODE_READDIR;
+	request->Directory = level->Directory;
+	request->Cursor = level->Cursor;
+	request->Size = count * sizeof(DirNode);
+
+	result_t result = DoFilesystemOperation(level->FSDescriptor, request);
+	*cursor = request->Cursor;
+
+	return result;
+}
+
+/* A cursor comes back from the caller, so nothing in it is taken on trust */
+result_t VirtualFilesystem::CheckWalkCursor(WalkCursor *cursor) {
+	if(cursor->Depth == 0 || cursor->Depth > WALK_MAX_DEPTH) return -EBADREQUEST;
+
+	for (size_t i = 0; i < cursor->Depth; ++i) {
+		WalkLevel *level = &cursor->Levels[i];
+
+		/* Each directory is named by a longer path than the one it is in */
+		if(level->PathLength >= MAX_PATH_SIZE) return -EBADREQUEST;
+		if(i == 0 ? level->PathLength != 0 : level->PathLength <= cursor->Levels[i - 1].PathLength) return -EBADREQUEST;
+
+		FSGetByNodeRequest request;
+		request.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+		request.Request = NODE_GETBYNODE;
+		request.Node = level->Directory;
+
+		if(DoFilesystemOperation(level->FSDescriptor, &request) != 0) return -EBADREQUEST;
+		if(!(request.ResultNode.Properties & NODE_PROPERTY_DIRECTORY)) return -EBADREQUEST;
+	}
+
+	return 0;
+}
+
+result_t VirtualFilesystem::WalkTree(FileWalkRequest *request) {
+	WalkCursor *cursor = &request->Cursor;
+	if(cursor->Finished) return 0;
+
+	if(cursor->Started) {
+		result_t result = CheckWalkCursor(cursor);
+		if(result != 0) return result;
+	} else {
+		VNode root;
+
+		result_t result = ResolvePath(request->Path, &root);
+		if(result != 0) return result;
+
+		if(!(root.Properties & NODE_PROPERTY_DIRECTORY)) return -EBADREQUEST;
+
+		cursor->Started = 1;
+		cursor->Depth = 1;
+		cursor->Levels[0].FSDescriptor = root.FSDescriptor;
+		cursor->Levels[0].Directory = root.Inode;
+		cursor->Levels[0].Cursor = 0;
+		cursor->Levels[0].PathLength = 0;
+		cursor->Path[0] = '\0';
+	}
+
+	size_t maxDepth = request->MaxDepth == 0 || request->MaxDepth > WALK_MAX_DEPTH ? WALK_MAX_DEPTH : request->MaxDepth;
+	bool filtered = request->Filter[0] != '\0';
+
+	FSReadDirectoryRequest *fsReadDirRequest = (FSReadDirectoryRequest*)Pool->Allocate(sizeof(FSReadDirectoryRequest) + WALK_BATCH * sizeof(DirNode));
+	if(fsReadDirRequest == NULL) return -EFAULT;
+
+	DirNode *entries = (DirNode*)&fsReadDirRequest->Buffer;
+
+	uint8_t *buffer = &request->Buffer;
+	size_t used = 0;
+	result_t count = 0;
+	bool full = false;
+
+	while(cursor->Depth > 0 && !full) {
+		WalkLevel *level = &cursor->Levels[cursor->Depth - 1];
+
+		uintmax_t next;
+		result_t read = ReadWalkLevel(level, &next, fsReadDirRequest, WALK_BATCH);
+		if(read <= 0) {
+			--cursor->Depth;
+			continue;
+		}
+
+		/* What is needed of a directory to go into it, once the batch is gone */
+		filesystem_t childFS = 0;
+		inode_t childInode = 0;
+		size_t childPathLength = 0;
+		bool descend = false;
+		result_t consumed = 0;
+
+		while(consumed < read && !descend) {
+			DirNode *entry = &entries[consumed];
+
+			size_t nameLength = Strlen(entry->Name);
+			size_t pathLength = level->PathLength + (level->PathLength != 0) + nameLength;
+
+			/* Nothing that deep can be named anyway */
+			if(pathLength >= MAX_PATH_SIZE) {
+				++consumed;
+				continue;
 			}
-			break;
-		case FOPS_WRITE: {
+
+			filesystem_t fs = level->FSDescriptor;
+			inode_t inode = entry->Inode;
+			property_t properties = entry->Properties;
+			size_t size = entry->Size;
+
+			/* Directories something is mounted on show the root of what is mounted */
+			if((properties & NODE_PROPERTY_DIRECTORY) && Mounts != NULL) {
+				VNode mounted;
+				mounted.FSDescriptor = fs;
+				mounted.Inode = inode;
+				mounted.Properties = properties;
+				mounted.Size = size;
+
+				if(FollowMount(&mounted) != 0) {
+					++consumed;
+					continue;
+				}
+
+				fs = mounted.FSDescriptor;
+				inode = mounted.Inode;
+				properties = mounted.Properties;
+				size = mounted.Size;
 			}
-			break;
-		case FOPS_EXECUTE: {
-			FileExecuteRequest *executeRequest = (FileExecuteRequest*)request;
-			VNode executable;
 
-			result = ResolvePath(executeRequest->Path, &executable);
+			if(!filtered || MatchName(request->Filter, entry->Name)) {
+				size_t entrySize = sizeof(WalkEntry) + pathLength + 1;
 
-			if (result != 0) {
-				executeRequest->Result = result;
+				/* The entry is read again by the next call */
+				if(used + entrySize > request->Size) {
+					full = true;
+					break;
+				}
 
-				break;
+				WalkEntry *walkEntry = (WalkEntry*)(buffer + used);
+				walkEntry->FSDescriptor = fs;
+				walkEntry->Inode = inode;
+				walkEntry->Properties = properties;
+				walkEntry->Size = size;
+				walkEntry->Depth = cursor->Depth;
+				walkEntry->PathLength = pathLength;
+
+				Memcpy(walkEntry->Path, cursor->Path, level->PathLength);
+				if(level->PathLength != 0) walkEntry->Path[level->PathLength] = '/';
+				Memcpy(&walkEntry->Path[pathLength - nameLength], entry->Name, nameLength);
+				walkEntry->Path[pathLength] = '\0';
+
+				used += entrySize;
+				++count;
 			}
 
-			/* Here we open and read the data of the file, then we ask the kernel to
-			   start it up. We can use the message buffer to avoid eccessive copying */
+			++consumed;
 
-			}
-			break;
-		default:
-			result = -EBADREQUEST;
-			break;
+			if(!(properties & NODE_PROPERTY_DIRECTORY) || cursor->Depth >= maxDepth) continue;
+
+			/* The path to a directory stays in the cursor for as long as it is being read */
+			if(level->PathLength != 0) cursor->Path[level->PathLength] = '/';
+			Memcpy(&cursor->Path[pathLength - nameLength], entry->Name, nameLength);
+			cursor->Path[pathLength] = '\0';
+
+			childFS = fs;
+			childInode = inode;
+			childPathLength = pathLength;
+			descend = true;
+		}
+
+		/* Stopping inside of a batch, the directory is read again up to there
+		   to learn where the cursor has to be to pick up right after it */
+		if(consumed == read) {
+			level->Cursor = next;
+		} else if(consumed != 0) {
+			ReadWalkLevel(level, &next, fsReadDirRequest, consumed);
+			level->Cursor = next;
+		}
+
+		if(!descend) continue;
+
+		WalkLevel *childLevel = &cursor->Levels[cursor->Depth++];
+		childLevel->FSDescriptor = childFS;
+		childLevel->Directory = childInode;
+		childLevel->Cursor = 0;
+		childLevel->PathLength = childPathLength;
 	}
 
-	return result;
+	Pool->Release(fsReadDirRequest);
+
+	if(cursor->Depth == 0) cursor->Finished = 1;
+
+	/* Not even one entry fit, asking again would not help */
+	if(count == 0 && !cursor->Finished) return -EBADREQUEST;
+
+	return count;
 }
-	
-filesystem_t VirtualFilesystem::RegisterFilesystem(uint32_t vendorID, uint32_t productID, void *instance, FSOperations *ops) {
-	Filesystem *fs = new Filesystem;
 
-	fs->FSDescriptor = GetFSDescriptor();
-	fs->OwnerVendorID = vendorID;
-	fs->OwnerProductID = productID;
-	fs->Instance = instance;
-	fs->Operations = ops;
+/* A node looked up for a batch, found again by its directory and name */
+struct AttributeNode {
+	/* Result holds whether the lookup failed, so that it is not tried again either */
+	NodeAttributes Node;
 
-	RegisteredFilesystemNode *node = AddNode(fs);
+	/* The slot of its directory plus one, 0 for the root */
+	size_t Directory;
 
-	MKMI_Printf("Registered filesystem (ID: %x, VID: %x, PID: %x)\r\n",
-			node->FS->FSDescriptor,
-			node->FS->OwnerVendorID,
-			node->FS->OwnerProductID);
+	/* Its name, in the path it was first looked up for. NULL for a free slot */
+	const char *Name;
+	size_t NameLength;
+};
 
-	return fs->FSDescriptor;
+static size_t HashName(size_t directory, const char *name, size_t length) {
+	uint64_t hash = 0xCBF29CE484222325 ^ (directory * 0x9E3779B97F4A7C15);
+	for (size_t i = 0; i < length; ++i) hash = (hash ^ (uint8_t)name[i]) * 0x100000001B3;
+
+	return hash ^ (hash >> 32);
 }
-	
-result_t VirtualFilesystem::DoFilesystemOperation(filesystem_t fs, FSOperationRequest *request) {
-	result_t result = 0;
 
-	bool found = false;
-	RegisteredFilesystemNode *previous; 
-	RegisteredFilesystemNode *node = FindNode(fs, &previous, &found);
+result_t VirtualFilesystem::GetAttributesBatch(FileGetAttrsRequest *request) {
+	if(request->Count > request->Size / sizeof(NodeAttributes)) return -EBADREQUEST;
 
-	if (node == NULL || !found) return -ENODRIVER;
-	if (request == NULL) return -EBADREQUEST;
+	NodeAttributes *attributes = (NodeAttributes*)&request->Buffer;
+	const char *paths = (const char*)(attributes + request->Count);
+	const char *end = (const char*)&request->Buffer + request->Size;
 
-	switch(request->Request) {
-		case NODE_CREATE:
-			IF_IS_OURS(node) {
-				FSCreateNodeRequest *createRequest = (FSCreateNodeRequest*)request;
-				VNode *resultNode = node->FS->Operations->CreateNode(node->FS->Instance, createRequest->Directory, createRequest->Name, createRequest->Flags);
-				if(resultNode == NULL) {
-					result = -EFAULT;
-				} else {
-					result = 0;
-					createRequest->ResultNode = *resultNode;
-				}
+	/* Every name of every path could need a slot, with a quarter of them left free */
+	size_t names = 0;
+	for (const char *position = paths; position < end; ++position) {
+		if(*position != '/' && *position != '\0' && (position == paths || position[-1] == '/' || position[-1] == '\0')) ++names;
+	}
 
-				createRequest->Result = result;
-			}
-			break;
-/*		case NODE_DELETE:
-			IF_IS_OURS(node->FS->Operations->DeleteNode(node->FS->Instance, request->Data.DeleteNode.Node));
-			break;*/
-/*		case NODE_GETBYNODE:
-			IF_IS_OURS(node->FS->Operations->GetByInode(node->FS->Instance, request->Data.GetByNode.Node));
-			break;*/
-		case NODE_GETBYNAME:
-			IF_IS_OURS(node) {
-				FSGetByNameRequest *getByNameRequest = (FSGetByNameRequest*)request;
-				
-				VNode *resultNode = node->FS->Operations->GetByName(node->FS->Instance, getByNameRequest->Directory, getByNameRequest->Name);
-				if(resultNode == NULL) {
-					result = -EFAULT;
-				} else {
-					result = 0;
-					getByNameRequest->ResultNode = *resultNode;
-				}
+	size_t slotCount = 1;
+	while(slotCount < names + names / 3 + 1) slotCount *= 2;
 
-				getByNameRequest->Result = result;
-			}
-			break;
-/*		case NODE_GETBYINDEX:
-			IF_IS_OURS(node->FS->Operations->GetByIndex(node->FS->Instance, request->Data.GetByIndex.Directory, request->Data.GetByIndex.Index));
-			break;*/
-		case NODE_GETROOT:
-			IF_IS_OURS(node) {
-				FSGetRootRequest *getRootRequest = (FSGetRootRequest*)request;
-				VNode *resultNode = node->FS->Operations->GetRootNode(node->FS->Instance);
+	FSGetRootRequest rootRequest;
+	rootRequest.Request = NODE_GETROOT;
+	result_t result = DoFilesystemOperation(RootFilesystem, &rootRequest);
+	if(result != 0) return result;
 
-				if(resultNode == NULL) {
-					result = -EFAULT;
-				} else {
-					result = 0;
-					getRootRequest->ResultNode = *resultNode;
-				}
+	NodeAttributes root;
+	FillAttributes(&rootRequest.ResultNode, &root);
+	root.Result = 0;
 
-				getRootRequest->Result = result;
-			}
-			break;
-		case NODE_READ:
-			IF_IS_OURS(node) {
-				FSReadNodeRequest *nodeReadRequest = (FSReadNodeRequest*)request;
-				intmax_t readAmount = node->FS->Operations->ReadNode(node->FS->Instance, nodeReadRequest->Node, nodeReadRequest->Offset, nodeReadRequest->Size, (void*)&nodeReadRequest->Buffer);
+	/* Shared by the whole batch, so that a directory is looked up once
+	   for all the paths that go through it, in whatever order they come */
+	AttributeNode *slots = (AttributeNode*)Pool->Allocate(slotCount * sizeof(AttributeNode));
+	if(slots == NULL) return -EFAULT;
 
-				if(readAmount < 0) {
-					result = -EFAULT;
-				} else {
-					result = readAmount;
-				}
+	for (size_t i = 0; i < slotCount; ++i) slots[i].Name = NULL;
 
-				nodeReadRequest->Result = result;
+	VNode directory;
+	VNode next;
+	char name[MAX_NAME_SIZE];
+	const char *path = paths;
+	size_t found = 0;
+
+	for (size_t i = 0; i < request->Count; ++i) {
+		NodeAttributes *entry = &attributes[i];
+
+		const char *pathEnd = path;
+		while(pathEnd < end && *pathEnd != '\0') ++pathEnd;
+
+		/* Ran off the buffer, and so will every path after this one */
+		if(pathEnd == end) {
+			entry->Result = -EBADREQUEST;
+			continue;
+		}
+
+		NodeAttributes current = root;
+		size_t parent = 0;
+		const char *position = path;
+
+		while(current.Result == 0) {
+			while(position < pathEnd && *position == '/') ++position;
+			if(position == pathEnd) break;
+
+			size_t nameLength = 0;
+			while(position + nameLength < pathEnd && position[nameLength] != '/') ++nameLength;
+
+			size_t slot = HashName(parent, position, nameLength) & (slotCount - 1);
+			while(slots[slot].Name != NULL) {
+				if(slots[slot].Directory == parent && slots[slot].NameLength == nameLength &&
+				   Memcmp(slots[slot].Name, position, nameLength) == 0) break;
+
+				slot = (slot + 1) & (slotCount - 1);
 			}
-			break;
-		case NODE_WRITE:
-			IF_IS_OURS(node) {
-				FSWriteNodeRequest *nodeWriteRequest = (FSWriteNodeRequest*)request;
-				intmax_t writeAmount = node->FS->Operations->WriteNode(node->FS->Instance, nodeWriteRequest->Node, nodeWriteRequest->Offset, nodeWriteRequest->Size, (void*)&nodeWriteRequest->Buffer);
 
-				if(writeAmount < 0) {
-					result = -EFAULT;
+			if(slots[slot].Name == NULL) {
+				if(nameLength >= MAX_NAME_SIZE) {
+					current.Result = -EBADREQUEST;
 				} else {
-					result = writeAmount;
+					Memcpy(name, position, nameLength);
+					name[nameLength] = '\0';
+
+					directory.FSDescriptor = current.FSDescriptor;
+					directory.Inode = current.Inode;
+
+					current.Result = ProgressPath(&directory, &next, name);
+					if(current.Result == 0) FillAttributes(&next, &current);
 				}
 
-				nodeWriteRequest->Result = result;
+				slots[slot].Node = current;
+				slots[slot].Directory = parent;
+				slots[slot].Name = position;
+				slots[slot].NameLength = nameLength;
+			} else {
+				current = slots[slot].Node;
 			}
-			break;
-		default:
-			return -EBADREQUEST;
+
+			parent = slot + 1;
+			position += nameLength;
+		}
+
+		path = pathEnd + 1;
+
+		*entry = current;
+		if(current.Result == 0) ++found;
 	}
 
-	return result;
+	Pool->Release(slots);
+
+	return found;
+}
+
+result_t VirtualFilesystem::StartTrace(size_t count) {
+	if(Trace != NULL || count == 0) return -EBADREQUEST;
+
+	VFSTrace *trace = new VFSTrace(count);
+	if(trace == NULL) return -EFAULT;
+
+	if(!trace->IsRecording()) {
+		delete trace;
+		return -EFAULT;
+	}
+
+	Trace = trace;
+
+	return 0;
+}
+
+VFSTrace *VirtualFilesystem::StopTrace() {
+	VFSTrace *trace = Trace;
+	Trace = NULL;
+
+	return trace;
 }
 
 void VirtualFilesystem::SetRootFS(filesystem_t fs) {
@@ -255,7 +1695,77 @@ result_t VirtualFilesystem::ProgressPath(VNode *current, VNode *next, const char
 
 	*next = request.ResultNode;
 
-	return result;
+	return FollowMount(next);
+}
+
+result_t VirtualFilesystem::FollowMount(VNode *node) {
+	MountPoint *mount = Mounts;
+
+	while(mount != NULL) {
+		if(mount->FSDescriptor != node->FSDescriptor || mount->Inode != node->Inode) {
+			mount = mount->Next;
+			continue;
+		}
+
+		FSGetRootRequest request;
+		request.Request = NODE_GETROOT;
+		result_t result = DoFilesystemOperation(mount->MountedFS, &request);
+		if(result != 0) return result;
+
+		*node = request.ResultNode;
+
+		/* Something may be mounted on top of that as well */
+		mount = Mounts;
+	}
+
+	return 0;
+}
+
+result_t VirtualFilesystem::MountFilesystem(const char *path, filesystem_t fs) {
+	VNode directory;
+
+	result_t result = ResolvePath(path, &directory);
+	if(result != 0) return result;
+
+	if(!(directory.Properties & NODE_PROPERTY_DIRECTORY)) return -EBADREQUEST;
+	if(directory.FSDescriptor == fs) return -EBADREQUEST;
+
+	bool found = false;
+	RegisteredFilesystemNode *previous;
+	FindNode(fs, &previous, &found);
+	if(!found) return -ENODRIVER;
+
+	MountPoint *mount = new MountPoint;
+	mount->FSDescriptor = directory.FSDescriptor;
+	mount->Inode = directory.Inode;
+	mount->MountedFS = fs;
+	mount->Next = Mounts;
+
+	Mounts = mount;
+
+	return 0;
+}
+
+result_t VirtualFilesystem::SplitPath(const char *path, char *parent, char *name) {
+	size_t length = Strlen(path);
+
+	/* Trailing slashes don't name anything */
+	while(length > 0 && path[length - 1] == '/') --length;
+	if(length == 0) return -EBADREQUEST;
+
+	size_t nameStart = length;
+	while(nameStart > 0 && path[nameStart - 1] != '/') --nameStart;
+
+	if(length - nameStart >= MAX_NAME_SIZE) return -EBADREQUEST;
+	if(nameStart >= MAX_PATH_SIZE) return -EBADREQUEST;
+
+	Memcpy(parent, path, nameStart);
+	parent[nameStart] = '\0';
+
+	Memcpy(name, path + nameStart, length - nameStart);
+	name[length - nameStart] = '\0';
+
+	return 0;
 }
 
 result_t VirtualFilesystem::ResolvePath(const char *path, VNode *node) {
@@ -295,6 +1805,18 @@ result_t VirtualFilesystem::ResolvePath(const char *path, VNode *node) {
 	return -ENOTPRESENT;
 }
 
+size_t VirtualFilesystem::CompactFilesystems(size_t budget) {
+	size_t saved = 0;
+
+	for (RegisteredFilesystemNode *node = BaseNode->Next; node != NULL; node = node->Next) {
+		if(node->FS->Operations->CompactBlocks == NULL) continue;
+
+		saved += node->FS->Operations->CompactBlocks(node->FS->Instance, budget);
+	}
+
+	return saved;
+}
+
 RegisteredFilesystemNode *VirtualFilesystem::AddNode(Filesystem *fs) {
 	bool found = false;
 	RegisteredFilesystemNode *node, *prev;
@@ -354,3 +1876,231 @@ RegisteredFilesystemNode *VirtualFilesystem::FindNode(filesystem_t fs, Registere
 	return NULL;
 }
 
+
+FileHandle *VirtualFilesystem::AddHandle(filesystem_t fs, inode_t inode) {
+	FileHandle *handle = new FileHandle;
+
+	handle->FileDescriptor = GetFileDescriptor();
+	handle->FSDescriptor = fs;
+	handle->Inode = inode;
+	handle->Next = NULL;
+	handle->Previous = OpenFiles.Tail;
+
+	if(OpenFiles.Tail == NULL) {
+		OpenFiles.Head = handle;
+	} else {
+		OpenFiles.Tail->Next = handle;
+	}
+
+	OpenFiles.Tail = handle;
+
+	return handle;
+}
+
+FileHandle *VirtualFilesystem::FindHandle(fd_t fd) {
+	for (FileHandle *handle = OpenFiles.Head; handle != NULL; handle = handle->Next) {
+		if(handle->FileDescriptor == fd) return handle;
+	}
+
+	return NULL;
+}
+
+void VirtualFilesystem::RemoveHandle(FileHandle *handle) {
+	if(handle->Previous == NULL) {
+		OpenFiles.Head = handle->Next;
+	} else {
+		handle->Previous->Next = handle->Next;
+	}
+
+	if(handle->Next == NULL) {
+		OpenFiles.Tail = handle->Previous;
+	} else {
+		handle->Next->Previous = handle->Previous;
+	}
+
+	delete handle;
+}
+
+FileMapping *VirtualFilesystem::AddMapping(filesystem_t fs, inode_t inode, size_t offset, size_t size, uint32_t flags) {
+	FileMapping *mapping = new FileMapping;
+
+	mapping->FSDescriptor = fs;
+	mapping->Inode = inode;
+	mapping->Offset = offset;
+	mapping->Size = size;
+	mapping->Flags = flags;
+	mapping->Base = NULL;
+	mapping->BaseSize = 0;
+
+	mapping->PageCount = (size + MMAP_PAGE_SIZE - 1) / MMAP_PAGE_SIZE;
+	mapping->Pages = (uint8_t**)Malloc(mapping->PageCount * sizeof(uint8_t*));
+	mapping->States = (uint8_t*)Malloc(mapping->PageCount);
+
+	if(mapping->Pages == NULL || mapping->States == NULL) {
+		if(mapping->Pages != NULL) Free(mapping->Pages);
+		if(mapping->States != NULL) Free(mapping->States);
+		delete mapping;
+
+		return NULL;
+	}
+
+	Memset(mapping->Pages, 0, mapping->PageCount * sizeof(uint8_t*));
+	Memset(mapping->States, MAPPED_PAGE_ABSENT, mapping->PageCount);
+
+	/* Filesystems that can't hand out single blocks may still have the whole file in one place */
+	bool found = false;
+	RegisteredFilesystemNode *previous;
+	RegisteredFilesystemNode *node = FindNode(fs, &previous, &found);
+
+	if(node != NULL && found && node->FS->Operations->MapBlock == NULL) {
+		FSMapNodeRequest mapRequest;
+		mapRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+		mapRequest.Request = NODE_MAP;
+		mapRequest.Node = inode;
+		mapRequest.Address = 0;
+		mapRequest.Size = 0;
+
+		if(DoFilesystemOperation(fs, &mapRequest) == 0) {
+			mapping->Base = (const uint8_t*)mapRequest.Address;
+			mapping->BaseSize = mapRequest.Size;
+		}
+	}
+
+	mapping->Descriptor = GetMapDescriptor();
+	mapping->Next = Mappings;
+	Mappings = mapping;
+
+	return mapping;
+}
+
+FileMapping *VirtualFilesystem::FindMapping(map_t descriptor) {
+	for (FileMapping *mapping = Mappings; mapping != NULL; mapping = mapping->Next) {
+		if(mapping->Descriptor == descriptor) return mapping;
+	}
+
+	return NULL;
+}
+
+void VirtualFilesystem::RemoveMapping(FileMapping *mapping) {
+	FileMapping **link = &Mappings;
+	while(*link != mapping) link = &(*link)->Next;
+	*link = mapping->Next;
+
+	for (size_t i = 0; i < mapping->PageCount; ++i) {
+		if(mapping->States[i] == MAPPED_PAGE_PRIVATE) Pool->Release(mapping->Pages[i]);
+	}
+
+	Free(mapping->Pages);
+	Free(mapping->States);
+	delete mapping;
+}
+
+void VirtualFilesystem::ReleaseNode(filesystem_t fs, inode_t inode) {
+	/* Only once the last mapping of the file is gone */
+	if(IsMapped(fs, inode)) return;
+
+	FSUnmapNodeRequest fsUnmapRequest;
+	fsUnmapRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+	fsUnmapRequest.Request = NODE_UNMAP;
+	fsUnmapRequest.Node = inode;
+
+	DoFilesystemOperation(fs, &fsUnmapRequest);
+}
+
+bool VirtualFilesystem::IsMapped(filesystem_t fs, inode_t inode) {
+	for (FileMapping *mapping = Mappings; mapping != NULL; mapping = mapping->Next) {
+		if(mapping->FSDescriptor == fs && mapping->Inode == inode) return true;
+	}
+
+	return false;
+}
+
+bool VirtualFilesystem::HasMappings(filesystem_t fs) {
+	for (FileMapping *mapping = Mappings; mapping != NULL; mapping = mapping->Next) {
+		if(mapping->FSDescriptor == fs) return true;
+	}
+
+	return false;
+}
+
+result_t VirtualFilesystem::FaultMapping(FileMapping *mapping, size_t offset, uint32_t access, uintptr_t *address) {
+	if(offset >= mapping->Size) return -EBADREQUEST;
+
+	bool write = access & MMAP_WRITE;
+	bool shared = !(mapping->Flags & MMAP_PRIVATE);
+	if(write && !(mapping->Flags & MMAP_WRITE)) return -EBADREQUEST;
+
+	size_t index = offset / MMAP_PAGE_SIZE;
+	uint8_t state = mapping->States[index];
+
+	bool resolved = (state == MAPPED_PAGE_READ && !write) ||
+	                state == MAPPED_PAGE_WRITE ||
+	                (state == MAPPED_PAGE_PRIVATE && (!write || !shared));
+	Stats->RecordCache(STATS_CACHE_MMAP_FAULT, resolved);
+
+	if(resolved) {
+		*address = (uintptr_t)(mapping->Pages[index] + offset % MMAP_PAGE_SIZE);
+		return 0;
+	}
+
+	size_t position = mapping->Offset + index * MMAP_PAGE_SIZE;
+	uint8_t *page = NULL;
+	uint8_t newState = MAPPED_PAGE_PRIVATE;
+
+	/* Reads and shared writes go to the file's own block whenever the filesystem gives it out */
+	if(!write || shared) {
+		FSMapBlockRequest mapBlockRequest;
+		mapBlockRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+		mapBlockRequest.Request = NODE_MAP_BLOCK;
+		mapBlockRequest.Node = mapping->Inode;
+		mapBlockRequest.Offset = position;
+		mapBlockRequest.Write = write;
+		mapBlockRequest.Address = 0;
+
+		if(DoFilesystemOperation(mapping->FSDescriptor, &mapBlockRequest) == 0 && mapBlockRequest.Address != 0) {
+			page = (uint8_t*)mapBlockRequest.Address;
+			newState = write ? MAPPED_PAGE_WRITE : MAPPED_PAGE_READ;
+		} else if(!write && mapping->Base != NULL && position + MMAP_PAGE_SIZE <= mapping->BaseSize) {
+			page = (uint8_t*)mapping->Base + position;
+			newState = MAPPED_PAGE_READ;
+		} else if(write) {
+			/* A copy would not be seen by anyone else */
+			return -EBADREQUEST;
+		}
+	}
+
+	/* Otherwise the mapping gets a copy of its own */
+	if(page == NULL) {
+		page = (uint8_t*)Pool->Allocate(MMAP_PAGE_SIZE);
+		if(page == NULL) return -EFAULT;
+
+		if(mapping->Pages[index] != NULL) {
+			Memcpy(page, mapping->Pages[index], MMAP_PAGE_SIZE);
+		} else {
+			FSScatterNodeRequest readRequest;
+			readRequest.MagicNumber = FS_OPERATION_REQUEST_MAGIC_NUMBER;
+			readRequest.Request = NODE_READ_SCATTER;
+			readRequest.Node = mapping->Inode;
+			readRequest.Offset = position;
+			readRequest.Size = MMAP_PAGE_SIZE;
+			readRequest.Address = (uintptr_t)page;
+
+			intmax_t readAmount = DoFilesystemOperation(mapping->FSDescriptor, &readRequest);
+			if(readAmount < 0) {
+				Pool->Release(page);
+				return -EFAULT;
+			}
+
+			/* Past the end of the file, pages read as zeroes */
+			if(readAmount < MMAP_PAGE_SIZE) Memset(page + readAmount, 0, MMAP_PAGE_SIZE - readAmount);
+		}
+	}
+
+	if(state == MAPPED_PAGE_PRIVATE) Pool->Release(mapping->Pages[index]);
+
+	mapping->Pages[index] = page;
+	mapping->States[index] = newState;
+
+	*address = (uintptr_t)(page + offset % MMAP_PAGE_SIZE);
+	return 0;
+}
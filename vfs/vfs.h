@@ -6,6 +6,9 @@
 #include "vnode.h"
 #include "fs.h"
 #include "fops.h"
+#include "stats.h"
+#include "trace.h"
+#include "pool.h"
 
 struct FileHandle {
 	fd_t FileDescriptor;
@@ -22,6 +25,49 @@ struct FileList {
 	FileHandle *Tail;
 };
 
+enum MappedPageState {
+	MAPPED_PAGE_ABSENT = 0,
+	/* Only good for reading, may be shared with other files or mappings */
+	MAPPED_PAGE_READ,
+	/* The block of the file itself, writes go straight to it */
+	MAPPED_PAGE_WRITE,
+	/* A copy from the request pool, which only this mapping sees */
+	MAPPED_PAGE_PRIVATE,
+};
+
+struct FileMapping {
+	map_t Descriptor;
+
+	filesystem_t FSDescriptor;
+	inode_t Inode;
+
+	size_t Offset;
+	size_t Size;
+	uint32_t Flags;
+
+	/* The whole file in one range, for filesystems that can only hand out that */
+	const uint8_t *Base;
+	size_t BaseSize;
+
+	/* Filled in as pages are faulted */
+	size_t PageCount;
+	uint8_t **Pages;
+	uint8_t *States;
+
+	FileMapping *Next;
+};
+
+struct MountPoint {
+	/* The directory that is covered */
+	filesystem_t FSDescriptor;
+	inode_t Inode;
+
+	/* The filesystem whose root shows up in its place */
+	filesystem_t MountedFS;
+
+	MountPoint *Next;
+};
+
 struct RegisteredFilesystemNode {
 	Filesystem *FS;
 
@@ -39,21 +85,91 @@ public:
 	result_t DoFilesystemOperation(filesystem_t fs, FSOperationRequest *request);
 	void UnregisterFilesystem(filesystem_t fs);
 
+	/* Registers a read-only copy of fs as a filesystem of its own, to be mounted somewhere */
+	filesystem_t SnapshotFilesystem(filesystem_t fs);
+
 	void SetRootFS(filesystem_t fs);
+	result_t MountFilesystem(const char *path, filesystem_t fs);
 	result_t ResolvePath(const char *path, VNode *node);
+
+	VFSStats *GetStats() { return Stats; }
+	/* Where requests with a payload should come from, and go back to */
+	RequestPool *GetRequestPool() { return Pool; }
+
+	/* Lets every filesystem that can compact its storage do a step of at most budget.
+	   Meant to be called whenever the server has nothing better to do */
+	size_t CompactFilesystems(size_t budget);
+
+	/* Starts recording every request into a ring of about count records.
+	   Fails with -EFAULT if the ring can't be allocated */
+	result_t StartTrace(size_t count);
+	/* Stops recording and hands the trace over, to be deleted by the caller
+	   once no request that may still be writing to it is running */
+	VFSTrace *StopTrace();
 private:
+	result_t HandleFileOperation(FileOperationRequest *request);
+	result_t HandleFilesystemOperation(filesystem_t fs, FSOperationRequest *request);
+
+	VFSStats *Stats;
+	RequestPool *Pool;
+	VFSTrace *Trace = NULL;
+
 	RegisteredFilesystemNode *AddNode(Filesystem *fs);
 	void RemoveNode(filesystem_t fs);
 	RegisteredFilesystemNode *FindNode(filesystem_t fs, RegisteredFilesystemNode **previous, bool *found);
 
+	FileMapping *AddMapping(filesystem_t fs, inode_t inode, size_t offset, size_t size, uint32_t flags);
+	FileMapping *FindMapping(map_t mapping);
+	void RemoveMapping(FileMapping *mapping);
+	bool IsMapped(filesystem_t fs, inode_t inode);
+	/* Lets the filesystem move the storage of inode again, unless it is still mapped */
+	void ReleaseNode(filesystem_t fs, inode_t inode);
+	/* Whether any file of the filesystem is mapped */
+	bool HasMappings(filesystem_t fs);
+	result_t FaultMapping(FileMapping *mapping, size_t offset, uint32_t access, uintptr_t *address);
+
+	/* Writes the new content to a file of its own, which is then renamed over the one at path */
+	result_t ReplaceFile(const char *path, const void *data, size_t size);
+
+	/* Fills the buffer of a walk with the entries that come next, returning how many */
+	result_t WalkTree(FileWalkRequest *request);
+	/* Makes sure a cursor passed back to carry on a walk only points at what it could have */
+	result_t CheckWalkCursor(WalkCursor *cursor);
+	/* Reads up to count entries of the directory at level, from where its cursor is */
+	result_t ReadWalkLevel(WalkLevel *level, uintmax_t *cursor, FSReadDirectoryRequest *request, size_t count);
+
+	/* Looks up every path of a batch, going on from the directories it shares with the one before */
+	result_t GetAttributesBatch(FileGetAttrsRequest *request);
+
+	/* Copies between any two files by reading into a pool buffer and writing it back out */
+	result_t CopyThrough(VNode *source, size_t sourceOffset, VNode *destination, size_t destinationOffset, size_t size);
+
+	FileHandle *AddHandle(filesystem_t fs, inode_t inode);
+	FileHandle *FindHandle(fd_t handle);
+	void RemoveHandle(FileHandle *handle);
+
 	filesystem_t RootFilesystem;
 
 	result_t ProgressPath(VNode *current, VNode *next, const char *nextName);
+	result_t SplitPath(const char *path, char *parent, char *name);
+	result_t FollowMount(VNode *node);
+
+	MountPoint *Mounts = NULL;
 
 	RegisteredFilesystemNode *BaseNode;
 
 	FileList OpenFiles;
+	FileMapping *Mappings = NULL;
 
 	filesystem_t MaxFSDescriptor = 0;
 	filesystem_t GetFSDescriptor() { return ++MaxFSDescriptor; }
+
+	fd_t MaxFileDescriptor = 0;
+	fd_t GetFileDescriptor() { return ++MaxFileDescriptor; }
+
+	map_t MaxMapDescriptor = 0;
+	map_t GetMapDescriptor() { return ++MaxMapDescriptor; }
+
+	/* Counts up for the names of files written by ReplaceFile */
+	uintmax_t MaxTemporaryName = 0;
 };
@@ -9,10 +9,22 @@ struct VNode {
 
 	property_t Properties;
 	inode_t Directory;
+
+	size_t Size;
 }__attribute__((packed));
 
 struct DirNode {
 	char Name[MAX_NAME_SIZE] = { 0 };
 
+	inode_t Inode;
 	property_t Properties;
+	size_t Size;
+}__attribute__((packed));
+
+/* One piece of a vectored transfer: Size bytes at Offset in the file, to or from Address */
+struct IOSegment {
+	size_t Offset;
+	size_t Size;
+
+	uintptr_t Address;
 }__attribute__((packed));